@@ -5,30 +5,59 @@
 # QHULL_FOUND - True if QHULL was found.
 # QHULL_INCLUDE_DIRS - Directories containing the QHULL include files.
 # QHULL_LIBRARIES - Libraries needed to use QHULL.
+# HAVE_QHULL_R - True if the reentrant QHULL library (libqhull_r) was found;
+#                it is preferred, because it has no global state.
 # If QHULL_USE_STATIC is specified then look for static libraries ONLY else 
 # look for shared ones
 
 set(QHULL_MAJOR_VERSION 6)
 
 if(QHULL_USE_STATIC)
+  set(QHULL_R_RELEASE_NAME qhullstatic_r)
+  set(QHULL_R_DEBUG_NAME qhullstatic_rd)
   set(QHULL_RELEASE_NAME qhullstatic)
   set(QHULL_DEBUG_NAME qhullstatic_d)
 else(QHULL_USE_STATIC)
+  set(QHULL_R_RELEASE_NAME qhull_r)
+  set(QHULL_R_DEBUG_NAME qhull_rd)
   set(QHULL_RELEASE_NAME qhull_p qhull${QHULL_MAJOR_VERSION} qhull)
   set(QHULL_DEBUG_NAME qhull_pd qhull${QHULL_MAJOR_VERSION}_d qhull_d${QHULL_MAJOR_VERSION} qhull_d)
 endif(QHULL_USE_STATIC)
 
-find_file(QHULL_HEADER
-          NAMES libqhull/libqhull.h qhull.h
+# look for the reentrant library first
+find_file(QHULL_R_HEADER
+          NAMES libqhull_r/libqhull_r.h
           HINTS "${QHULL_ROOT}" "$ENV{QHULL_ROOT}" "${QHULL_INCLUDE_DIR}"
           PATHS "$ENV{PROGRAMFILES}/QHull" "$ENV{PROGRAMW6432}/QHull" 
-          PATH_SUFFIXES qhull src/libqhull libqhull include)
+          PATH_SUFFIXES include)
+
+find_library(QHULL_R_LIBRARY
+             NAMES ${QHULL_R_RELEASE_NAME}
+             HINTS "${QHULL_ROOT}" "$ENV{QHULL_ROOT}"
+             PATHS "$ENV{PROGRAMFILES}/QHull" "$ENV{PROGRAMW6432}/QHull" 
+             PATH_SUFFIXES project build bin lib)
+
+if(QHULL_R_HEADER AND QHULL_R_LIBRARY)
+  set(HAVE_QHULL_R ON)
+  set(QHULL_HEADER "${QHULL_R_HEADER}")
+else()
+  set(HAVE_QHULL_R OFF)
+  find_file(QHULL_HEADER
+            NAMES libqhull/libqhull.h qhull.h
+            HINTS "${QHULL_ROOT}" "$ENV{QHULL_ROOT}" "${QHULL_INCLUDE_DIR}"
+            PATHS "$ENV{PROGRAMFILES}/QHull" "$ENV{PROGRAMW6432}/QHull" 
+            PATH_SUFFIXES qhull src/libqhull libqhull include)
+endif()
 
 set(QHULL_HEADER "${QHULL_HEADER}" CACHE INTERNAL "QHull header" FORCE )
 
 if(QHULL_HEADER)
   get_filename_component(qhull_header ${QHULL_HEADER} NAME_WE)
-  if("${qhull_header}" STREQUAL "qhull")
+  if("${qhull_header}" STREQUAL "libqhull_r")
+    set(HAVE_QHULL_2011 OFF)
+    get_filename_component(QHULL_INCLUDE_DIR ${QHULL_HEADER} PATH)
+    get_filename_component(QHULL_INCLUDE_DIR ${QHULL_INCLUDE_DIR} PATH)
+  elseif("${qhull_header}" STREQUAL "qhull")
     set(HAVE_QHULL_2011 OFF)
     get_filename_component(QHULL_INCLUDE_DIR ${QHULL_HEADER} PATH)
   elseif("${qhull_header}" STREQUAL "libqhull")
@@ -42,17 +71,26 @@ endif(QHULL_HEADER)
 
 set(QHULL_INCLUDE_DIR "${QHULL_INCLUDE_DIR}" CACHE PATH "QHull include dir." FORCE)
 
-find_library(QHULL_LIBRARY 
-             NAMES ${QHULL_RELEASE_NAME}
-             HINTS "${QHULL_ROOT}" "$ENV{QHULL_ROOT}"
-             PATHS "$ENV{PROGRAMFILES}/QHull" "$ENV{PROGRAMW6432}/QHull" 
-             PATH_SUFFIXES project build bin lib)
+if(HAVE_QHULL_R)
+  set(QHULL_LIBRARY ${QHULL_R_LIBRARY})
+  find_library(QHULL_LIBRARY_DEBUG 
+               NAMES ${QHULL_R_DEBUG_NAME} ${QHULL_R_RELEASE_NAME}
+               HINTS "${QHULL_ROOT}" "$ENV{QHULL_ROOT}"
+               PATHS "$ENV{PROGRAMFILES}/QHull" "$ENV{PROGRAMW6432}/QHull" 
+               PATH_SUFFIXES project build bin lib)
+else(HAVE_QHULL_R)
+  find_library(QHULL_LIBRARY 
+               NAMES ${QHULL_RELEASE_NAME}
+               HINTS "${QHULL_ROOT}" "$ENV{QHULL_ROOT}"
+               PATHS "$ENV{PROGRAMFILES}/QHull" "$ENV{PROGRAMW6432}/QHull" 
+               PATH_SUFFIXES project build bin lib)
 
-find_library(QHULL_LIBRARY_DEBUG 
-             NAMES ${QHULL_DEBUG_NAME} ${QHULL_RELEASE_NAME}
-             HINTS "${QHULL_ROOT}" "$ENV{QHULL_ROOT}"
-             PATHS "$ENV{PROGRAMFILES}/QHull" "$ENV{PROGRAMW6432}/QHull" 
-             PATH_SUFFIXES project build bin lib)
+  find_library(QHULL_LIBRARY_DEBUG 
+               NAMES ${QHULL_DEBUG_NAME} ${QHULL_RELEASE_NAME}
+               HINTS "${QHULL_ROOT}" "$ENV{QHULL_ROOT}"
+               PATHS "$ENV{PROGRAMFILES}/QHull" "$ENV{PROGRAMW6432}/QHull" 
+               PATH_SUFFIXES project build bin lib)
+endif(HAVE_QHULL_R)
 
 if(NOT QHULL_LIBRARY_DEBUG)
   set(QHULL_LIBRARY_DEBUG ${QHULL_LIBRARY})
@@ -64,11 +102,11 @@ set(QHULL_LIBRARIES optimized ${QHULL_LIBRARY} debug ${QHULL_LIBRARY_DEBUG})
 include(FindPackageHandleStandardArgs)
 find_package_handle_standard_args(Qhull DEFAULT_MSG QHULL_LIBRARY QHULL_INCLUDE_DIR)
 
-mark_as_advanced(QHULL_LIBRARY QHULL_LIBRARY_DEBUG QHULL_INCLUDE_DIR)
+mark_as_advanced(QHULL_R_LIBRARY QHULL_LIBRARY QHULL_LIBRARY_DEBUG QHULL_INCLUDE_DIR)
 
 if(QHULL_FOUND)
   set(HAVE_QHULL ON)
-  if(NOT QHULL_USE_STATIC)
+  if(NOT QHULL_USE_STATIC AND NOT HAVE_QHULL_R)
     add_definitions("-Dqh_QHpointer")
     if(MSVC)
       add_definitions("-Dqh_QHpointer_dllimport")
@@ -46,7 +46,12 @@
 #include <random_numbers/random_numbers.h>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
+#include <atomic>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <unordered_set>
 #include <vector>
 
 /** \brief This set of classes allows quickly detecting whether a given point
@@ -74,6 +79,62 @@ struct BoundingCylinder
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
 
+/** \brief A ray for Body::intersect(), with the values the intersection tests need computed once.
+    Distances along the ray are measured along the normalized direction; only the part of the ray
+    with tmin < t <= tmax is intersected. */
+struct Ray
+{
+  Ray(const Eigen::Vector3d& ray_origin, const Eigen::Vector3d& ray_dir, double min_t = 0.0,
+      double max_t = std::numeric_limits<double>::infinity())
+    : origin(ray_origin), dir(ray_dir.normalized()), tmin(min_t), tmax(max_t)
+  {
+    inv_dir = dir.cwiseInverse();
+    for (int k = 0; k < 3; ++k)
+      sign[k] = inv_dir[k] < 0.0 ? 1 : 0;
+  }
+
+  /** \brief The point at distance \e t along the ray */
+  Eigen::Vector3d at(double t) const
+  {
+    return origin + dir * t;
+  }
+
+  Eigen::Vector3d origin;
+
+  /** \brief The normalized direction */
+  Eigen::Vector3d dir;
+
+  /** \brief The componentwise inverse of dir; infinite for components that are 0 */
+  Eigen::Vector3d inv_dir;
+
+  /** \brief 1 for the components of dir that are negative (or -0), 0 otherwise; the index of the bound of
+      an axis-aligned box that the ray reaches first along each axis, with {min, max} */
+  int sign[3];
+
+  double tmin;
+  double tmax;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/** \brief Where a Ray crosses the surface of a body: the first MAX_POINTS distances along the ray, in order */
+struct Hit
+{
+  static const unsigned int MAX_POINTS = 2;
+
+  Hit() : count(0), inside(false)
+  {
+  }
+
+  /** \brief The number of distances in t */
+  unsigned int count;
+
+  /** \brief Whether the ray starts inside the body at ray.tmin, so that t[0] is where it leaves */
+  bool inside;
+
+  double t[MAX_POINTS];
+};
+
 class Body;
 
 /** \brief Shared pointer to a Body */
@@ -135,7 +196,7 @@ public:
   void setPose(const Eigen::Affine3d& pose)
   {
     pose_ = pose;
-    updateInternalData();
+    updateInternalPose();
   }
 
   /** \brief Retrieve the pose of the body */
@@ -160,6 +221,17 @@ public:
   /** \brief Check if a point is inside the body */
   virtual bool containsPoint(const Eigen::Vector3d& p, bool verbose = false) const = 0;
 
+  /** \brief Check which of the \e n points given in structure-of-arrays form (\e xs, \e ys, \e zs)
+      are inside the body. \e mask[i] is set to 1 if point i is inside and to 0 otherwise. The result
+      is the same as calling containsPoint() for every point; bodies override this to test several
+      points at once. */
+  virtual void containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                              uint8_t* mask) const;
+
+  /** \brief Check which of the columns of \e points are inside the body. \e mask must have room for
+      points.cols() values; \e mask[i] is set to 1 if column i is inside and to 0 otherwise. */
+  void containsPoints(const Eigen::Matrix3Xd& points, uint8_t* mask) const;
+
   /** \brief Check if a ray intersects the body, and find the
       set of intersections, in order, along the ray. A maximum
       number of intersections can be specified as well. If that
@@ -167,6 +239,46 @@ public:
   virtual bool intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
                              EigenSTL::vector_Vector3d* intersections = NULL, unsigned int count = 0) const = 0;
 
+  /** \brief Check if the part of \e ray between ray.tmin and ray.tmax overlaps the body. \e hit is set to
+      the crossings of the surface in that part, in order along the ray; it may have none if the part lies
+      inside the body, and hit.inside tells whether the part starts inside. Sphere, Cylinder, Box and
+      ConvexMesh do not allocate memory; other bodies call intersectsRay() with a buffer kept for each
+      thread and take the ray to start inside when it crosses the surface an odd number of times. */
+  virtual bool intersect(const Ray& ray, Hit& hit) const;
+
+  /** \brief Intersect \e n rays given in structure-of-arrays form with the body. Ray i starts at
+      (\e ox[i], \e oy[i], \e oz[i]) and has the normalized direction (\e dx[i], \e dy[i], \e dz[i]).
+      \e out_t[i] is set to the distance from the origin to the nearest intersection in front of it
+      (the exit point if the origin is inside the body), or to infinity if the ray misses. Packets of
+      rays whose lines all pass outside the bounding sphere are rejected together; the other rays are
+      passed to intersect(). */
+  virtual void intersectsRays(const double* ox, const double* oy, const double* oz, const double* dx,
+                              const double* dy, const double* dz, std::size_t n, double* out_t) const;
+
+  /** \brief Intersect the \e n rays starting at \e origins[i] with normalized directions \e dirs[i]
+      with the body; \e out_t is filled as for the structure-of-arrays version */
+  void intersectsRays(const Eigen::Vector3d* origins, const Eigen::Vector3d* dirs, std::size_t n,
+                      double* out_t) const;
+
+  /** \brief Compute the signed distance from \e p to the surface of the body, including scaling and
+      padding. The distance is negative inside the body and positive outside. */
+  virtual double computeSignedDistance(const Eigen::Vector3d& p) const = 0;
+
+  /** \brief Compute the signed distances of the \e n points given in structure-of-arrays form
+      (\e xs, \e ys, \e zs) into \e out. The result is the same as calling computeSignedDistance()
+      for every point; bodies override this to process several points at once. */
+  virtual void computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                      double* out) const;
+
+  /** \brief Get the point of the body (including scaling and padding) that is the furthest along \e dir.
+      This is the support function used by intersects() and computePenetration(). */
+  virtual Eigen::Vector3d computeSupportPoint(const Eigen::Vector3d& dir) const = 0;
+
+  /** \brief Get the outward unit normal of the surface of the body (including scaling and padding) at \e p,
+      a point on or near the surface. The default is the gradient of computeSignedDistance(), by central
+      differences. */
+  virtual Eigen::Vector3d computeSurfaceNormal(const Eigen::Vector3d& p) const;
+
   /** \brief Compute the volume of the body. This method includes
       changes induced by scaling and padding */
   virtual double computeVolume() const = 0;
@@ -179,6 +291,12 @@ public:
   virtual bool samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
                                  Eigen::Vector3d& result);
 
+  /** \brief Sample \e n points that are included in the body into the preallocated array \e result.
+      Every point is sampled as by samplePointInside(), with at most \e max_attempts attempts; sampling
+      stops at the first point that fails. Returns the number of points written to \e result. */
+  virtual std::size_t samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                         Eigen::Vector3d* result, unsigned int max_attempts = 100);
+
   /** \brief Compute the bounding radius for the body, in its current
       pose. Scaling and padding are accounted for. */
   virtual void computeBoundingSphere(BoundingSphere& sphere) const = 0;
@@ -205,6 +323,14 @@ protected:
       reasons are kept up to date. */
   virtual void updateInternalData() = 0;
 
+  /** \brief This function is called when only the pose of the body
+      changed. By default, all the intermediate values are recomputed
+      with updateInternalData(). */
+  virtual void updateInternalPose()
+  {
+    updateInternalData();
+  }
+
   /** \brief Depending on the shape, this function copies the relevant data to the body. */
   virtual void useDimensions(const shapes::Shape* shape) = 0;
 
@@ -246,14 +372,25 @@ public:
   /** \brief Get the radius of the sphere */
   virtual std::vector<double> getDimensions() const;
 
+  using Body::containsPoints;
   virtual bool containsPoint(const Eigen::Vector3d& p, bool verbose = false) const;
+  virtual void containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                              uint8_t* mask) const;
   virtual double computeVolume() const;
   virtual bool samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
                                  Eigen::Vector3d& result);
+  virtual std::size_t samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                         Eigen::Vector3d* result, unsigned int max_attempts = 100);
   virtual void computeBoundingSphere(BoundingSphere& sphere) const;
   virtual void computeBoundingCylinder(BoundingCylinder& cylinder) const;
   virtual bool intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
                              EigenSTL::vector_Vector3d* intersections = NULL, unsigned int count = 0) const;
+  virtual bool intersect(const Ray& ray, Hit& hit) const;
+  virtual double computeSignedDistance(const Eigen::Vector3d& p) const;
+  virtual void computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                      double* out) const;
+  virtual Eigen::Vector3d computeSupportPoint(const Eigen::Vector3d& dir) const;
+  virtual Eigen::Vector3d computeSurfaceNormal(const Eigen::Vector3d& p) const;
 
   virtual BodyPtr cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const;
 
@@ -295,14 +432,25 @@ public:
   /** \brief Get the radius & length of the cylinder */
   virtual std::vector<double> getDimensions() const;
 
+  using Body::containsPoints;
   virtual bool containsPoint(const Eigen::Vector3d& p, bool verbose = false) const;
+  virtual void containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                              uint8_t* mask) const;
   virtual double computeVolume() const;
   virtual bool samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
                                  Eigen::Vector3d& result);
+  virtual std::size_t samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                         Eigen::Vector3d* result, unsigned int max_attempts = 100);
   virtual void computeBoundingSphere(BoundingSphere& sphere) const;
   virtual void computeBoundingCylinder(BoundingCylinder& cylinder) const;
   virtual bool intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
                              EigenSTL::vector_Vector3d* intersections = NULL, unsigned int count = 0) const;
+  virtual bool intersect(const Ray& ray, Hit& hit) const;
+  virtual double computeSignedDistance(const Eigen::Vector3d& p) const;
+  virtual void computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                      double* out) const;
+  virtual Eigen::Vector3d computeSupportPoint(const Eigen::Vector3d& dir) const;
+  virtual Eigen::Vector3d computeSurfaceNormal(const Eigen::Vector3d& p) const;
 
   virtual BodyPtr cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const;
 
@@ -354,14 +502,25 @@ public:
   /** \brief Get the length & width & height (x, y, z) of the box */
   virtual std::vector<double> getDimensions() const;
 
+  using Body::containsPoints;
   virtual bool containsPoint(const Eigen::Vector3d& p, bool verbose = false) const;
+  virtual void containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                              uint8_t* mask) const;
   virtual double computeVolume() const;
   virtual bool samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
                                  Eigen::Vector3d& result);
+  virtual std::size_t samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                         Eigen::Vector3d* result, unsigned int max_attempts = 100);
   virtual void computeBoundingSphere(BoundingSphere& sphere) const;
   virtual void computeBoundingCylinder(BoundingCylinder& cylinder) const;
   virtual bool intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
                              EigenSTL::vector_Vector3d* intersections = NULL, unsigned int count = 0) const;
+  virtual bool intersect(const Ray& ray, Hit& hit) const;
+  virtual double computeSignedDistance(const Eigen::Vector3d& p) const;
+  virtual void computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                      double* out) const;
+  virtual Eigen::Vector3d computeSupportPoint(const Eigen::Vector3d& dir) const;
+  virtual Eigen::Vector3d computeSurfaceNormal(const Eigen::Vector3d& p) const;
 
   virtual BodyPtr cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const;
 
@@ -401,12 +560,17 @@ public:
   {
     type_ = shapes::MESH;
     scaled_vertices_ = NULL;
+    max_planes_ = 0;
   }
 
-  ConvexMesh(const shapes::Shape* shape) : Body()
+  /** \brief Build the convex hull of \e shape. If \e max_planes is not 0 and the hull has more planes, the
+      body is instead a polytope with at most \e max_planes planes (and at least 6) that contains the hull;
+      getApproximationError() reports how far it extends beyond the hull. */
+  ConvexMesh(const shapes::Shape* shape, unsigned int max_planes = 0) : Body()
   {
     type_ = shapes::MESH;
     scaled_vertices_ = NULL;
+    max_planes_ = max_planes;
     setDimensions(shape);
   }
 
@@ -417,13 +581,30 @@ public:
   /** \brief Returns an empty vector */
   virtual std::vector<double> getDimensions() const;
 
+  using Body::containsPoints;
   virtual bool containsPoint(const Eigen::Vector3d& p, bool verbose = false) const;
+  virtual void containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                              uint8_t* mask) const;
   virtual double computeVolume() const;
 
+  /** \brief Sample the tetrahedra spanned by the center of the hull and its triangles, picked by volume.
+      With padding, points are sampled in the hull grown to contain the padded one and rejected if
+      containsPoint() would not accept them. */
+  virtual bool samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
+                                 Eigen::Vector3d& result);
+  virtual std::size_t samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                         Eigen::Vector3d* result, unsigned int max_attempts = 100);
+
   virtual void computeBoundingSphere(BoundingSphere& sphere) const;
   virtual void computeBoundingCylinder(BoundingCylinder& cylinder) const;
   virtual bool intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
                              EigenSTL::vector_Vector3d* intersections = NULL, unsigned int count = 0) const;
+  virtual bool intersect(const Ray& ray, Hit& hit) const;
+  virtual double computeSignedDistance(const Eigen::Vector3d& p) const;
+  virtual void computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                      double* out) const;
+  virtual Eigen::Vector3d computeSupportPoint(const Eigen::Vector3d& dir) const;
+  virtual Eigen::Vector3d computeSurfaceNormal(const Eigen::Vector3d& p) const;
 
   const std::vector<unsigned int>& getTriangles() const;
   const EigenSTL::vector_Vector3d& getVertices() const;
@@ -435,6 +616,32 @@ public:
    */
   const EigenSTL::vector_Vector4d& getPlanes() const;
 
+  /** \brief The largest number of planes the body may have; 0 if the hull is kept exact */
+  unsigned int getMaxPlanes() const
+  {
+    return max_planes_;
+  }
+
+  /** \brief The Hausdorff distance between the body (unscaled and unpadded) and the convex hull of the mesh;
+      0 unless the hull had more planes than getMaxPlanes() */
+  double getApproximationError() const;
+
+  /** \brief Let containment queries count how often each plane rejects a point and, after every \e period
+      rejections, test the planes that rejected the most points first. The counts of earlier periods are
+      halved each time, so the order follows points that keep coming from one side of the body, as those
+      of a sensor do. Queries stay safe to run from several threads; clones start from the current order.
+      Disabling the adaptive order restores the order of the hull. */
+  void setAdaptivePlaneOrder(bool enabled, unsigned int period = 4096);
+
+  /** \brief Check whether the planes are reordered by how many points they reject */
+  bool getAdaptivePlaneOrder() const
+  {
+    return plane_order_.get() != NULL;
+  }
+
+  /** \brief The indices in getPlanes() in the order the containment queries test them */
+  std::vector<unsigned int> getPlaneOrder() const;
+
   virtual BodyPtr cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const;
 
   /// Project the original vertex to the scaled and padded planes and average.
@@ -442,32 +649,107 @@ public:
 
   void correctVertexOrderFromPlanes();
 
+  /** \brief Counters of the process-wide cache of convex hulls */
+  struct CacheStatistics
+  {
+    CacheStatistics() : hits(0), misses(0), evictions(0), entries(0), bytes(0)
+    {
+    }
+
+    /** \brief Number of meshes whose hull was found in the cache */
+    std::size_t hits;
+
+    /** \brief Number of meshes whose hull had to be computed */
+    std::size_t misses;
+
+    /** \brief Number of hulls dropped to stay within the memory budget */
+    std::size_t evictions;
+
+    /** \brief Number of hulls currently in the cache */
+    std::size_t entries;
+
+    /** \brief Approximate memory used by the hulls in the cache */
+    std::size_t bytes;
+  };
+
+  /** \brief Set the approximate amount of memory the process-wide cache of convex hulls may use.
+      Convex meshes built from a mesh with the same vertices share the hull computed for the
+      first of them; the least recently used hulls are dropped when the budget is exceeded.
+      A budget of 0 disables the cache. The default is 64 MiB. */
+  static void setCacheBudget(std::size_t bytes);
+
+  /** \brief Get the memory budget of the cache of convex hulls */
+  static std::size_t getCacheBudget();
+
+  /** \brief Get the counters of the cache of convex hulls */
+  static CacheStatistics getCacheStatistics();
+
+  /** \brief Drop all the hulls from the cache and reset its counters */
+  static void clearCache();
+
 protected:
   virtual void useDimensions(const shapes::Shape* shape);
   virtual void updateInternalData();
 
+  /** \brief Only the rigid transform of the bounding box, the center and the inverse pose change
+      with the pose; the scaled vertices are in the frame of the mesh */
+  virtual void updateInternalPose();
+
   /** \brief (Used mainly for debugging) Count the number of vertices behind a plane*/
   unsigned int countVerticesBehindPlane(const Eigen::Vector4f& planeNormal) const;
 
   /** \brief Check if a point is inside a set of planes that make up a convex mesh*/
   bool isPointInsidePlanes(const Eigen::Vector3d& point) const;
 
+  /** \brief Sample a point inside the hull, in the unscaled and unpadded frame of the mesh */
+  Eigen::Vector3d sampleHullPoint(random_numbers::RandomNumberGenerator& rng) const;
+
   struct MeshData
   {
     EigenSTL::vector_Vector4d planes_;
     EigenSTL::vector_Vector3d vertices_;
     std::vector<unsigned int> triangles_;
-    std::map<unsigned int, unsigned int> plane_for_triangle_;
+    // the index in planes_ of the plane of each triangle; coplanar triangles share a plane
+    std::vector<unsigned int> plane_for_triangle_;
     Eigen::Vector3d mesh_center_;
+
+    // the smallest sphere that encloses the vertices
+    Eigen::Vector3d sphere_center_;
     double mesh_radiusB_;
+
+    // the oriented bounding box of the hull: its center, axes and extents in the frame of the mesh
     Eigen::Vector3d box_offset_;
+    Eigen::Matrix3d box_rotation_;
     Eigen::Vector3d box_size_;
+
+    // the bounding cylinder of the hull, in the frame of the mesh
     BoundingCylinder bounding_cylinder_;
 
+    // running sums of the volumes of the tetrahedra spanned by mesh_center_ and the triangles
+    std::vector<double> tetrahedron_volumes_;
+
+    // the distance from mesh_center_ to the closest plane
+    double inner_radius_;
+
+    // the Hausdorff distance to the exact hull, for a hull approximated with fewer planes
+    double approximation_error_;
+
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   };
 
+  /** \brief Build the convex hull of \e mesh into a new mesh_data_ and add it to the cache under \e hash */
+  void computeHull(const shapes::Mesh* mesh, std::uint64_t hash);
+
+  /** \brief Compute the members of \e data that follow from its vertices, triangles and planes */
+  static void completeMeshData(MeshData& data);
+
+  /** \brief Approximate \e hull by a polytope with at most \e max_planes planes that contains it. Starting
+      from the oriented bounding box, the face of the hull that the corner of the polytope farthest from
+      the hull violates most is added until the budget is used up or the polytope is the hull. */
+  static std::shared_ptr<MeshData> approximateHull(const MeshData& hull, unsigned int max_planes);
+
   // shape-dependent data; keep this in one struct so that a cheap pointer copy can be done in cloneAt()
+  // and so that it can be shared through the cache of convex hulls
   std::shared_ptr<MeshData> mesh_data_;
 
   // pose/padding/scaling-dependent values & values computed for convenience and fast upcoming computations
@@ -483,9 +765,245 @@ protected:
   // Otherwise, point to scaled_vertices_storage_
   EigenSTL::vector_Vector3d* scaled_vertices_;
 
+  unsigned int max_planes_;
+
 private:
+  class MeshDataCache;
+  class AdaptivePlaneOrder;
+
+  // the order of the planes and their rejection counts; null unless the adaptive order is enabled
+  std::shared_ptr<AdaptivePlaneOrder> plane_order_;
+
   std::unique_ptr<EigenSTL::vector_Vector3d> scaled_vertices_storage_;
 
+  // the scale and padding scaled_vertices_ was computed for
+  double scaled_vertices_scale_;
+  double scaled_vertices_padding_;
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/** \brief Definition of a mesh body that keeps the triangles of a shapes::Mesh, so that, unlike ConvexMesh,
+    concave parts are not filled in. The triangles are kept in a bounding volume hierarchy built with the
+    surface area heuristic and stored as a flat array of nodes. The mesh is expected to be closed:
+    containsPoint() counts how often a ray from the point crosses the triangles. Padding adds the points
+    within the padding distance of the triangles; scaling is about the mean of the vertices of the convex
+    hull, as for ConvexMesh. */
+class TriangleMesh : public Body
+{
+public:
+  TriangleMesh() : Body()
+  {
+    type_ = shapes::MESH;
+  }
+
+  TriangleMesh(const shapes::Shape* shape) : Body()
+  {
+    type_ = shapes::MESH;
+    setDimensions(shape);
+  }
+
+  virtual ~TriangleMesh()
+  {
+  }
+
+  /** \brief Returns an empty vector */
+  virtual std::vector<double> getDimensions() const;
+
+  virtual bool containsPoint(const Eigen::Vector3d& p, bool verbose = false) const;
+
+  /** \brief The volume enclosed by the triangles; padding is accounted for by the area of the triangles
+      times the padding, which underestimates the padded volume around convex edges */
+  virtual double computeVolume() const;
+
+  virtual void computeBoundingSphere(BoundingSphere& sphere) const;
+  virtual void computeBoundingCylinder(BoundingCylinder& cylinder) const;
+
+  /** \brief Without padding, all the crossings of the ray with the triangles are reported, closest
+      first. With padding, only the first point on the padded surface is reported, found by stepping
+      along the ray by the distance to the triangles, and rays starting inside report nothing. */
+  virtual bool intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                             EigenSTL::vector_Vector3d* intersections = NULL, unsigned int count = 0) const;
+  virtual double computeSignedDistance(const Eigen::Vector3d& p) const;
+
+  /** \brief The support point of the convex hull of the (padded) triangles */
+  virtual Eigen::Vector3d computeSupportPoint(const Eigen::Vector3d& dir) const;
+
+  virtual BodyPtr cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const;
+
+  const std::vector<unsigned int>& getTriangles() const;
+  const EigenSTL::vector_Vector3d& getVertices() const;
+
+protected:
+  virtual void useDimensions(const shapes::Shape* shape);
+  virtual void updateInternalData();
+  virtual void updateInternalPose();
+
+  /** \brief Bring a point from the world frame to the unscaled frame of the mesh */
+  Eigen::Vector3d toMeshFrame(const Eigen::Vector3d& p) const;
+
+  /** \brief Check whether \e p, in the unscaled frame of the mesh, is enclosed by the triangles */
+  bool isInside(const Eigen::Vector3d& p) const;
+
+  /** \brief The distance from \e p, in the unscaled frame of the mesh, to the closest triangle; triangles
+      farther than \e max_distance are skipped, and infinity is returned if none is within it */
+  double computeDistance(const Eigen::Vector3d& p,
+                         double max_distance = std::numeric_limits<double>::infinity()) const;
+
+  /** \brief Call \e visit(t) for every triangle crossed by the ray, in the unscaled frame of the mesh */
+  template <typename Visitor>
+  void visitRayCrossings(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir, Visitor& visit) const;
+
+  /** \brief A node of the hierarchy, 32 bytes with boxes rounded outwards to floats. Leaves (count > 0)
+      hold the triangles [first, first + count); inner nodes have their first child right after them and
+      their second child at index \e first. */
+  struct Node
+  {
+    float min[3];
+    float max[3];
+    unsigned int first;
+    unsigned int count;
+  };
+
+  struct MeshData
+  {
+    EigenSTL::vector_Vector3d vertices_;
+    std::vector<unsigned int> triangles_;
+
+    // the corners of the triangles, three per triangle, in the order of the leaves of the hierarchy
+    EigenSTL::vector_Vector3d corners_;
+    std::vector<Node> nodes_;
+
+    // the center scaling is about, computed as for ConvexMesh
+    Eigen::Vector3d mesh_center_;
+
+    // the axis-aligned bounding box of the vertices
+    Eigen::Vector3d box_center_;
+    Eigen::Vector3d box_size_;
+
+    // the smallest sphere that encloses the vertices
+    Eigen::Vector3d sphere_center_;
+    double mesh_radiusB_;
+
+    double volume_;
+    double area_;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  // shape-dependent data; keep this in one struct so that a cheap pointer copy can be done in cloneAt()
+  std::shared_ptr<const MeshData> mesh_data_;
+
+  // pose/padding/scaling-dependent values
+  Eigen::Affine3d i_pose_;
+  Eigen::Vector3d center_;
+  Eigen::Vector3d sphere_center_;
+  double radiusB_;
+  Box bounding_box_;
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/** \brief Definition of a body built from the occupied voxels of an octomap::OcTree (shapes::OcTree).
+    The occupied leaves are expanded to voxels of the finest resolution and kept in a hash set, so
+    containsPoint() is a single lookup instead of a descent from the root of the tree. Padding dilates
+    the voxels by whole voxels, so it is rounded up to the resolution; scaling is about the center of
+    the occupied voxels. */
+class OcTree : public Body
+{
+public:
+  OcTree() : Body()
+  {
+    type_ = shapes::OCTREE;
+    resolution_ = 1.0;
+    padded_for_ = -1.0;
+  }
+
+  OcTree(const shapes::Shape* shape) : Body()
+  {
+    type_ = shapes::OCTREE;
+    resolution_ = 1.0;
+    padded_for_ = -1.0;
+    setDimensions(shape);
+  }
+
+  virtual ~OcTree()
+  {
+  }
+
+  /** \brief Returns an empty vector */
+  virtual std::vector<double> getDimensions() const;
+
+  virtual bool containsPoint(const Eigen::Vector3d& p, bool verbose = false) const;
+  virtual double computeVolume() const;
+  virtual void computeBoundingSphere(BoundingSphere& sphere) const;
+  virtual void computeBoundingCylinder(BoundingCylinder& cylinder) const;
+
+  /** \brief Traverse the voxels along the ray (3D DDA); the entries into and exits from the occupied voxels
+      are reported in order, at most \e count of them unless it is 0 */
+  virtual bool intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                             EigenSTL::vector_Vector3d* intersections = NULL, unsigned int count = 0) const;
+
+  /** \brief The distance to the closest occupied voxel for points outside (this visits all the voxels) and
+      minus the distance to the closest free voxel for points inside */
+  virtual double computeSignedDistance(const Eigen::Vector3d& p) const;
+
+  /** \brief The support point of the convex hull of the occupied voxels */
+  virtual Eigen::Vector3d computeSupportPoint(const Eigen::Vector3d& dir) const;
+
+  virtual BodyPtr cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const;
+
+  /** \brief Get the edge length of the voxels, before scaling */
+  double getResolution() const
+  {
+    return resolution_;
+  }
+
+  /** \brief Get the number of occupied voxels, including the ones added by padding */
+  std::size_t getVoxelCount() const;
+
+protected:
+  virtual void useDimensions(const shapes::Shape* shape);
+  virtual void updateInternalData();
+  virtual void updateInternalPose();
+
+  /** \brief Voxel keys are packed into 16 bits per axis, as for octomap::OcTreeKey */
+  typedef std::uint64_t VoxelKey;
+
+  static VoxelKey packKey(int x, int y, int z)
+  {
+    return ((VoxelKey)x << 32) | ((VoxelKey)y << 16) | (VoxelKey)z;
+  }
+
+  /** \brief Get the key of the voxel that contains \e p, given in the frame of the tree and unscaled;
+      returns false if \e p is outside of the range of keys */
+  bool pointToKey(const Eigen::Vector3d& p, int key[3]) const;
+
+  /** \brief Check whether the voxel with the given (possibly out of range) key is occupied */
+  bool isOccupied(int x, int y, int z) const;
+
+  /** \brief Bring a point from the world frame to the unscaled frame of the tree */
+  Eigen::Vector3d toTreeFrame(const Eigen::Vector3d& p) const;
+
+  // shape-dependent data, shared by clones
+  double resolution_;
+  std::shared_ptr<const std::vector<VoxelKey> > voxels_;
+  Eigen::Vector3d voxels_center_;
+
+  // padding-dependent data: the dilated voxels, the padding they were dilated by (in voxels) and their
+  // range of keys
+  std::shared_ptr<const std::unordered_set<VoxelKey> > padded_voxels_;
+  double padded_for_;
+  int min_key_[3];
+  int max_key_[3];
+
+  // pose/padding/scaling-dependent values
+  Eigen::Affine3d i_pose_;
+  Eigen::Vector3d box_center_;
+  Box bounding_box_;
+
 public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
@@ -512,9 +1030,19 @@ public:
   /** \brief Clear all bodies from the vector*/
   void clear();
 
-  /** \brief Set the pose of a particular body in the vector of bodies */
+  /** \brief Set the pose of a particular body in the vector of bodies. If the bounding volume
+      hierarchy is in use, the bounds of the body and of its ancestors are refitted. */
   void setPose(unsigned int i, const Eigen::Affine3d& pose);
 
+  /** \brief Enable or disable the bounding volume hierarchy (BVH) over the bounding spheres of the bodies.
+      When enabled, containsPoint() and intersectsRay() descend the hierarchy instead of testing every
+      body in turn; the results are the same as for the linear scan. The hierarchy is built by the first query
+      after bodies are added, so adding many bodies costs a single build. Default is disabled. */
+  void setUseBoundingVolumeHierarchy(bool use);
+
+  /** \brief Check whether the bounding volume hierarchy is used to answer queries */
+  bool getUseBoundingVolumeHierarchy() const;
+
   /** \brief Get the number of bodies in this vector*/
   std::size_t getCount() const;
 
@@ -532,11 +1060,133 @@ public:
   bool intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir, std::size_t& index,
                      EigenSTL::vector_Vector3d* intersections = NULL, unsigned int count = 0) const;
 
+  /** \brief Check if any of the bodies overlaps the part of \e ray between ray.tmin and ray.tmax, as
+      intersectsRay() does, without allocating memory for the bodies that Body::intersect() lists. The
+      index of the first body found is set to \e index and its crossings to \e hit. */
+  bool intersect(const Ray& ray, std::size_t& index, Hit& hit) const;
+
+  /** \brief Intersect \e n rays with all the bodies. Ray i starts at \e origins[i] and has the normalized
+      direction \e dirs[i]. \e out_t[i] is set to the distance to the nearest intersection over all bodies
+      (infinity if there is none) and, if \e out_body_index is not NULL, \e out_body_index[i] is set to the
+      index of the body hit first (NO_BODY if there is none). The rays are processed in packets; if the
+      bounding volume hierarchy is in use, each packet descends it together. */
+  void intersectsRays(const Eigen::Vector3d* origins, const Eigen::Vector3d* dirs, std::size_t n, double* out_t,
+                      std::size_t* out_body_index = NULL) const;
+
+  /** \brief Where a ray hits one of the bodies */
+  struct RayHit
+  {
+    /** \brief The index of the body */
+    std::size_t index;
+
+    /** \brief The distance along the normalized direction of the ray */
+    double t;
+
+    Eigen::Vector3d point;
+
+    /** \brief The outward unit normal of the surface of the body at point */
+    Eigen::Vector3d normal;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  /** \brief Find the body that \e ray hits first, between ray.tmin and ray.tmax. Bodies whose bounding
+      sphere starts beyond the nearest hit found so far are not tested. If the ray starts inside a body, it
+      hits the body where it leaves it. Ties go to the lowest index. */
+  bool closestHit(const Ray& ray, RayHit& hit) const;
+
+  /** \brief Find any body that \e ray hits between ray.tmin and ray.tmax; the search stops at the first one,
+      which is cheaper than closestHit() for occlusion tests */
+  bool anyHit(const Ray& ray, RayHit& hit) const;
+
+  /** \brief Find the first hit of \e ray with each body it hits between ray.tmin and ray.tmax; \e hits is
+      set to them, sorted by distance. Returns their number. */
+  std::size_t allHits(const Ray& ray, std::vector<RayHit>& hits) const;
+
+  /** \brief Body index reported by intersectsRays() for rays that do not hit any body */
+  static const std::size_t NO_BODY = std::numeric_limits<std::size_t>::max();
+
   /** \brief Get the \e i<sup>th</sup> body in the vector*/
   const Body* getBody(unsigned int i) const;
 
 private:
+  /** \brief A node of the bounding volume hierarchy; nodes are stored in a flat array and leaves
+      refer to exactly one body */
+  struct BVHNode
+  {
+    /** \brief Axis-aligned box enclosing the bounding spheres of all bodies below this node */
+    Eigen::Vector3d min;
+    Eigen::Vector3d max;
+
+    /** \brief Smallest body index below this node; used to report the same body as the linear scan */
+    std::size_t min_index;
+
+    /** \brief Children of an inner node, -1 for leaves */
+    int left;
+    int right;
+
+    /** \brief Parent node, -1 for the root */
+    int parent;
+
+    /** \brief Body referred to by a leaf */
+    std::size_t body;
+  };
+
+  /** \brief Rebuild the bounding volume hierarchy if bodies were added since it was built */
+  void updateBoundingVolumeHierarchy() const;
+
+  /** \brief Build the bounding volume hierarchy from scratch */
+  void buildBoundingVolumeHierarchy() const;
+
+  /** \brief Recursively build the subtree for the bodies in \e order[begin, end) and return its node index */
+  int buildBoundingVolumeHierarchy(std::vector<std::size_t>& order, const EigenSTL::vector_Vector3d& centers,
+                                   std::size_t begin, std::size_t end, int parent) const;
+
+  /** \brief Recompute the bounds of leaf \e node from its body and update the bounds of its ancestors */
+  void refitBoundingVolumeHierarchy(int node);
+
+  /** \brief Compute the bounds of a leaf from the bounding sphere of its body */
+  void updateLeafBounds(BVHNode& node) const;
+
+  bool containsPointBVH(const Eigen::Vector3d& p, std::size_t& index, bool verbose) const;
+
+  bool intersectBVH(const Ray& ray, std::size_t& index, Hit& hit) const;
+
+  enum RayHitMode
+  {
+    CLOSEST_HIT,
+    ANY_HIT,
+    ALL_HITS
+  };
+
+  /** \brief The traversal shared by closestHit(), anyHit() and allHits(): visit the bodies whose bounding
+      sphere the ray reaches before the best distance so far, descending the hierarchy if it is in use.
+      For ALL_HITS, the hits are appended to \e all and \e best is not set. */
+  bool traceRay(const Ray& ray, RayHitMode mode, RayHit& best, std::vector<RayHit>* all) const;
+
+  /** \brief Find the nearest hits of at most one packet of rays, given in structure-of-arrays form,
+      descending the hierarchy with the whole packet */
+  void intersectsRaysBVH(const double* ox, const double* oy, const double* oz, const double* dx, const double* dy,
+                         const double* dz, std::size_t n, double* out_t, std::size_t* out_body_index) const;
+
   std::vector<Body*> bodies_;
+
+  bool use_bvh_;
+
+  /** \brief The nodes of the hierarchy; the root is the first element */
+  mutable std::vector<BVHNode> bvh_nodes_;
+
+  /** \brief The leaf node for each body */
+  mutable std::vector<int> bvh_leaf_for_body_;
+
+  /** \brief Set when bodies were added since the hierarchy was built; the next query rebuilds it */
+  mutable std::atomic<bool> bvh_dirty_;
+
+  /** \brief Serializes the rebuild of the hierarchy by concurrent queries */
+  mutable std::mutex bvh_mutex_;
+
+  /** \brief The bounding sphere of each body, for the ray queries */
+  std::vector<BoundingSphere> bounding_spheres_;
 };
 
 /** \brief Shared pointer to a Body */
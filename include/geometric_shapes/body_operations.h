@@ -45,8 +45,18 @@
 
 namespace bodies
 {
-/** \brief Create a body from a given shape */
-Body* createBodyFromShape(const shapes::Shape* shape);
+/** \brief The body createBodyFromShape() builds for a shapes::Mesh */
+enum MeshBodyType
+{
+  /** \brief A ConvexMesh, the convex hull of the mesh */
+  CONVEX_HULL,
+
+  /** \brief A TriangleMesh, which keeps the concave parts of the mesh */
+  TRIANGLES
+};
+
+/** \brief Create a body from a given shape; meshes become the body type given by \e mesh_type */
+Body* createBodyFromShape(const shapes::Shape* shape, MeshBodyType mesh_type = CONVEX_HULL);
 
 /** \brief Create a body from a given shape */
 Body* constructBodyFromMsg(const shape_msgs::Mesh& shape, const geometry_msgs::Pose& pose);
@@ -60,7 +70,21 @@ Body* constructBodyFromMsg(const shapes::ShapeMsg& shape, const geometry_msgs::P
 /** \brief Compute a bounding sphere to enclose a set of bounding spheres */
 void mergeBoundingSpheres(const std::vector<BoundingSphere>& spheres, BoundingSphere& mergedSphere);
 
-/** \brief Compute the bounding sphere for a set of \e bodies and store the resulting sphere in \e mergedSphere */
+/** \brief Compute the bounding sphere for a set of \e bodies and store the resulting sphere in \e mergedSphere.
+    The vertices of convex meshes and the corners of boxes are enclosed by their smallest sphere; the
+    bounding spheres of the other bodies are merged into it. */
 void computeBoundingSphere(const std::vector<const Body*>& bodies, BoundingSphere& mergedSphere);
+
+/** \brief Check whether the bodies \e a and \e b, including their scaling and padding, intersect.
+    Spheres and boxes are tested analytically; other pairs use GJK on the support functions of the
+    bodies (Body::computeSupportPoint()). Bodies that only touch are not considered intersecting; in the rare case that
+    GJK does not converge, which only happens within round-off of contact, they are. */
+bool intersects(const Body& a, const Body& b);
+
+/** \brief Compute how deep the bodies \e a and \e b penetrate each other. Returns false if they do not
+    intersect. Otherwise, moving \e b by \e depth along the unit vector \e normal brings the bodies into
+    contact. Pairs without an analytic solution use EPA, which is exact up to a small tolerance for
+    polyhedra and approximates curved surfaces. */
+bool computePenetration(const Body& a, const Body& b, double& depth, Eigen::Vector3d& normal);
 }
 #endif
@@ -58,6 +58,17 @@ Mesh* createMeshFromVertices(const EigenSTL::vector_Vector3d& vertices, const st
     the set of triangle indices is constructed. The normal at each triangle is also computed */
 Mesh* createMeshFromVertices(const EigenSTL::vector_Vector3d& source);
 
+/** \brief Load a mesh from a set of vertices, welding the vertices that fall in the same cell of a grid of
+    size \e tolerance. A tolerance of 0 welds identical vertices only. A welded vertex is placed where it
+    first occurs in \e source, and the vertices are numbered in that order. */
+Mesh* createMeshFromVertices(const EigenSTL::vector_Vector3d& source, double tolerance);
+
+/** \brief The same as createMeshFromVertices(\e source, \e tolerance), with the vertices hashed and welded
+    on \e threads threads (the number of hardware threads for 0). Meant for triangle soups of millions of
+    triangles; the mesh is identical to the one built on a single thread. */
+Mesh* createMeshFromVerticesParallel(const EigenSTL::vector_Vector3d& source, double tolerance = 0.0,
+                                     unsigned int threads = 0);
+
 /** \brief Load a mesh from a resource that contains a mesh that can be loaded by assimp */
 Mesh* createMeshFromResource(const std::string& resource);
 
@@ -93,6 +104,10 @@ Mesh* createMeshFromShape(const Cylinder& cylinder);
 /** \brief Construct a mesh from a cone */
 Mesh* createMeshFromShape(const Cone& cone);
 
+/** \brief Compute the smallest sphere that contains all the \e vertices. Welzl's algorithm is run on the
+    vertices in a random order, which takes expected linear time. */
+void computeMinimumBoundingSphere(const EigenSTL::vector_Vector3d& vertices, Eigen::Vector3d& center, double& radius);
+
 /** \brief Write the mesh to a buffer in STL format */
 void writeSTLBinary(const Mesh* mesh, std::vector<char>& buffer);
 }
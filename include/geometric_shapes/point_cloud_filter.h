@@ -0,0 +1,137 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef GEOMETRIC_SHAPES_POINT_CLOUD_FILTER_
+#define GEOMETRIC_SHAPES_POINT_CLOUD_FILTER_
+
+#include "geometric_shapes/bodies.h"
+#include "geometric_shapes/thread_pool.h"
+#include <cstdint>
+#include <vector>
+
+namespace bodies
+{
+/** @class PointCloudFilter
+ *  @brief Label the points of a cloud as inside or outside of the bodies of a BodyVector,
+ *  using a pool of worker threads.
+ *
+ *  The points are split into chunks that are processed by a ThreadPool. Every chunk writes
+ *  to its own contiguous range of the output, so workers do not share cache lines except
+ *  at chunk boundaries. Only the const query functions of the bodies are used, so
+ *  the bodies must not be modified while filter() runs.
+ */
+class PointCloudFilter
+{
+public:
+  /** \brief The label of a point */
+  enum Label
+  {
+    OUTSIDE = 0,
+    INSIDE = 1
+  };
+
+  /** \brief Body index reported for points that are not inside any body */
+  static const std::size_t NO_BODY = BodyVector::NO_BODY;
+
+  /** \brief Timing information about the last call to filter() */
+  struct Statistics
+  {
+    Statistics() : points(0), inside(0), threads(0), seconds(0.0)
+    {
+    }
+
+    /** \brief Throughput of the whole pool */
+    double pointsPerSecond() const
+    {
+      return seconds > 0.0 ? points / seconds : 0.0;
+    }
+
+    /** \brief Throughput divided by the number of threads that took part */
+    double pointsPerSecondPerThread() const
+    {
+      return threads > 0 ? pointsPerSecond() / threads : 0.0;
+    }
+
+    std::size_t points;
+    std::size_t inside;
+    unsigned int threads;
+    double seconds;
+  };
+
+  /** \brief Construct a filter that uses \e threads threads (including the calling thread).
+      If \e threads is 0, the number of hardware threads is used. */
+  explicit PointCloudFilter(unsigned int threads = 0);
+
+  /** \brief Get the number of threads used by filter(), including the calling thread */
+  unsigned int getThreadCount() const;
+
+  /** \brief Set the number of points processed as one unit of work. Default is 1024 */
+  void setChunkSize(std::size_t chunk_size);
+
+  /** \brief Get the number of points processed as one unit of work */
+  std::size_t getChunkSize() const;
+
+  /** \brief Label the \e n points starting at \e points; the coordinates of point \e i are
+      points[i * stride], points[i * stride + 1] and points[i * stride + 2]. For every point the label
+      is written to \e labels[i] and, if \e indices is not NULL, the index of the first body that
+      contains it (the same as BodyVector::containsPoint()) or NO_BODY is written to \e indices[i] */
+  void filter(const BodyVector& bodies, const float* points, std::size_t stride, std::size_t n, uint8_t* labels,
+              std::size_t* indices = NULL);
+
+  /** \brief Label the \e n points starting at \e points, with the same layout as for the float version */
+  void filter(const BodyVector& bodies, const double* points, std::size_t stride, std::size_t n, uint8_t* labels,
+              std::size_t* indices = NULL);
+
+  /** \brief Label \e points; \e labels and \e indices are resized to the number of points */
+  void filter(const BodyVector& bodies, const EigenSTL::vector_Vector3d& points, std::vector<uint8_t>& labels,
+              std::vector<std::size_t>& indices);
+
+  /** \brief Get timing information about the last call to filter() */
+  const Statistics& getLastStatistics() const;
+
+private:
+  struct Job;
+
+  /** \brief Process \e job on the pool and record its statistics */
+  void run(const Job& job);
+
+  ThreadPool pool_;
+
+  std::size_t chunk_size_;
+
+  Statistics statistics_;
+};
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef GEOMETRIC_SHAPES_RAY_CASTER_
+#define GEOMETRIC_SHAPES_RAY_CASTER_
+
+#include "geometric_shapes/bodies.h"
+#include "geometric_shapes/thread_pool.h"
+#include <vector>
+
+namespace bodies
+{
+/** @class RayCaster
+ *  @brief Find the nearest hits of many rays with the bodies of a BodyVector, using a pool of
+ *  worker threads; meant for simulating range sensors and for shadow filtering.
+ *
+ *  The rays are split into chunks that are processed by a ThreadPool; within a chunk,
+ *  BodyVector::intersectsRays() intersects packets of rays at once. Only the const query
+ *  functions of the bodies are used, so the bodies must not be modified while castRays() runs.
+ */
+class RayCaster
+{
+public:
+  /** \brief Timing information about the last call to castRays() */
+  struct Statistics
+  {
+    Statistics() : rays(0), hits(0), threads(0), seconds(0.0)
+    {
+    }
+
+    /** \brief Throughput of the whole pool */
+    double raysPerSecond() const
+    {
+      return seconds > 0.0 ? rays / seconds : 0.0;
+    }
+
+    /** \brief Throughput divided by the number of threads that took part */
+    double raysPerSecondPerThread() const
+    {
+      return threads > 0 ? raysPerSecond() / threads : 0.0;
+    }
+
+    std::size_t rays;
+    std::size_t hits;
+    unsigned int threads;
+    double seconds;
+  };
+
+  /** \brief Construct a ray caster that uses \e threads threads (including the calling thread).
+      If \e threads is 0, the number of hardware threads is used. */
+  explicit RayCaster(unsigned int threads = 0);
+
+  /** \brief Get the number of threads used by castRays(), including the calling thread */
+  unsigned int getThreadCount() const;
+
+  /** \brief Set the number of rays processed as one unit of work. Default is 1024 */
+  void setChunkSize(std::size_t chunk_size);
+
+  /** \brief Get the number of rays processed as one unit of work */
+  std::size_t getChunkSize() const;
+
+  /** \brief Intersect \e n rays with \e bodies; the results are the same as for
+      BodyVector::intersectsRays() */
+  void castRays(const BodyVector& bodies, const Eigen::Vector3d* origins, const Eigen::Vector3d* dirs, std::size_t n,
+                double* out_t, std::size_t* out_body_index = NULL);
+
+  /** \brief Intersect the rays given by \e origins and \e dirs with \e bodies; \e out_t and
+      \e out_body_index are resized to the number of rays */
+  void castRays(const BodyVector& bodies, const EigenSTL::vector_Vector3d& origins,
+                const EigenSTL::vector_Vector3d& dirs, std::vector<double>& out_t,
+                std::vector<std::size_t>& out_body_index);
+
+  /** \brief Get timing information about the last call to castRays() */
+  const Statistics& getLastStatistics() const;
+
+private:
+  ThreadPool pool_;
+
+  std::size_t chunk_size_;
+
+  Statistics statistics_;
+};
+}
+
+#endif
@@ -41,10 +41,13 @@
 #error This header requires at least C++11
 #endif
 
+#include <atomic>
+#include <cstdint>
 #include <cstdlib>
 #include <vector>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 
 namespace octomap
@@ -196,15 +199,42 @@ public:
 class Mesh : public Shape
 {
 public:
+  /** \brief How the vertices, triangles and normals of a mesh are stored */
+  enum Storage
+  {
+    /** \brief In vertices, triangles and the normal arrays, as double and unsigned int */
+    DOUBLE_STORAGE,
+
+    /** \brief In compact_vertices as float, and in compact_triangles as 16 bit indices if the vertices are at
+        most 65536, in triangles otherwise. Normals are not stored. */
+    COMPACT_STORAGE
+  };
+
   Mesh();
-  Mesh(unsigned int v_count, unsigned int t_count);
+
+  /** \brief Allocate \e v_count vertices and \e t_count triangles, and room for their normals unless
+      \e allocate_normals is false, in which case the normals are NULL until computed. Either way the normals
+      are only computed when asked for; the meshes this package creates and loads do not allocate them. */
+  Mesh(unsigned int v_count, unsigned int t_count, bool allocate_normals = true);
+
+  /** \brief Take the arrays of \e other, which is left empty */
+  Mesh(Mesh&& other);
+
+  /** \brief Free the arrays of this mesh and take those of \e other, which is left empty */
+  Mesh& operator=(Mesh&& other);
+
   virtual ~Mesh();
 
   /** \brief The type of the shape, as a string */
   static const std::string STRING_NAME;
 
   virtual void scaleAndPadd(double scale, double padd);
+
+  /** \brief A deep copy of the mesh, which takes time and memory in proportion to its size. The arrays are
+      public and writable, so clones cannot share them; to use one mesh in several places without copying
+      it, share a ShapeConstPtr to it, and to hand its arrays over, move it. */
   virtual Shape* clone() const;
+
   virtual void print(std::ostream& out = std::cout) const;
 
   /** \brief Compute the normals of each triangle from its vertices via cross product. */
@@ -215,30 +245,103 @@ public:
      Calls computeTriangleNormals() if needed. */
   void computeVertexNormals();
 
-  /** \brief Merge vertices that are very close to each other, up to a threshold*/
-  void mergeVertices(double threshold);
+  /** \brief Compute the triangle normals and the vertex normals on \e threads threads (the number of hardware
+      threads for 0). With \e area_weighted, triangles weigh on the normals of their vertices in proportion
+      to their area rather than equally. */
+  void computeNormals(bool area_weighted = false, unsigned int threads = 0);
+
+  /** \brief The triangle normals, computed if missing. Safe to call from several threads on the same mesh. */
+  const double* getTriangleNormals() const;
+
+  /** \brief The vertex normals, computed if missing. Safe to call from several threads on the same mesh. */
+  const double* getVertexNormals() const;
+
+  /** \brief Free the normals, so that they are computed again when asked for. Needed after moving vertices. */
+  void clearNormals();
+
+  /** \brief Convert the arrays of the mesh to \e storage. A compact mesh takes about half the memory; its
+      coordinates keep float precision when converted back. Normals are not kept by compact meshes: the
+      functions that compute them do nothing, getTriangleNormals() and getVertexNormals() return NULL, and
+      getTriangleNormal() computes the normal of a triangle when asked. scaleAndPadd() and mergeVertices()
+      convert a compact mesh to doubles and back. */
+  void setStorage(Storage storage);
+
+  /** \brief How the arrays of the mesh are stored */
+  Storage getStorage() const
+  {
+    return compact_vertices ? COMPACT_STORAGE : DOUBLE_STORAGE;
+  }
+
+  /** \brief Coordinate \e i of the vertices, vertices[i] for either storage */
+  double getVertexCoordinate(unsigned int i) const
+  {
+    return compact_vertices ? compact_vertices[i] : vertices[i];
+  }
+
+  /** \brief Vertex index \e i of the triangles, triangles[i] for either storage */
+  unsigned int getTriangleIndex(unsigned int i) const
+  {
+    return compact_triangles ? compact_triangles[i] : triangles[i];
+  }
+
+  /** \brief Set \e normal to the normal of triangle \e t, computed from its vertices if it is not stored */
+  void getTriangleNormal(unsigned int t, double* normal) const;
+
+  /** \brief Merge vertices that are very close to each other, up to a threshold.
+
+     Vertices are visited in order; a vertex within \e threshold of an earlier vertex that was kept is merged
+     into the last such vertex. Triangles the merge collapses are removed. Nearby vertices are found in a grid
+     of cells of size \e threshold, which takes linear time for well spread vertices. With \e threads other
+     than 1, the neighbors are searched for on that many threads (the number of hardware threads for 0); the
+     result is the same. */
+  void mergeVertices(double threshold, unsigned int threads = 1);
 
   /** \brief The number of available vertices */
   unsigned int vertex_count;
 
   /** \brief The position for each vertex vertex k has values at
-   * index (3k, 3k+1, 3k+2) = (x,y,z) */
+   * index (3k, 3k+1, 3k+2) = (x,y,z); NULL for COMPACT_STORAGE. Code that may be given compact meshes reads
+   * the vertices through getVertexCoordinate(), as the functions of this package do, or calls
+   * setStorage(DOUBLE_STORAGE) first. */
   double* vertices;
 
   /** \brief The number of triangles formed with the vertices */
   unsigned int triangle_count;
 
   /** \brief The vertex indices for each triangle
-   * triangle k has vertices at index (3k, 3k+1, 3k+2) = (v1, v2, v3) */
+   * triangle k has vertices at index (3k, 3k+1, 3k+2) = (v1, v2, v3); NULL when compact_triangles is used.
+   * Read them through getTriangleIndex() when the mesh may be compact. */
   unsigned int* triangles;
 
   /** \brief The normal to each triangle; unit vector represented
-      as (x,y,z); If missing from the mesh, these vectors can be computed using computeTriangleNormals() */
-  double* triangle_normals;
+      as (x,y,z); not computed until asked for, and NULL until then for meshes created or loaded by this
+      package. Code that reads this array directly must call getTriangleNormals() or computeTriangleNormals()
+      first; better, it reads what getTriangleNormals() returns. */
+  mutable double* triangle_normals;
 
   /** \brief The normal to each vertex; unit vector represented
-      as (x,y,z); If missing from the mesh, these vectors can be computed using computeVertexNormals()  */
-  double* vertex_normals;
+      as (x,y,z); not computed until asked for. As for triangle_normals, read it through getVertexNormals(), or
+      call computeVertexNormals() first. */
+  mutable double* vertex_normals;
+
+  /** \brief The positions of the vertices, as vertices, for COMPACT_STORAGE; NULL otherwise */
+  float* compact_vertices;
+
+  /** \brief The vertex indices of the triangles, as triangles, for COMPACT_STORAGE with at most 65536
+      vertices; NULL otherwise */
+  std::uint16_t* compact_triangles;
+
+private:
+  /** \brief Exchange the arrays, and their counts, with those of \e other */
+  void swapArrays(Mesh& other);
+
+  /** \brief Set once triangle_normals or vertex_normals hold the normals, so that the getters return them
+      without locking */
+  mutable std::atomic<bool> triangle_normals_ready_;
+  mutable std::atomic<bool> vertex_normals_ready_;
+
+  /** \brief Held by the getters that compute the normals of a const mesh, and by clone() */
+  mutable std::mutex normals_mutex_;
 };
 
 /** \brief Definition of a plane with equation ax + by + cz + d = 0 */
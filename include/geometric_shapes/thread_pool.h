@@ -0,0 +1,103 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#ifndef GEOMETRIC_SHAPES_THREAD_POOL_
+#define GEOMETRIC_SHAPES_THREAD_POOL_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bodies
+{
+/** @class ThreadPool
+ *  @brief A fixed set of threads that process the chunks of one job at a time.
+ *
+ *  The chunks of a job are distributed evenly over the workers; a worker that runs out of
+ *  chunks steals the remaining ones from the other workers. The calling thread is worker 0,
+ *  so a pool of one thread runs everything inline. Used by PointCloudFilter and RayCaster.
+ */
+class ThreadPool
+{
+public:
+  /** \brief Construct a pool of \e threads threads, including the calling thread.
+      If \e threads is 0, the number of hardware threads is used. */
+  explicit ThreadPool(unsigned int threads = 0);
+
+  ~ThreadPool();
+
+  /** \brief Get the number of threads, including the calling thread */
+  unsigned int getThreadCount() const;
+
+  /** \brief Call \e task(chunk, worker) once for every chunk in [0, \e chunks) and return when all
+      are done. \e worker is the index (less than getThreadCount()) of the thread executing the
+      chunk, so tasks can keep per-worker state without locking. Only one job runs at a time. */
+  void run(std::size_t chunks, const std::function<void(std::size_t, unsigned int)>& task);
+
+private:
+  struct Worker;
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /** \brief Process chunks of the current job, first from the queue of worker \e self, then from the others */
+  void work(unsigned int self);
+
+  /** \brief Main loop of the pool thread for worker \e self */
+  void threadMain(unsigned int self);
+
+  std::vector<std::unique_ptr<Worker> > workers_;
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable start_condition_;
+  std::condition_variable done_condition_;
+
+  /** \brief The task of the current job, NULL when the pool is idle */
+  const std::function<void(std::size_t, unsigned int)>* task_;
+
+  /** \brief Incremented for every new job, so that sleeping threads notice it */
+  std::size_t generation_;
+
+  /** \brief Number of pool threads that have not finished the current job */
+  unsigned int running_;
+
+  bool shutdown_;
+};
+}
+
+#endif
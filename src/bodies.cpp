@@ -36,11 +36,22 @@
 
 #include "geometric_shapes/bodies.h"
 #include "geometric_shapes/body_operations.h"
+#include "geometric_shapes/mesh_operations.h"
 
 #include <console_bridge/console.h>
+#include <octomap/octomap.h>
 
 extern "C" {
-#ifdef GEOMETRIC_SHAPES_HAVE_QHULL_2011
+#if defined(GEOMETRIC_SHAPES_HAVE_QHULL_R)
+#include <libqhull_r/libqhull_r.h>
+#include <libqhull_r/mem_r.h>
+#include <libqhull_r/qset_r.h>
+#include <libqhull_r/geom_r.h>
+#include <libqhull_r/merge_r.h>
+#include <libqhull_r/poly_r.h>
+#include <libqhull_r/io_r.h>
+#include <libqhull_r/stat_r.h>
+#elif defined(GEOMETRIC_SHAPES_HAVE_QHULL_2011)
 #include <libqhull/libqhull.h>
 #include <libqhull/mem.h>
 #include <libqhull/qset.h>
@@ -63,9 +74,16 @@ extern "C" {
 
 #include <boost/math/constants/constants.hpp>
 #include <limits>
+#include <cmath>
 #include <cstdio>
 #include <algorithm>
+#include <atomic>
 #include <Eigen/Geometry>
+#include <Eigen/Eigenvalues>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 
 namespace bodies
 {
@@ -82,6 +100,43 @@ static inline double distanceSQR(const Eigen::Vector3d& p, const Eigen::Vector3d
   return a.squaredNorm() - d * d;
 }
 
+/** \brief The squared distance from \e p to the line of \e ray; the direction is already normalized */
+static inline double distanceSQR(const Eigen::Vector3d& p, const Ray& ray)
+{
+  const Eigen::Vector3d a = p - ray.origin;
+  const double d = ray.dir.dot(a);
+  return a.squaredNorm() - d * d;
+}
+
+/** \brief Set \e hit to the crossings of the surface of a convex body that \e ray is inside of for
+    \e tenter <= t <= \e texit, keeping those in (ray.tmin, ray.tmax]; false if the part of the ray does not
+    overlap [\e tenter, \e texit] */
+static inline bool clipHit(const Ray& ray, double tenter, double texit, Hit& hit)
+{
+  hit.count = 0;
+  hit.inside = false;
+  if (!(tenter <= texit) || texit <= ray.tmin || tenter > ray.tmax)
+    return false;
+  hit.inside = tenter <= ray.tmin;
+  if (tenter > ray.tmin)
+    hit.t[hit.count++] = tenter;
+  if (texit <= ray.tmax && (hit.count == 0 || texit > tenter))
+    hit.t[hit.count++] = texit;
+  return true;
+}
+
+/** \brief Append the points of \e hit to \e intersections, at most \e count of them unless it is 0, as
+    Body::intersectsRay() reports them */
+static inline void appendHits(const Ray& ray, const Hit& hit, EigenSTL::vector_Vector3d* intersections,
+                              unsigned int count)
+{
+  if (!intersections)
+    return;
+  const unsigned int n = count > 0 ? std::min(count, hit.count) : hit.count;
+  for (unsigned int i = 0; i < n; ++i)
+    intersections->push_back(ray.at(hit.t[i]));
+}
+
 // temp structure for intersection points (used for ordering them)
 struct intersc
 {
@@ -103,1074 +158,3875 @@ struct interscOrder
     return a.time < b.time;
   }
 };
+
+// number of points the batched containment kernels process at once; a block of 8 doubles per
+// coordinate maps onto whole SSE/AVX registers and lets Eigen unroll the fixed-size expressions
+static const int BATCH_SIZE = 8;
+typedef Eigen::Array<double, BATCH_SIZE, 1> BatchArray;
+
+// with the adaptive plane order of ConvexMesh, the batched containment test counts the rejections
+// of one in this many blocks, which keeps the counting cheap next to the plane tests
+static const std::size_t PLANE_ORDER_SAMPLING = 8;
+
+// number of rays BodyVector::intersectsRays() passes to each body at once
+static const std::size_t RAY_BLOCK_SIZE = 256;
+
+// the containment kernels are written once, as templates over the coordinate type; they are
+// instantiated for BatchArray (vectorized by Eigen) and for double (scalar fallback), so both
+// paths execute the same sequence of floating point operations and give identical results
+template <typename T>
+struct BatchTraits
+{
+  typedef bool Mask;
+
+  static Mask constant(bool value)
+  {
+    return value;
+  }
+
+  static bool any(const Mask& m)
+  {
+    return m;
+  }
+
+  static std::size_t count(const Mask& m)
+  {
+    return m ? 1 : 0;
+  }
+};
+
+template <>
+struct BatchTraits<BatchArray>
+{
+  typedef Eigen::Array<bool, BATCH_SIZE, 1> Mask;
+
+  static Mask constant(bool value)
+  {
+    return Mask::Constant(value);
+  }
+
+  static bool any(const Mask& m)
+  {
+    return m.any();
+  }
+
+  static std::size_t count(const Mask& m)
+  {
+    return m.count();
+  }
+};
+
+static inline double absolute(double v)
+{
+  return fabs(v);
 }
+
+static inline BatchArray absolute(const BatchArray& v)
+{
+  return v.abs();
 }
 
-void bodies::Body::setDimensions(const shapes::Shape* shape)
+static inline double minimum(double a, double b)
 {
-  useDimensions(shape);
-  updateInternalData();
+  return std::min(a, b);
 }
 
-bool bodies::Body::samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
-                                     Eigen::Vector3d& result)
+static inline BatchArray minimum(const BatchArray& a, const BatchArray& b)
 {
-  BoundingSphere bs;
-  computeBoundingSphere(bs);
-  for (unsigned int i = 0; i < max_attempts; ++i)
-  {
-    result = Eigen::Vector3d(rng.uniformReal(bs.center.x() - bs.radius, bs.center.x() + bs.radius),
-                             rng.uniformReal(bs.center.y() - bs.radius, bs.center.y() + bs.radius),
-                             rng.uniformReal(bs.center.z() - bs.radius, bs.center.z() + bs.radius));
-    if (containsPoint(result))
-      return true;
-  }
-  return false;
+  return a.min(b);
 }
 
-bool bodies::Sphere::containsPoint(const Eigen::Vector3d& p, bool verbose) const
+static inline BatchArray minimum(const BatchArray& a, double b)
 {
-  return (center_ - p).squaredNorm() < radius2_;
+  return a.min(b);
 }
 
-void bodies::Sphere::useDimensions(const shapes::Shape* shape)  // radius
+static inline double maximum(double a, double b)
 {
-  radius_ = static_cast<const shapes::Sphere*>(shape)->radius;
+  return std::max(a, b);
 }
 
-std::vector<double> bodies::Sphere::getDimensions() const
+static inline BatchArray maximum(const BatchArray& a, const BatchArray& b)
 {
-  std::vector<double> d(1, radius_);
-  return d;
+  return a.max(b);
 }
 
-void bodies::Sphere::updateInternalData()
+static inline BatchArray maximum(const BatchArray& a, double b)
 {
-  radiusU_ = radius_ * scale_ + padding_;
-  radius2_ = radiusU_ * radiusU_;
-  center_ = pose_.translation();
+  return a.max(b);
 }
 
-std::shared_ptr<bodies::Body> bodies::Sphere::cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const
+static inline void setConstant(double& v, double value)
 {
-  Sphere* s = new Sphere();
-  s->radius_ = radius_;
-  s->padding_ = padding;
-  s->scale_ = scale;
-  s->pose_ = pose;
-  s->updateInternalData();
-  return std::shared_ptr<Body>(s);
+  v = value;
 }
 
-double bodies::Sphere::computeVolume() const
+static inline void setConstant(BatchArray& v, double value)
 {
-  return 4.0 * boost::math::constants::pi<double>() * radiusU_ * radiusU_ * radiusU_ / 3.0;
+  v.setConstant(value);
 }
 
-void bodies::Sphere::computeBoundingSphere(BoundingSphere& sphere) const
+static inline double squareRoot(double v)
 {
-  sphere.center = center_;
-  sphere.radius = radiusU_;
+  return sqrt(v);
 }
 
-void bodies::Sphere::computeBoundingCylinder(BoundingCylinder& cylinder) const
+static inline BatchArray squareRoot(const BatchArray& v)
 {
-  cylinder.pose = pose_;
-  cylinder.radius = radiusU_;
-  cylinder.length = radiusU_;
+  return v.sqrt();
 }
 
-bool bodies::Sphere::samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
-                                       Eigen::Vector3d& result)
+/** \brief Run \e kernel on full blocks of BATCH_SIZE points and use the scalar instantiation for the remainder */
+template <typename Kernel>
+static void containsPointsBatched(const Kernel& kernel, const double* xs, const double* ys, const double* zs,
+                                  std::size_t n, uint8_t* mask)
 {
-  for (unsigned int i = 0; i < max_attempts; ++i)
+  std::size_t i = 0;
+  for (; i + BATCH_SIZE <= n; i += BATCH_SIZE)
   {
-    const double minX = center_.x() - radiusU_;
-    const double maxX = center_.x() + radiusU_;
-    const double minY = center_.y() - radiusU_;
-    const double maxY = center_.y() + radiusU_;
-    const double minZ = center_.z() - radiusU_;
-    const double maxZ = center_.z() + radiusU_;
-    // we are sampling in a box; the probability of success after 20 attempts is 99.99996% given the ratio of box volume
-    // to sphere volume
-    for (int j = 0; j < 20; ++j)
-    {
-      result = Eigen::Vector3d(rng.uniformReal(minX, maxX), rng.uniformReal(minY, maxY), rng.uniformReal(minZ, maxZ));
-      if (containsPoint(result))
-        return true;
-    }
+    const BatchArray x = Eigen::Map<const BatchArray>(xs + i);
+    const BatchArray y = Eigen::Map<const BatchArray>(ys + i);
+    const BatchArray z = Eigen::Map<const BatchArray>(zs + i);
+    const BatchTraits<BatchArray>::Mask inside = kernel(x, y, z);
+    Eigen::Map<Eigen::Array<uint8_t, BATCH_SIZE, 1> >(mask + i) = inside.cast<uint8_t>();
   }
-  return false;
+  for (; i < n; ++i)
+    mask[i] = kernel(xs[i], ys[i], zs[i]) ? 1 : 0;
 }
 
-bool bodies::Sphere::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
-                                   EigenSTL::vector_Vector3d* intersections, unsigned int count) const
+struct SphereKernel
 {
-  if (detail::distanceSQR(center_, origin, dir) > radius2_)
-    return false;
+  template <typename T>
+  typename BatchTraits<T>::Mask operator()(const T& x, const T& y, const T& z) const
+  {
+    const T dx = cx - x;
+    const T dy = cy - y;
+    const T dz = cz - z;
+    return dx * dx + dy * dy + dz * dz < radius2;
+  }
 
-  bool result = false;
+  double cx, cy, cz;
+  double radius2;
+};
 
-  Eigen::Vector3d cp = origin - center_;
-  double dpcpv = cp.dot(dir);
+struct CylinderKernel
+{
+  template <typename T>
+  typename BatchTraits<T>::Mask operator()(const T& x, const T& y, const T& z) const
+  {
+    const T vx = x - center.x();
+    const T vy = y - center.y();
+    const T vz = z - center.z();
+    const T pH = vx * normalH.x() + vy * normalH.y() + vz * normalH.z();
+    const T pB1 = vx * normalB1.x() + vy * normalB1.y() + vz * normalB1.z();
+    const T pB2 = vx * normalB2.x() + vy * normalB2.y() + vz * normalB2.z();
+    return !(absolute(pH) > length2) && pB2 * pB2 < radius2 - pB1 * pB1;
+  }
 
-  Eigen::Vector3d w = cp - dpcpv * dir;
-  Eigen::Vector3d Q = center_ + w;
-  double x = radius2_ - w.squaredNorm();
+  Eigen::Vector3d center;
+  Eigen::Vector3d normalH;
+  Eigen::Vector3d normalB1;
+  Eigen::Vector3d normalB2;
+  double length2;
+  double radius2;
+};
 
-  if (fabs(x) < detail::ZERO)
+struct BoxKernel
+{
+  template <typename T>
+  typename BatchTraits<T>::Mask operator()(const T& x, const T& y, const T& z) const
   {
-    w = Q - origin;
-    double dpQv = w.dot(dir);
-    if (dpQv > detail::ZERO)
-    {
-      if (intersections)
-        intersections->push_back(Q);
-      result = true;
-    }
+    const T vx = x - center.x();
+    const T vy = y - center.y();
+    const T vz = z - center.z();
+    const T pL = vx * normalL.x() + vy * normalL.y() + vz * normalL.z();
+    const T pW = vx * normalW.x() + vy * normalW.y() + vz * normalW.z();
+    const T pH = vx * normalH.x() + vy * normalH.y() + vz * normalH.z();
+    return !(absolute(pL) > length2) && !(absolute(pW) > width2) && !(absolute(pH) > height2);
   }
-  else if (x > 0.0)
-  {
-    x = sqrt(x);
-    w = dir * x;
-    Eigen::Vector3d A = Q - w;
-    Eigen::Vector3d B = Q + w;
-    w = A - origin;
-    double dpAv = w.dot(dir);
-    w = B - origin;
-    double dpBv = w.dot(dir);
 
-    if (dpAv > detail::ZERO)
+  Eigen::Vector3d center;
+  Eigen::Vector3d normalL;
+  Eigen::Vector3d normalW;
+  Eigen::Vector3d normalH;
+  double length2;
+  double width2;
+  double height2;
+};
+
+/** \brief Test points against the planes of a convex mesh; the points are first brought into the mesh frame
+    and unscaled exactly as ConvexMesh::containsPoint() does */
+struct ConvexMeshPlanesKernel
+{
+  template <typename T>
+  typename BatchTraits<T>::Mask operator()(const T& x, const T& y, const T& z) const
+  {
+    const Eigen::Matrix3d& r = i_pose.linear();
+    const Eigen::Vector3d& t = i_pose.translation();
+    const T px = x * r(0, 0) + y * r(0, 1) + z * r(0, 2) + t.x();
+    const T py = x * r(1, 0) + y * r(1, 1) + z * r(1, 2) + t.y();
+    const T pz = x * r(2, 0) + y * r(2, 1) + z * r(2, 2) + t.z();
+    const T ux = (px - center.x()) / scale + center.x();
+    const T uy = (py - center.y()) / scale + center.y();
+    const T uz = (pz - center.z()) / scale + center.z();
+
+    typename BatchTraits<T>::Mask inside = BatchTraits<T>::constant(true);
+    std::size_t remaining = rejections ? BatchTraits<T>::count(inside) : 0;
+    for (std::size_t i = 0; i < planes->size(); ++i)
     {
-      result = true;
-      if (intersections)
+      const std::size_t index = order ? order[i].load(std::memory_order_relaxed) : i;
+      const Eigen::Vector4d& plane = (*planes)[index];
+      const T dist = ux * plane.x() + uy * plane.y() + uz * plane.z() + plane.w() - padding - 1e-6;
+      inside = inside && !(dist > 0.0);
+      if (rejections)
       {
-        intersections->push_back(A);
-        if (count == 1)
-          return result;
+        const std::size_t left = BatchTraits<T>::count(inside);
+        rejections[index] += remaining - left;
+        remaining = left;
       }
+      if (!BatchTraits<T>::any(inside))
+        break;
     }
-
-    if (dpBv > detail::ZERO)
-    {
-      result = true;
-      if (intersections)
-        intersections->push_back(B);
-    }
+    return inside;
   }
-  return result;
-}
 
-bool bodies::Cylinder::containsPoint(const Eigen::Vector3d& p, bool verbose) const
-{
-  Eigen::Vector3d v = p - center_;
-  double pH = v.dot(normalH_);
+  Eigen::Affine3d i_pose;
+  Eigen::Vector3d center;
+  double scale;
+  double padding;
+  const EigenSTL::vector_Vector4d* planes;
 
-  if (fabs(pH) > length2_)
-    return false;
+  // the order to test the planes in, or NULL for the order of planes
+  const std::atomic<unsigned int>* order;
 
-  double pB1 = v.dot(normalB1_);
-  double remaining = radius2_ - pB1 * pB1;
+  // if not NULL, the number of points each plane rejected is added to this array
+  std::uint64_t* rejections;
 
-  if (remaining < 0.0)
-    return false;
-  else
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/** \brief Run the distance \e kernel on full blocks of BATCH_SIZE points and use the scalar instantiation
+    for the remainder */
+template <typename Kernel>
+static void signedDistancesBatched(const Kernel& kernel, const double* xs, const double* ys, const double* zs,
+                                   std::size_t n, double* out)
+{
+  std::size_t i = 0;
+  for (; i + BATCH_SIZE <= n; i += BATCH_SIZE)
   {
-    double pB2 = v.dot(normalB2_);
-    return pB2 * pB2 < remaining;
+    const BatchArray x = Eigen::Map<const BatchArray>(xs + i);
+    const BatchArray y = Eigen::Map<const BatchArray>(ys + i);
+    const BatchArray z = Eigen::Map<const BatchArray>(zs + i);
+    Eigen::Map<BatchArray>(out + i) = kernel(x, y, z);
   }
+  for (; i < n; ++i)
+    out[i] = kernel(xs[i], ys[i], zs[i]);
 }
 
-void bodies::Cylinder::useDimensions(const shapes::Shape* shape)  // (length, radius)
+struct SphereDistanceKernel
 {
-  length_ = static_cast<const shapes::Cylinder*>(shape)->length;
-  radius_ = static_cast<const shapes::Cylinder*>(shape)->radius;
-}
+  template <typename T>
+  T operator()(const T& x, const T& y, const T& z) const
+  {
+    const T dx = cx - x;
+    const T dy = cy - y;
+    const T dz = cz - z;
+    return squareRoot(dx * dx + dy * dy + dz * dz) - radius;
+  }
 
-std::vector<double> bodies::Cylinder::getDimensions() const
-{
-  std::vector<double> d(2);
-  d[0] = radius_;
-  d[1] = length_;
-  return d;
-}
+  double cx, cy, cz;
+  double radius;
+};
 
-void bodies::Cylinder::updateInternalData()
+struct CylinderDistanceKernel
 {
-  radiusU_ = radius_ * scale_ + padding_;
-  radius2_ = radiusU_ * radiusU_;
-  length2_ = scale_ * length_ / 2.0 + padding_;
-  center_ = pose_.translation();
-  radiusBSqr_ = length2_ * length2_ + radius2_;
-  radiusB_ = sqrt(radiusBSqr_);
-
-  Eigen::Matrix3d basis = pose_.rotation();
-  normalB1_ = basis.col(0);
-  normalB2_ = basis.col(1);
-  normalH_ = basis.col(2);
+  template <typename T>
+  T operator()(const T& x, const T& y, const T& z) const
+  {
+    const T vx = x - center.x();
+    const T vy = y - center.y();
+    const T vz = z - center.z();
+    const T pH = vx * normalH.x() + vy * normalH.y() + vz * normalH.z();
+    const T pB1 = vx * normalB1.x() + vy * normalB1.y() + vz * normalB1.z();
+    const T pB2 = vx * normalB2.x() + vy * normalB2.y() + vz * normalB2.z();
+    // distances outside of the infinite cylinder and outside of the slab between the caps
+    const T qR = squareRoot(pB1 * pB1 + pB2 * pB2) - radius;
+    const T qH = absolute(pH) - length2;
+    const T oR = maximum(qR, 0.0);
+    const T oH = maximum(qH, 0.0);
+    return minimum(maximum(qR, qH), 0.0) + squareRoot(oR * oR + oH * oH);
+  }
 
-  double tmp = -normalH_.dot(center_);
-  d1_ = tmp + length2_;
-  d2_ = tmp - length2_;
-}
+  Eigen::Vector3d center;
+  Eigen::Vector3d normalH;
+  Eigen::Vector3d normalB1;
+  Eigen::Vector3d normalB2;
+  double length2;
+  double radius;
+};
 
-bool bodies::Cylinder::samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
-                                         Eigen::Vector3d& result)
+struct BoxDistanceKernel
 {
-  // sample a point on the base disc of the cylinder
-  double a = rng.uniformReal(-boost::math::constants::pi<double>(), boost::math::constants::pi<double>());
-  double r = rng.uniformReal(-radiusU_, radiusU_);
-  double x = cos(a) * r;
-  double y = sin(a) * r;
-
-  // sample e height
-  double z = rng.uniformReal(-length2_, length2_);
+  template <typename T>
+  T operator()(const T& x, const T& y, const T& z) const
+  {
+    const T vx = x - center.x();
+    const T vy = y - center.y();
+    const T vz = z - center.z();
+    const T qL = absolute(vx * normalL.x() + vy * normalL.y() + vz * normalL.z()) - length2;
+    const T qW = absolute(vx * normalW.x() + vy * normalW.y() + vz * normalW.z()) - width2;
+    const T qH = absolute(vx * normalH.x() + vy * normalH.y() + vz * normalH.z()) - height2;
+    const T oL = maximum(qL, 0.0);
+    const T oW = maximum(qW, 0.0);
+    const T oH = maximum(qH, 0.0);
+    return minimum(maximum(qL, maximum(qW, qH)), 0.0) + squareRoot(oL * oL + oW * oW + oH * oH);
+  }
 
-  result = Eigen::Vector3d(x, y, z);
-  return true;
-}
+  Eigen::Vector3d center;
+  Eigen::Vector3d normalL;
+  Eigen::Vector3d normalW;
+  Eigen::Vector3d normalH;
+  double length2;
+  double width2;
+  double height2;
+};
 
-std::shared_ptr<bodies::Body> bodies::Cylinder::cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const
+/** \brief Largest signed distance of a point to the scaled and padded planes of a convex mesh. This is the
+    signed distance to the hull for points inside and a lower bound of it for points outside */
+struct ConvexMeshPlaneDistanceKernel
 {
-  Cylinder* c = new Cylinder();
-  c->length_ = length_;
-  c->radius_ = radius_;
-  c->padding_ = padding;
-  c->scale_ = scale;
-  c->pose_ = pose;
-  c->updateInternalData();
-  return std::shared_ptr<Body>(c);
-}
+  template <typename T>
+  T operator()(const T& x, const T& y, const T& z) const
+  {
+    const Eigen::Matrix3d& r = i_pose.linear();
+    const Eigen::Vector3d& t = i_pose.translation();
+    const T px = x * r(0, 0) + y * r(0, 1) + z * r(0, 2) + t.x();
+    const T py = x * r(1, 0) + y * r(1, 1) + z * r(1, 2) + t.y();
+    const T pz = x * r(2, 0) + y * r(2, 1) + z * r(2, 2) + t.z();
+
+    // plane i scaled about the center and moved out by the padding:
+    // n.p + (scale - 1) n.center + scale (w - padding) = 0
+    T dist;
+    setConstant(dist, -std::numeric_limits<double>::infinity());
+    for (std::size_t i = 0; i < planes->size(); ++i)
+    {
+      const Eigen::Vector4d& plane = (*planes)[i];
+      const double offset = (scale - 1.0) * plane.head<3>().dot(center) + scale * (plane.w() - padding);
+      dist = maximum(dist, px * plane.x() + py * plane.y() + pz * plane.z() + offset);
+    }
+    return dist;
+  }
 
-double bodies::Cylinder::computeVolume() const
-{
-  return 2.0 * boost::math::constants::pi<double>() * radius2_ * length2_;
-}
+  Eigen::Affine3d i_pose;
+  Eigen::Vector3d center;
+  double scale;
+  double padding;
+  const EigenSTL::vector_Vector4d* planes;
 
-void bodies::Cylinder::computeBoundingSphere(BoundingSphere& sphere) const
-{
-  sphere.center = center_;
-  sphere.radius = radiusB_;
-}
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
 
-void bodies::Cylinder::computeBoundingCylinder(BoundingCylinder& cylinder) const
+/** \brief Find the point of the triangle (\e a, \e b, \e c) closest to \e p, by the Voronoi regions of the
+    vertices and edges of the triangle */
+static Eigen::Vector3d closestPointOnTriangle(const Eigen::Vector3d& p, const Eigen::Vector3d& a,
+                                              const Eigen::Vector3d& b, const Eigen::Vector3d& c)
 {
-  cylinder.pose = pose_;
-  cylinder.radius = radiusU_;
-  cylinder.length = scale_ * length_ + padding_;
+  const Eigen::Vector3d ab = b - a;
+  const Eigen::Vector3d ac = c - a;
+  const Eigen::Vector3d ap = p - a;
+  const double d1 = ab.dot(ap);
+  const double d2 = ac.dot(ap);
+  if (d1 <= 0.0 && d2 <= 0.0)
+    return a;
+
+  const Eigen::Vector3d bp = p - b;
+  const double d3 = ab.dot(bp);
+  const double d4 = ac.dot(bp);
+  if (d3 >= 0.0 && d4 <= d3)
+    return b;
+
+  const double vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+    return a + ab * (d1 / (d1 - d3));
+
+  const Eigen::Vector3d cp = p - c;
+  const double d5 = ab.dot(cp);
+  const double d6 = ac.dot(cp);
+  if (d6 >= 0.0 && d5 <= d6)
+    return c;
+
+  const double vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+    return a + ac * (d2 / (d2 - d6));
+
+  const double va = d3 * d6 - d5 * d4;
+  if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0)
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+  const double denom = 1.0 / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
 }
 
-bool bodies::Cylinder::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
-                                     EigenSTL::vector_Vector3d* intersections, unsigned int count) const
+/** \brief Sample a point uniformly in the tetrahedron (\e a, \e b, \e c, \e d) by folding the unit cube
+    onto the unit simplex (Rocchini and Cignoni) */
+static Eigen::Vector3d sampleTetrahedron(random_numbers::RandomNumberGenerator& rng, const Eigen::Vector3d& a,
+                                         const Eigen::Vector3d& b, const Eigen::Vector3d& c, const Eigen::Vector3d& d)
 {
-  if (detail::distanceSQR(center_, origin, dir) > radiusBSqr_)
-    return false;
+  double s = rng.uniform01();
+  double t = rng.uniform01();
+  double u = rng.uniform01();
+  if (s + t > 1.0)
+  {
+    s = 1.0 - s;
+    t = 1.0 - t;
+  }
+  if (t + u > 1.0)
+  {
+    const double tmp = u;
+    u = 1.0 - s - t;
+    t = 1.0 - tmp;
+  }
+  else if (s + t + u > 1.0)
+  {
+    const double tmp = u;
+    u = s + t + u - 1.0;
+    s = 1.0 - t - tmp;
+  }
+  return a + (b - a) * s + (c - a) * t + (d - a) * u;
+}
 
-  std::vector<detail::intersc> ipts;
+/** \brief Largest difference between the coefficients of two hull planes that are merged into one */
+static const double PLANE_MERGE_TOLERANCE = 1e-6;
 
-  // intersect bases
-  double tmp = normalH_.dot(dir);
-  if (fabs(tmp) > detail::ZERO)
+/** \brief Finds the hull planes that are equal to within a tolerance. Plane equations are hashed on a grid
+    with cells twice as large as the tolerance, so an equal plane is in the same cell or in the neighbouring
+    cell towards which the plane lies in each coordinate; only those 16 cells are looked up. */
+class PlaneIndex
+{
+public:
+  PlaneIndex(double tolerance) : tolerance_(tolerance), cell_(2.0 * tolerance)
   {
-    double tmp2 = -normalH_.dot(origin);
-    double t1 = (tmp2 - d1_) / tmp;
+  }
 
-    if (t1 > 0.0)
+  /** \brief Return the index in \e planes of a plane equal to \e plane, adding \e plane if there is none */
+  unsigned int insert(const Eigen::Vector4d& plane, EigenSTL::vector_Vector4d& planes)
+  {
+    std::int64_t cell[4];
+    std::int64_t side[4];
+    for (int k = 0; k < 4; ++k)
     {
-      Eigen::Vector3d p1(origin + dir * t1);
-      Eigen::Vector3d v1(p1 - center_);
-      v1 = v1 - normalH_.dot(v1) * normalH_;
-      if (v1.squaredNorm() < radius2_ + detail::ZERO)
-      {
-        if (intersections == NULL)
-          return true;
-
-        detail::intersc ip(p1, t1);
-        ipts.push_back(ip);
-      }
+      const double c = plane[k] / cell_;
+      cell[k] = (std::int64_t)std::floor(c);
+      side[k] = c - cell[k] < 0.5 ? -1 : 1;
     }
-
-    double t2 = (tmp2 - d2_) / tmp;
-    if (t2 > 0.0)
+    for (int neighbour = 0; neighbour < 16; ++neighbour)
     {
-      Eigen::Vector3d p2(origin + dir * t2);
-      Eigen::Vector3d v2(p2 - center_);
-      v2 = v2 - normalH_.dot(v2) * normalH_;
-      if (v2.squaredNorm() < radius2_ + detail::ZERO)
-      {
-        if (intersections == NULL)
-          return true;
-
-        detail::intersc ip(p2, t2);
-        ipts.push_back(ip);
-      }
+      std::int64_t key[4];
+      for (int k = 0; k < 4; ++k)
+        key[k] = cell[k] + (neighbour & (1 << k) ? side[k] : 0);
+      std::unordered_map<std::uint64_t, std::vector<unsigned int> >::const_iterator it = cells_.find(hash(key));
+      if (it == cells_.end())
+        continue;
+      for (std::size_t i = 0; i < it->second.size(); ++i)
+        if ((planes[it->second[i]] - plane).cwiseAbs().maxCoeff() <= tolerance_)
+          return it->second[i];
     }
+    planes.push_back(plane);
+    cells_[hash(cell)].push_back(planes.size() - 1);
+    return planes.size() - 1;
   }
 
-  if (ipts.size() < 2)
+private:
+  static std::uint64_t hash(const std::int64_t key[4])
   {
-    // intersect with infinite cylinder
-    Eigen::Vector3d VD(normalH_.cross(dir));
-    Eigen::Vector3d ROD(normalH_.cross(origin - center_));
-    double a = VD.squaredNorm();
-    double b = 2.0 * ROD.dot(VD);
-    double c = ROD.squaredNorm() - radius2_;
-    double d = b * b - 4.0 * a * c;
-    if (d > 0.0 && fabs(a) > detail::ZERO)
-    {
-      d = sqrt(d);
-      double e = -a * 2.0;
-      double t1 = (b + d) / e;
-      double t2 = (b - d) / e;
-
-      if (t1 > 0.0)
-      {
-        Eigen::Vector3d p1(origin + dir * t1);
-        Eigen::Vector3d v1(center_ - p1);
-
-        if (fabs(normalH_.dot(v1)) < length2_ + detail::ZERO)
-        {
-          if (intersections == NULL)
-            return true;
-
-          detail::intersc ip(p1, t1);
-          ipts.push_back(ip);
-        }
-      }
-
-      if (t2 > 0.0)
-      {
-        Eigen::Vector3d p2(origin + dir * t2);
-        Eigen::Vector3d v2(center_ - p2);
-
-        if (fabs(normalH_.dot(v2)) < length2_ + detail::ZERO)
-        {
-          if (intersections == NULL)
-            return true;
-          detail::intersc ip(p2, t2);
-          ipts.push_back(ip);
-        }
-      }
-    }
+    std::uint64_t h = 0;
+    for (int k = 0; k < 4; ++k)
+      h = (h ^ (std::uint64_t)key[k]) * 0x100000001b3ULL + 0x9e3779b97f4a7c15ULL;
+    return h;
   }
 
-  if (ipts.empty())
-    return false;
+  double tolerance_;
+  double cell_;
+  // cells with colliding hashes share a list; candidates are compared with the tolerance anyway
+  std::unordered_map<std::uint64_t, std::vector<unsigned int> > cells_;
+};
 
-  std::sort(ipts.begin(), ipts.end(), detail::interscOrder());
-  const unsigned int n = count > 0 ? std::min<unsigned int>(count, ipts.size()) : ipts.size();
-  for (unsigned int i = 0; i < n; ++i)
-    intersections->push_back(ipts[i].pt);
+/** \brief Maximum number of hull faces (the largest ones) tried as orientations of the bounding box of a mesh */
+static const std::size_t BOUNDING_BOX_MAX_FACES = 64;
 
-  return true;
+/** \brief Fit a box with axes \e axes around \e vertices; returns the volume of the box */
+static double boxAlongAxes(const EigenSTL::vector_Vector3d& vertices, const Eigen::Matrix3d& axes,
+                           Eigen::Vector3d& center, Eigen::Vector3d& size)
+{
+  Eigen::Vector3d min = Eigen::Vector3d::Constant(std::numeric_limits<double>::infinity());
+  Eigen::Vector3d max = -min;
+  for (std::size_t i = 0; i < vertices.size(); ++i)
+  {
+    const Eigen::Vector3d p = axes.transpose() * vertices[i];
+    min = min.cwiseMin(p);
+    max = max.cwiseMax(p);
+  }
+  size = max - min;
+  center = axes * ((min + max) / 2.0);
+  return size.prod();
 }
 
-bool bodies::Box::samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int /* max_attempts */,
-                                    Eigen::Vector3d& result)
+/** \brief The z component of the cross product of two vectors in the plane */
+static inline double cross2d(const Eigen::Vector2d& a, const Eigen::Vector2d& b)
 {
-  result = pose_ * Eigen::Vector3d(rng.uniformReal(-length2_, length2_), rng.uniformReal(-width2_, width2_),
-                                   rng.uniformReal(-height2_, height2_));
-  return true;
+  return a.x() * b.y() - a.y() * b.x();
 }
 
-bool bodies::Box::containsPoint(const Eigen::Vector3d& p, bool verbose) const
+/** \brief The direction of one side of the smallest rectangle that contains the planar points \e p. One side
+    of that rectangle is an edge of the convex hull of the points, so only those are tried. */
+static Eigen::Vector2d
+minimumAreaRectangleAxis(std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > p)
 {
-  Eigen::Vector3d v = p - center_;
-  double pL = v.dot(normalL_);
-  if (fabs(pL) > length2_)
+  // Andrew's monotone chain
+  std::sort(p.begin(), p.end(), [](const Eigen::Vector2d& a, const Eigen::Vector2d& b) {
+    return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+  });
+  std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > hull(2 * p.size() + 1);
+  std::size_t k = 0;
+  for (std::size_t i = 0; i < p.size(); ++i)
+  {
+    while (k >= 2 && cross2d(hull[k - 1] - hull[k - 2], p[i] - hull[k - 2]) <= 0.0)
+      --k;
+    hull[k++] = p[i];
+  }
+  for (std::size_t i = p.size() - 1, t = k + 1; i-- > 0;)
+  {
+    while (k >= t && cross2d(hull[k - 1] - hull[k - 2], p[i] - hull[k - 2]) <= 0.0)
+      --k;
+    hull[k++] = p[i];
+  }
+
+  Eigen::Vector2d best_axis(1.0, 0.0);
+  double best_area = std::numeric_limits<double>::infinity();
+  for (std::size_t i = 0; i + 1 < k; ++i)
+  {
+    Eigen::Vector2d e = hull[i + 1] - hull[i];
+    const double l = e.norm();
+    if (l < ZERO)
+      continue;
+    e /= l;
+    double min_e = std::numeric_limits<double>::infinity(), max_e = -min_e, min_n = min_e, max_n = -min_e;
+    for (std::size_t j = 0; j + 1 < k; ++j)
+    {
+      const double pe = e.dot(hull[j]);
+      const double pn = cross2d(e, hull[j]);
+      min_e = std::min(min_e, pe);
+      max_e = std::max(max_e, pe);
+      min_n = std::min(min_n, pn);
+      max_n = std::max(max_n, pn);
+    }
+    const double area = (max_e - min_e) * (max_n - min_n);
+    if (area < best_area)
+    {
+      best_area = area;
+      best_axis = e;
+    }
+  }
+  return best_axis;
+}
+
+/** \brief Compute a small oriented box around \e vertices. The boxes along the coordinate axes, along the
+    principal axes of the vertices and flush with each of the faces with normals \e normals (the side
+    directions within the face come from the smallest enclosing rectangle of the projected vertices) are
+    tried, and the one with the smallest volume is kept. */
+static void computeOrientedBoundingBox(const EigenSTL::vector_Vector3d& vertices,
+                                       const EigenSTL::vector_Vector3d& normals, Eigen::Matrix3d& axes,
+                                       Eigen::Vector3d& center, Eigen::Vector3d& size)
+{
+  axes.setIdentity();
+  double best = boxAlongAxes(vertices, axes, center, size);
+  if (vertices.size() < 2)
+    return;
+
+  Eigen::Vector3d mean(0.0, 0.0, 0.0);
+  for (std::size_t i = 0; i < vertices.size(); ++i)
+    mean += vertices[i];
+  mean /= (double)vertices.size();
+  Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+  for (std::size_t i = 0; i < vertices.size(); ++i)
+    covariance += (vertices[i] - mean) * (vertices[i] - mean).transpose();
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+  Eigen::Matrix3d candidate = solver.eigenvectors();
+  if (candidate.determinant() < 0.0)
+    candidate.col(0) = -candidate.col(0);
+
+  Eigen::Vector3d candidate_center, candidate_size;
+  double volume = boxAlongAxes(vertices, candidate, candidate_center, candidate_size);
+  if (volume < best)
+  {
+    best = volume;
+    axes = candidate;
+    center = candidate_center;
+    size = candidate_size;
+  }
+
+  std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > projected(vertices.size());
+  for (std::size_t i = 0; i < normals.size(); ++i)
+  {
+    const Eigen::Vector3d n = normals[i].normalized();
+    const Eigen::Vector3d u = n.unitOrthogonal();
+    const Eigen::Vector3d v = n.cross(u);
+    for (std::size_t j = 0; j < vertices.size(); ++j)
+      projected[j] = Eigen::Vector2d(u.dot(vertices[j]), v.dot(vertices[j]));
+    const Eigen::Vector2d e = minimumAreaRectangleAxis(projected);
+    candidate.col(0) = u * e.x() + v * e.y();
+    candidate.col(1) = n.cross(candidate.col(0));
+    candidate.col(2) = n;
+    volume = boxAlongAxes(vertices, candidate, candidate_center, candidate_size);
+    if (volume < best)
+    {
+      best = volume;
+      axes = candidate;
+      center = candidate_center;
+      size = candidate_size;
+    }
+  }
+}
+
+/** \brief Fit the smallest cylinder with its axis along \e axis around \e vertices; returns the volume of the
+    cylinder */
+static double cylinderAlongAxis(const EigenSTL::vector_Vector3d& vertices, const Eigen::Vector3d& axis,
+                                BoundingCylinder& cylinder)
+{
+  const Eigen::Matrix3d rotation =
+      Eigen::Quaterniond::FromTwoVectors(Eigen::Vector3d::UnitZ(), axis).toRotationMatrix();
+  EigenSTL::vector_Vector3d projected(vertices.size());
+  double min = std::numeric_limits<double>::infinity(), max = -min;
+  for (std::size_t i = 0; i < vertices.size(); ++i)
+  {
+    const Eigen::Vector3d p = rotation.transpose() * vertices[i];
+    min = std::min(min, p.z());
+    max = std::max(max, p.z());
+    projected[i] = Eigen::Vector3d(p.x(), p.y(), 0.0);
+  }
+  Eigen::Vector3d center;
+  shapes::computeMinimumBoundingSphere(projected, center, cylinder.radius);
+  cylinder.length = max - min;
+  cylinder.pose = Eigen::Affine3d::Identity();
+  cylinder.pose.linear() = rotation;
+  cylinder.pose.translation() = rotation * Eigen::Vector3d(center.x(), center.y(), (min + max) / 2.0);
+  return boost::math::constants::pi<double>() * cylinder.radius * cylinder.radius * cylinder.length;
+}
+
+/** \brief Compute a small cylinder around \e vertices: the cylinders along the principal axes of the vertices
+    and along the axes \e axes of their bounding box are tried, and the one with the smallest volume is kept */
+static void computeBoundingCylinder(const EigenSTL::vector_Vector3d& vertices, const Eigen::Matrix3d& axes,
+                                    BoundingCylinder& cylinder)
+{
+  Eigen::Vector3d mean(0.0, 0.0, 0.0);
+  for (std::size_t i = 0; i < vertices.size(); ++i)
+    mean += vertices[i];
+  mean /= (double)vertices.size();
+  Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+  for (std::size_t i = 0; i < vertices.size(); ++i)
+    covariance += (vertices[i] - mean) * (vertices[i] - mean).transpose();
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+
+  double best = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < 6; ++i)
+  {
+    BoundingCylinder candidate;
+    // the principal axis with the largest variance first, so it wins ties
+    const double volume = cylinderAlongAxis(vertices, i < 3 ? solver.eigenvectors().col(2 - i) : axes.col(i - 3),
+                                            candidate);
+    if (volume < best)
+    {
+      best = volume;
+      cylinder = candidate;
+    }
+  }
+}
+
+/** \brief The plane with normal \e normal that supports \e vertices, with them behind it */
+static Eigen::Vector4d supportPlane(const Eigen::Vector3d& normal, const EigenSTL::vector_Vector3d& vertices)
+{
+  double support = -std::numeric_limits<double>::infinity();
+  for (std::size_t i = 0; i < vertices.size(); ++i)
+    support = std::max(support, normal.dot(vertices[i]));
+  return Eigen::Vector4d(normal.x(), normal.y(), normal.z(), -support);
+}
+
+/** \brief Add to \e corners the points where plane \e a meets two of \e planes (with indices below \e a) and
+    that are behind all of \e planes, up to \e tolerance; points closer than \e tolerance to a corner are
+    not added again */
+static void addPolytopeCorners(const EigenSTL::vector_Vector4d& planes, std::size_t a, double tolerance,
+                               EigenSTL::vector_Vector3d& corners)
+{
+  Eigen::Matrix3d m;
+  m.row(0) = planes[a].head<3>();
+  for (std::size_t b = 0; b < a; ++b)
+  {
+    m.row(1) = planes[b].head<3>();
+    for (std::size_t c = 0; c < b; ++c)
+    {
+      m.row(2) = planes[c].head<3>();
+      if (std::fabs(m.determinant()) < ZERO)
+        continue;
+      const Eigen::Vector3d p = m.inverse() * -Eigen::Vector3d(planes[a].w(), planes[b].w(), planes[c].w());
+      bool inside = true;
+      for (std::size_t i = 0; i < planes.size() && inside; ++i)
+        inside = planes[i].head<3>().dot(p) + planes[i].w() <= tolerance;
+      for (std::size_t i = 0; i < corners.size() && inside; ++i)
+        inside = (corners[i] - p).squaredNorm() > tolerance * tolerance;
+      if (inside)
+        corners.push_back(p);
+    }
+  }
+}
+
+/** \brief The distance from \e p to the convex polytope with the triangles \e triangles and planes \e planes */
+static double distanceToPolytope(const Eigen::Vector3d& p, const EigenSTL::vector_Vector3d& vertices,
+                                 const std::vector<unsigned int>& triangles, const EigenSTL::vector_Vector4d& planes)
+{
+  bool inside = true;
+  for (std::size_t i = 0; i < planes.size() && inside; ++i)
+    inside = planes[i].head<3>().dot(p) + planes[i].w() <= 0.0;
+  if (inside)
+    return 0.0;
+  double distance = std::numeric_limits<double>::infinity();
+  for (std::size_t i = 0; i < triangles.size(); i += 3)
+    distance = std::min(distance, (p - closestPointOnTriangle(p, vertices[triangles[i]], vertices[triangles[i + 1]],
+                                                              vertices[triangles[i + 2]]))
+                                      .norm());
+  return distance;
+}
+
+/** \brief A packet of BATCH_SIZE rays in structure-of-arrays form */
+struct RayPacket
+{
+  BatchArray ox, oy, oz;
+  BatchArray dx, dy, dz;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/** \brief Fill \e packet with the \e n (at most BATCH_SIZE) rays; unused lanes repeat the last ray */
+static inline void loadRayPacket(const double* ox, const double* oy, const double* oz, const double* dx,
+                                 const double* dy, const double* dz, std::size_t n, RayPacket& packet)
+{
+  if (n == (std::size_t)BATCH_SIZE)
+  {
+    packet.ox = Eigen::Map<const BatchArray>(ox);
+    packet.oy = Eigen::Map<const BatchArray>(oy);
+    packet.oz = Eigen::Map<const BatchArray>(oz);
+    packet.dx = Eigen::Map<const BatchArray>(dx);
+    packet.dy = Eigen::Map<const BatchArray>(dy);
+    packet.dz = Eigen::Map<const BatchArray>(dz);
+    return;
+  }
+  for (std::size_t k = 0; k < (std::size_t)BATCH_SIZE; ++k)
+  {
+    const std::size_t i = k < n ? k : n - 1;
+    packet.ox[k] = ox[i];
+    packet.oy[k] = oy[i];
+    packet.oz[k] = oz[i];
+    packet.dx[k] = dx[i];
+    packet.dy[k] = dy[i];
+    packet.dz[k] = dz[i];
+  }
+}
+
+static inline BatchArray infinityBatch()
+{
+  return BatchArray::Constant(std::numeric_limits<double>::infinity());
+}
+
+/** \brief Split \e n rays into structure-of-arrays form, \e RAY_BLOCK_SIZE at a time, and call
+    \e f(start, count, ox, oy, oz, dx, dy, dz) for each block */
+template <typename F>
+static void forEachRayBlock(const Eigen::Vector3d* origins, const Eigen::Vector3d* dirs, std::size_t n, const F& f)
+{
+  double ox[RAY_BLOCK_SIZE], oy[RAY_BLOCK_SIZE], oz[RAY_BLOCK_SIZE];
+  double dx[RAY_BLOCK_SIZE], dy[RAY_BLOCK_SIZE], dz[RAY_BLOCK_SIZE];
+  for (std::size_t start = 0; start < n; start += RAY_BLOCK_SIZE)
+  {
+    const std::size_t count = std::min(RAY_BLOCK_SIZE, n - start);
+    for (std::size_t k = 0; k < count; ++k)
+    {
+      ox[k] = origins[start + k].x();
+      oy[k] = origins[start + k].y();
+      oz[k] = origins[start + k].z();
+      dx[k] = dirs[start + k].x();
+      dy[k] = dirs[start + k].y();
+      dz[k] = dirs[start + k].z();
+    }
+    f(start, count, ox, oy, oz, dx, dy, dz);
+  }
+}
+
+/** \brief Ray \e k of \e packet as a single Ray query */
+static inline Ray packetRay(const RayPacket& packet, int k)
+{
+  return Ray(Eigen::Vector3d(packet.ox[k], packet.oy[k], packet.oz[k]),
+             Eigen::Vector3d(packet.dx[k], packet.dy[k], packet.dz[k]));
+}
+
+/** \brief The rays of a packet as single Ray queries, which normalize the directions and invert them once */
+struct PacketRays
+{
+  explicit PacketRays(const RayPacket& packet)
+    : rays{ packetRay(packet, 0), packetRay(packet, 1), packetRay(packet, 2), packetRay(packet, 3),
+            packetRay(packet, 4), packetRay(packet, 5), packetRay(packet, 6), packetRay(packet, 7) }
+  {
+    static_assert(BATCH_SIZE == 8, "one ray is listed for each lane");
+  }
+
+  const Ray rays[BATCH_SIZE];
+};
+
+/** \brief Intersect the rays of \e packet, also given as \e rays, with \e body, which has the index \e index
+    and the bounding sphere \e sphere. The whole packet is tested against the sphere at once; rays that reach
+    the sphere before their best hit \e best[k] are then intersected one at a time, with the same code as
+    single ray queries. \e best[k] and \e best_index[k] are updated for nearer hits, and for hits at the same
+    distance on a body with a lower index. */
+static inline void intersectPacket(const Body& body, std::size_t index, const BoundingSphere& sphere,
+                                   const RayPacket& packet, const PacketRays& rays, double* best,
+                                   std::size_t* best_index)
+{
+  const double radius2 = sphere.radius * sphere.radius;
+  const BatchArray ax = sphere.center.x() - packet.ox;
+  const BatchArray ay = sphere.center.y() - packet.oy;
+  const BatchArray az = sphere.center.z() - packet.oz;
+  const BatchArray along = ax * packet.dx + ay * packet.dy + az * packet.dz;
+  const BatchArray distance2 = ax * ax + ay * ay + az * az - along * along;
+  if (distance2.minCoeff() > radius2)
+    return;
+
+  for (int k = 0; k < BATCH_SIZE; ++k)
+  {
+    if (distance2[k] > radius2 || along[k] - sqrt(radius2 - distance2[k]) > best[k])
+      continue;
+    Hit hit;
+    if (body.intersect(rays.rays[k], hit) && hit.count > 0 &&
+        (hit.t[0] < best[k] || (hit.t[0] == best[k] && index < best_index[k])))
+    {
+      best[k] = hit.t[0];
+      best_index[k] = index;
+    }
+  }
+}
+}
+}
+
+void bodies::Body::setDimensions(const shapes::Shape* shape)
+{
+  useDimensions(shape);
+  updateInternalData();
+}
+
+void bodies::Body::containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                  uint8_t* mask) const
+{
+  for (std::size_t i = 0; i < n; ++i)
+    mask[i] = containsPoint(Eigen::Vector3d(xs[i], ys[i], zs[i])) ? 1 : 0;
+}
+
+void bodies::Body::containsPoints(const Eigen::Matrix3Xd& points, uint8_t* mask) const
+{
+  // Matrix3Xd stores the coordinates interleaved; split them into small blocks on the stack
+  static const std::size_t CHUNK = 256;
+  double xs[CHUNK], ys[CHUNK], zs[CHUNK];
+  const std::size_t n = points.cols();
+  for (std::size_t start = 0; start < n; start += CHUNK)
+  {
+    const std::size_t count = std::min(CHUNK, n - start);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      xs[i] = points(0, start + i);
+      ys[i] = points(1, start + i);
+      zs[i] = points(2, start + i);
+    }
+    containsPoints(xs, ys, zs, count, mask + start);
+  }
+}
+
+void bodies::Body::intersectsRays(const double* ox, const double* oy, const double* oz, const double* dx,
+                                  const double* dy, const double* dz, std::size_t n, double* out_t) const
+{
+  BoundingSphere sphere;
+  computeBoundingSphere(sphere);
+  detail::RayPacket packet;
+  for (std::size_t i = 0; i < n; i += detail::BATCH_SIZE)
+  {
+    const std::size_t count = std::min<std::size_t>(detail::BATCH_SIZE, n - i);
+    detail::loadRayPacket(ox + i, oy + i, oz + i, dx + i, dy + i, dz + i, count, packet);
+    const detail::PacketRays rays(packet);
+    double best[detail::BATCH_SIZE];
+    std::size_t index[detail::BATCH_SIZE];
+    std::fill(best, best + detail::BATCH_SIZE, std::numeric_limits<double>::infinity());
+    std::fill(index, index + detail::BATCH_SIZE, 0);
+    detail::intersectPacket(*this, 0, sphere, packet, rays, best, index);
+    std::copy(best, best + count, out_t + i);
+  }
+}
+
+bool bodies::Body::intersect(const Ray& ray, Hit& hit) const
+{
+  // the buffer keeps its capacity, so that after the first calls the points fit without allocating
+  static thread_local EigenSTL::vector_Vector3d points;
+  points.clear();
+  hit.count = 0;
+  hit.inside = false;
+  if (!intersectsRay(ray.origin, ray.dir, &points))
     return false;
+  // the surface is closed, so the ray starts inside when it crosses it an odd number of times after that
+  std::size_t crossings = 0;
+  for (std::size_t i = 0; i < points.size(); ++i)
+  {
+    const double t = (points[i] - ray.origin).dot(ray.dir);
+    if (t <= ray.tmin)
+      continue;
+    ++crossings;
+    if (t <= ray.tmax && hit.count < Hit::MAX_POINTS)
+      hit.t[hit.count++] = t;
+  }
+  hit.inside = crossings % 2 == 1;
+  return hit.count > 0 || hit.inside;
+}
 
-  double pW = v.dot(normalW_);
-  if (fabs(pW) > width2_)
+Eigen::Vector3d bodies::Body::computeSurfaceNormal(const Eigen::Vector3d& p) const
+{
+  BoundingSphere sphere;
+  computeBoundingSphere(sphere);
+  const double h = 1e-6 * std::max(1.0, sphere.radius);
+  Eigen::Vector3d gradient;
+  for (int k = 0; k < 3; ++k)
+  {
+    Eigen::Vector3d step(Eigen::Vector3d::Zero());
+    step[k] = h;
+    gradient[k] = computeSignedDistance(p + step) - computeSignedDistance(p - step);
+  }
+  const double norm = gradient.norm();
+  return norm > 0.0 ? Eigen::Vector3d(gradient / norm) : Eigen::Vector3d(Eigen::Vector3d::Zero());
+}
+
+void bodies::Body::intersectsRays(const Eigen::Vector3d* origins, const Eigen::Vector3d* dirs, std::size_t n,
+                                  double* out_t) const
+{
+  detail::forEachRayBlock(origins, dirs, n,
+                          [this, out_t](std::size_t start, std::size_t count, const double* ox, const double* oy,
+                                        const double* oz, const double* dx, const double* dy, const double* dz) {
+                            intersectsRays(ox, oy, oz, dx, dy, dz, count, out_t + start);
+                          });
+}
+
+void bodies::Body::computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                          double* out) const
+{
+  for (std::size_t i = 0; i < n; ++i)
+    out[i] = computeSignedDistance(Eigen::Vector3d(xs[i], ys[i], zs[i]));
+}
+
+bool bodies::Body::samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
+                                     Eigen::Vector3d& result)
+{
+  BoundingSphere bs;
+  computeBoundingSphere(bs);
+  for (unsigned int i = 0; i < max_attempts; ++i)
+  {
+    result = Eigen::Vector3d(rng.uniformReal(bs.center.x() - bs.radius, bs.center.x() + bs.radius),
+                             rng.uniformReal(bs.center.y() - bs.radius, bs.center.y() + bs.radius),
+                             rng.uniformReal(bs.center.z() - bs.radius, bs.center.z() + bs.radius));
+    if (containsPoint(result))
+      return true;
+  }
+  return false;
+}
+
+std::size_t bodies::Body::samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                             Eigen::Vector3d* result, unsigned int max_attempts)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    if (!samplePointInside(rng, max_attempts, result[i]))
+      return i;
+  return n;
+}
+
+bool bodies::Sphere::containsPoint(const Eigen::Vector3d& p, bool verbose) const
+{
+  return (center_ - p).squaredNorm() < radius2_;
+}
+
+void bodies::Sphere::containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                    uint8_t* mask) const
+{
+  detail::SphereKernel kernel;
+  kernel.cx = center_.x();
+  kernel.cy = center_.y();
+  kernel.cz = center_.z();
+  kernel.radius2 = radius2_;
+  detail::containsPointsBatched(kernel, xs, ys, zs, n, mask);
+}
+
+void bodies::Sphere::useDimensions(const shapes::Shape* shape)  // radius
+{
+  radius_ = static_cast<const shapes::Sphere*>(shape)->radius;
+}
+
+std::vector<double> bodies::Sphere::getDimensions() const
+{
+  std::vector<double> d(1, radius_);
+  return d;
+}
+
+void bodies::Sphere::updateInternalData()
+{
+  radiusU_ = radius_ * scale_ + padding_;
+  radius2_ = radiusU_ * radiusU_;
+  center_ = pose_.translation();
+}
+
+std::shared_ptr<bodies::Body> bodies::Sphere::cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const
+{
+  Sphere* s = new Sphere();
+  s->radius_ = radius_;
+  s->padding_ = padding;
+  s->scale_ = scale;
+  s->pose_ = pose;
+  s->updateInternalData();
+  return std::shared_ptr<Body>(s);
+}
+
+double bodies::Sphere::computeVolume() const
+{
+  return 4.0 * boost::math::constants::pi<double>() * radiusU_ * radiusU_ * radiusU_ / 3.0;
+}
+
+void bodies::Sphere::computeBoundingSphere(BoundingSphere& sphere) const
+{
+  sphere.center = center_;
+  sphere.radius = radiusU_;
+}
+
+void bodies::Sphere::computeBoundingCylinder(BoundingCylinder& cylinder) const
+{
+  cylinder.pose = pose_;
+  cylinder.radius = radiusU_;
+  cylinder.length = radiusU_;
+}
+
+bool bodies::Sphere::samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int /* max_attempts */,
+                                       Eigen::Vector3d& result)
+{
+  // a uniformly distributed direction and a radius distributed so that every shell gets its share of volume
+  Eigen::Vector3d dir(rng.gaussian01(), rng.gaussian01(), rng.gaussian01());
+  const double norm = dir.norm();
+  if (norm < detail::ZERO)
+    dir = Eigen::Vector3d::UnitX();
+  else
+    dir /= norm;
+  result = center_ + dir * (radiusU_ * std::cbrt(rng.uniform01()));
+  return true;
+}
+
+std::size_t bodies::Sphere::samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                               Eigen::Vector3d* result, unsigned int max_attempts)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    Sphere::samplePointInside(rng, max_attempts, result[i]);
+  return n;
+}
+
+bool bodies::Sphere::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                                   EigenSTL::vector_Vector3d* intersections, unsigned int count) const
+{
+  const Ray ray(origin, dir);
+  Hit hit;
+  if (!intersect(ray, hit))
+    return false;
+  detail::appendHits(ray, hit, intersections, count);
+  return true;
+}
+
+bool bodies::Sphere::intersect(const Ray& ray, Hit& hit) const
+{
+  hit.count = 0;
+  const Eigen::Vector3d cp = ray.origin - center_;
+  const double b = cp.dot(ray.dir);
+  const double x = radius2_ - (cp.squaredNorm() - b * b);
+  if (x <= -detail::ZERO)
     return false;
+  // a ray that only touches the sphere gives a single point
+  const double s = x < detail::ZERO ? 0.0 : sqrt(x);
+  return detail::clipHit(ray, -b - s, -b + s, hit);
+}
+
+double bodies::Sphere::computeSignedDistance(const Eigen::Vector3d& p) const
+{
+  return (p - center_).norm() - radiusU_;
+}
+
+void bodies::Sphere::computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                            double* out) const
+{
+  detail::SphereDistanceKernel kernel;
+  kernel.cx = center_.x();
+  kernel.cy = center_.y();
+  kernel.cz = center_.z();
+  kernel.radius = radiusU_;
+  detail::signedDistancesBatched(kernel, xs, ys, zs, n, out);
+}
 
+Eigen::Vector3d bodies::Sphere::computeSupportPoint(const Eigen::Vector3d& dir) const
+{
+  const double norm = dir.norm();
+  return norm > detail::ZERO ? Eigen::Vector3d(center_ + dir * (radiusU_ / norm)) : center_;
+}
+
+Eigen::Vector3d bodies::Sphere::computeSurfaceNormal(const Eigen::Vector3d& p) const
+{
+  const Eigen::Vector3d d = p - center_;
+  const double norm = d.norm();
+  return norm > detail::ZERO ? Eigen::Vector3d(d / norm) : Eigen::Vector3d(Eigen::Vector3d::UnitZ());
+}
+
+bool bodies::Cylinder::containsPoint(const Eigen::Vector3d& p, bool verbose) const
+{
+  Eigen::Vector3d v = p - center_;
   double pH = v.dot(normalH_);
-  if (fabs(pH) > height2_)
+
+  if (fabs(pH) > length2_)
     return false;
 
-  return true;
+  double pB1 = v.dot(normalB1_);
+  double remaining = radius2_ - pB1 * pB1;
+
+  if (remaining < 0.0)
+    return false;
+  else
+  {
+    double pB2 = v.dot(normalB2_);
+    return pB2 * pB2 < remaining;
+  }
+}
+
+void bodies::Cylinder::containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                      uint8_t* mask) const
+{
+  detail::CylinderKernel kernel;
+  kernel.center = center_;
+  kernel.normalH = normalH_;
+  kernel.normalB1 = normalB1_;
+  kernel.normalB2 = normalB2_;
+  kernel.length2 = length2_;
+  kernel.radius2 = radius2_;
+  detail::containsPointsBatched(kernel, xs, ys, zs, n, mask);
+}
+
+void bodies::Cylinder::useDimensions(const shapes::Shape* shape)  // (length, radius)
+{
+  length_ = static_cast<const shapes::Cylinder*>(shape)->length;
+  radius_ = static_cast<const shapes::Cylinder*>(shape)->radius;
+}
+
+std::vector<double> bodies::Cylinder::getDimensions() const
+{
+  std::vector<double> d(2);
+  d[0] = radius_;
+  d[1] = length_;
+  return d;
+}
+
+void bodies::Cylinder::updateInternalData()
+{
+  radiusU_ = radius_ * scale_ + padding_;
+  radius2_ = radiusU_ * radiusU_;
+  length2_ = scale_ * length_ / 2.0 + padding_;
+  center_ = pose_.translation();
+  radiusBSqr_ = length2_ * length2_ + radius2_;
+  radiusB_ = sqrt(radiusBSqr_);
+
+  Eigen::Matrix3d basis = pose_.rotation();
+  normalB1_ = basis.col(0);
+  normalB2_ = basis.col(1);
+  normalH_ = basis.col(2);
+
+  double tmp = -normalH_.dot(center_);
+  d1_ = tmp + length2_;
+  d2_ = tmp - length2_;
+}
+
+bool bodies::Cylinder::samplePointInside(random_numbers::RandomNumberGenerator& rng,
+                                         unsigned int /* max_attempts */, Eigen::Vector3d& result)
+{
+  // sample a point on the base disc of the cylinder; the square root of the radius keeps the density
+  // uniform over the area of the disc
+  const double a = rng.uniformReal(-boost::math::constants::pi<double>(), boost::math::constants::pi<double>());
+  const double r = radiusU_ * std::sqrt(rng.uniform01());
+
+  // sample a height
+  const double z = rng.uniformReal(-length2_, length2_);
+
+  result = center_ + normalB1_ * (cos(a) * r) + normalB2_ * (sin(a) * r) + normalH_ * z;
+  return true;
+}
+
+std::size_t bodies::Cylinder::samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                                 Eigen::Vector3d* result, unsigned int max_attempts)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    Cylinder::samplePointInside(rng, max_attempts, result[i]);
+  return n;
+}
+
+std::shared_ptr<bodies::Body> bodies::Cylinder::cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const
+{
+  Cylinder* c = new Cylinder();
+  c->length_ = length_;
+  c->radius_ = radius_;
+  c->padding_ = padding;
+  c->scale_ = scale;
+  c->pose_ = pose;
+  c->updateInternalData();
+  return std::shared_ptr<Body>(c);
+}
+
+double bodies::Cylinder::computeVolume() const
+{
+  return 2.0 * boost::math::constants::pi<double>() * radius2_ * length2_;
+}
+
+void bodies::Cylinder::computeBoundingSphere(BoundingSphere& sphere) const
+{
+  sphere.center = center_;
+  sphere.radius = radiusB_;
+}
+
+void bodies::Cylinder::computeBoundingCylinder(BoundingCylinder& cylinder) const
+{
+  cylinder.pose = pose_;
+  cylinder.radius = radiusU_;
+  cylinder.length = scale_ * length_ + padding_;
+}
+
+bool bodies::Cylinder::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                                     EigenSTL::vector_Vector3d* intersections, unsigned int count) const
+{
+  const Ray ray(origin, dir);
+  Hit hit;
+  if (!intersect(ray, hit))
+    return false;
+  detail::appendHits(ray, hit, intersections, count);
+  return true;
+}
+
+bool bodies::Cylinder::intersect(const Ray& ray, Hit& hit) const
+{
+  hit.count = 0;
+  if (detail::distanceSQR(center_, ray) > radiusBSqr_)
+    return false;
+
+  // the part of the line between the planes of the bases
+  const Eigen::Vector3d v = ray.origin - center_;
+  const double a = normalH_.dot(ray.dir);
+  const double o = normalH_.dot(v);
+  double tenter = -std::numeric_limits<double>::infinity();
+  double texit = std::numeric_limits<double>::infinity();
+  if (fabs(a) > detail::ZERO)
+  {
+    const double t1 = (-length2_ - o) / a;
+    const double t2 = (length2_ - o) / a;
+    tenter = std::min(t1, t2);
+    texit = std::max(t1, t2);
+  }
+  else if (fabs(o) > length2_)
+    return false;
+
+  // and inside the infinite cylinder
+  const Eigen::Vector3d vd = normalH_.cross(ray.dir);
+  const Eigen::Vector3d rod = normalH_.cross(v);
+  const double qa = vd.squaredNorm();
+  const double qb = rod.dot(vd);
+  const double qc = rod.squaredNorm() - radius2_;
+  if (qa > detail::ZERO)
+  {
+    const double d = qb * qb - qa * qc;
+    if (d < 0.0)
+      return false;
+    const double s = sqrt(d);
+    tenter = std::max(tenter, (-qb - s) / qa);
+    texit = std::min(texit, (-qb + s) / qa);
+  }
+  else if (qc > 0.0)
+    return false;
+
+  return detail::clipHit(ray, tenter, texit, hit);
+}
+
+double bodies::Cylinder::computeSignedDistance(const Eigen::Vector3d& p) const
+{
+  double d;
+  computeSignedDistances(&p.x(), &p.y(), &p.z(), 1, &d);
+  return d;
+}
+
+void bodies::Cylinder::computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                              double* out) const
+{
+  detail::CylinderDistanceKernel kernel;
+  kernel.center = center_;
+  kernel.normalH = normalH_;
+  kernel.normalB1 = normalB1_;
+  kernel.normalB2 = normalB2_;
+  kernel.length2 = length2_;
+  kernel.radius = radiusU_;
+  detail::signedDistancesBatched(kernel, xs, ys, zs, n, out);
+}
+
+Eigen::Vector3d bodies::Cylinder::computeSupportPoint(const Eigen::Vector3d& dir) const
+{
+  const double h = dir.dot(normalH_);
+  Eigen::Vector3d result = center_ + normalH_ * (h < 0.0 ? -length2_ : length2_);
+  const Eigen::Vector3d radial = dir - normalH_ * h;
+  const double norm = radial.norm();
+  if (norm > detail::ZERO)
+    result += radial * (radiusU_ / norm);
+  return result;
+}
+
+Eigen::Vector3d bodies::Cylinder::computeSurfaceNormal(const Eigen::Vector3d& p) const
+{
+  // the normal of the cap or of the side, whichever p is closer to, as for the signed distance
+  const Eigen::Vector3d v = p - center_;
+  const double h = v.dot(normalH_);
+  const Eigen::Vector3d radial = v - normalH_ * h;
+  const double r = radial.norm();
+  if (fabs(h) - length2_ > r - radiusU_ || r <= detail::ZERO)
+    return h < 0.0 ? Eigen::Vector3d(-normalH_) : normalH_;
+  return radial / r;
+}
+
+bool bodies::Box::samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int /* max_attempts */,
+                                    Eigen::Vector3d& result)
+{
+  result = pose_ * Eigen::Vector3d(rng.uniformReal(-length2_, length2_), rng.uniformReal(-width2_, width2_),
+                                   rng.uniformReal(-height2_, height2_));
+  return true;
+}
+
+std::size_t bodies::Box::samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                            Eigen::Vector3d* result, unsigned int max_attempts)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    Box::samplePointInside(rng, max_attempts, result[i]);
+  return n;
+}
+
+bool bodies::Box::containsPoint(const Eigen::Vector3d& p, bool verbose) const
+{
+  Eigen::Vector3d v = p - center_;
+  double pL = v.dot(normalL_);
+  if (fabs(pL) > length2_)
+    return false;
+
+  double pW = v.dot(normalW_);
+  if (fabs(pW) > width2_)
+    return false;
+
+  double pH = v.dot(normalH_);
+  if (fabs(pH) > height2_)
+    return false;
+
+  return true;
+}
+
+void bodies::Box::containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                 uint8_t* mask) const
+{
+  detail::BoxKernel kernel;
+  kernel.center = center_;
+  kernel.normalL = normalL_;
+  kernel.normalW = normalW_;
+  kernel.normalH = normalH_;
+  kernel.length2 = length2_;
+  kernel.width2 = width2_;
+  kernel.height2 = height2_;
+  detail::containsPointsBatched(kernel, xs, ys, zs, n, mask);
+}
+
+void bodies::Box::useDimensions(const shapes::Shape* shape)  // (x, y, z) = (length, width, height)
+{
+  const double* size = static_cast<const shapes::Box*>(shape)->size;
+  length_ = size[0];
+  width_ = size[1];
+  height_ = size[2];
+}
+
+std::vector<double> bodies::Box::getDimensions() const
+{
+  std::vector<double> d(3);
+  d[0] = length_;
+  d[1] = width_;
+  d[2] = height_;
+  return d;
+}
+
+void bodies::Box::updateInternalData()
+{
+  double s2 = scale_ / 2.0;
+  length2_ = length_ * s2 + padding_;
+  width2_ = width_ * s2 + padding_;
+  height2_ = height_ * s2 + padding_;
+
+  center_ = pose_.translation();
+
+  radius2_ = length2_ * length2_ + width2_ * width2_ + height2_ * height2_;
+  radiusB_ = sqrt(radius2_);
+
+  Eigen::Matrix3d basis = pose_.rotation();
+  normalL_ = basis.col(0);
+  normalW_ = basis.col(1);
+  normalH_ = basis.col(2);
+
+  const Eigen::Vector3d tmp(normalL_ * length2_ + normalW_ * width2_ + normalH_ * height2_);
+  corner1_ = center_ - tmp;
+  corner2_ = center_ + tmp;
+}
+
+std::shared_ptr<bodies::Body> bodies::Box::cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const
+{
+  Box* b = new Box();
+  b->length_ = length_;
+  b->width_ = width_;
+  b->height_ = height_;
+  b->padding_ = padding;
+  b->scale_ = scale;
+  b->pose_ = pose;
+  b->updateInternalData();
+  return std::shared_ptr<Body>(b);
+}
+
+double bodies::Box::computeVolume() const
+{
+  return 8.0 * length2_ * width2_ * height2_;
+}
+
+void bodies::Box::computeBoundingSphere(BoundingSphere& sphere) const
+{
+  sphere.center = center_;
+  sphere.radius = radiusB_;
+}
+
+void bodies::Box::computeBoundingCylinder(BoundingCylinder& cylinder) const
+{
+  double a, b;
+
+  if (length2_ > width2_ && length2_ > height2_)
+  {
+    cylinder.length = length2_ * 2.0;
+    a = width2_;
+    b = height2_;
+    Eigen::Affine3d rot(Eigen::AngleAxisd(90.0f * (M_PI / 180.0f), Eigen::Vector3d::UnitY()));
+    cylinder.pose = pose_ * rot;
+  }
+  else if (width2_ > height2_)
+  {
+    cylinder.length = width2_ * 2.0;
+    a = height2_;
+    b = length2_;
+    cylinder.radius = sqrt(height2_ * height2_ + length2_ * length2_);
+    Eigen::Affine3d rot(Eigen::AngleAxisd(90.0f * (M_PI / 180.0f), Eigen::Vector3d::UnitX()));
+    cylinder.pose = pose_ * rot;
+  }
+  else
+  {
+    cylinder.length = height2_ * 2.0;
+    a = width2_;
+    b = length2_;
+    cylinder.pose = pose_;
+  }
+  cylinder.radius = sqrt(a * a + b * b);
+}
+
+bool bodies::Box::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                                EigenSTL::vector_Vector3d* intersections, unsigned int count) const
+{
+  const Ray ray(origin, dir);
+  Hit hit;
+  if (!intersect(ray, hit))
+    return false;
+  detail::appendHits(ray, hit, intersections, count);
+  return true;
+}
+
+bool bodies::Box::intersect(const Ray& ray, Hit& hit) const
+{
+  hit.count = 0;
+  if (detail::distanceSQR(center_, ray) > radius2_)
+    return false;
+
+  // slab test in the frame of the box
+  const Eigen::Vector3d v = ray.origin - center_;
+  const Eigen::Vector3d* normals[3] = { &normalL_, &normalW_, &normalH_ };
+  const double half[3] = { length2_, width2_, height2_ };
+  double tenter = -std::numeric_limits<double>::infinity();
+  double texit = std::numeric_limits<double>::infinity();
+  for (int k = 0; k < 3; ++k)
+  {
+    const double o = normals[k]->dot(v);
+    const double d = normals[k]->dot(ray.dir);
+    if (d == 0.0)
+    {
+      if (fabs(o) > half[k])
+        return false;
+      continue;
+    }
+    const double inv = 1.0 / d;
+    double t1 = (-half[k] - o) * inv;
+    double t2 = (half[k] - o) * inv;
+    if (inv < 0.0)
+      std::swap(t1, t2);
+    tenter = std::max(tenter, t1);
+    texit = std::min(texit, t2);
+    if (tenter > texit)
+      return false;
+  }
+  return detail::clipHit(ray, tenter, texit, hit);
+}
+
+double bodies::Box::computeSignedDistance(const Eigen::Vector3d& p) const
+{
+  double d;
+  computeSignedDistances(&p.x(), &p.y(), &p.z(), 1, &d);
+  return d;
+}
+
+void bodies::Box::computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                         double* out) const
+{
+  detail::BoxDistanceKernel kernel;
+  kernel.center = center_;
+  kernel.normalL = normalL_;
+  kernel.normalW = normalW_;
+  kernel.normalH = normalH_;
+  kernel.length2 = length2_;
+  kernel.width2 = width2_;
+  kernel.height2 = height2_;
+  detail::signedDistancesBatched(kernel, xs, ys, zs, n, out);
+}
+
+Eigen::Vector3d bodies::Box::computeSupportPoint(const Eigen::Vector3d& dir) const
+{
+  return center_ + normalL_ * (dir.dot(normalL_) < 0.0 ? -length2_ : length2_) +
+         normalW_ * (dir.dot(normalW_) < 0.0 ? -width2_ : width2_) +
+         normalH_ * (dir.dot(normalH_) < 0.0 ? -height2_ : height2_);
+}
+
+Eigen::Vector3d bodies::Box::computeSurfaceNormal(const Eigen::Vector3d& p) const
+{
+  // the normal of the face whose slab p is farthest out of, or least inside of
+  const Eigen::Vector3d v = p - center_;
+  const Eigen::Vector3d* normals[3] = { &normalL_, &normalW_, &normalH_ };
+  const double half[3] = { length2_, width2_, height2_ };
+  int best = 0;
+  double best_d = -std::numeric_limits<double>::infinity();
+  double best_o = 0.0;
+  for (int k = 0; k < 3; ++k)
+  {
+    const double o = normals[k]->dot(v);
+    const double d = fabs(o) - half[k];
+    if (d > best_d)
+    {
+      best = k;
+      best_d = d;
+      best_o = o;
+    }
+  }
+  return best_o < 0.0 ? Eigen::Vector3d(-*normals[best]) : *normals[best];
+}
+
+/** \brief The order in which a convex mesh tests its planes and the number of points each plane rejected.
+    Queries read the order without locking; a reorder bumps the version to an odd value while it rewrites
+    the order, so a query that saw it change checks its verdict again in the order of the planes. Each thread
+    counts rejections in a tally of its own and adds them to the shared counts once per period. */
+class bodies::ConvexMesh::AdaptivePlaneOrder : public std::enable_shared_from_this<AdaptivePlaneOrder>
+{
+public:
+  AdaptivePlaneOrder(const std::vector<unsigned int>& order, unsigned int period)
+    : id_(next_id_.fetch_add(1, std::memory_order_relaxed))
+    , size_(order.size())
+    , period_(std::max(period, 1u))
+    , order_(new std::atomic<unsigned int>[order.size()])
+    , rejections_(new std::atomic<std::uint64_t>[order.size()])
+    , pending_(0)
+    , version_(0)
+  {
+    for (std::size_t i = 0; i < size_; ++i)
+    {
+      order_[i].store(order[i], std::memory_order_relaxed);
+      rejections_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  unsigned int getPeriod() const
+  {
+    return period_;
+  }
+
+  const std::atomic<unsigned int>* getOrder() const
+  {
+    return order_.get();
+  }
+
+  std::vector<unsigned int> getOrderCopy() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<unsigned int> order(size_);
+    for (std::size_t i = 0; i < size_; ++i)
+      order[i] = order_[i].load(std::memory_order_relaxed);
+    return order;
+  }
+
+  /** \brief Start reading the order; the result is passed to unchanged() */
+  unsigned int beginRead() const
+  {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  /** \brief Check that the order was not rewritten since beginRead() returned \e version */
+  bool unchanged(unsigned int version) const
+  {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (version & 1) == 0 && version_.load(std::memory_order_relaxed) == version;
+  }
+
+  /** \brief Record that \e plane rejected \e count points */
+  void record(unsigned int plane, std::uint64_t count)
+  {
+    Tally& tally = localTally();
+    tally.counts[plane] += count;
+    tally.total += count;
+    if (tally.total >= period_)
+      publish(tally);
+  }
+
+  /** \brief Record the rejections counted by a batch of queries, one entry per plane */
+  void record(const std::vector<std::uint64_t>& rejections)
+  {
+    Tally& tally = localTally();
+    for (std::size_t i = 0; i < size_; ++i)
+    {
+      tally.counts[i] += rejections[i];
+      tally.total += rejections[i];
+    }
+    if (tally.total >= period_)
+      publish(tally);
+  }
+
+private:
+  /** \brief The rejections a thread counted for one order and has not added to the shared counts yet */
+  struct Tally
+  {
+    std::uint64_t id;
+    std::weak_ptr<AdaptivePlaneOrder> owner;
+    std::vector<std::uint64_t> counts;
+    std::uint64_t total;
+  };
+
+  /** \brief The number of orders a thread keeps tallies for */
+  static const std::size_t TALLIES_PER_THREAD = 16;
+
+  /** \brief The tally of the calling thread for this order. A thread that queries more orders than it keeps
+      tallies for publishes the oldest tally, if its order still exists, and reuses it. */
+  Tally& localTally()
+  {
+    static thread_local std::vector<Tally> tallies;
+    static thread_local std::size_t last = 0;
+    static thread_local std::size_t oldest = 0;
+    if (last < tallies.size() && tallies[last].id == id_)
+      return tallies[last];
+    for (last = 0; last < tallies.size(); ++last)
+      if (tallies[last].id == id_)
+        return tallies[last];
+
+    if (tallies.size() < TALLIES_PER_THREAD)
+      tallies.emplace_back();
+    else
+    {
+      last = oldest;
+      oldest = (oldest + 1) % TALLIES_PER_THREAD;
+      if (std::shared_ptr<AdaptivePlaneOrder> owner = tallies[last].owner.lock())
+        owner->publish(tallies[last]);
+    }
+    Tally& tally = tallies[last];
+    tally.id = id_;
+    tally.owner = shared_from_this();
+    tally.counts.assign(size_, 0);
+    tally.total = 0;
+    return tally;
+  }
+
+  /** \brief Add the counts of \e tally to the shared counts and clear it */
+  void publish(Tally& tally)
+  {
+    if (tally.total == 0)
+      return;
+    for (std::size_t i = 0; i < size_; ++i)
+      if (tally.counts[i] > 0)
+      {
+        rejections_[i].fetch_add(tally.counts[i], std::memory_order_relaxed);
+        tally.counts[i] = 0;
+      }
+    const std::uint64_t total = tally.total;
+    tally.total = 0;
+    if (pending_.fetch_add(total, std::memory_order_relaxed) + total >= period_)
+      reorder();
+  }
+
+  /** \brief Sort the planes by the number of points they rejected and halve the counts. A query that
+      arrives while another thread reorders does not wait for it. */
+  void reorder()
+  {
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (!lock.owns_lock() || pending_.load(std::memory_order_relaxed) < period_)
+      return;
+    pending_.store(0, std::memory_order_relaxed);
+
+    std::vector<std::uint64_t> counts(size_);
+    for (std::size_t i = 0; i < size_; ++i)
+    {
+      counts[i] = rejections_[i].load(std::memory_order_relaxed);
+      rejections_[i].fetch_sub(counts[i] / 2, std::memory_order_relaxed);
+    }
+    std::vector<unsigned int> order(size_);
+    for (std::size_t i = 0; i < size_; ++i)
+      order[i] = order_[i].load(std::memory_order_relaxed);
+    // ties keep their current order, so the order does not change once the counts settle
+    std::vector<unsigned int> sorted(order);
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&counts](unsigned int a, unsigned int b) { return counts[a] > counts[b]; });
+    if (sorted == order)
+      return;
+
+    const unsigned int version = version_.load(std::memory_order_relaxed);
+    version_.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < size_; ++i)
+      order_[i].store(sorted[i], std::memory_order_relaxed);
+    version_.store(version + 2, std::memory_order_release);
+  }
+
+  // identifies the tallies of this order; unlike the address, it is never reused
+  std::uint64_t id_;
+  static std::atomic<std::uint64_t> next_id_;
+
+  std::size_t size_;
+  unsigned int period_;
+  std::unique_ptr<std::atomic<unsigned int>[]> order_;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> rejections_;
+
+  // the number of rejections recorded since the last reorder
+  std::atomic<std::uint64_t> pending_;
+
+  // odd while the order is rewritten
+  std::atomic<unsigned int> version_;
+
+  mutable std::mutex mutex_;
+};
+
+std::atomic<std::uint64_t> bodies::ConvexMesh::AdaptivePlaneOrder::next_id_(1);
+
+void bodies::ConvexMesh::setAdaptivePlaneOrder(bool enabled, unsigned int period)
+{
+  if (!enabled)
+  {
+    plane_order_.reset();
+    return;
+  }
+  std::vector<unsigned int> order(mesh_data_ ? mesh_data_->planes_.size() : 0);
+  for (std::size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  plane_order_ = std::make_shared<AdaptivePlaneOrder>(order, period);
+}
+
+std::vector<unsigned int> bodies::ConvexMesh::getPlaneOrder() const
+{
+  if (plane_order_)
+    return plane_order_->getOrderCopy();
+  std::vector<unsigned int> order(getPlanes().size());
+  for (std::size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  return order;
+}
+
+bool bodies::ConvexMesh::containsPoint(const Eigen::Vector3d& p, bool verbose) const
+{
+  if (!mesh_data_)
+    return false;
+  if (bounding_box_.containsPoint(p))
+  {
+    Eigen::Vector3d ip(i_pose_ * p);
+    ip = mesh_data_->mesh_center_ + (ip - mesh_data_->mesh_center_) / scale_;
+    return isPointInsidePlanes(ip);
+  }
+  else
+    return false;
+}
+
+void bodies::ConvexMesh::containsPoints(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                        uint8_t* mask) const
+{
+  if (!mesh_data_)
+  {
+    std::fill(mask, mask + n, 0);
+    return;
+  }
+
+  // first stage: the bounding box rejects most points cheaply
+  bounding_box_.containsPoints(xs, ys, zs, n, mask);
+
+  detail::ConvexMeshPlanesKernel kernel;
+  kernel.i_pose = i_pose_;
+  kernel.center = mesh_data_->mesh_center_;
+  kernel.scale = scale_;
+  kernel.padding = padding_;
+  kernel.planes = &mesh_data_->planes_;
+  kernel.order = NULL;
+  kernel.rejections = NULL;
+
+  // with the adaptive order, the rejections in a sample of the blocks are counted locally and recorded once
+  std::vector<std::uint64_t> rejections;
+  unsigned int version = 0;
+  if (plane_order_)
+  {
+    rejections.resize(mesh_data_->planes_.size(), 0);
+    kernel.order = plane_order_->getOrder();
+    version = plane_order_->beginRead();
+  }
+
+  // second stage: run the plane test only on blocks that still have candidate points
+  const auto test_planes = [&kernel, &rejections, xs, ys, zs, n, mask]() {
+    for (std::size_t start = 0, block = 0; start < n; start += detail::BATCH_SIZE)
+    {
+      const std::size_t count = std::min<std::size_t>(detail::BATCH_SIZE, n - start);
+      uint8_t* block_mask = mask + start;
+      if (std::find(block_mask, block_mask + count, 1) == block_mask + count)
+        continue;
+
+      if (kernel.order)
+        kernel.rejections = block++ % detail::PLANE_ORDER_SAMPLING == 0 ? &rejections[0] : NULL;
+      uint8_t planes_mask[detail::BATCH_SIZE];
+      detail::containsPointsBatched(kernel, xs + start, ys + start, zs + start, count, planes_mask);
+      for (std::size_t i = 0; i < count; ++i)
+        block_mask[i] &= planes_mask[i];
+    }
+  };
+  test_planes();
+  if (!plane_order_)
+    return;
+
+  // if the order was rewritten meanwhile, check the points found inside in the order of the planes
+  if (!plane_order_->unchanged(version))
+  {
+    kernel.order = NULL;
+    kernel.rejections = NULL;
+    test_planes();
+  }
+  plane_order_->record(rejections);
+}
+
+void bodies::ConvexMesh::correctVertexOrderFromPlanes()
+{
+  for (unsigned int i = 0; i < mesh_data_->triangles_.size(); i += 3)
+  {
+    Eigen::Vector3d d1 =
+        mesh_data_->vertices_[mesh_data_->triangles_[i]] - mesh_data_->vertices_[mesh_data_->triangles_[i + 1]];
+    Eigen::Vector3d d2 =
+        mesh_data_->vertices_[mesh_data_->triangles_[i]] - mesh_data_->vertices_[mesh_data_->triangles_[i + 2]];
+    // expected computed normal from triangle vertex order
+    Eigen::Vector3d tri_normal = d1.cross(d2);
+    tri_normal.normalize();
+    // actual plane normal
+    Eigen::Vector3d normal(mesh_data_->planes_[mesh_data_->plane_for_triangle_[i / 3]].x(),
+                           mesh_data_->planes_[mesh_data_->plane_for_triangle_[i / 3]].y(),
+                           mesh_data_->planes_[mesh_data_->plane_for_triangle_[i / 3]].z());
+    bool same_dir = tri_normal.dot(normal) > 0;
+    if (!same_dir)
+    {
+      std::swap(mesh_data_->triangles_[i], mesh_data_->triangles_[i + 1]);
+    }
+  }
+}
+
+/** \brief Process-wide cache of convex hulls, keyed by the vertices of the input mesh. The least
+    recently used hulls are dropped when the approximate memory they use exceeds the budget. */
+class bodies::ConvexMesh::MeshDataCache
+{
+public:
+  static MeshDataCache& instance()
+  {
+    static MeshDataCache cache;
+    return cache;
+  }
+
+  /** \brief Look up the hull of \e mesh; on a hit, \e data is set and true is returned */
+  bool find(const shapes::Mesh* mesh, std::uint64_t hash, std::shared_ptr<MeshData>& data)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (budget_ == 0)
+      return false;
+    std::unordered_map<std::uint64_t, EntryList::iterator>::iterator it = index_.find(hash);
+    if (it == index_.end() || !it->second->matches(mesh))
+    {
+      ++statistics_.misses;
+      return false;
+    }
+    // move the entry to the front of the list, as the most recently used
+    entries_.splice(entries_.begin(), entries_, it->second);
+    data = it->second->data;
+    ++statistics_.hits;
+    return true;
+  }
+
+  /** \brief Add the hull \e data computed for \e mesh */
+  void insert(const shapes::Mesh* mesh, std::uint64_t hash, const std::shared_ptr<MeshData>& data)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (budget_ == 0)
+      return;
+    std::unordered_map<std::uint64_t, EntryList::iterator>::iterator it = index_.find(hash);
+    if (it != index_.end())
+      erase(it->second);
+
+    entries_.push_front(Entry());
+    Entry& entry = entries_.front();
+    entry.hash = hash;
+    std::size_t size;
+    const unsigned char* bytes = vertexBytes(mesh, size);
+    entry.vertex_count = mesh->vertex_count;
+    entry.vertices.assign(bytes, bytes + size);
+    entry.data = data;
+    entry.bytes = sizeof(Entry) + sizeof(MeshData) + entry.vertices.size() +
+                  data->planes_.size() * sizeof(Eigen::Vector4d) + data->vertices_.size() * sizeof(Eigen::Vector3d) +
+                  data->triangles_.size() * sizeof(unsigned int) +
+                  data->tetrahedron_volumes_.size() * sizeof(double) +
+                  data->plane_for_triangle_.size() * sizeof(unsigned int);
+    index_[hash] = entries_.begin();
+    statistics_.bytes += entry.bytes;
+    ++statistics_.entries;
+    evict();
+  }
+
+  void setBudget(std::size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    evict();
+  }
+
+  std::size_t getBudget()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_;
+  }
+
+  CacheStatistics getStatistics()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return statistics_;
+  }
+
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    statistics_ = CacheStatistics();
+  }
+
+  /** \brief FNV-1a hash of the vertex coordinates of \e mesh, in whichever storage it uses */
+  static std::uint64_t hash(const shapes::Mesh* mesh)
+  {
+    std::uint64_t h = 14695981039346656037ULL;
+    std::size_t size;
+    const unsigned char* bytes = vertexBytes(mesh, size);
+    for (std::size_t i = 0; i < size; ++i)
+      h = (h ^ bytes[i]) * 1099511628211ULL;
+    return h ^ mesh->vertex_count;
+  }
+
+private:
+  struct Entry
+  {
+    /** \brief Compare the vertices, so that hash collisions are not mistaken for hits */
+    bool matches(const shapes::Mesh* mesh) const
+    {
+      std::size_t size;
+      const unsigned char* bytes = vertexBytes(mesh, size);
+      return vertex_count == mesh->vertex_count && vertices.size() == size &&
+             (vertices.empty() || memcmp(&vertices[0], bytes, size) == 0);
+    }
+
+    std::uint64_t hash;
+    unsigned int vertex_count;
+    /** \brief The raw vertex coordinates, as doubles or as floats for compact meshes */
+    std::vector<unsigned char> vertices;
+    std::shared_ptr<MeshData> data;
+    std::size_t bytes;
+  };
+  typedef std::list<Entry> EntryList;
+
+  /** \brief The vertex coordinates of \e mesh as raw bytes, without converting compact storage */
+  static const unsigned char* vertexBytes(const shapes::Mesh* mesh, std::size_t& size)
+  {
+    if (mesh->compact_vertices)
+    {
+      size = 3 * mesh->vertex_count * sizeof(float);
+      return reinterpret_cast<const unsigned char*>(mesh->compact_vertices);
+    }
+    size = 3 * mesh->vertex_count * sizeof(double);
+    return reinterpret_cast<const unsigned char*>(mesh->vertices);
+  }
+
+  MeshDataCache() : budget_(64 * 1024 * 1024)
+  {
+  }
+
+  void erase(EntryList::iterator entry)
+  {
+    statistics_.bytes -= entry->bytes;
+    --statistics_.entries;
+    index_.erase(entry->hash);
+    entries_.erase(entry);
+  }
+
+  /** \brief Drop the least recently used entries until the budget is met */
+  void evict()
+  {
+    while (!entries_.empty() && statistics_.bytes > budget_)
+    {
+      erase(--entries_.end());
+      ++statistics_.evictions;
+    }
+  }
+
+  std::mutex mutex_;
+  std::size_t budget_;
+  EntryList entries_;
+  std::unordered_map<std::uint64_t, EntryList::iterator> index_;
+  CacheStatistics statistics_;
+};
+
+void bodies::ConvexMesh::setCacheBudget(std::size_t bytes)
+{
+  MeshDataCache::instance().setBudget(bytes);
+}
+
+std::size_t bodies::ConvexMesh::getCacheBudget()
+{
+  return MeshDataCache::instance().getBudget();
+}
+
+bodies::ConvexMesh::CacheStatistics bodies::ConvexMesh::getCacheStatistics()
+{
+  return MeshDataCache::instance().getStatistics();
+}
+
+void bodies::ConvexMesh::clearCache()
+{
+  MeshDataCache::instance().clear();
+}
+
+namespace bodies
+{
+namespace detail
+{
+/** \brief Compute the convex hull of the vertices of \e mesh with qhull: its \e vertices and, if asked for, the
+    vertex indices of its \e triangles and the plane of each of them. Returns false if qhull fails. */
+static bool computeConvexHull(const shapes::Mesh* mesh, EigenSTL::vector_Vector3d& vertices,
+                              std::vector<unsigned int>* triangles, EigenSTL::vector_Vector4d* planes)
+{
+  coordT* points = (coordT*)calloc(mesh->vertex_count * 3, sizeof(coordT));
+  for (unsigned int i = 0; i < mesh->vertex_count; ++i)
+  {
+    points[3 * i + 0] = (coordT)mesh->getVertexCoordinate(3 * i + 0);
+    points[3 * i + 1] = (coordT)mesh->getVertexCoordinate(3 * i + 1);
+    points[3 * i + 2] = (coordT)mesh->getVertexCoordinate(3 * i + 2);
+  }
+
+  static FILE* null = fopen("/dev/null", "w");
+
+  char flags[] = "qhull Tv Qt";
+#ifdef GEOMETRIC_SHAPES_HAVE_QHULL_R
+  // reentrant qhull keeps all of its state in qh_qh, so hulls can be built concurrently
+  qhT qh_qh;
+  qhT* qh = &qh_qh;
+  qh_zero(qh, null);
+  int exitcode = qh_new_qhull(qh, 3, mesh->vertex_count, points, true, flags, null, null);
+#else
+  // the non-reentrant qhull library uses global state; only one hull can be built at a time
+  static std::mutex qhull_mutex;
+  std::lock_guard<std::mutex> qhull_lock(qhull_mutex);
+  int exitcode = qh_new_qhull(3, mesh->vertex_count, points, true, flags, null, null);
+#endif
+
+  if (exitcode != 0)
+  {
+    CONSOLE_BRIDGE_logWarn("Convex hull creation failed");
+    int curlong, totlong;
+#ifdef GEOMETRIC_SHAPES_HAVE_QHULL_R
+    qh_freeqhull(qh, !qh_ALL);
+    qh_memfreeshort(qh, &curlong, &totlong);
+#else
+    qh_freeqhull(!qh_ALL);
+    qh_memfreeshort(&curlong, &totlong);
+#endif
+    return false;
+  }
+
+#ifdef GEOMETRIC_SHAPES_HAVE_QHULL_R
+  int num_facets = qh->num_facets;
+  int num_vertices = qh->num_vertices;
+#else
+  int num_facets = qh num_facets;
+  int num_vertices = qh num_vertices;
+#endif
+  vertices.reserve(num_vertices);
+
+  // necessary for FORALLvertices
+  std::map<unsigned int, unsigned int> qhull_vertex_table;
+  vertexT* vertex;
+  FORALLvertices
+  {
+    Eigen::Vector3d vert(vertex->point[0], vertex->point[1], vertex->point[2]);
+    qhull_vertex_table[vertex->id] = vertices.size();
+    vertices.push_back(vert);
+  }
+
+  if (triangles)
+    triangles->reserve(3 * num_facets);
+  if (planes)
+    planes->reserve(num_facets);
+
+  // neccessary for qhull macro
+  facetT* facet;
+  FORALLfacets
+  {
+    if (planes)
+      planes->push_back(Eigen::Vector4d(facet->normal[0], facet->normal[1], facet->normal[2], facet->offset));
+    if (!triangles)
+      continue;
+
+    // Needed by FOREACHvertex_i_
+    int vertex_n, vertex_i;
+#ifdef GEOMETRIC_SHAPES_HAVE_QHULL_R
+    FOREACHvertex_i_(qh, (*facet).vertices)
+#else
+    FOREACHvertex_i_((*facet).vertices)
+#endif
+    {
+      triangles->push_back(qhull_vertex_table[vertex->id]);
+    }
+  }
+  int curlong, totlong;
+#ifdef GEOMETRIC_SHAPES_HAVE_QHULL_R
+  qh_freeqhull(qh, !qh_ALL);
+  qh_memfreeshort(qh, &curlong, &totlong);
+#else
+  qh_freeqhull(!qh_ALL);
+  qh_memfreeshort(&curlong, &totlong);
+#endif
+  return true;
+}
+}
+}
+
+void bodies::ConvexMesh::useDimensions(const shapes::Shape* shape)
+{
+  const shapes::Mesh* mesh = static_cast<const shapes::Mesh*>(shape);
+  // the scaled vertices have to be recomputed for the new mesh
+  scaled_vertices_ = NULL;
+  const std::uint64_t hash = MeshDataCache::hash(mesh);
+  if (!MeshDataCache::instance().find(mesh, hash, mesh_data_))
+    computeHull(mesh, hash);
+
+  // the cache keeps the exact hull; the approximation is shared by clones of this body only
+  if (max_planes_ > 0 && mesh_data_ && mesh_data_->planes_.size() > max_planes_)
+  {
+    mesh_data_ = approximateHull(*mesh_data_, max_planes_);
+    CONSOLE_BRIDGE_logDebug("Approximated a convex hull with %u planes; Hausdorff error %f",
+                            (unsigned int)mesh_data_->planes_.size(), mesh_data_->approximation_error_);
+  }
+
+  // the counts were for the planes of the previous hull
+  if (plane_order_)
+    setAdaptivePlaneOrder(true, plane_order_->getPeriod());
+}
+
+void bodies::ConvexMesh::computeHull(const shapes::Mesh* mesh, std::uint64_t hash)
+{
+  mesh_data_.reset(new MeshData());
+
+  double maxX = -std::numeric_limits<double>::infinity(), maxY = -std::numeric_limits<double>::infinity(),
+         maxZ = -std::numeric_limits<double>::infinity();
+  double minX = std::numeric_limits<double>::infinity(), minY = std::numeric_limits<double>::infinity(),
+         minZ = std::numeric_limits<double>::infinity();
+
+  for (unsigned int i = 0; i < mesh->vertex_count; ++i)
+  {
+    double vx = mesh->getVertexCoordinate(3 * i);
+    double vy = mesh->getVertexCoordinate(3 * i + 1);
+    double vz = mesh->getVertexCoordinate(3 * i + 2);
+
+    if (maxX < vx)
+      maxX = vx;
+    if (maxY < vy)
+      maxY = vy;
+    if (maxZ < vz)
+      maxZ = vz;
+
+    if (minX > vx)
+      minX = vx;
+    if (minY > vy)
+      minY = vy;
+    if (minZ > vz)
+      minZ = vz;
+  }
+
+  if (maxX < minX)
+    maxX = minX = 0.0;
+  if (maxY < minY)
+    maxY = minY = 0.0;
+  if (maxZ < minZ)
+    maxZ = minZ = 0.0;
+
+  mesh_data_->box_size_ = Eigen::Vector3d(maxX - minX, maxY - minY, maxZ - minZ);
+
+  mesh_data_->box_offset_ = Eigen::Vector3d((minX + maxX) / 2.0, (minY + maxY) / 2.0, (minZ + maxZ) / 2.0);
+
+  mesh_data_->planes_.clear();
+  mesh_data_->triangles_.clear();
+  mesh_data_->plane_for_triangle_.clear();
+  mesh_data_->vertices_.clear();
+  mesh_data_->mesh_radiusB_ = 0.0;
+  mesh_data_->mesh_center_ = Eigen::Vector3d();
+  mesh_data_->sphere_center_ = Eigen::Vector3d();
+  mesh_data_->tetrahedron_volumes_.clear();
+  mesh_data_->inner_radius_ = 0.0;
+  mesh_data_->approximation_error_ = 0.0;
+
+  // until the hull is known, use the bounding box of the mesh and a cylinder around it
+  mesh_data_->box_rotation_.setIdentity();
+  const int cylinder_axis = (mesh_data_->box_size_.x() > mesh_data_->box_size_.y() &&
+                             mesh_data_->box_size_.x() > mesh_data_->box_size_.z()) ?
+                                0 :
+                                (mesh_data_->box_size_.y() > mesh_data_->box_size_.z() ? 1 : 2);
+  mesh_data_->bounding_cylinder_.length = mesh_data_->box_size_[cylinder_axis];
+  mesh_data_->bounding_cylinder_.radius =
+      Eigen::Vector2d(mesh_data_->box_size_[(cylinder_axis + 1) % 3], mesh_data_->box_size_[(cylinder_axis + 2) % 3])
+          .norm() /
+      2.0;
+  mesh_data_->bounding_cylinder_.pose =
+      Eigen::Translation3d(mesh_data_->box_offset_) *
+      Eigen::Quaterniond::FromTwoVectors(Eigen::Vector3d::UnitZ(), Eigen::Vector3d::Unit(cylinder_axis));
+
+  /* compute convex hull */
+  EigenSTL::vector_Vector4d triangle_planes;
+  if (!detail::computeConvexHull(mesh, mesh_data_->vertices_, &mesh_data_->triangles_, &triangle_planes))
+    return;
+
+  // coplanar triangles, wherever they are in the output of qhull, share one plane; together they are
+  // the polygon of that face of the hull
+  detail::PlaneIndex plane_index(detail::PLANE_MERGE_TOLERANCE);
+  mesh_data_->plane_for_triangle_.reserve(triangle_planes.size());
+  for (std::size_t i = 0; i < triangle_planes.size(); ++i)
+    mesh_data_->plane_for_triangle_.push_back(plane_index.insert(triangle_planes[i], mesh_data_->planes_));
+
+  completeMeshData(*mesh_data_);
+  MeshDataCache::instance().insert(mesh, hash, mesh_data_);
+}
+
+void bodies::ConvexMesh::completeMeshData(MeshData& data)
+{
+  Eigen::Vector3d sum(0.0, 0.0, 0.0);
+  for (std::size_t i = 0; i < data.vertices_.size(); ++i)
+    sum += data.vertices_[i];
+  data.mesh_center_ = sum / (double)data.vertices_.size();
+  shapes::computeMinimumBoundingSphere(data.vertices_, data.sphere_center_, data.mesh_radiusB_);
+
+  // a merged plane keeps the normal of its first triangle; move it so that it supports the vertices again
+  for (std::size_t i = 0; i < data.planes_.size(); ++i)
+  {
+    Eigen::Vector4d& plane = data.planes_[i];
+    double support = -std::numeric_limits<double>::infinity();
+    for (std::size_t j = 0; j < data.vertices_.size(); ++j)
+      support = std::max(support, plane.head<3>().dot(data.vertices_[j]));
+    plane.w() = -support;
+  }
+
+  // the tetrahedra from the center to the triangles partition the hull; their volumes let samplePointInside()
+  // pick one with the right probability
+  const Eigen::Vector3d& center = data.mesh_center_;
+  const std::vector<unsigned int>& triangles = data.triangles_;
+  data.tetrahedron_volumes_.resize(triangles.size() / 3);
+  double volume = 0.0;
+  for (std::size_t i = 0; i < triangles.size() / 3; ++i)
+  {
+    const Eigen::Vector3d a = data.vertices_[triangles[3 * i]] - center;
+    const Eigen::Vector3d b = data.vertices_[triangles[3 * i + 1]] - center;
+    const Eigen::Vector3d c = data.vertices_[triangles[3 * i + 2]] - center;
+    volume += std::fabs(a.dot(b.cross(c))) / 6.0;
+    data.tetrahedron_volumes_[i] = volume;
+  }
+  data.inner_radius_ = std::numeric_limits<double>::infinity();
+  for (std::size_t i = 0; i < data.planes_.size(); ++i)
+  {
+    const Eigen::Vector4d& plane = data.planes_[i];
+    data.inner_radius_ = std::min(data.inner_radius_, -(plane.head<3>().dot(center) + plane.w()));
+  }
+
+  // the largest faces of the hull are the likely orientations of the smallest bounding box
+  std::vector<double> plane_areas(data.planes_.size(), 0.0);
+  for (std::size_t i = 0; i < data.plane_for_triangle_.size(); ++i)
+  {
+    const Eigen::Vector3d& a = data.vertices_[triangles[3 * i]];
+    const Eigen::Vector3d& b = data.vertices_[triangles[3 * i + 1]];
+    const Eigen::Vector3d& c = data.vertices_[triangles[3 * i + 2]];
+    plane_areas[data.plane_for_triangle_[i]] += (b - a).cross(c - a).norm();
+  }
+  std::vector<unsigned int> largest_planes(plane_areas.size());
+  for (std::size_t i = 0; i < largest_planes.size(); ++i)
+    largest_planes[i] = i;
+  const std::size_t face_count = std::min(largest_planes.size(), detail::BOUNDING_BOX_MAX_FACES);
+  std::partial_sort(largest_planes.begin(), largest_planes.begin() + face_count, largest_planes.end(),
+                    [&plane_areas](unsigned int a, unsigned int b) { return plane_areas[a] > plane_areas[b]; });
+  EigenSTL::vector_Vector3d normals(face_count);
+  for (std::size_t i = 0; i < face_count; ++i)
+    normals[i] = data.planes_[largest_planes[i]].head<3>();
+
+  detail::computeOrientedBoundingBox(data.vertices_, normals, data.box_rotation_, data.box_offset_, data.box_size_);
+  detail::computeBoundingCylinder(data.vertices_, data.box_rotation_, data.bounding_cylinder_);
+}
+
+std::shared_ptr<bodies::ConvexMesh::MeshData> bodies::ConvexMesh::approximateHull(const MeshData& hull,
+                                                                                   unsigned int max_planes)
+{
+  const double tolerance = 1e-9 * std::max(1.0, hull.mesh_radiusB_);
+
+  // the oriented bounding box contains the hull and bounds the polytope from the start
+  EigenSTL::vector_Vector4d planes;
+  EigenSTL::vector_Vector3d corners;
+  for (int k = 0; k < 6; ++k)
+  {
+    planes.push_back(detail::supportPlane(hull.box_rotation_.col(k / 2) * (k % 2 ? -1.0 : 1.0), hull.vertices_));
+    detail::addPolytopeCorners(planes, planes.size() - 1, tolerance, corners);
+  }
+
+  double error = 0.0;
+  while (true)
+  {
+    // the corner farthest from the hull is where the polytope is worst
+    std::size_t worst = corners.size();
+    error = 0.0;
+    for (std::size_t i = 0; i < corners.size(); ++i)
+    {
+      const double d = detail::distanceToPolytope(corners[i], hull.vertices_, hull.triangles_, hull.planes_);
+      if (d > error)
+      {
+        error = d;
+        worst = i;
+      }
+    }
+    if (worst == corners.size() || error <= tolerance || planes.size() >= max_planes)
+      break;
+
+    // cut it off with the face of the hull it is farthest in front of
+    std::size_t face = 0;
+    double violation = -std::numeric_limits<double>::infinity();
+    for (std::size_t i = 0; i < hull.planes_.size(); ++i)
+    {
+      const double v = hull.planes_[i].head<3>().dot(corners[worst]) + hull.planes_[i].w();
+      if (v > violation)
+      {
+        violation = v;
+        face = i;
+      }
+    }
+    if (violation <= tolerance)
+      break;
+    const Eigen::Vector4d& plane = hull.planes_[face];
+    planes.push_back(plane);
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < corners.size(); ++i)
+      if (plane.head<3>().dot(corners[i]) + plane.w() <= tolerance)
+        corners[kept++] = corners[i];
+    corners.resize(kept);
+    detail::addPolytopeCorners(planes, planes.size() - 1, tolerance, corners);
+  }
+
+  // the faces of the polytope: the corners on each plane, in order around its normal and split into fans
+  std::shared_ptr<MeshData> data(new MeshData());
+  data->vertices_ = corners;
+  data->approximation_error_ = error;
+  const double face_tolerance = 1e-7 * std::max(1.0, hull.mesh_radiusB_);
+  for (std::size_t i = 0; i < planes.size(); ++i)
+  {
+    const Eigen::Vector3d normal = planes[i].head<3>();
+    std::vector<unsigned int> face;
+    Eigen::Vector3d centroid(0.0, 0.0, 0.0);
+    for (std::size_t j = 0; j < corners.size(); ++j)
+      if (std::fabs(normal.dot(corners[j]) + planes[i].w()) <= face_tolerance)
+      {
+        face.push_back(j);
+        centroid += corners[j];
+      }
+    // planes that only touch the polytope at an edge or a corner are not needed
+    if (face.size() < 3)
+      continue;
+    centroid /= (double)face.size();
+    const Eigen::Vector3d u = normal.unitOrthogonal();
+    const Eigen::Vector3d v = normal.cross(u);
+    std::vector<std::pair<double, unsigned int> > angles(face.size());
+    for (std::size_t j = 0; j < face.size(); ++j)
+    {
+      const Eigen::Vector3d d = corners[face[j]] - centroid;
+      angles[j] = std::make_pair(std::atan2(v.dot(d), u.dot(d)), face[j]);
+    }
+    std::sort(angles.begin(), angles.end());
+    for (std::size_t j = 1; j + 1 < angles.size(); ++j)
+    {
+      data->triangles_.push_back(angles[0].second);
+      data->triangles_.push_back(angles[j].second);
+      data->triangles_.push_back(angles[j + 1].second);
+      data->plane_for_triangle_.push_back(data->planes_.size());
+    }
+    data->planes_.push_back(planes[i]);
+  }
+
+  completeMeshData(*data);
+  return data;
+}
+
+double bodies::ConvexMesh::getApproximationError() const
+{
+  return mesh_data_ ? mesh_data_->approximation_error_ : 0.0;
+}
+
+std::vector<double> bodies::ConvexMesh::getDimensions() const
+{
+  return std::vector<double>();
+}
+
+void bodies::ConvexMesh::computeScaledVerticesFromPlaneProjections()
+{
+  // compute the scaled vertices, if needed
+  if (padding_ == 0.0 && scale_ == 1.0)
+  {
+    scaled_vertices_ = &mesh_data_->vertices_;
+    return;
+  }
+
+  if (!scaled_vertices_storage_)
+    scaled_vertices_storage_.reset(new EigenSTL::vector_Vector3d());
+  scaled_vertices_ = scaled_vertices_storage_.get();
+  scaled_vertices_storage_->resize(mesh_data_->vertices_.size());
+  // project vertices along the vertex - center line to the scaled and padded plane
+  // take the average of all tri's planes around that vertex as the result
+  // is not unique
+
+  // First figure out, which tris are connected to each vertex
+  std::map<unsigned int, std::vector<unsigned int> > vertex_to_tris;
+  for (unsigned int i = 0; i < mesh_data_->triangles_.size() / 3; ++i)
+  {
+    vertex_to_tris[mesh_data_->triangles_[3 * i + 0]].push_back(i);
+    vertex_to_tris[mesh_data_->triangles_[3 * i + 1]].push_back(i);
+    vertex_to_tris[mesh_data_->triangles_[3 * i + 2]].push_back(i);
+  }
+
+  for (unsigned int i = 0; i < mesh_data_->vertices_.size(); ++i)
+  {
+    Eigen::Vector3d v(mesh_data_->vertices_[i] - mesh_data_->mesh_center_);
+    EigenSTL::vector_Vector3d projected_vertices;
+    for (unsigned int t = 0; t < vertex_to_tris[i].size(); ++t)
+    {
+      const Eigen::Vector4d& plane = mesh_data_->planes_[mesh_data_->plane_for_triangle_[vertex_to_tris[i][t]]];
+      Eigen::Vector3d plane_normal(plane.x(), plane.y(), plane.z());
+      double d_scaled_padded =
+          scale_ * plane.w() - (1 - scale_) * mesh_data_->mesh_center_.dot(plane_normal) - padding_;
+
+      // intersect vert - center with scaled/padded plane equation
+      double denom = v.dot(plane_normal);
+      if (fabs(denom) < 1e-3)
+        continue;
+      double lambda = (-mesh_data_->mesh_center_.dot(plane_normal) - d_scaled_padded) / denom;
+      Eigen::Vector3d vert_on_plane = v * lambda + mesh_data_->mesh_center_;
+      projected_vertices.push_back(vert_on_plane);
+    }
+    if (projected_vertices.empty())
+    {
+      double l = v.norm();
+      scaled_vertices_storage_->at(i) =
+          mesh_data_->mesh_center_ + v * (scale_ + (l > detail::ZERO ? padding_ / l : 0.0));
+    }
+    else
+    {
+      Eigen::Vector3d sum(0, 0, 0);
+      for (unsigned int v = 0; v < projected_vertices.size(); ++v)
+      {
+        sum += projected_vertices[v];
+      }
+      sum /= projected_vertices.size();
+      scaled_vertices_storage_->at(i) = sum;
+    }
+  }
+}
+
+void bodies::ConvexMesh::updateInternalData()
+{
+  if (!mesh_data_)
+    return;
+
+  const shapes::Box box_shape(mesh_data_->box_size_.x(), mesh_data_->box_size_.y(), mesh_data_->box_size_.z());
+  bounding_box_.setDimensions(&box_shape);
+  bounding_box_.setPadding(padding_);
+  bounding_box_.setScale(scale_);
+
+  radiusB_ = mesh_data_->mesh_radiusB_ * scale_ + padding_;
+  radiusBSqr_ = radiusB_ * radiusB_;
+  updateInternalPose();
+
+  // compute the scaled vertices, if needed
+  if (scaled_vertices_ && scaled_vertices_scale_ == scale_ && scaled_vertices_padding_ == padding_)
+    return;
+  scaled_vertices_scale_ = scale_;
+  scaled_vertices_padding_ = padding_;
+  if (padding_ == 0.0 && scale_ == 1.0)
+    scaled_vertices_ = &mesh_data_->vertices_;
+  else
+  {
+    if (!scaled_vertices_storage_)
+      scaled_vertices_storage_.reset(new EigenSTL::vector_Vector3d());
+    scaled_vertices_ = scaled_vertices_storage_.get();
+    scaled_vertices_storage_->resize(mesh_data_->vertices_.size());
+    for (unsigned int i = 0; i < mesh_data_->vertices_.size(); ++i)
+    {
+      Eigen::Vector3d v(mesh_data_->vertices_[i] - mesh_data_->mesh_center_);
+      double l = v.norm();
+      scaled_vertices_storage_->at(i) =
+          mesh_data_->mesh_center_ + v * (scale_ + (l > detail::ZERO ? padding_ / l : 0.0));
+    }
+  }
+}
+
+void bodies::ConvexMesh::updateInternalPose()
+{
+  if (!mesh_data_)
+    return;
+  // the box is scaled about its own center, so move that center as the mesh scales about mesh_center_
+  Eigen::Affine3d box_pose = Eigen::Affine3d::Identity();
+  box_pose.linear() = mesh_data_->box_rotation_;
+  box_pose.translation() = mesh_data_->mesh_center_ + (mesh_data_->box_offset_ - mesh_data_->mesh_center_) * scale_;
+  bounding_box_.setPose(pose_ * box_pose);
+
+  i_pose_ = pose_.inverse();
+
+  // scaling and padding move the vertices away from mesh_center_; the enclosing sphere follows its center
+  center_ = pose_ * (mesh_data_->mesh_center_ + (mesh_data_->sphere_center_ - mesh_data_->mesh_center_) * scale_);
+}
+
+const std::vector<unsigned int>& bodies::ConvexMesh::getTriangles() const
+{
+  static const std::vector<unsigned int> empty;
+  return mesh_data_ ? mesh_data_->triangles_ : empty;
+}
+
+const EigenSTL::vector_Vector3d& bodies::ConvexMesh::getVertices() const
+{
+  static const EigenSTL::vector_Vector3d empty;
+  return mesh_data_ ? mesh_data_->vertices_ : empty;
+}
+
+const EigenSTL::vector_Vector3d& bodies::ConvexMesh::getScaledVertices() const
+{
+  return scaled_vertices_ ? *scaled_vertices_ : getVertices();
+}
+
+const EigenSTL::vector_Vector4d& bodies::ConvexMesh::getPlanes() const
+{
+  static const EigenSTL::vector_Vector4d empty;
+  return mesh_data_ ? mesh_data_->planes_ : empty;
+}
+
+std::shared_ptr<bodies::Body> bodies::ConvexMesh::cloneAt(const Eigen::Affine3d& pose, double padding,
+                                                          double scale) const
+{
+  ConvexMesh* m = new ConvexMesh();
+  m->mesh_data_ = mesh_data_;
+  m->max_planes_ = max_planes_;
+  if (plane_order_)
+    m->plane_order_ = std::make_shared<AdaptivePlaneOrder>(plane_order_->getOrderCopy(), plane_order_->getPeriod());
+  m->padding_ = padding;
+  m->scale_ = scale;
+  m->pose_ = pose;
+  m->updateInternalData();
+  return std::shared_ptr<Body>(m);
+}
+
+void bodies::ConvexMesh::computeBoundingSphere(BoundingSphere& sphere) const
+{
+  sphere.center = center_;
+  sphere.radius = radiusB_;
+}
+
+void bodies::ConvexMesh::computeBoundingCylinder(BoundingCylinder& cylinder) const
+{
+  if (!mesh_data_)
+  {
+    cylinder.length = 0.0;
+    cylinder.radius = 0.0;
+    cylinder.pose = pose_;
+    return;
+  }
+  const BoundingCylinder& mesh_cylinder = mesh_data_->bounding_cylinder_;
+  cylinder.length = mesh_cylinder.length * scale_ + 2.0 * padding_;
+  cylinder.radius = mesh_cylinder.radius * scale_ + padding_;
+  cylinder.pose = mesh_cylinder.pose;
+  cylinder.pose.translation() =
+      mesh_data_->mesh_center_ + (mesh_cylinder.pose.translation() - mesh_data_->mesh_center_) * scale_;
+  cylinder.pose = pose_ * cylinder.pose;
+}
+
+bool bodies::ConvexMesh::isPointInsidePlanes(const Eigen::Vector3d& point) const
+{
+  unsigned int numplanes = mesh_data_->planes_.size();
+  if (plane_order_)
+  {
+    const std::atomic<unsigned int>* order = plane_order_->getOrder();
+    const unsigned int version = plane_order_->beginRead();
+    for (unsigned int i = 0; i < numplanes; ++i)
+    {
+      const unsigned int index = order[i].load(std::memory_order_relaxed);
+      const Eigen::Vector4d& plane = mesh_data_->planes_[index];
+      if (plane.head<3>().dot(point) + plane.w() - padding_ - 1e-6 > 0.0)
+      {
+        plane_order_->record(index, 1);
+        return false;
+      }
+    }
+    // a rejection is right in any order, but an order rewritten meanwhile may have skipped a plane
+    if (plane_order_->unchanged(version))
+      return true;
+  }
+  for (unsigned int i = 0; i < numplanes; ++i)
+  {
+    const Eigen::Vector4d& plane = mesh_data_->planes_[i];
+    Eigen::Vector3d plane_vec(plane.x(), plane.y(), plane.z());
+    double dist = plane_vec.dot(point) + plane.w() - padding_ - 1e-6;
+    if (dist > 0.0)
+      return false;
+  }
+  return true;
+}
+
+unsigned int bodies::ConvexMesh::countVerticesBehindPlane(const Eigen::Vector4f& planeNormal) const
+{
+  unsigned int numvertices = mesh_data_->vertices_.size();
+  unsigned int result = 0;
+  for (unsigned int i = 0; i < numvertices; ++i)
+  {
+    Eigen::Vector3d plane_vec(planeNormal.x(), planeNormal.y(), planeNormal.z());
+    double dist = plane_vec.dot(mesh_data_->vertices_[i]) + planeNormal.w() - 1e-6;
+    if (dist > 0.0)
+      result++;
+  }
+  return result;
+}
+
+double bodies::ConvexMesh::computeVolume() const
+{
+  double volume = 0.0;
+  if (mesh_data_)
+    for (unsigned int i = 0; i < mesh_data_->triangles_.size() / 3; ++i)
+    {
+      const Eigen::Vector3d& v1 = mesh_data_->vertices_[mesh_data_->triangles_[3 * i + 0]];
+      const Eigen::Vector3d& v2 = mesh_data_->vertices_[mesh_data_->triangles_[3 * i + 1]];
+      const Eigen::Vector3d& v3 = mesh_data_->vertices_[mesh_data_->triangles_[3 * i + 2]];
+      volume += v1.x() * v2.y() * v3.z() + v2.x() * v3.y() * v1.z() + v3.x() * v1.y() * v2.z() -
+                v1.x() * v3.y() * v2.z() - v2.x() * v1.y() * v3.z() - v3.x() * v2.y() * v1.z();
+    }
+  return fabs(volume) / 6.0;
 }
 
-void bodies::Box::useDimensions(const shapes::Shape* shape)  // (x, y, z) = (length, width, height)
+Eigen::Vector3d bodies::ConvexMesh::sampleHullPoint(random_numbers::RandomNumberGenerator& rng) const
 {
-  const double* size = static_cast<const shapes::Box*>(shape)->size;
-  length_ = size[0];
-  width_ = size[1];
-  height_ = size[2];
+  const std::vector<double>& volumes = mesh_data_->tetrahedron_volumes_;
+  const std::size_t t =
+      std::min<std::size_t>(std::upper_bound(volumes.begin(), volumes.end(), rng.uniform01() * volumes.back()) -
+                                volumes.begin(),
+                            volumes.size() - 1);
+  const std::vector<unsigned int>& triangles = mesh_data_->triangles_;
+  return detail::sampleTetrahedron(rng, mesh_data_->mesh_center_, mesh_data_->vertices_[triangles[3 * t]],
+                                   mesh_data_->vertices_[triangles[3 * t + 1]],
+                                   mesh_data_->vertices_[triangles[3 * t + 2]]);
 }
 
-std::vector<double> bodies::Box::getDimensions() const
+bool bodies::ConvexMesh::samplePointInside(random_numbers::RandomNumberGenerator& rng, unsigned int max_attempts,
+                                           Eigen::Vector3d& result)
 {
-  std::vector<double> d(3);
-  d[0] = length_;
-  d[1] = width_;
-  d[2] = height_;
-  return d;
+  return samplePointsInside(rng, 1, &result, max_attempts) == 1;
 }
 
-void bodies::Box::updateInternalData()
+std::size_t bodies::ConvexMesh::samplePointsInside(random_numbers::RandomNumberGenerator& rng, std::size_t n,
+                                                   Eigen::Vector3d* result, unsigned int max_attempts)
 {
-  double s2 = scale_ / 2.0;
-  length2_ = length_ * s2 + padding_;
-  width2_ = width_ * s2 + padding_;
-  height2_ = height_ * s2 + padding_;
-
-  center_ = pose_.translation();
-
-  radius2_ = length2_ * length2_ + width2_ * width2_ + height2_ * height2_;
-  radiusB_ = sqrt(radius2_);
-
-  Eigen::Matrix3d basis = pose_.rotation();
-  normalL_ = basis.col(0);
-  normalW_ = basis.col(1);
-  normalH_ = basis.col(2);
-
-  const Eigen::Vector3d tmp(normalL_ * length2_ + normalW_ * width2_ + normalH_ * height2_);
-  corner1_ = center_ - tmp;
-  corner2_ = center_ + tmp;
+  if (!mesh_data_ || mesh_data_->tetrahedron_volumes_.empty() || mesh_data_->tetrahedron_volumes_.back() <= 0.0)
+    return 0;
+  if (padding_ > 0.0 && mesh_data_->inner_radius_ < detail::ZERO)
+    return Body::samplePointsInside(rng, n, result, max_attempts);
+
+  // the padded planes are at most padding_ farther from the center than the planes of the hull, so the
+  // hull grown by this factor contains the padded hull; with padding, containsPoint() also checks the
+  // padded bounding box, so samples are rejected against both
+  const Eigen::Vector3d& center = mesh_data_->mesh_center_;
+  const double grow = 1.0 + padding_ / mesh_data_->inner_radius_;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    for (unsigned int attempt = 0;; ++attempt)
+    {
+      if (attempt >= max_attempts && padding_ > 0.0)
+        return i;
+      const Eigen::Vector3d p = center + (sampleHullPoint(rng) - center) * grow;
+      result[i] = pose_ * Eigen::Vector3d(center + (p - center) * scale_);
+      if (padding_ == 0.0 || (isPointInsidePlanes(p) && bounding_box_.containsPoint(result[i])))
+        break;
+    }
+  }
+  return n;
 }
 
-std::shared_ptr<bodies::Body> bodies::Box::cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const
+bool bodies::ConvexMesh::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                                       EigenSTL::vector_Vector3d* intersections, unsigned int count) const
 {
-  Box* b = new Box();
-  b->length_ = length_;
-  b->width_ = width_;
-  b->height_ = height_;
-  b->padding_ = padding;
-  b->scale_ = scale;
-  b->pose_ = pose;
-  b->updateInternalData();
-  return std::shared_ptr<Body>(b);
+  const Ray ray(origin, dir);
+  Hit hit;
+  if (!intersect(ray, hit))
+    return false;
+  detail::appendHits(ray, hit, intersections, count);
+  return true;
 }
 
-double bodies::Box::computeVolume() const
+bool bodies::ConvexMesh::intersect(const Ray& ray, Hit& hit) const
 {
-  return 8.0 * length2_ * width2_ * height2_;
+  hit.count = 0;
+  if (!mesh_data_)
+    return false;
+  if (detail::distanceSQR(center_, ray) > radiusBSqr_)
+    return false;
+
+  // clip the ray to the oriented bounding box
+  double tenter = -std::numeric_limits<double>::infinity();
+  double texit = std::numeric_limits<double>::infinity();
+  const Eigen::Affine3d& box_pose = bounding_box_.getPose();
+  const Eigen::Vector3d box_origin(ray.origin - box_pose.translation());
+  for (int k = 0; k < 3; ++k)
+  {
+    const Eigen::Vector3d axis(box_pose.linear().col(k));
+    const double half = mesh_data_->box_size_[k] * scale_ / 2.0 + padding_;
+    const double o = axis.dot(box_origin);
+    const double d = axis.dot(ray.dir);
+    const double t1 = (-half - o) / d;
+    const double t2 = (half - o) / d;
+    tenter = std::max(tenter, std::min(t1, t2));
+    texit = std::min(texit, std::max(t1, t2));
+  }
+  // NaN, for a ray in the plane of a face of the box, counts as a miss
+  if (!(tenter <= texit) || texit <= ray.tmin || tenter > ray.tmax)
+    return false;
+
+  // then to each plane of the hull, in the frame of the mesh, as containsPoint() scales and pads them
+  const Eigen::Vector3d orig(i_pose_ * ray.origin);
+  const Eigen::Vector3d dr(i_pose_.linear() * ray.dir);
+  const EigenSTL::vector_Vector4d& planes = mesh_data_->planes_;
+  for (std::size_t i = 0; i < planes.size(); ++i)
+  {
+    const Eigen::Vector3d normal(planes[i].x(), planes[i].y(), planes[i].z());
+    const double offset =
+        scale_ * (planes[i].w() - padding_) + (scale_ - 1.0) * normal.dot(mesh_data_->mesh_center_);
+    const double a = normal.dot(orig) + offset;
+    const double b = normal.dot(dr);
+    if (b < 0.0)
+      tenter = std::max(tenter, -a / b);
+    else if (b > 0.0)
+      texit = std::min(texit, -a / b);
+    else if (a > 0.0)
+      return false;
+    if (tenter > texit)
+      return false;
+  }
+  return detail::clipHit(ray, tenter, texit, hit);
 }
 
-void bodies::Box::computeBoundingSphere(BoundingSphere& sphere) const
+double bodies::ConvexMesh::computeSignedDistance(const Eigen::Vector3d& p) const
 {
-  sphere.center = center_;
-  sphere.radius = radiusB_;
+  double d;
+  computeSignedDistances(&p.x(), &p.y(), &p.z(), 1, &d);
+  return d;
 }
 
-void bodies::Box::computeBoundingCylinder(BoundingCylinder& cylinder) const
+void bodies::ConvexMesh::computeSignedDistances(const double* xs, const double* ys, const double* zs, std::size_t n,
+                                                double* out) const
 {
-  double a, b;
+  if (!mesh_data_)
+  {
+    std::fill(out, out + n, std::numeric_limits<double>::infinity());
+    return;
+  }
 
-  if (length2_ > width2_ && length2_ > height2_)
+  // the planes give the exact distance inside the hull and a lower bound outside of it
+  detail::ConvexMeshPlaneDistanceKernel kernel;
+  kernel.i_pose = i_pose_;
+  kernel.center = mesh_data_->mesh_center_;
+  kernel.scale = scale_;
+  kernel.padding = padding_;
+  kernel.planes = &mesh_data_->planes_;
+  detail::signedDistancesBatched(kernel, xs, ys, zs, n, out);
+
+  // outside, the distance to the closest triangle of the hull is exact
+  const std::vector<unsigned int>& triangles = mesh_data_->triangles_;
+  const EigenSTL::vector_Vector3d& vertices = getScaledVertices();
+  if (triangles.empty())
+    return;
+  for (std::size_t i = 0; i < n; ++i)
   {
-    cylinder.length = length2_ * 2.0;
-    a = width2_;
-    b = height2_;
-    Eigen::Affine3d rot(Eigen::AngleAxisd(90.0f * (M_PI / 180.0f), Eigen::Vector3d::UnitY()));
-    cylinder.pose = pose_ * rot;
+    if (!(out[i] > 0.0))
+      continue;
+    const Eigen::Vector3d p = i_pose_ * Eigen::Vector3d(xs[i], ys[i], zs[i]);
+    double best = std::numeric_limits<double>::infinity();
+    for (std::size_t j = 0; j < triangles.size(); j += 3)
+    {
+      const Eigen::Vector3d closest = detail::closestPointOnTriangle(p, vertices[triangles[j]],
+                                                                     vertices[triangles[j + 1]],
+                                                                     vertices[triangles[j + 2]]);
+      best = std::min(best, (closest - p).squaredNorm());
+    }
+    // with padding, the scaled vertices only approximate the padded planes; never report less than the bound
+    out[i] = std::max(out[i], sqrt(best));
   }
-  else if (width2_ > height2_)
+}
+
+Eigen::Vector3d bodies::ConvexMesh::computeSupportPoint(const Eigen::Vector3d& dir) const
+{
+  const EigenSTL::vector_Vector3d& vertices = getScaledVertices();
+  if (vertices.empty())
+    return pose_.translation();
+  // the scaled vertices are in the frame of the mesh
+  const Eigen::Vector3d local_dir = pose_.linear().transpose() * dir;
+  std::size_t best = 0;
+  double best_dot = vertices[0].dot(local_dir);
+  for (std::size_t i = 1; i < vertices.size(); ++i)
   {
-    cylinder.length = width2_ * 2.0;
-    a = height2_;
-    b = length2_;
-    cylinder.radius = sqrt(height2_ * height2_ + length2_ * length2_);
-    Eigen::Affine3d rot(Eigen::AngleAxisd(90.0f * (M_PI / 180.0f), Eigen::Vector3d::UnitX()));
-    cylinder.pose = pose_ * rot;
+    const double d = vertices[i].dot(local_dir);
+    if (d > best_dot)
+    {
+      best_dot = d;
+      best = i;
+    }
   }
-  else
+  return pose_ * vertices[best];
+}
+
+Eigen::Vector3d bodies::ConvexMesh::computeSurfaceNormal(const Eigen::Vector3d& p) const
+{
+  if (!mesh_data_ || mesh_data_->planes_.empty())
+    return Body::computeSurfaceNormal(p);
+  // the normal of the plane p is farthest out of, or least inside of, as containsPoint() scales and pads it
+  const Eigen::Vector3d local(i_pose_ * p);
+  const EigenSTL::vector_Vector4d& planes = mesh_data_->planes_;
+  std::size_t best = 0;
+  double best_d = -std::numeric_limits<double>::infinity();
+  for (std::size_t i = 0; i < planes.size(); ++i)
   {
-    cylinder.length = height2_ * 2.0;
-    a = width2_;
-    b = length2_;
-    cylinder.pose = pose_;
+    const Eigen::Vector3d normal(planes[i].x(), planes[i].y(), planes[i].z());
+    const double d = normal.dot(local) + scale_ * (planes[i].w() - padding_) +
+                     (scale_ - 1.0) * normal.dot(mesh_data_->mesh_center_);
+    if (d > best_d)
+    {
+      best = i;
+      best_d = d;
+    }
   }
-  cylinder.radius = sqrt(a * a + b * b);
+  return pose_.linear() * Eigen::Vector3d(planes[best].x(), planes[best].y(), planes[best].z());
 }
 
-bool bodies::Box::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
-                                EigenSTL::vector_Vector3d* intersections, unsigned int count) const
+namespace bodies
 {
-  // Brian Smits. Efficient bounding box intersection. Ray tracing news 15(1), 2002
-  float tmin, tmax, tymin, tymax, tzmin, tzmax;
-  float divx, divy, divz;
-  divx = 1 / dir.x();
-  if (divx >= 0)
+namespace detail
+{
+/** \brief Leaves of the triangle hierarchy are not split below this many triangles */
+static const unsigned int TRIANGLE_BVH_LEAF_SIZE = 4;
+
+/** \brief Number of bins the centroids are sorted into when evaluating the surface area heuristic */
+static const int TRIANGLE_BVH_BINS = 16;
+
+/** \brief Nodes of the triangle hierarchy at this depth are not split, so traversal fits a fixed stack */
+static const unsigned int TRIANGLE_BVH_MAX_DEPTH = 48;
+
+/** \brief The bin a centroid at \e value falls into, for centroids in [\e min, \e min + \e extent] */
+static inline int triangleBin(double value, double min, double extent)
+{
+  return std::min(TRIANGLE_BVH_BINS - 1, (int)((value - min) / extent * TRIANGLE_BVH_BINS));
+}
+
+/** \brief Axis-aligned box used while building the triangle hierarchy */
+struct BuildBox
+{
+  BuildBox()
+    : min(Eigen::Vector3d::Constant(std::numeric_limits<double>::infinity()))
+    , max(Eigen::Vector3d::Constant(-std::numeric_limits<double>::infinity()))
   {
-    tmin = (corner1_.x() - origin.x()) * divx;
-    tmax = (corner2_.x() - origin.x()) * divx;
   }
-  else
+
+  void extend(const Eigen::Vector3d& p)
   {
-    tmax = (corner1_.x() - origin.x()) * divx;
-    tmin = (corner2_.x() - origin.x()) * divx;
+    min = min.cwiseMin(p);
+    max = max.cwiseMax(p);
   }
 
-  divy = 1 / dir.y();
-  if (dir.y() >= 0)
+  void extend(const BuildBox& b)
   {
-    tymin = (corner1_.y() - origin.y()) * divy;
-    tymax = (corner2_.y() - origin.y()) * divy;
+    min = min.cwiseMin(b.min);
+    max = max.cwiseMax(b.max);
   }
-  else
+
+  double area() const
   {
-    tymax = (corner1_.y() - origin.y()) * divy;
-    tymin = (corner2_.y() - origin.y()) * divy;
+    if (min.x() > max.x())
+      return 0.0;
+    const Eigen::Vector3d d = max - min;
+    return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
   }
 
-  if ((tmin > tymax || tymin > tmax))
-    return false;
+  Eigen::Vector3d min;
+  Eigen::Vector3d max;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
 
-  if (tymin > tmin)
-    tmin = tymin;
-  if (tymax < tmax)
-    tmax = tymax;
+/** \brief Build the hierarchy over the triangles \e order[begin, end) and append its nodes to \e nodes;
+    the nodes are laid out depth first, with the first child right after its parent */
+template <typename Node>
+static void buildTriangleHierarchy(std::vector<Node>& nodes, std::vector<unsigned int>& order,
+                                   const std::vector<BuildBox, Eigen::aligned_allocator<BuildBox> >& boxes,
+                                   const EigenSTL::vector_Vector3d& centroids, unsigned int begin, unsigned int end,
+                                   unsigned int depth = 0)
+{
+  const std::size_t index = nodes.size();
+  nodes.push_back(Node());
 
-  divz = 1 / dir.z();
-  if (dir.z() >= 0)
+  BuildBox box, centroid_box;
+  for (unsigned int i = begin; i < end; ++i)
   {
-    tzmin = (corner1_.z() - origin.z()) * divz;
-    tzmax = (corner2_.z() - origin.z()) * divz;
+    box.extend(boxes[order[i]]);
+    centroid_box.extend(centroids[order[i]]);
   }
-  else
+  // round the box outwards, so the float box still contains the triangles
+  for (int a = 0; a < 3; ++a)
   {
-    tzmax = (corner1_.z() - origin.z()) * divz;
-    tzmin = (corner2_.z() - origin.z()) * divz;
+    float lo = (float)box.min[a], hi = (float)box.max[a];
+    if (lo > box.min[a])
+      lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+    if (hi < box.max[a])
+      hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+    nodes[index].min[a] = lo;
+    nodes[index].max[a] = hi;
   }
 
-  if ((tmin > tzmax || tzmin > tmax))
-    return false;
+  const unsigned int n = end - begin;
+  int best_axis = -1;
+  int best_split = 0;
+  // splitting costs one extra box test per triangle; keep a leaf if that is not worth it
+  double best_cost = n * box.area();
+  if (n > TRIANGLE_BVH_LEAF_SIZE && depth < TRIANGLE_BVH_MAX_DEPTH)
+    for (int a = 0; a < 3; ++a)
+    {
+      const double extent = centroid_box.max[a] - centroid_box.min[a];
+      if (extent <= 0.0)
+        continue;
+      BuildBox bin_boxes[TRIANGLE_BVH_BINS];
+      unsigned int bin_counts[TRIANGLE_BVH_BINS] = { 0 };
+      for (unsigned int i = begin; i < end; ++i)
+      {
+        const int b = triangleBin(centroids[order[i]][a], centroid_box.min[a], extent);
+        bin_boxes[b].extend(boxes[order[i]]);
+        ++bin_counts[b];
+      }
+      // sweep from the right to get the cost of the right side of every split
+      double right_cost[TRIANGLE_BVH_BINS];
+      BuildBox right;
+      unsigned int right_count = 0;
+      for (int b = TRIANGLE_BVH_BINS - 1; b > 0; --b)
+      {
+        right.extend(bin_boxes[b]);
+        right_count += bin_counts[b];
+        right_cost[b] = right_count * right.area();
+      }
+      BuildBox left;
+      unsigned int left_count = 0;
+      for (int b = 1; b < TRIANGLE_BVH_BINS; ++b)
+      {
+        left.extend(bin_boxes[b - 1]);
+        left_count += bin_counts[b - 1];
+        const double cost = box.area() + left_count * left.area() + right_cost[b];
+        if (left_count > 0 && left_count < n && cost < best_cost)
+        {
+          best_cost = cost;
+          best_axis = a;
+          best_split = b;
+        }
+      }
+    }
 
-  if (tzmin > tmin)
-    tmin = tzmin;
-  if (tzmax < tmax)
-    tmax = tzmax;
+  if (best_axis < 0)
+  {
+    nodes[index].first = begin;
+    nodes[index].count = n;
+    return;
+  }
 
-  if (tmax < 0)
-    return false;
+  const double extent = centroid_box.max[best_axis] - centroid_box.min[best_axis];
+  const double min = centroid_box.min[best_axis];
+  std::vector<unsigned int>::iterator middle =
+      std::partition(order.begin() + begin, order.begin() + end, [&](unsigned int t) {
+        return triangleBin(centroids[t][best_axis], min, extent) < best_split;
+      });
+  const unsigned int mid = middle - order.begin();
+  buildTriangleHierarchy(nodes, order, boxes, centroids, begin, mid, depth + 1);
+  nodes[index].first = nodes.size();
+  nodes[index].count = 0;
+  buildTriangleHierarchy(nodes, order, boxes, centroids, mid, end, depth + 1);
+}
 
-  if (intersections)
+/** \brief Check whether the ray \e origin + t * \e dir with inverse direction \e inv_dir crosses the box
+    of \e node for some t in [0, \e t_max] */
+template <typename Node>
+static inline bool rayHitsNode(const Node& node, const Eigen::Vector3d& origin, const Eigen::Vector3d& inv_dir,
+                               double t_max)
+{
+  double t_near = 0.0;
+  for (int a = 0; a < 3; ++a)
   {
-    if (tmax - tmin > detail::ZERO)
-    {
-      intersections->push_back(tmin * dir + origin);
-      if (count > 1)
-        intersections->push_back(tmax * dir + origin);
-    }
-    else
-      intersections->push_back(tmax * dir + origin);
+    double t1 = (node.min[a] - origin[a]) * inv_dir[a];
+    double t2 = (node.max[a] - origin[a]) * inv_dir[a];
+    // 0 * inf gives NaN for rays in the plane of a face; treat them as crossing it
+    if (t1 != t1)
+      t1 = -std::numeric_limits<double>::infinity();
+    if (t2 != t2)
+      t2 = std::numeric_limits<double>::infinity();
+    if (t1 > t2)
+      std::swap(t1, t2);
+    t_near = std::max(t_near, t1);
+    t_max = std::min(t_max, t2);
   }
-
-  return true;
+  return t_near <= t_max;
 }
 
-bool bodies::ConvexMesh::containsPoint(const Eigen::Vector3d& p, bool verbose) const
+/** \brief The squared distance from \e p to the box of \e node */
+template <typename Node>
+static inline double squaredDistanceToNode(const Node& node, const Eigen::Vector3d& p)
 {
-  if (!mesh_data_)
-    return false;
-  if (bounding_box_.containsPoint(p))
+  double d2 = 0.0;
+  for (int a = 0; a < 3; ++a)
   {
-    Eigen::Vector3d ip(i_pose_ * p);
-    ip = mesh_data_->mesh_center_ + (ip - mesh_data_->mesh_center_) / scale_;
-    return isPointInsidePlanes(ip);
+    const double d = std::max(std::max(node.min[a] - p[a], p[a] - node.max[a]), 0.0);
+    d2 += d * d;
   }
-  else
-    return false;
+  return d2;
 }
 
-void bodies::ConvexMesh::correctVertexOrderFromPlanes()
+/** \brief The parameter at which the ray crosses the triangle (\e a, \e b, \e c), or a negative value if
+    it does not (Moeller-Trumbore) */
+static inline double rayTriangle(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir, const Eigen::Vector3d& a,
+                                 const Eigen::Vector3d& b, const Eigen::Vector3d& c)
 {
-  for (unsigned int i = 0; i < mesh_data_->triangles_.size(); i += 3)
+  const Eigen::Vector3d e1 = b - a;
+  const Eigen::Vector3d e2 = c - a;
+  const Eigen::Vector3d p = dir.cross(e2);
+  const double det = e1.dot(p);
+  if (std::fabs(det) < 1e-300)
+    return -1.0;
+  const double inv_det = 1.0 / det;
+  const Eigen::Vector3d s = origin - a;
+  const double u = s.dot(p) * inv_det;
+  if (u < 0.0 || u > 1.0)
+    return -1.0;
+  const Eigen::Vector3d q = s.cross(e1);
+  const double v = dir.dot(q) * inv_det;
+  if (v < 0.0 || u + v > 1.0)
+    return -1.0;
+  return e2.dot(q) * inv_det;
+}
+
+/** \brief Collects the parameters of the crossings of a ray with the triangles */
+struct RayCrossings
+{
+  void operator()(double t)
   {
-    Eigen::Vector3d d1 =
-        mesh_data_->vertices_[mesh_data_->triangles_[i]] - mesh_data_->vertices_[mesh_data_->triangles_[i + 1]];
-    Eigen::Vector3d d2 =
-        mesh_data_->vertices_[mesh_data_->triangles_[i]] - mesh_data_->vertices_[mesh_data_->triangles_[i + 2]];
-    // expected computed normal from triangle vertex order
-    Eigen::Vector3d tri_normal = d1.cross(d2);
-    tri_normal.normalize();
-    // actual plane normal
-    Eigen::Vector3d normal(mesh_data_->planes_[mesh_data_->plane_for_triangle_[i / 3]].x(),
-                           mesh_data_->planes_[mesh_data_->plane_for_triangle_[i / 3]].y(),
-                           mesh_data_->planes_[mesh_data_->plane_for_triangle_[i / 3]].z());
-    bool same_dir = tri_normal.dot(normal) > 0;
-    if (!same_dir)
-    {
-      std::swap(mesh_data_->triangles_[i], mesh_data_->triangles_[i + 1]);
-    }
+    ts.push_back(t);
+  }
+  std::vector<double> ts;
+};
+
+/** \brief Counts the crossings of a ray with the triangles */
+struct RayCrossingCount
+{
+  RayCrossingCount() : count(0)
+  {
+  }
+  void operator()(double /* t */)
+  {
+    ++count;
   }
+  unsigned int count;
+};
+}
 }
 
-void bodies::ConvexMesh::useDimensions(const shapes::Shape* shape)
+std::vector<double> bodies::TriangleMesh::getDimensions() const
 {
-  mesh_data_.reset(new MeshData());
-  const shapes::Mesh* mesh = static_cast<const shapes::Mesh*>(shape);
+  return std::vector<double>();
+}
 
-  double maxX = -std::numeric_limits<double>::infinity(), maxY = -std::numeric_limits<double>::infinity(),
-         maxZ = -std::numeric_limits<double>::infinity();
-  double minX = std::numeric_limits<double>::infinity(), minY = std::numeric_limits<double>::infinity(),
-         minZ = std::numeric_limits<double>::infinity();
+void bodies::TriangleMesh::useDimensions(const shapes::Shape* shape)
+{
+  const shapes::Mesh* mesh = static_cast<const shapes::Mesh*>(shape);
+  MeshData* data = new MeshData();
 
+  data->vertices_.resize(mesh->vertex_count);
+  Eigen::Vector3d min = Eigen::Vector3d::Zero(), max = Eigen::Vector3d::Zero();
   for (unsigned int i = 0; i < mesh->vertex_count; ++i)
   {
-    double vx = mesh->vertices[3 * i];
-    double vy = mesh->vertices[3 * i + 1];
-    double vz = mesh->vertices[3 * i + 2];
+    data->vertices_[i] = Eigen::Vector3d(mesh->getVertexCoordinate(3 * i), mesh->getVertexCoordinate(3 * i + 1),
+                                         mesh->getVertexCoordinate(3 * i + 2));
+    min = i == 0 ? data->vertices_[i] : Eigen::Vector3d(min.cwiseMin(data->vertices_[i]));
+    max = i == 0 ? data->vertices_[i] : Eigen::Vector3d(max.cwiseMax(data->vertices_[i]));
+  }
+  data->box_center_ = (min + max) / 2.0;
+  data->box_size_ = max - min;
+
+  // scale about the mean of the vertices of the convex hull, as ConvexMesh does, so that both bodies
+  // agree on convex meshes at any scale; the hull is not kept, so it stays out of the cache of ConvexMesh
+  EigenSTL::vector_Vector3d hull_vertices;
+  data->mesh_center_ = data->box_center_;
+  if (detail::computeConvexHull(mesh, hull_vertices, NULL, NULL) && !hull_vertices.empty())
+  {
+    Eigen::Vector3d sum(0.0, 0.0, 0.0);
+    for (std::size_t i = 0; i < hull_vertices.size(); ++i)
+      sum += hull_vertices[i];
+    data->mesh_center_ = sum / (double)hull_vertices.size();
+  }
+  shapes::computeMinimumBoundingSphere(data->vertices_, data->sphere_center_, data->mesh_radiusB_);
+
+  data->triangles_.resize(3 * mesh->triangle_count);
+  for (unsigned int i = 0; i < data->triangles_.size(); ++i)
+    data->triangles_[i] = mesh->getTriangleIndex(i);
+
+  // volume (divergence theorem) and area, and the boxes and centroids the hierarchy is built from
+  std::vector<detail::BuildBox, Eigen::aligned_allocator<detail::BuildBox> > boxes(mesh->triangle_count);
+  EigenSTL::vector_Vector3d centroids(mesh->triangle_count);
+  std::vector<unsigned int> order(mesh->triangle_count);
+  data->volume_ = 0.0;
+  data->area_ = 0.0;
+  for (unsigned int i = 0; i < mesh->triangle_count; ++i)
+  {
+    const Eigen::Vector3d& a = data->vertices_[data->triangles_[3 * i]];
+    const Eigen::Vector3d& b = data->vertices_[data->triangles_[3 * i + 1]];
+    const Eigen::Vector3d& c = data->vertices_[data->triangles_[3 * i + 2]];
+    data->volume_ += (a - data->mesh_center_).dot((b - data->mesh_center_).cross(c - data->mesh_center_)) / 6.0;
+    data->area_ += (b - a).cross(c - a).norm() / 2.0;
+    boxes[i].extend(a);
+    boxes[i].extend(b);
+    boxes[i].extend(c);
+    centroids[i] = (a + b + c) / 3.0;
+    order[i] = i;
+  }
+  data->volume_ = std::fabs(data->volume_);
 
-    if (maxX < vx)
-      maxX = vx;
-    if (maxY < vy)
-      maxY = vy;
-    if (maxZ < vz)
-      maxZ = vz;
+  if (mesh->triangle_count > 0)
+    detail::buildTriangleHierarchy(data->nodes_, order, boxes, centroids, 0, mesh->triangle_count);
 
-    if (minX > vx)
-      minX = vx;
-    if (minY > vy)
-      minY = vy;
-    if (minZ > vz)
-      minZ = vz;
-  }
+  data->corners_.resize(3 * order.size());
+  for (std::size_t i = 0; i < order.size(); ++i)
+    for (int k = 0; k < 3; ++k)
+      data->corners_[3 * i + k] = data->vertices_[data->triangles_[3 * order[i] + k]];
 
-  if (maxX < minX)
-    maxX = minX = 0.0;
-  if (maxY < minY)
-    maxY = minY = 0.0;
-  if (maxZ < minZ)
-    maxZ = minZ = 0.0;
+  mesh_data_.reset(data);
+}
 
-  mesh_data_->box_size_ = Eigen::Vector3d(maxX - minX, maxY - minY, maxZ - minZ);
+void bodies::TriangleMesh::updateInternalData()
+{
+  if (!mesh_data_)
+    return;
 
-  mesh_data_->box_offset_ = Eigen::Vector3d((minX + maxX) / 2.0, (minY + maxY) / 2.0, (minZ + maxZ) / 2.0);
+  const shapes::Box box_shape(mesh_data_->box_size_.x(), mesh_data_->box_size_.y(), mesh_data_->box_size_.z());
+  bounding_box_.setDimensions(&box_shape);
+  bounding_box_.setPadding(padding_);
+  bounding_box_.setScale(scale_);
+  radiusB_ = mesh_data_->mesh_radiusB_ * scale_ + padding_;
+  updateInternalPose();
+}
 
-  mesh_data_->planes_.clear();
-  mesh_data_->triangles_.clear();
-  mesh_data_->vertices_.clear();
-  mesh_data_->mesh_radiusB_ = 0.0;
-  mesh_data_->mesh_center_ = Eigen::Vector3d();
+void bodies::TriangleMesh::updateInternalPose()
+{
+  if (!mesh_data_)
+    return;
+  i_pose_ = pose_.inverse();
+  // the box is scaled about its own center, so move that center as the mesh scales about mesh_center_
+  center_ = pose_ * (mesh_data_->mesh_center_ + (mesh_data_->box_center_ - mesh_data_->mesh_center_) * scale_);
+  sphere_center_ =
+      pose_ * (mesh_data_->mesh_center_ + (mesh_data_->sphere_center_ - mesh_data_->mesh_center_) * scale_);
+  Eigen::Affine3d pose = pose_;
+  pose.translation() = center_;
+  bounding_box_.setPose(pose);
+}
+
+const std::vector<unsigned int>& bodies::TriangleMesh::getTriangles() const
+{
+  static const std::vector<unsigned int> empty;
+  return mesh_data_ ? mesh_data_->triangles_ : empty;
+}
 
-  double xdim = maxX - minX;
-  double ydim = maxY - minY;
-  double zdim = maxZ - minZ;
+const EigenSTL::vector_Vector3d& bodies::TriangleMesh::getVertices() const
+{
+  static const EigenSTL::vector_Vector3d empty;
+  return mesh_data_ ? mesh_data_->vertices_ : empty;
+}
 
-  double pose1;
-  double pose2;
+Eigen::Vector3d bodies::TriangleMesh::toMeshFrame(const Eigen::Vector3d& p) const
+{
+  return mesh_data_->mesh_center_ + (i_pose_ * p - mesh_data_->mesh_center_) / scale_;
+}
 
-  unsigned int off1;
-  unsigned int off2;
+template <typename Visitor>
+void bodies::TriangleMesh::visitRayCrossings(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                                             Visitor& visit) const
+{
+  const std::vector<Node>& nodes = mesh_data_->nodes_;
+  const EigenSTL::vector_Vector3d& corners = mesh_data_->corners_;
+  if (nodes.empty())
+    return;
+  const Eigen::Vector3d inv_dir = dir.cwiseInverse();
+  const double t_max = std::numeric_limits<double>::infinity();
 
-  /* compute bounding cylinder */
-  double cyl_length;
-  double maxdist = -std::numeric_limits<double>::infinity();
-  if (xdim > ydim && xdim > zdim)
+  unsigned int stack[detail::TRIANGLE_BVH_MAX_DEPTH + 2];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0)
   {
-    off1 = 1;
-    off2 = 2;
-    pose1 = mesh_data_->box_offset_.y();
-    pose2 = mesh_data_->box_offset_.z();
-    cyl_length = xdim;
-  }
-  else if (ydim > zdim)
-  {
-    off1 = 0;
-    off2 = 2;
-    pose1 = mesh_data_->box_offset_.x();
-    pose2 = mesh_data_->box_offset_.z();
-    cyl_length = ydim;
-  }
-  else
-  {
-    off1 = 0;
-    off2 = 1;
-    pose1 = mesh_data_->box_offset_.x();
-    pose2 = mesh_data_->box_offset_.y();
-    cyl_length = zdim;
+    const unsigned int index = stack[--top];
+    const Node& node = nodes[index];
+    if (!detail::rayHitsNode(node, origin, inv_dir, t_max))
+      continue;
+    if (node.count > 0)
+    {
+      for (unsigned int i = node.first; i < node.first + node.count; ++i)
+      {
+        const double t = detail::rayTriangle(origin, dir, corners[3 * i], corners[3 * i + 1], corners[3 * i + 2]);
+        if (t >= 0.0)
+          visit(t);
+      }
+    }
+    else
+    {
+      stack[top++] = node.first;
+      stack[top++] = index + 1;
+    }
   }
+}
 
-  /* compute convex hull */
-  coordT* points = (coordT*)calloc(mesh->vertex_count * 3, sizeof(coordT));
-  for (unsigned int i = 0; i < mesh->vertex_count; ++i)
-  {
-    points[3 * i + 0] = (coordT)mesh->vertices[3 * i + 0];
-    points[3 * i + 1] = (coordT)mesh->vertices[3 * i + 1];
-    points[3 * i + 2] = (coordT)mesh->vertices[3 * i + 2];
+bool bodies::TriangleMesh::isInside(const Eigen::Vector3d& p) const
+{
+  // a direction that is unlikely to graze the edges of meshes built on a grid
+  static const Eigen::Vector3d dir = Eigen::Vector3d(1.0, 0.0013165, 0.0021337).normalized();
+  detail::RayCrossingCount crossings;
+  visitRayCrossings(p, dir, crossings);
+  return crossings.count % 2 == 1;
+}
 
-    double dista = mesh->vertices[3 * i + off1] - pose1;
-    double distb = mesh->vertices[3 * i + off2] - pose2;
-    double dist = sqrt(((dista * dista) + (distb * distb)));
-    if (dist > maxdist)
-      maxdist = dist;
+double bodies::TriangleMesh::computeDistance(const Eigen::Vector3d& p, double max_distance) const
+{
+  const std::vector<Node>& nodes = mesh_data_->nodes_;
+  const EigenSTL::vector_Vector3d& corners = mesh_data_->corners_;
+  double best = max_distance * max_distance;
+  bool found = false;
+  if (nodes.empty())
+    return std::numeric_limits<double>::infinity();
+
+  unsigned int stack[detail::TRIANGLE_BVH_MAX_DEPTH + 2];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0)
+  {
+    const Node& node = nodes[stack[--top]];
+    if (node.count > 0)
+    {
+      for (unsigned int i = node.first; i < node.first + node.count; ++i)
+      {
+        const double d2 =
+            (detail::closestPointOnTriangle(p, corners[3 * i], corners[3 * i + 1], corners[3 * i + 2]) - p)
+                .squaredNorm();
+        if (d2 <= best)
+        {
+          best = d2;
+          found = true;
+        }
+      }
+      continue;
+    }
+    // visit the closer child first, so the farther one is more likely to be pruned
+    const unsigned int left = &node - &nodes[0] + 1, right = node.first;
+    const double d_left = detail::squaredDistanceToNode(nodes[left], p);
+    const double d_right = detail::squaredDistanceToNode(nodes[right], p);
+    if (d_left < d_right)
+    {
+      if (d_right <= best)
+        stack[top++] = right;
+      if (d_left <= best)
+        stack[top++] = left;
+    }
+    else
+    {
+      if (d_left <= best)
+        stack[top++] = left;
+      if (d_right <= best)
+        stack[top++] = right;
+    }
   }
-  mesh_data_->bounding_cylinder_.radius = maxdist;
-  mesh_data_->bounding_cylinder_.length = cyl_length;
+  return found ? std::sqrt(best) : std::numeric_limits<double>::infinity();
+}
 
-  static FILE* null = fopen("/dev/null", "w");
+bool bodies::TriangleMesh::containsPoint(const Eigen::Vector3d& p, bool /* verbose */) const
+{
+  if (!mesh_data_ || !bounding_box_.containsPoint(p))
+    return false;
+  const Eigen::Vector3d q = toMeshFrame(p);
+  if (isInside(q))
+    return true;
+  return padding_ > 0.0 && computeDistance(q, padding_ / scale_) <= padding_ / scale_;
+}
 
-  char flags[] = "qhull Tv Qt";
-  int exitcode = qh_new_qhull(3, mesh->vertex_count, points, true, flags, null, null);
+double bodies::TriangleMesh::computeVolume() const
+{
+  if (!mesh_data_)
+    return 0.0;
+  return mesh_data_->volume_ * scale_ * scale_ * scale_ + mesh_data_->area_ * scale_ * scale_ * padding_;
+}
 
-  if (exitcode != 0)
-  {
-    CONSOLE_BRIDGE_logWarn("Convex hull creation failed");
-    qh_freeqhull(!qh_ALL);
-    int curlong, totlong;
-    qh_memfreeshort(&curlong, &totlong);
-    return;
-  }
+void bodies::TriangleMesh::computeBoundingSphere(BoundingSphere& sphere) const
+{
+  sphere.center = sphere_center_;
+  sphere.radius = radiusB_;
+}
 
-  int num_facets = qh num_facets;
+void bodies::TriangleMesh::computeBoundingCylinder(BoundingCylinder& cylinder) const
+{
+  bounding_box_.computeBoundingCylinder(cylinder);
+}
 
-  int num_vertices = qh num_vertices;
-  mesh_data_->vertices_.reserve(num_vertices);
-  Eigen::Vector3d sum(0, 0, 0);
+bool bodies::TriangleMesh::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                                         EigenSTL::vector_Vector3d* intersections, unsigned int count) const
+{
+  if (!mesh_data_ || detail::distanceSQR(sphere_center_, origin, dir) > radiusB_ * radiusB_)
+    return false;
 
-  // necessary for FORALLvertices
-  std::map<unsigned int, unsigned int> qhull_vertex_table;
-  vertexT* vertex;
-  FORALLvertices
+  // the ray in the unscaled frame of the mesh; the direction is divided by the scale so that the ray
+  // parameter is the same in both frames
+  const Eigen::Vector3d o = toMeshFrame(origin);
+  const Eigen::Vector3d d = i_pose_.linear() * dir / scale_;
+
+  if (padding_ > 0.0)
   {
-    Eigen::Vector3d vert(vertex->point[0], vertex->point[1], vertex->point[2]);
-    qhull_vertex_table[vertex->id] = mesh_data_->vertices_.size();
-    sum += vert;
-    mesh_data_->vertices_.push_back(vert);
+    // step along the ray by the distance to the padded surface, from outside as well as from inside: the
+    // padded volume is the mesh grown by a ball, so a ball as large as the depth of a point stays on its side
+    const double padding = padding_ / scale_;
+    const double speed = d.norm();
+    const double tolerance = 1e-9 * std::max(1.0, mesh_data_->mesh_radiusB_);
+    const double t_end = ((o - mesh_data_->sphere_center_).norm() + mesh_data_->mesh_radiusB_ + padding) / speed;
+    unsigned int reported = 0;
+    bool on_surface = false;
+    double t = 0.0;
+    for (int i = 0; i < 1000 && t <= t_end; ++i)
+    {
+      const Eigen::Vector3d q = o + d * t;
+      const double distance = computeDistance(q);
+      // positive inside the padded volume, negative outside of it
+      const double depth = isInside(q) ? distance + padding : padding - distance;
+      if (std::fabs(depth) > tolerance)
+        on_surface = false;
+      else if (!on_surface)
+      {
+        if (!intersections)
+          return true;
+        intersections->push_back(origin + dir * t);
+        if (++reported == count)
+          return true;
+        on_surface = true;
+      }
+      // leave the surface just reached before stepping by the depth again
+      t += std::max(std::fabs(depth), 2.0 * tolerance) / speed;
+    }
+    return reported > 0;
   }
 
-  mesh_data_->mesh_center_ = sum / (double)(num_vertices);
-  for (unsigned int j = 0; j < mesh_data_->vertices_.size(); ++j)
+  detail::RayCrossings crossings;
+  visitRayCrossings(o, d, crossings);
+  if (crossings.ts.empty())
+    return false;
+  if (intersections)
   {
-    double dist = (mesh_data_->vertices_[j] - mesh_data_->mesh_center_).squaredNorm();
-    if (dist > mesh_data_->mesh_radiusB_)
-      mesh_data_->mesh_radiusB_ = dist;
+    // a ray through an edge or a vertex crosses every triangle sharing it; report that point once
+    std::sort(crossings.ts.begin(), crossings.ts.end());
+    unsigned int reported = 0;
+    for (std::size_t i = 0; i < crossings.ts.size() && (count == 0 || reported < count); ++i)
+    {
+      if (i > 0 && crossings.ts[i] - crossings.ts[i - 1] <= detail::ZERO * std::max(1.0, crossings.ts[i]))
+        continue;
+      intersections->push_back(origin + dir * crossings.ts[i]);
+      ++reported;
+    }
   }
+  return true;
+}
 
-  mesh_data_->mesh_radiusB_ = sqrt(mesh_data_->mesh_radiusB_);
-  mesh_data_->triangles_.reserve(num_facets);
+double bodies::TriangleMesh::computeSignedDistance(const Eigen::Vector3d& p) const
+{
+  if (!mesh_data_ || mesh_data_->nodes_.empty())
+    return std::numeric_limits<double>::infinity();
+  const Eigen::Vector3d q = toMeshFrame(p);
+  const double distance = computeDistance(q) * scale_;
+  return (isInside(q) ? -distance : distance) - padding_;
+}
 
-  // neccessary for qhull macro
-  facetT* facet;
-  FORALLfacets
+Eigen::Vector3d bodies::TriangleMesh::computeSupportPoint(const Eigen::Vector3d& dir) const
+{
+  if (!mesh_data_ || mesh_data_->vertices_.empty())
+    return pose_.translation();
+  const Eigen::Vector3d local_dir = pose_.linear().transpose() * dir;
+  const EigenSTL::vector_Vector3d& vertices = mesh_data_->vertices_;
+  std::size_t best = 0;
+  double best_dot = vertices[0].dot(local_dir);
+  for (std::size_t i = 1; i < vertices.size(); ++i)
   {
-    Eigen::Vector4d planeEquation(facet->normal[0], facet->normal[1], facet->normal[2], facet->offset);
-    if (!mesh_data_->planes_.empty())
+    const double d = vertices[i].dot(local_dir);
+    if (d > best_dot)
     {
-      // filter equal planes - assuming same ones follow each other
-      if ((planeEquation - mesh_data_->planes_.back()).cwiseAbs().maxCoeff() > 1e-6)  // max diff to last
-        mesh_data_->planes_.push_back(planeEquation);
-    }
-    else
-    {
-      mesh_data_->planes_.push_back(planeEquation);
+      best_dot = d;
+      best = i;
     }
+  }
+  const double norm = local_dir.norm();
+  Eigen::Vector3d support = mesh_data_->mesh_center_ + (vertices[best] - mesh_data_->mesh_center_) * scale_;
+  if (norm > detail::ZERO)
+    support += local_dir * (padding_ / norm);
+  return pose_ * support;
+}
 
-    // Needed by FOREACHvertex_i_
-    int vertex_n, vertex_i;
-    FOREACHvertex_i_((*facet).vertices)
-    {
-      mesh_data_->triangles_.push_back(qhull_vertex_table[vertex->id]);
-    }
+std::shared_ptr<bodies::Body> bodies::TriangleMesh::cloneAt(const Eigen::Affine3d& pose, double padding,
+                                                            double scale) const
+{
+  TriangleMesh* m = new TriangleMesh();
+  m->mesh_data_ = mesh_data_;
+  m->padding_ = padding;
+  m->scale_ = scale;
+  m->pose_ = pose;
+  m->updateInternalData();
+  return std::shared_ptr<Body>(m);
+}
 
-    mesh_data_->plane_for_triangle_[(mesh_data_->triangles_.size() - 1) / 3] = mesh_data_->planes_.size() - 1;
-  }
-  qh_freeqhull(!qh_ALL);
-  int curlong, totlong;
-  qh_memfreeshort(&curlong, &totlong);
+namespace bodies
+{
+namespace detail
+{
+/** \brief Keys are offset so that the voxel containing the origin has key 32768 along each axis */
+static const int OCTREE_KEY_OFFSET = 32768;
+static const int OCTREE_KEY_MAX = 65535;
+
+/** \brief The distance from \e p to the voxel with key \e key */
+static inline double distanceToVoxel(const Eigen::Vector3d& p, int x, int y, int z, double resolution)
+{
+  const Eigen::Vector3d center((x - OCTREE_KEY_OFFSET + 0.5) * resolution, (y - OCTREE_KEY_OFFSET + 0.5) * resolution,
+                               (z - OCTREE_KEY_OFFSET + 0.5) * resolution);
+  return ((p - center).cwiseAbs().array() - 0.5 * resolution).max(0.0).matrix().norm();
+}
+}
 }
 
-std::vector<double> bodies::ConvexMesh::getDimensions() const
+std::vector<double> bodies::OcTree::getDimensions() const
 {
   return std::vector<double>();
 }
 
-void bodies::ConvexMesh::computeScaledVerticesFromPlaneProjections()
+void bodies::OcTree::useDimensions(const shapes::Shape* shape)
 {
-  // compute the scaled vertices, if needed
-  if (padding_ == 0.0 && scale_ == 1.0)
-  {
-    scaled_vertices_ = &mesh_data_->vertices_;
-    return;
-  }
-
-  if (!scaled_vertices_storage_)
-    scaled_vertices_storage_.reset(new EigenSTL::vector_Vector3d());
-  scaled_vertices_ = scaled_vertices_storage_.get();
-  scaled_vertices_storage_->resize(mesh_data_->vertices_.size());
-  // project vertices along the vertex - center line to the scaled and padded plane
-  // take the average of all tri's planes around that vertex as the result
-  // is not unique
+  const shapes::OcTree* octree = static_cast<const shapes::OcTree*>(shape);
+  std::vector<VoxelKey>* voxels = new std::vector<VoxelKey>();
+  voxels_center_ = Eigen::Vector3d::Zero();
+  padded_for_ = -1.0;
 
-  // First figure out, which tris are connected to each vertex
-  std::map<unsigned int, std::vector<unsigned int> > vertex_to_tris;
-  for (unsigned int i = 0; i < mesh_data_->triangles_.size() / 3; ++i)
+  if (octree->octree)
   {
-    vertex_to_tris[mesh_data_->triangles_[3 * i + 0]].push_back(i);
-    vertex_to_tris[mesh_data_->triangles_[3 * i + 1]].push_back(i);
-    vertex_to_tris[mesh_data_->triangles_[3 * i + 2]].push_back(i);
-  }
+    const octomap::OcTree& tree = *octree->octree;
+    resolution_ = tree.getResolution();
 
-  for (unsigned int i = 0; i < mesh_data_->vertices_.size(); ++i)
-  {
-    Eigen::Vector3d v(mesh_data_->vertices_[i] - mesh_data_->mesh_center_);
-    EigenSTL::vector_Vector3d projected_vertices;
-    for (unsigned int t = 0; t < vertex_to_tris[i].size(); ++t)
+    // expand the occupied leaves to voxels of the finest resolution
+    for (octomap::OcTree::leaf_iterator it = tree.begin_leafs(), end = tree.end_leafs(); it != end; ++it)
     {
-      const Eigen::Vector4d& plane = mesh_data_->planes_[mesh_data_->plane_for_triangle_[vertex_to_tris[i][t]]];
-      Eigen::Vector3d plane_normal(plane.x(), plane.y(), plane.z());
-      double d_scaled_padded =
-          scale_ * plane.w() - (1 - scale_) * mesh_data_->mesh_center_.dot(plane_normal) - padding_;
-
-      // intersect vert - center with scaled/padded plane equation
-      double denom = v.dot(plane_normal);
-      if (fabs(denom) < 1e-3)
+      if (!tree.isNodeOccupied(*it))
         continue;
-      double lambda = (-mesh_data_->mesh_center_.dot(plane_normal) - d_scaled_padded) / denom;
-      Eigen::Vector3d vert_on_plane = v * lambda + mesh_data_->mesh_center_;
-      projected_vertices.push_back(vert_on_plane);
-    }
-    if (projected_vertices.empty())
-    {
-      double l = v.norm();
-      scaled_vertices_storage_->at(i) =
-          mesh_data_->mesh_center_ + v * (scale_ + (l > detail::ZERO ? padding_ / l : 0.0));
+      const double size = it.getSize();
+      const int n = std::max(1, (int)std::floor(size / resolution_ + 0.5));
+      const double first = 0.5 * (resolution_ - size);
+      const int x = (int)std::floor((it.getX() + first) / resolution_) + detail::OCTREE_KEY_OFFSET;
+      const int y = (int)std::floor((it.getY() + first) / resolution_) + detail::OCTREE_KEY_OFFSET;
+      const int z = (int)std::floor((it.getZ() + first) / resolution_) + detail::OCTREE_KEY_OFFSET;
+      for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+          for (int k = 0; k < n; ++k)
+            voxels->push_back(packKey(x + i, y + j, z + k));
     }
-    else
+    std::sort(voxels->begin(), voxels->end());
+    voxels->erase(std::unique(voxels->begin(), voxels->end()), voxels->end());
+
+    if (!voxels->empty())
     {
-      Eigen::Vector3d sum(0, 0, 0);
-      for (unsigned int v = 0; v < projected_vertices.size(); ++v)
+      int min_key[3] = { detail::OCTREE_KEY_MAX, detail::OCTREE_KEY_MAX, detail::OCTREE_KEY_MAX };
+      int max_key[3] = { 0, 0, 0 };
+      for (std::size_t i = 0; i < voxels->size(); ++i)
       {
-        sum += projected_vertices[v];
+        const int key[3] = { (int)((*voxels)[i] >> 32), (int)(((*voxels)[i] >> 16) & 0xFFFF),
+                             (int)((*voxels)[i] & 0xFFFF) };
+        for (int a = 0; a < 3; ++a)
+        {
+          min_key[a] = std::min(min_key[a], key[a]);
+          max_key[a] = std::max(max_key[a], key[a]);
+        }
       }
-      sum /= projected_vertices.size();
-      scaled_vertices_storage_->at(i) = sum;
+      for (int a = 0; a < 3; ++a)
+        voxels_center_[a] = 0.5 * (min_key[a] + max_key[a] + 1 - 2 * detail::OCTREE_KEY_OFFSET) * resolution_;
     }
   }
+  voxels_.reset(voxels);
 }
 
-void bodies::ConvexMesh::updateInternalData()
+void bodies::OcTree::updateInternalData()
 {
-  if (!mesh_data_)
+  if (!voxels_)
     return;
-  Eigen::Affine3d pose = pose_;
-  pose.translation() = Eigen::Vector3d(pose_ * mesh_data_->box_offset_);
-
-  std::unique_ptr<shapes::Box> box_shape(
-      new shapes::Box(mesh_data_->box_size_.x(), mesh_data_->box_size_.y(), mesh_data_->box_size_.z()));
-  bounding_box_.setDimensions(box_shape.get());
-  bounding_box_.setPose(pose);
-  bounding_box_.setPadding(padding_);
-  bounding_box_.setScale(scale_);
-
-  i_pose_ = pose_.inverse();
-  center_ = pose_ * mesh_data_->mesh_center_;
-  radiusB_ = mesh_data_->mesh_radiusB_ * scale_ + padding_;
-  radiusBSqr_ = radiusB_ * radiusB_;
 
-  // compute the scaled vertices, if needed
-  if (padding_ == 0.0 && scale_ == 1.0)
-    scaled_vertices_ = &mesh_data_->vertices_;
-  else
+  // padding is applied by dilating the voxels, in units of voxels of the unscaled tree
+  const double radius = std::max(0.0, padding_ / (scale_ * resolution_));
+  if (radius != padded_for_ || !padded_voxels_)
   {
-    if (!scaled_vertices_storage_)
-      scaled_vertices_storage_.reset(new EigenSTL::vector_Vector3d());
-    scaled_vertices_ = scaled_vertices_storage_.get();
-    scaled_vertices_storage_->resize(mesh_data_->vertices_.size());
-    for (unsigned int i = 0; i < mesh_data_->vertices_.size(); ++i)
+    std::unordered_set<VoxelKey>* padded = new std::unordered_set<VoxelKey>();
+    padded->reserve(voxels_->size());
+
+    // offsets of the voxels within \e radius (distance between voxel boxes) of a voxel
+    std::vector<Eigen::Vector3i> offsets;
+    const int r = (int)std::floor(radius) + 1;
+    for (int i = -r; i <= r; ++i)
+      for (int j = -r; j <= r; ++j)
+        for (int k = -r; k <= r; ++k)
+        {
+          const Eigen::Vector3d gap(std::max(std::abs(i) - 1, 0), std::max(std::abs(j) - 1, 0),
+                                    std::max(std::abs(k) - 1, 0));
+          if ((i == 0 && j == 0 && k == 0) || (radius > 0.0 && gap.squaredNorm() <= radius * radius))
+            offsets.push_back(Eigen::Vector3i(i, j, k));
+        }
+
+    for (int a = 0; a < 3; ++a)
     {
-      Eigen::Vector3d v(mesh_data_->vertices_[i] - mesh_data_->mesh_center_);
-      double l = v.norm();
-      scaled_vertices_storage_->at(i) =
-          mesh_data_->mesh_center_ + v * (scale_ + (l > detail::ZERO ? padding_ / l : 0.0));
+      min_key_[a] = detail::OCTREE_KEY_MAX;
+      max_key_[a] = 0;
+    }
+    for (std::size_t v = 0; v < voxels_->size(); ++v)
+    {
+      const int key[3] = { (int)((*voxels_)[v] >> 32), (int)(((*voxels_)[v] >> 16) & 0xFFFF),
+                           (int)((*voxels_)[v] & 0xFFFF) };
+      for (std::size_t o = 0; o < offsets.size(); ++o)
+      {
+        const int x = key[0] + offsets[o].x(), y = key[1] + offsets[o].y(), z = key[2] + offsets[o].z();
+        if (x < 0 || y < 0 || z < 0 || x > detail::OCTREE_KEY_MAX || y > detail::OCTREE_KEY_MAX ||
+            z > detail::OCTREE_KEY_MAX)
+          continue;
+        padded->insert(packKey(x, y, z));
+        min_key_[0] = std::min(min_key_[0], x);
+        min_key_[1] = std::min(min_key_[1], y);
+        min_key_[2] = std::min(min_key_[2], z);
+        max_key_[0] = std::max(max_key_[0], x);
+        max_key_[1] = std::max(max_key_[1], y);
+        max_key_[2] = std::max(max_key_[2], z);
+      }
     }
+    padded_voxels_.reset(padded);
+    padded_for_ = radius;
   }
-}
-const std::vector<unsigned int>& bodies::ConvexMesh::getTriangles() const
-{
-  static const std::vector<unsigned int> empty;
-  return mesh_data_ ? mesh_data_->triangles_ : empty;
+
+  // the box around the occupied keys, scaled about the center of the voxels
+  Eigen::Vector3d size = Eigen::Vector3d::Zero();
+  box_center_ = voxels_center_;
+  if (!padded_voxels_->empty())
+    for (int a = 0; a < 3; ++a)
+    {
+      const double lo = (min_key_[a] - detail::OCTREE_KEY_OFFSET) * resolution_;
+      const double hi = (max_key_[a] + 1 - detail::OCTREE_KEY_OFFSET) * resolution_;
+      size[a] = (hi - lo) * scale_;
+      box_center_[a] = voxels_center_[a] + (0.5 * (lo + hi) - voxels_center_[a]) * scale_;
+    }
+  const shapes::Box box(size.x(), size.y(), size.z());
+  bounding_box_.setDimensions(&box);
+  updateInternalPose();
 }
 
-const EigenSTL::vector_Vector3d& bodies::ConvexMesh::getVertices() const
+void bodies::OcTree::updateInternalPose()
 {
-  static const EigenSTL::vector_Vector3d empty;
-  return mesh_data_ ? mesh_data_->vertices_ : empty;
+  i_pose_ = pose_.inverse();
+  Eigen::Affine3d box_pose = pose_;
+  box_pose.translation() = pose_ * box_center_;
+  bounding_box_.setPose(box_pose);
 }
 
-const EigenSTL::vector_Vector3d& bodies::ConvexMesh::getScaledVertices() const
+Eigen::Vector3d bodies::OcTree::toTreeFrame(const Eigen::Vector3d& p) const
 {
-  return scaled_vertices_ ? *scaled_vertices_ : getVertices();
+  return voxels_center_ + (i_pose_ * p - voxels_center_) / scale_;
 }
 
-const EigenSTL::vector_Vector4d& bodies::ConvexMesh::getPlanes() const
+bool bodies::OcTree::pointToKey(const Eigen::Vector3d& p, int key[3]) const
 {
-  static const EigenSTL::vector_Vector4d empty;
-  return mesh_data_ ? mesh_data_->planes_ : empty;
+  for (int a = 0; a < 3; ++a)
+  {
+    const double k = std::floor(p[a] / resolution_) + detail::OCTREE_KEY_OFFSET;
+    if (!(k >= 0.0 && k <= detail::OCTREE_KEY_MAX))
+      return false;
+    key[a] = (int)k;
+  }
+  return true;
 }
 
-std::shared_ptr<bodies::Body> bodies::ConvexMesh::cloneAt(const Eigen::Affine3d& pose, double padding,
-                                                          double scale) const
+bool bodies::OcTree::isOccupied(int x, int y, int z) const
 {
-  ConvexMesh* m = new ConvexMesh();
-  m->mesh_data_ = mesh_data_;
-  m->padding_ = padding;
-  m->scale_ = scale;
-  m->pose_ = pose;
-  m->updateInternalData();
-  return std::shared_ptr<Body>(m);
+  if (x < min_key_[0] || y < min_key_[1] || z < min_key_[2] || x > max_key_[0] || y > max_key_[1] ||
+      z > max_key_[2])
+    return false;
+  return padded_voxels_->count(packKey(x, y, z)) > 0;
 }
 
-void bodies::ConvexMesh::computeBoundingSphere(BoundingSphere& sphere) const
+std::size_t bodies::OcTree::getVoxelCount() const
 {
-  sphere.center = center_;
-  sphere.radius = radiusB_;
+  return padded_voxels_ ? padded_voxels_->size() : 0;
 }
 
-void bodies::ConvexMesh::computeBoundingCylinder(BoundingCylinder& cylinder) const
+bool bodies::OcTree::containsPoint(const Eigen::Vector3d& p, bool /* verbose */) const
 {
-  cylinder.length = mesh_data_ ? mesh_data_->bounding_cylinder_.length : 0.0;
-  cylinder.radius = mesh_data_ ? mesh_data_->bounding_cylinder_.radius : 0.0;
-  // need to do rotation correctly to get pose, which bounding box does
-  BoundingCylinder cyl;
-  bounding_box_.computeBoundingCylinder(cyl);
-  cylinder.pose = cyl.pose;
+  if (!padded_voxels_ || padded_voxels_->empty())
+    return false;
+  int key[3];
+  return pointToKey(toTreeFrame(p), key) && isOccupied(key[0], key[1], key[2]);
 }
 
-bool bodies::ConvexMesh::isPointInsidePlanes(const Eigen::Vector3d& point) const
+double bodies::OcTree::computeVolume() const
 {
-  unsigned int numplanes = mesh_data_->planes_.size();
-  for (unsigned int i = 0; i < numplanes; ++i)
-  {
-    const Eigen::Vector4d& plane = mesh_data_->planes_[i];
-    Eigen::Vector3d plane_vec(plane.x(), plane.y(), plane.z());
-    double dist = plane_vec.dot(point) + plane.w() - padding_ - 1e-6;
-    if (dist > 0.0)
-      return false;
-  }
-  return true;
+  const double edge = resolution_ * scale_;
+  return getVoxelCount() * edge * edge * edge;
 }
 
-unsigned int bodies::ConvexMesh::countVerticesBehindPlane(const Eigen::Vector4f& planeNormal) const
+void bodies::OcTree::computeBoundingSphere(BoundingSphere& sphere) const
 {
-  unsigned int numvertices = mesh_data_->vertices_.size();
-  unsigned int result = 0;
-  for (unsigned int i = 0; i < numvertices; ++i)
-  {
-    Eigen::Vector3d plane_vec(planeNormal.x(), planeNormal.y(), planeNormal.z());
-    double dist = plane_vec.dot(mesh_data_->vertices_[i]) + planeNormal.w() - 1e-6;
-    if (dist > 0.0)
-      result++;
-  }
-  return result;
+  bounding_box_.computeBoundingSphere(sphere);
 }
 
-double bodies::ConvexMesh::computeVolume() const
+void bodies::OcTree::computeBoundingCylinder(BoundingCylinder& cylinder) const
 {
-  double volume = 0.0;
-  if (mesh_data_)
-    for (unsigned int i = 0; i < mesh_data_->triangles_.size() / 3; ++i)
-    {
-      const Eigen::Vector3d& v1 = mesh_data_->vertices_[mesh_data_->triangles_[3 * i + 0]];
-      const Eigen::Vector3d& v2 = mesh_data_->vertices_[mesh_data_->triangles_[3 * i + 1]];
-      const Eigen::Vector3d& v3 = mesh_data_->vertices_[mesh_data_->triangles_[3 * i + 2]];
-      volume += v1.x() * v2.y() * v3.z() + v2.x() * v3.y() * v1.z() + v3.x() * v1.y() * v2.z() -
-                v1.x() * v3.y() * v2.z() - v2.x() * v1.y() * v3.z() - v3.x() * v2.y() * v1.z();
-    }
-  return fabs(volume) / 6.0;
+  bounding_box_.computeBoundingCylinder(cylinder);
 }
 
-bool bodies::ConvexMesh::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
-                                       EigenSTL::vector_Vector3d* intersections, unsigned int count) const
+bool bodies::OcTree::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                                   EigenSTL::vector_Vector3d* intersections, unsigned int count) const
 {
-  if (!mesh_data_)
-    return false;
-  if (detail::distanceSQR(center_, origin, dir) > radiusBSqr_)
-    return false;
-  if (!bounding_box_.intersectsRay(origin, dir))
+  if (!padded_voxels_ || padded_voxels_->empty())
     return false;
 
-  // transform the ray into the coordinate frame of the mesh
-  Eigen::Vector3d orig(i_pose_ * origin);
-  Eigen::Vector3d dr(i_pose_ * dir);
+  // the ray in the unscaled frame of the tree; the direction is divided by the scale so that the
+  // ray parameter is the same in both frames
+  const Eigen::Vector3d o = toTreeFrame(origin);
+  const Eigen::Vector3d d = i_pose_.linear() * dir / scale_;
 
-  std::vector<detail::intersc> ipts;
-
-  bool result = false;
+  // clip the ray to the box of occupied keys
+  double t_near = 0.0;
+  double t_far = std::numeric_limits<double>::infinity();
+  for (int a = 0; a < 3; ++a)
+  {
+    const double lo = (min_key_[a] - detail::OCTREE_KEY_OFFSET) * resolution_;
+    const double hi = (max_key_[a] + 1 - detail::OCTREE_KEY_OFFSET) * resolution_;
+    if (std::fabs(d[a]) < 1e-12)
+    {
+      if (o[a] < lo || o[a] > hi)
+        return false;
+      continue;
+    }
+    double t1 = (lo - o[a]) / d[a];
+    double t2 = (hi - o[a]) / d[a];
+    if (t1 > t2)
+      std::swap(t1, t2);
+    t_near = std::max(t_near, t1);
+    t_far = std::min(t_far, t2);
+  }
+  if (t_near > t_far)
+    return false;
 
-  // for each triangle
-  const unsigned int nt = mesh_data_->triangles_.size() / 3;
-  for (unsigned int i = 0; i < nt; ++i)
+  // the voxel the ray enters the box in; clamped, since the entry point lies on the boundary
+  int key[3];
+  int step[3];
+  double t_max[3];
+  double t_delta[3];
+  const Eigen::Vector3d entry = o + d * t_near;
+  for (int a = 0; a < 3; ++a)
   {
-    Eigen::Vector3d vec(mesh_data_->planes_[mesh_data_->plane_for_triangle_[i]].x(),
-                        mesh_data_->planes_[mesh_data_->plane_for_triangle_[i]].y(),
-                        mesh_data_->planes_[mesh_data_->plane_for_triangle_[i]].z());
+    key[a] = (int)std::floor(entry[a] / resolution_) + detail::OCTREE_KEY_OFFSET;
+    key[a] = std::min(std::max(key[a], min_key_[a]), max_key_[a]);
+    if (std::fabs(d[a]) < 1e-12)
+    {
+      step[a] = 0;
+      t_max[a] = std::numeric_limits<double>::infinity();
+      t_delta[a] = std::numeric_limits<double>::infinity();
+    }
+    else
+    {
+      step[a] = d[a] > 0.0 ? 1 : -1;
+      const double boundary = (key[a] - detail::OCTREE_KEY_OFFSET + (step[a] > 0 ? 1 : 0)) * resolution_;
+      t_max[a] = (boundary - o[a]) / d[a];
+      t_delta[a] = resolution_ / std::fabs(d[a]);
+    }
+  }
 
-    double tmp = vec.dot(dr);
-    if (fabs(tmp) > detail::ZERO)
+  // each change between free and occupied voxels is a crossing of the surface; a ray that starts inside
+  // first crosses it where it leaves the occupied voxels
+  bool occupied = t_near == 0.0 && isOccupied(key[0], key[1], key[2]);
+  double t = t_near;
+  unsigned int found = 0;
+  while (true)
+  {
+    if (isOccupied(key[0], key[1], key[2]) != occupied)
+    {
+      occupied = !occupied;
+      ++found;
+      if (!intersections)
+        break;
+      intersections->push_back(origin + dir * t);
+      if (found == count)
+        break;
+    }
+    const int a = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+    t = t_max[a];
+    key[a] += step[a];
+    if (key[a] < min_key_[a] || key[a] > max_key_[a])
     {
-      double t = -(vec.dot(orig) + mesh_data_->planes_[mesh_data_->plane_for_triangle_[i]].w()) / tmp;
-      if (t > 0.0)
+      // leaving the box also leaves the occupied voxels
+      if (occupied)
       {
-        const int i3 = 3 * i;
-        const int v1 = mesh_data_->triangles_[i3 + 0];
-        const int v2 = mesh_data_->triangles_[i3 + 1];
-        const int v3 = mesh_data_->triangles_[i3 + 2];
-
-        const Eigen::Vector3d& a = scaled_vertices_->at(v1);
-        const Eigen::Vector3d& b = scaled_vertices_->at(v2);
-        const Eigen::Vector3d& c = scaled_vertices_->at(v3);
-
-        Eigen::Vector3d cb(c - b);
-        Eigen::Vector3d ab(a - b);
-
-        // intersection of the plane defined by the triangle and the ray
-        Eigen::Vector3d P(orig + dr * t);
-
-        // check if it is inside the triangle
-        Eigen::Vector3d pb(P - b);
-        Eigen::Vector3d c1(cb.cross(pb));
-        Eigen::Vector3d c2(cb.cross(ab));
-        if (c1.dot(c2) < 0.0)
-          continue;
-
-        Eigen::Vector3d ca(c - a);
-        Eigen::Vector3d pa(P - a);
-        Eigen::Vector3d ba(-ab);
+        ++found;
+        if (intersections)
+          intersections->push_back(origin + dir * t);
+      }
+      break;
+    }
+    t_max[a] += t_delta[a];
+  }
 
-        c1 = ca.cross(pa);
-        c2 = ca.cross(ba);
-        if (c1.dot(c2) < 0.0)
-          continue;
+  return found > 0;
+}
 
-        c1 = ba.cross(pa);
-        c2 = ba.cross(ca);
+double bodies::OcTree::computeSignedDistance(const Eigen::Vector3d& p) const
+{
+  if (!padded_voxels_ || padded_voxels_->empty())
+    return std::numeric_limits<double>::infinity();
 
-        if (c1.dot(c2) < 0.0)
-          continue;
+  const Eigen::Vector3d q = toTreeFrame(p);
+  int key[3];
+  if (!pointToKey(q, key) || !isOccupied(key[0], key[1], key[2]))
+  {
+    double best = std::numeric_limits<double>::infinity();
+    for (std::unordered_set<VoxelKey>::const_iterator it = padded_voxels_->begin(); it != padded_voxels_->end(); ++it)
+      best = std::min(best, detail::distanceToVoxel(q, (int)(*it >> 32), (int)((*it >> 16) & 0xFFFF),
+                                                    (int)(*it & 0xFFFF), resolution_));
+    return best * scale_;
+  }
 
-        result = true;
-        if (intersections)
+  // look for the closest free voxel in growing shells of voxels around the point; a voxel in shell
+  // k is at least (k - 1) voxels away
+  double best = std::numeric_limits<double>::infinity();
+  for (int k = 1; (k - 1) * resolution_ < best; ++k)
+    for (int i = -k; i <= k; ++i)
+      for (int j = -k; j <= k; ++j)
+        for (int l = -k; l <= k; ++l)
         {
-          detail::intersc ip(origin + dir * t, t);
-          ipts.push_back(ip);
+          if (std::abs(i) != k && std::abs(j) != k && std::abs(l) != k)
+            continue;
+          if (!isOccupied(key[0] + i, key[1] + j, key[2] + l))
+            best = std::min(best, detail::distanceToVoxel(q, key[0] + i, key[1] + j, key[2] + l, resolution_));
         }
-        else
-          break;
-      }
+  return -best * scale_;
+}
+
+Eigen::Vector3d bodies::OcTree::computeSupportPoint(const Eigen::Vector3d& dir) const
+{
+  if (!padded_voxels_ || padded_voxels_->empty())
+    return pose_.translation();
+
+  // the farthest voxel center, then the farthest corner of that voxel
+  const Eigen::Vector3d local_dir = pose_.linear().transpose() * dir;
+  double best_dot = -std::numeric_limits<double>::infinity();
+  Eigen::Vector3d best;
+  for (std::unordered_set<VoxelKey>::const_iterator it = padded_voxels_->begin(); it != padded_voxels_->end(); ++it)
+  {
+    const Eigen::Vector3d center(((int)(*it >> 32) - detail::OCTREE_KEY_OFFSET + 0.5) * resolution_,
+                                 ((int)((*it >> 16) & 0xFFFF) - detail::OCTREE_KEY_OFFSET + 0.5) * resolution_,
+                                 ((int)(*it & 0xFFFF) - detail::OCTREE_KEY_OFFSET + 0.5) * resolution_);
+    const double d = center.dot(local_dir);
+    if (d > best_dot)
+    {
+      best_dot = d;
+      best = center;
     }
   }
+  for (int a = 0; a < 3; ++a)
+    best[a] += local_dir[a] >= 0.0 ? 0.5 * resolution_ : -0.5 * resolution_;
+  return pose_ * (voxels_center_ + (best - voxels_center_) * scale_);
+}
 
-  if (intersections)
+std::shared_ptr<bodies::Body> bodies::OcTree::cloneAt(const Eigen::Affine3d& pose, double padding, double scale) const
+{
+  OcTree* o = new OcTree();
+  o->resolution_ = resolution_;
+  o->voxels_ = voxels_;
+  o->voxels_center_ = voxels_center_;
+  o->padding_ = padding;
+  o->scale_ = scale;
+  o->pose_ = pose;
+  // the dilated voxels are shared as well if the padding is the same in units of voxels
+  if (padded_voxels_ && std::max(0.0, padding / (scale * resolution_)) == padded_for_)
   {
-    std::sort(ipts.begin(), ipts.end(), detail::interscOrder());
-    const unsigned int n = count > 0 ? std::min<unsigned int>(count, ipts.size()) : ipts.size();
-    for (unsigned int i = 0; i < n; ++i)
-      intersections->push_back(ipts[i].pt);
+    o->padded_voxels_ = padded_voxels_;
+    o->padded_for_ = padded_for_;
+    std::copy(min_key_, min_key_ + 3, o->min_key_);
+    std::copy(max_key_, max_key_ + 3, o->max_key_);
   }
-
-  return result;
+  o->updateInternalData();
+  return std::shared_ptr<Body>(o);
 }
 
-bodies::BodyVector::BodyVector()
+const std::size_t bodies::BodyVector::NO_BODY;
+
+bodies::BodyVector::BodyVector() : use_bvh_(false), bvh_dirty_(false)
 {
 }
 
 bodies::BodyVector::BodyVector(const std::vector<shapes::Shape*>& shapes, const EigenSTL::vector_Affine3d& poses,
                                double padding)
+  : use_bvh_(false), bvh_dirty_(false)
 {
   for (unsigned int i = 0; i < shapes.size(); i++)
     addBody(shapes[i], poses[i], padding);
@@ -1186,13 +4042,20 @@ void bodies::BodyVector::clear()
   for (unsigned int i = 0; i < bodies_.size(); i++)
     delete bodies_[i];
   bodies_.clear();
+  bounding_spheres_.clear();
+  bvh_nodes_.clear();
+  bvh_leaf_for_body_.clear();
+  bvh_dirty_ = false;
 }
 
 void bodies::BodyVector::addBody(Body* body)
 {
   bodies_.push_back(body);
-  BoundingSphere sphere;
-  body->computeBoundingSphere(sphere);
+  bounding_spheres_.push_back(BoundingSphere());
+  body->computeBoundingSphere(bounding_spheres_.back());
+  // the hierarchy is rebuilt once, by the next query, rather than after each body that is added
+  if (use_bvh_)
+    bvh_dirty_ = true;
 }
 
 void bodies::BodyVector::addBody(const shapes::Shape* shape, const Eigen::Affine3d& pose, double padding)
@@ -1217,6 +4080,145 @@ void bodies::BodyVector::setPose(unsigned int i, const Eigen::Affine3d& pose)
   }
 
   bodies_[i]->setPose(pose);
+  bodies_[i]->computeBoundingSphere(bounding_spheres_[i]);
+  if (use_bvh_ && !bvh_dirty_)
+    refitBoundingVolumeHierarchy(bvh_leaf_for_body_[i]);
+}
+
+void bodies::BodyVector::setUseBoundingVolumeHierarchy(bool use)
+{
+  use_bvh_ = use;
+  bvh_dirty_ = use;
+  bvh_nodes_.clear();
+  bvh_leaf_for_body_.clear();
+}
+
+bool bodies::BodyVector::getUseBoundingVolumeHierarchy() const
+{
+  return use_bvh_;
+}
+
+void bodies::BodyVector::updateLeafBounds(BVHNode& node) const
+{
+  BoundingSphere sphere;
+  bodies_[node.body]->computeBoundingSphere(sphere);
+  const Eigen::Vector3d r(sphere.radius, sphere.radius, sphere.radius);
+  node.min = sphere.center - r;
+  node.max = sphere.center + r;
+}
+
+void bodies::BodyVector::updateBoundingVolumeHierarchy() const
+{
+  if (!bvh_dirty_.load(std::memory_order_acquire))
+    return;
+  // concurrent queries wait for the first one to rebuild the hierarchy
+  std::lock_guard<std::mutex> lock(bvh_mutex_);
+  if (bvh_dirty_.load(std::memory_order_relaxed))
+  {
+    buildBoundingVolumeHierarchy();
+    bvh_dirty_.store(false, std::memory_order_release);
+  }
+}
+
+void bodies::BodyVector::buildBoundingVolumeHierarchy() const
+{
+  bvh_nodes_.clear();
+  bvh_leaf_for_body_.assign(bodies_.size(), -1);
+  if (bodies_.empty())
+    return;
+  bvh_nodes_.reserve(2 * bodies_.size() - 1);
+
+  EigenSTL::vector_Vector3d centers(bodies_.size());
+  std::vector<std::size_t> order(bodies_.size());
+  for (std::size_t i = 0; i < bodies_.size(); ++i)
+  {
+    BoundingSphere sphere;
+    bodies_[i]->computeBoundingSphere(sphere);
+    centers[i] = sphere.center;
+    order[i] = i;
+  }
+  buildBoundingVolumeHierarchy(order, centers, 0, order.size(), -1);
+}
+
+namespace bodies
+{
+namespace detail
+{
+// orders body indices by the coordinate of their bounding sphere center along one axis
+struct CenterAxisOrder
+{
+  CenterAxisOrder(const EigenSTL::vector_Vector3d& centers, int axis) : centers_(centers), axis_(axis)
+  {
+  }
+
+  bool operator()(std::size_t a, std::size_t b) const
+  {
+    return centers_[a][axis_] < centers_[b][axis_];
+  }
+
+  const EigenSTL::vector_Vector3d& centers_;
+  int axis_;
+};
+
+// splitting at the median keeps the tree balanced, so its depth is at most log2(#bodies) + 1
+static const int BVH_MAX_DEPTH = 64;
+}
+}
+
+int bodies::BodyVector::buildBoundingVolumeHierarchy(std::vector<std::size_t>& order,
+                                                     const EigenSTL::vector_Vector3d& centers, std::size_t begin,
+                                                     std::size_t end, int parent) const
+{
+  const int index = bvh_nodes_.size();
+  bvh_nodes_.push_back(BVHNode());
+  bvh_nodes_[index].parent = parent;
+
+  if (end - begin == 1)
+  {
+    BVHNode& leaf = bvh_nodes_[index];
+    leaf.left = leaf.right = -1;
+    leaf.body = order[begin];
+    leaf.min_index = order[begin];
+    updateLeafBounds(leaf);
+    bvh_leaf_for_body_[leaf.body] = index;
+    return index;
+  }
+
+  // split along the axis in which the sphere centers are most spread out
+  Eigen::Vector3d cmin = centers[order[begin]];
+  Eigen::Vector3d cmax = cmin;
+  for (std::size_t i = begin + 1; i < end; ++i)
+  {
+    cmin = cmin.cwiseMin(centers[order[i]]);
+    cmax = cmax.cwiseMax(centers[order[i]]);
+  }
+  int axis;
+  (cmax - cmin).maxCoeff(&axis);
+  const std::size_t mid = begin + (end - begin) / 2;
+  std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                   detail::CenterAxisOrder(centers, axis));
+
+  const int left = buildBoundingVolumeHierarchy(order, centers, begin, mid, index);
+  const int right = buildBoundingVolumeHierarchy(order, centers, mid, end, index);
+
+  BVHNode& node = bvh_nodes_[index];
+  node.left = left;
+  node.right = right;
+  node.min = bvh_nodes_[left].min.cwiseMin(bvh_nodes_[right].min);
+  node.max = bvh_nodes_[left].max.cwiseMax(bvh_nodes_[right].max);
+  node.min_index = std::min(bvh_nodes_[left].min_index, bvh_nodes_[right].min_index);
+  return index;
+}
+
+void bodies::BodyVector::refitBoundingVolumeHierarchy(int node)
+{
+  updateLeafBounds(bvh_nodes_[node]);
+  for (int n = bvh_nodes_[node].parent; n >= 0; n = bvh_nodes_[n].parent)
+  {
+    BVHNode& inner = bvh_nodes_[n];
+    inner.min = bvh_nodes_[inner.left].min.cwiseMin(bvh_nodes_[inner.right].min);
+    inner.max = bvh_nodes_[inner.left].max.cwiseMax(bvh_nodes_[inner.right].max);
+  }
 }
 
 const bodies::Body* bodies::BodyVector::getBody(unsigned int i) const
@@ -1232,6 +4234,9 @@ const bodies::Body* bodies::BodyVector::getBody(unsigned int i) const
 
 bool bodies::BodyVector::containsPoint(const Eigen::Vector3d& p, std::size_t& index, bool verbose) const
 {
+  if (use_bvh_)
+    return containsPointBVH(p, index, verbose);
+
   for (std::size_t i = 0; i < bodies_.size(); ++i)
     if (bodies_[i]->containsPoint(p, verbose))
     {
@@ -1241,6 +4246,54 @@ bool bodies::BodyVector::containsPoint(const Eigen::Vector3d& p, std::size_t& in
   return false;
 }
 
+bool bodies::BodyVector::containsPointBVH(const Eigen::Vector3d& p, std::size_t& index, bool verbose) const
+{
+  updateBoundingVolumeHierarchy();
+  if (bvh_nodes_.empty())
+    return false;
+
+  // the linear scan reports the body with the smallest index, so subtrees that cannot improve
+  // on the best body found so far are skipped
+  std::size_t best = bodies_.size();
+  int stack[detail::BVH_MAX_DEPTH];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0)
+  {
+    const BVHNode& node = bvh_nodes_[stack[--top]];
+    if (node.min_index >= best)
+      continue;
+    if ((p.array() < node.min.array()).any() || (p.array() > node.max.array()).any())
+      continue;
+    if (node.left < 0)
+    {
+      if (bodies_[node.body]->containsPoint(p, verbose))
+        best = node.body;
+    }
+    else
+    {
+      // visit the child holding the smaller indices first
+      if (bvh_nodes_[node.left].min_index < bvh_nodes_[node.right].min_index)
+      {
+        stack[top++] = node.right;
+        stack[top++] = node.left;
+      }
+      else
+      {
+        stack[top++] = node.left;
+        stack[top++] = node.right;
+      }
+    }
+  }
+
+  if (best < bodies_.size())
+  {
+    index = best;
+    return true;
+  }
+  return false;
+}
+
 bool bodies::BodyVector::containsPoint(const Eigen::Vector3d& p, bool verbose) const
 {
   std::size_t dummy;
@@ -1250,6 +4303,16 @@ bool bodies::BodyVector::containsPoint(const Eigen::Vector3d& p, bool verbose) c
 bool bodies::BodyVector::intersectsRay(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir, std::size_t& index,
                                        EigenSTL::vector_Vector3d* intersections, unsigned int count) const
 {
+  if (use_bvh_)
+  {
+    Hit hit;
+    if (!intersectBVH(Ray(origin, dir), index, hit))
+      return false;
+    if (intersections)
+      bodies_[index]->intersectsRay(origin, dir, intersections, count);
+    return true;
+  }
+
   for (std::size_t i = 0; i < bodies_.size(); ++i)
     if (bodies_[i]->intersectsRay(origin, dir, intersections, count))
     {
@@ -1258,3 +4321,307 @@ bool bodies::BodyVector::intersectsRay(const Eigen::Vector3d& origin, const Eige
     }
   return false;
 }
+
+void bodies::BodyVector::intersectsRays(const Eigen::Vector3d* origins, const Eigen::Vector3d* dirs, std::size_t n,
+                                        double* out_t, std::size_t* out_body_index) const
+{
+  if (use_bvh_)
+    updateBoundingVolumeHierarchy();
+  detail::forEachRayBlock(origins, dirs, n, [this, out_t, out_body_index](std::size_t start, std::size_t count,
+                                                                          const double* ox, const double* oy,
+                                                                          const double* oz, const double* dx,
+                                                                          const double* dy, const double* dz) {
+    double* block_t = out_t + start;
+    std::size_t* block_index = out_body_index ? out_body_index + start : NULL;
+
+    if (use_bvh_)
+    {
+      for (std::size_t i = 0; i < count; i += detail::BATCH_SIZE)
+        intersectsRaysBVH(ox + i, oy + i, oz + i, dx + i, dy + i, dz + i,
+                          std::min<std::size_t>(detail::BATCH_SIZE, count - i), block_t + i,
+                          block_index ? block_index + i : NULL);
+      return;
+    }
+
+    // intersect one packet at a time with each body; as in traceRay(), a ray skips the bodies whose bounding
+    // sphere it reaches after its best hit so far
+    detail::RayPacket packet;
+    for (std::size_t i = 0; i < count; i += detail::BATCH_SIZE)
+    {
+      const std::size_t lanes = std::min<std::size_t>(detail::BATCH_SIZE, count - i);
+      detail::loadRayPacket(ox + i, oy + i, oz + i, dx + i, dy + i, dz + i, lanes, packet);
+      const detail::PacketRays rays(packet);
+      double best[detail::BATCH_SIZE];
+      std::size_t index[detail::BATCH_SIZE];
+      std::fill(best, best + detail::BATCH_SIZE, std::numeric_limits<double>::infinity());
+      std::fill(index, index + detail::BATCH_SIZE, NO_BODY);
+      for (std::size_t b = 0; b < bodies_.size(); ++b)
+        detail::intersectPacket(*bodies_[b], b, bounding_spheres_[b], packet, rays, best, index);
+      std::copy(best, best + lanes, block_t + i);
+      if (block_index)
+        std::copy(index, index + lanes, block_index + i);
+    }
+  });
+}
+
+namespace bodies
+{
+namespace detail
+{
+/** \brief Check if the part of \e ray between ray.tmin and ray.tmax hits the box [\e min, \e max] (slab
+    method). The bound each slab is entered through is picked by the sign of the direction, so there is no
+    division and no swap; for a direction parallel to a slab the products are infinite, or NaN for an origin
+    right on its bound, which the comparisons ignore. */
+static inline bool rayHitsBox(const Ray& ray, const Eigen::Vector3d& min, const Eigen::Vector3d& max)
+{
+  const Eigen::Vector3d* bounds[2] = { &min, &max };
+  double tmin = ray.tmin;
+  double tmax = ray.tmax;
+  for (int k = 0; k < 3; ++k)
+  {
+    const double t1 = ((*bounds[ray.sign[k]])[k] - ray.origin[k]) * ray.inv_dir[k];
+    const double t2 = ((*bounds[1 - ray.sign[k]])[k] - ray.origin[k]) * ray.inv_dir[k];
+    if (t1 > tmin)
+      tmin = t1;
+    if (t2 < tmax)
+      tmax = t2;
+    if (tmin > tmax)
+      return false;
+  }
+  return true;
+}
+}
+}
+
+bool bodies::BodyVector::intersect(const Ray& ray, std::size_t& index, Hit& hit) const
+{
+  if (use_bvh_)
+    return intersectBVH(ray, index, hit);
+
+  for (std::size_t i = 0; i < bodies_.size(); ++i)
+    if (bodies_[i]->intersect(ray, hit))
+    {
+      index = i;
+      return true;
+    }
+  return false;
+}
+
+bool bodies::BodyVector::intersectBVH(const Ray& ray, std::size_t& index, Hit& hit) const
+{
+  updateBoundingVolumeHierarchy();
+  if (bvh_nodes_.empty())
+    return false;
+
+  std::size_t best = bodies_.size();
+  int stack[detail::BVH_MAX_DEPTH];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0)
+  {
+    const BVHNode& node = bvh_nodes_[stack[--top]];
+    if (node.min_index >= best)
+      continue;
+    if (!detail::rayHitsBox(ray, node.min, node.max))
+      continue;
+    if (node.left < 0)
+    {
+      Hit body_hit;
+      if (bodies_[node.body]->intersect(ray, body_hit))
+      {
+        best = node.body;
+        hit = body_hit;
+      }
+    }
+    else
+    {
+      if (bvh_nodes_[node.left].min_index < bvh_nodes_[node.right].min_index)
+      {
+        stack[top++] = node.right;
+        stack[top++] = node.left;
+      }
+      else
+      {
+        stack[top++] = node.left;
+        stack[top++] = node.right;
+      }
+    }
+  }
+
+  if (best < bodies_.size())
+  {
+    index = best;
+    return true;
+  }
+  return false;
+}
+
+bool bodies::BodyVector::closestHit(const Ray& ray, RayHit& hit) const
+{
+  return traceRay(ray, CLOSEST_HIT, hit, NULL);
+}
+
+bool bodies::BodyVector::anyHit(const Ray& ray, RayHit& hit) const
+{
+  return traceRay(ray, ANY_HIT, hit, NULL);
+}
+
+std::size_t bodies::BodyVector::allHits(const Ray& ray, std::vector<RayHit>& hits) const
+{
+  hits.clear();
+  RayHit unused;
+  traceRay(ray, ALL_HITS, unused, &hits);
+  std::sort(hits.begin(), hits.end(), [](const RayHit& a, const RayHit& b) {
+    return a.t < b.t || (a.t == b.t && a.index < b.index);
+  });
+  return hits.size();
+}
+
+bool bodies::BodyVector::traceRay(const Ray& ray, RayHitMode mode, RayHit& best, std::vector<RayHit>* all) const
+{
+  // for the closest hit, the part of the ray that is searched ends at the best hit found so far
+  Ray search(ray);
+  bool found = false;
+
+  // test one body; returns true when the search is over
+  const auto visit = [this, mode, &ray, &search, &found, &best, all](std::size_t b) {
+    const BoundingSphere& sphere = bounding_spheres_[b];
+    const Eigen::Vector3d to_center = sphere.center - ray.origin;
+    const double along = to_center.dot(ray.dir);
+    const double distance2 = to_center.squaredNorm() - along * along;
+    const double radius2 = sphere.radius * sphere.radius;
+    if (distance2 > radius2)
+      return false;
+    const double half_chord = sqrt(radius2 - distance2);
+    if (along + half_chord <= search.tmin || along - half_chord > search.tmax)
+      return false;
+
+    Hit hit;
+    if (!bodies_[b]->intersect(search, hit))
+      return false;
+    // a ray that starts inside the body hits it where it starts
+    const double t = hit.inside || hit.count == 0 ? search.tmin : hit.t[0];
+    if (mode == CLOSEST_HIT && found && (t > best.t || (t == best.t && b > best.index)))
+      return false;
+
+    RayHit body_hit;
+    body_hit.index = b;
+    body_hit.t = t;
+    body_hit.point = ray.at(t);
+    body_hit.normal = bodies_[b]->computeSurfaceNormal(body_hit.point);
+    found = true;
+    if (mode == ALL_HITS)
+    {
+      all->push_back(body_hit);
+      return false;
+    }
+    best = body_hit;
+    if (mode == CLOSEST_HIT)
+      search.tmax = t;
+    return mode == ANY_HIT;
+  };
+
+  if (!use_bvh_)
+  {
+    for (std::size_t b = 0; b < bodies_.size(); ++b)
+      if (visit(b))
+        break;
+    return found;
+  }
+
+  updateBoundingVolumeHierarchy();
+  if (bvh_nodes_.empty())
+    return false;
+  int stack[detail::BVH_MAX_DEPTH];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0)
+  {
+    const BVHNode& node = bvh_nodes_[stack[--top]];
+    if (!detail::rayHitsBox(search, node.min, node.max))
+      continue;
+    if (node.left < 0)
+    {
+      if (visit(node.body))
+        break;
+    }
+    else
+    {
+      // descend into the child nearer along the ray first, so the closest hit shrinks the search early
+      const BVHNode& left = bvh_nodes_[node.left];
+      const BVHNode& right = bvh_nodes_[node.right];
+      if ((left.min + left.max - right.min - right.max).dot(ray.dir) <= 0.0)
+      {
+        stack[top++] = node.right;
+        stack[top++] = node.left;
+      }
+      else
+      {
+        stack[top++] = node.left;
+        stack[top++] = node.right;
+      }
+    }
+  }
+  return found;
+}
+
+void bodies::BodyVector::intersectsRaysBVH(const double* ox, const double* oy, const double* oz, const double* dx,
+                                           const double* dy, const double* dz, std::size_t n, double* out_t,
+                                           std::size_t* out_body_index) const
+{
+  detail::BatchArray best = detail::infinityBatch();
+  std::size_t best_index[detail::BATCH_SIZE];
+  std::fill(best_index, best_index + detail::BATCH_SIZE, NO_BODY);
+
+  if (!bvh_nodes_.empty())
+  {
+    detail::RayPacket packet;
+    detail::loadRayPacket(ox, oy, oz, dx, dy, dz, n, packet);
+    // a zero direction component would give 0 * inf for rays in the plane of a slab; a tiny
+    // component keeps the slab test finite and only affects rays that graze the box
+    const detail::BatchArray* o[3] = { &packet.ox, &packet.oy, &packet.oz };
+    detail::BatchArray inv[3];
+    inv[0] = 1.0 / (packet.dx == 0.0).select(detail::BatchArray::Constant(1e-300), packet.dx);
+    inv[1] = 1.0 / (packet.dy == 0.0).select(detail::BatchArray::Constant(1e-300), packet.dy);
+    inv[2] = 1.0 / (packet.dz == 0.0).select(detail::BatchArray::Constant(1e-300), packet.dz);
+
+    const detail::PacketRays rays(packet);
+    int stack[detail::BVH_MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+      const BVHNode& node = bvh_nodes_[stack[--top]];
+
+      // the whole packet descends as long as one of its rays may hit something nearer than its current best
+      detail::BatchArray tnear = detail::BatchArray::Zero();
+      detail::BatchArray tfar = best;
+      for (int k = 0; k < 3; ++k)
+      {
+        const detail::BatchArray t1 = (node.min[k] - *o[k]) * inv[k];
+        const detail::BatchArray t2 = (node.max[k] - *o[k]) * inv[k];
+        tnear = tnear.max(t1.min(t2));
+        tfar = tfar.min(t1.max(t2));
+      }
+      // the lanes past the n rays repeat the last one, so they do not change the outcome
+      if ((tfar - tnear).maxCoeff() < 0.0)
+        continue;
+
+      if (node.left < 0)
+        detail::intersectPacket(*bodies_[node.body], node.body, bounding_spheres_[node.body], packet, rays,
+                                best.data(), best_index);
+      else
+      {
+        stack[top++] = node.right;
+        stack[top++] = node.left;
+      }
+    }
+  }
+
+  for (std::size_t k = 0; k < n; ++k)
+  {
+    out_t[k] = best[k];
+    if (out_body_index)
+      out_body_index[k] = best_index[k];
+  }
+}
@@ -38,8 +38,10 @@
 #include <geometric_shapes/shape_operations.h>
 #include <console_bridge/console.h>
 #include <Eigen/Geometry>
+#include <algorithm>
+#include <limits>
 
-bodies::Body* bodies::createBodyFromShape(const shapes::Shape* shape)
+bodies::Body* bodies::createBodyFromShape(const shapes::Shape* shape, MeshBodyType mesh_type)
 {
   Body* body = NULL;
 
@@ -56,7 +58,13 @@ bodies::Body* bodies::createBodyFromShape(const shapes::Shape* shape)
         body = new bodies::Cylinder(shape);
         break;
       case shapes::MESH:
-        body = new bodies::ConvexMesh(shape);
+        if (mesh_type == TRIANGLES)
+          body = new bodies::TriangleMesh(shape);
+        else
+          body = new bodies::ConvexMesh(shape);
+        break;
+      case shapes::OCTREE:
+        body = new bodies::OcTree(shape);
         break;
       default:
         CONSOLE_BRIDGE_logError("Creating body from shape: Unknown shape type %d", (int)shape->type);
@@ -142,37 +150,546 @@ bodies::Body* bodies::constructBodyFromMsg(const shape_msgs::SolidPrimitive& sha
 
 void bodies::computeBoundingSphere(const std::vector<const bodies::Body*>& bodies, bodies::BoundingSphere& sphere)
 {
-  Eigen::Vector3d sum(0.0, 0.0, 0.0);
-
-  // TODO - expand to all body types
-  unsigned int vertex_count = 0;
+  // the corners of boxes and the vertices of convex meshes are enclosed exactly; the other bodies are
+  // represented by their own bounding spheres
+  EigenSTL::vector_Vector3d points;
+  std::vector<BoundingSphere> spheres;
   for (unsigned int i = 0; i < bodies.size(); i++)
   {
-    const bodies::ConvexMesh* conv = dynamic_cast<const bodies::ConvexMesh*>(bodies[i]);
-    if (!conv)
-      continue;
-    for (unsigned int j = 0; j < conv->getScaledVertices().size(); j++, vertex_count++)
+    if (const bodies::ConvexMesh* conv = dynamic_cast<const bodies::ConvexMesh*>(bodies[i]))
+    {
+      for (unsigned int j = 0; j < conv->getScaledVertices().size(); j++)
+        points.push_back(conv->getPose() * conv->getScaledVertices()[j]);
+    }
+    else if (bodies[i]->getType() == shapes::BOX)
     {
-      sum += conv->getPose() * conv->getScaledVertices()[j];
+      const Eigen::Matrix3d& axes = bodies[i]->getPose().linear();
+      for (int j = 0; j < 8; ++j)
+        points.push_back(bodies[i]->computeSupportPoint(axes * Eigen::Vector3d(j & 1 ? 1.0 : -1.0, j & 2 ? 1.0 : -1.0,
+                                                                               j & 4 ? 1.0 : -1.0)));
+    }
+    else
+    {
+      BoundingSphere s;
+      bodies[i]->computeBoundingSphere(s);
+      spheres.push_back(s);
     }
   }
 
-  sphere.center = sum / (double)vertex_count;
+  if (!points.empty())
+  {
+    spheres.push_back(BoundingSphere());
+    shapes::computeMinimumBoundingSphere(points, spheres.back().center, spheres.back().radius);
+  }
 
-  double max_dist_squared = 0.0;
-  for (unsigned int i = 0; i < bodies.size(); i++)
+  // merging the largest spheres first keeps the merged sphere small
+  std::sort(spheres.begin(), spheres.end(),
+            [](const BoundingSphere& a, const BoundingSphere& b) { return a.radius > b.radius; });
+  mergeBoundingSpheres(spheres, sphere);
+}
+
+namespace bodies
+{
+namespace detail
+{
+/** \brief Maximum number of iterations of GJK and EPA */
+static const int MAX_ITERATIONS = 64;
+
+/** \brief Relative tolerance on the penetration depth at which EPA stops; shallower overlaps count as contact */
+static const double EPA_TOLERANCE = 1e-6;
+
+/** \brief Relative distance from the origin below which GJK treats a point or a face as passing through it */
+static const double GJK_TOLERANCE = 1e-9;
+
+/** \brief Half extents of a box body, including scaling and padding */
+static Eigen::Vector3d boxHalfExtents(const Box& box)
+{
+  const std::vector<double> size = box.getDimensions();
+  return Eigen::Vector3d(size[0], size[1], size[2]) * (box.getScale() / 2.0) +
+         Eigen::Vector3d::Constant(box.getPadding());
+}
+
+/** \brief Support point of the Minkowski difference a - b */
+static Eigen::Vector3d support(const Body& a, const Body& b, const Eigen::Vector3d& dir)
+{
+  return a.computeSupportPoint(dir) - b.computeSupportPoint(-dir);
+}
+
+static bool sphereSphere(const BoundingSphere& a, const BoundingSphere& b, double* depth, Eigen::Vector3d* normal)
+{
+  const Eigen::Vector3d diff = b.center - a.center;
+  const double dist = diff.norm();
+  if (dist >= a.radius + b.radius)
+    return false;
+  if (depth)
+  {
+    *depth = a.radius + b.radius - dist;
+    *normal = dist > 0.0 ? Eigen::Vector3d(diff / dist) : Eigen::Vector3d::UnitX();
+  }
+  return true;
+}
+
+/** \brief Sphere against box; \e normal points from the box towards the sphere */
+static bool sphereBox(const BoundingSphere& sphere, const Box& box, double* depth, Eigen::Vector3d* normal)
+{
+  const Eigen::Vector3d half = boxHalfExtents(box);
+  const Eigen::Matrix3d rotation = box.getPose().rotation();
+  const Eigen::Vector3d q = rotation.transpose() * (sphere.center - box.getPose().translation());
+  const Eigen::Vector3d closest = q.cwiseMax(-half).cwiseMin(half);
+  const Eigen::Vector3d diff = q - closest;
+  const double dist2 = diff.squaredNorm();
+  if (dist2 >= sphere.radius * sphere.radius)
+    return false;
+  if (!depth)
+    return true;
+
+  if (dist2 > 0.0)
   {
-    const bodies::ConvexMesh* conv = dynamic_cast<const bodies::ConvexMesh*>(bodies[i]);
-    if (!conv)
+    const double dist = sqrt(dist2);
+    *depth = sphere.radius - dist;
+    *normal = rotation * (diff / dist);
+  }
+  else
+  {
+    // the center is inside the box; leave through the closest face
+    int axis = 0;
+    double face = half[0] - fabs(q[0]);
+    for (int k = 1; k < 3; ++k)
+      if (half[k] - fabs(q[k]) < face)
+      {
+        face = half[k] - fabs(q[k]);
+        axis = k;
+      }
+    *depth = sphere.radius + face;
+    *normal = rotation.col(axis) * (q[axis] < 0.0 ? -1.0 : 1.0);
+  }
+  return true;
+}
+
+/** \brief Separating axis test for two oriented boxes; the minimum overlap over the 15 candidate axes is the
+    penetration depth */
+static bool boxBox(const Box& a, const Box& b, double* depth, Eigen::Vector3d* normal)
+{
+  const Eigen::Vector3d half_a = boxHalfExtents(a);
+  const Eigen::Vector3d half_b = boxHalfExtents(b);
+  const Eigen::Matrix3d ra = a.getPose().rotation();
+  const Eigen::Matrix3d rb = b.getPose().rotation();
+  const Eigen::Vector3d t = b.getPose().translation() - a.getPose().translation();
+
+  Eigen::Vector3d axes[15];
+  for (int k = 0; k < 3; ++k)
+  {
+    axes[k] = ra.col(k);
+    axes[3 + k] = rb.col(k);
+    for (int l = 0; l < 3; ++l)
+      axes[6 + 3 * k + l] = ra.col(k).cross(rb.col(l));
+  }
+
+  double best = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < 15; ++i)
+  {
+    const double norm = axes[i].norm();
+    // edges that are parallel give no new axis
+    if (norm < 1e-9)
       continue;
-    for (unsigned int j = 0; j < conv->getScaledVertices().size(); j++)
+    const Eigen::Vector3d axis = axes[i] / norm;
+    const double radius_a = (ra.transpose() * axis).cwiseAbs().dot(half_a);
+    const double radius_b = (rb.transpose() * axis).cwiseAbs().dot(half_b);
+    const double dist = axis.dot(t);
+    const double overlap = radius_a + radius_b - fabs(dist);
+    if (overlap <= 0.0)
+      return false;
+    if (overlap < best)
     {
-      double dist = (conv->getPose() * conv->getScaledVertices()[j] - sphere.center).squaredNorm();
-      if (dist > max_dist_squared)
+      best = overlap;
+      if (normal)
+        *normal = dist < 0.0 ? Eigen::Vector3d(-axis) : axis;
+    }
+  }
+  if (depth)
+    *depth = best;
+  return true;
+}
+
+/** \brief The simplex GJK maintains; the most recently added point is the last one */
+struct Simplex
+{
+  Eigen::Vector3d points[4];
+  int size;
+};
+
+static inline Eigen::Vector3d tripleCross(const Eigen::Vector3d& a, const Eigen::Vector3d& b)
+{
+  // (a x b) x a: perpendicular to a, in the plane of a and b, pointing towards b
+  return a.cross(b).cross(a);
+}
+
+/** \brief Reduce \e simplex to the feature closest to the origin, formed by \e a and \e b */
+static void simplexLine(Simplex& simplex, const Eigen::Vector3d& b, const Eigen::Vector3d& a, Eigen::Vector3d& dir)
+{
+  const Eigen::Vector3d ab = b - a;
+  if (ab.dot(-a) > 0.0)
+  {
+    simplex.points[0] = b;
+    simplex.points[1] = a;
+    simplex.size = 2;
+    dir = tripleCross(ab, -a);
+  }
+  else
+  {
+    simplex.points[0] = a;
+    simplex.size = 1;
+    dir = -a;
+  }
+}
+
+/** \brief Reduce \e simplex, which is the triangle (\e c, \e b, \e a), to the feature closest to the origin */
+static void simplexTriangle(Simplex& simplex, const Eigen::Vector3d& c, const Eigen::Vector3d& b,
+                            const Eigen::Vector3d& a, Eigen::Vector3d& dir)
+{
+  const Eigen::Vector3d ab = b - a;
+  const Eigen::Vector3d ac = c - a;
+  const Eigen::Vector3d ao = -a;
+  const Eigen::Vector3d abc = ab.cross(ac);
+
+  // a flat triangle has no normal; keep the edge with the new point
+  if (abc.squaredNorm() < 1e-24)
+  {
+    simplexLine(simplex, b, a, dir);
+    return;
+  }
+
+  if (abc.cross(ac).dot(ao) > 0.0)
+  {
+    if (ac.dot(ao) > 0.0)
+    {
+      simplex.points[0] = c;
+      simplex.points[1] = a;
+      simplex.size = 2;
+      dir = tripleCross(ac, ao);
+    }
+    else
+      simplexLine(simplex, b, a, dir);
+  }
+  else if (ab.cross(abc).dot(ao) > 0.0)
+    simplexLine(simplex, b, a, dir);
+  else
+  {
+    simplex.size = 3;
+    if (abc.dot(ao) > 0.0)
+    {
+      simplex.points[0] = c;
+      simplex.points[1] = b;
+      simplex.points[2] = a;
+      dir = abc;
+    }
+    else
+    {
+      simplex.points[0] = b;
+      simplex.points[1] = c;
+      simplex.points[2] = a;
+      dir = -abc;
+    }
+  }
+}
+
+/** \brief Reduce \e simplex to the feature closest to the origin and return true if it encloses the origin */
+static bool updateSimplex(Simplex& simplex, Eigen::Vector3d& dir)
+{
+  if (simplex.size == 2)
+  {
+    const Eigen::Vector3d b = simplex.points[0], a = simplex.points[1];
+    simplexLine(simplex, b, a, dir);
+    return false;
+  }
+  if (simplex.size == 3)
+  {
+    const Eigen::Vector3d c = simplex.points[0], b = simplex.points[1], a = simplex.points[2];
+    simplexTriangle(simplex, c, b, a, dir);
+    return false;
+  }
+
+  const Eigen::Vector3d d = simplex.points[0], c = simplex.points[1], b = simplex.points[2], a = simplex.points[3];
+  const Eigen::Vector3d ao = -a;
+  // the three faces that contain the new point, with normals pointing away from the remaining vertex
+  const Eigen::Vector3d faces[3][3] = { { c, b, d }, { d, c, b }, { b, d, c } };
+  for (int f = 0; f < 3; ++f)
+  {
+    const Eigen::Vector3d& p = faces[f][0];
+    const Eigen::Vector3d& q = faces[f][1];
+    Eigen::Vector3d n = (q - a).cross(p - a);
+    if (n.dot(faces[f][2] - a) > 0.0)
+      n = -n;
+    if (n.dot(ao) > 0.0)
+    {
+      simplexTriangle(simplex, p, q, a, dir);
+      return false;
+    }
+  }
+  return true;
+}
+
+/** \brief Grow a simplex that contains the origin on its boundary into a tetrahedron; returns false if the
+    Minkowski difference is flat */
+static bool completeTetrahedron(const Body& a, const Body& b, Simplex& simplex)
+{
+  static const Eigen::Vector3d axes[3] = { Eigen::Vector3d::UnitX(), Eigen::Vector3d::UnitY(),
+                                           Eigen::Vector3d::UnitZ() };
+  while (simplex.size < 4)
+  {
+    std::vector<Eigen::Vector3d> candidates;
+    if (simplex.size == 1)
+      candidates.assign(axes, axes + 3);
+    else if (simplex.size == 2)
+    {
+      const Eigen::Vector3d line = simplex.points[1] - simplex.points[0];
+      for (int k = 0; k < 3; ++k)
+        candidates.push_back(line.cross(axes[k]));
+    }
+    else
+      candidates.push_back((simplex.points[1] - simplex.points[0]).cross(simplex.points[2] - simplex.points[0]));
+
+    bool added = false;
+    for (std::size_t i = 0; i < candidates.size() && !added; ++i)
+    {
+      if (candidates[i].squaredNorm() < 1e-18)
+        continue;
+      for (int sign = -1; sign <= 1 && !added; sign += 2)
+      {
+        const Eigen::Vector3d w = support(a, b, candidates[i] * sign);
+        // the new point has to leave the affine hull of the simplex
+        double extent = (w - simplex.points[0]).dot(candidates[i].normalized());
+        if (simplex.size == 1)
+          extent = (w - simplex.points[0]).norm();
+        if (fabs(extent) > 1e-9)
+        {
+          simplex.points[simplex.size++] = w;
+          added = true;
+        }
+      }
+    }
+    if (!added)
+      return false;
+  }
+  return true;
+}
+
+struct PolytopeFace
+{
+  int vertices[3];
+  Eigen::Vector3d normal;
+  double distance;
+};
+
+/** \brief Add the face (\e i, \e j, \e k) to \e faces, oriented away from \e interior */
+static bool addFace(const std::vector<Eigen::Vector3d>& points, int i, int j, int k, const Eigen::Vector3d& interior,
+                    std::vector<PolytopeFace>& faces)
+{
+  PolytopeFace face;
+  face.normal = (points[j] - points[i]).cross(points[k] - points[i]);
+  const double norm = face.normal.norm();
+  if (norm < 1e-12)
+    return false;
+  face.normal /= norm;
+  face.vertices[0] = i;
+  if (face.normal.dot(points[i] - interior) < 0.0)
+  {
+    face.normal = -face.normal;
+    face.vertices[1] = k;
+    face.vertices[2] = j;
+  }
+  else
+  {
+    face.vertices[1] = j;
+    face.vertices[2] = k;
+  }
+  face.distance = face.normal.dot(points[i]);
+  faces.push_back(face);
+  return true;
+}
+
+/** \brief Expanding polytope algorithm: grow the tetrahedron \e simplex, which contains the origin, towards
+    the boundary of the Minkowski difference until the face closest to the origin is found */
+static void epa(const Body& a, const Body& b, const Simplex& simplex, double& depth, Eigen::Vector3d& normal)
+{
+  std::vector<Eigen::Vector3d> points(simplex.points, simplex.points + 4);
+  const Eigen::Vector3d interior = (points[0] + points[1] + points[2] + points[3]) / 4.0;
+  std::vector<PolytopeFace> faces;
+  addFace(points, 0, 1, 2, interior, faces);
+  addFace(points, 0, 1, 3, interior, faces);
+  addFace(points, 0, 2, 3, interior, faces);
+  addFace(points, 1, 2, 3, interior, faces);
+
+  depth = 0.0;
+  normal = Eigen::Vector3d::UnitX();
+  for (int iteration = 0; iteration < MAX_ITERATIONS && !faces.empty(); ++iteration)
+  {
+    std::size_t closest = 0;
+    for (std::size_t i = 1; i < faces.size(); ++i)
+      if (faces[i].distance < faces[closest].distance)
+        closest = i;
+    depth = faces[closest].distance;
+    normal = faces[closest].normal;
+
+    const Eigen::Vector3d w = support(a, b, normal);
+    if (w.dot(normal) - depth <= EPA_TOLERANCE * std::max(1.0, depth))
+      return;
+
+    // remove the faces the new point sees and keep the edges of the hole
+    std::vector<std::pair<int, int> > horizon;
+    std::vector<PolytopeFace> kept;
+    for (std::size_t i = 0; i < faces.size(); ++i)
+    {
+      if (faces[i].normal.dot(w - points[faces[i].vertices[0]]) > 0.0)
       {
-        max_dist_squared = dist;
+        for (int e = 0; e < 3; ++e)
+        {
+          const std::pair<int, int> edge(faces[i].vertices[e], faces[i].vertices[(e + 1) % 3]);
+          const std::pair<int, int> reverse(edge.second, edge.first);
+          std::vector<std::pair<int, int> >::iterator it = std::find(horizon.begin(), horizon.end(), reverse);
+          if (it != horizon.end())
+            horizon.erase(it);
+          else
+            horizon.push_back(edge);
+        }
       }
+      else
+        kept.push_back(faces[i]);
+    }
+    if (horizon.empty())
+      return;
+
+    points.push_back(w);
+    const int index = points.size() - 1;
+    faces.swap(kept);
+    for (std::size_t i = 0; i < horizon.size(); ++i)
+      addFace(points, horizon[i].first, horizon[i].second, index, interior, faces);
+  }
+}
+
+/** \brief Whether the origin, which lies on the boundary of \e simplex, is in the interior of the Minkowski
+    difference rather than on its boundary; the simplex alone cannot tell, so EPA measures the depth */
+static bool originInInterior(const Body& a, const Body& b, Simplex& simplex)
+{
+  // a flat Minkowski difference has no interior
+  if (!completeTetrahedron(a, b, simplex))
+    return false;
+  double depth;
+  Eigen::Vector3d normal;
+  epa(a, b, simplex, depth, normal);
+  return depth > EPA_TOLERANCE;
+}
+
+/** \brief Whether the origin, which is in the tetrahedron \e simplex, is in the interior of the Minkowski
+    difference. An origin inside a face is, exactly when the difference reaches past that face. */
+static bool originEnclosed(const Body& a, const Body& b, Simplex& simplex)
+{
+  double scale = 1.0;
+  for (int i = 0; i < 4; ++i)
+    scale = std::max(scale, simplex.points[i].norm());
+  const double tolerance = GJK_TOLERANCE * scale;
+  for (int i = 0; i < 4; ++i)
+  {
+    const Eigen::Vector3d corners[3] = { simplex.points[(i + 1) % 4], simplex.points[(i + 2) % 4],
+                                         simplex.points[(i + 3) % 4] };
+    Eigen::Vector3d n = (corners[1] - corners[0]).cross(corners[2] - corners[0]);
+    const double norm = n.norm();
+    if (norm == 0.0 || fabs(n.dot(corners[0])) > tolerance * norm)
+      continue;
+    n /= norm;
+
+    // on an edge or a corner of the face, several faces meet at the origin; let EPA sort it out
+    for (int e = 0; e < 3; ++e)
+    {
+      const Eigen::Vector3d edge = corners[(e + 1) % 3] - corners[e];
+      if (edge.cross(-corners[e]).dot(n) <= tolerance * edge.norm())
+        return originInInterior(a, b, simplex);
     }
+    if (n.dot(simplex.points[i] - corners[0]) > 0.0)
+      n = -n;
+    const Eigen::Vector3d w = support(a, b, n);
+    return w.dot(n) > GJK_TOLERANCE * std::max(1.0, w.norm());
   }
-  sphere.radius = sqrt(max_dist_squared);
+  return true;
+}
+
+/** \brief Run GJK on the Minkowski difference of \e a and \e b; on success, \e simplex contains the origin.
+    Bodies that only touch, so that the origin is on the boundary of the difference, do not intersect. */
+static bool gjk(const Body& a, const Body& b, Simplex& simplex)
+{
+  Eigen::Vector3d dir = b.getPose().translation() - a.getPose().translation();
+  if (dir.squaredNorm() < 1e-18)
+    dir = Eigen::Vector3d::UnitX();
+
+  simplex.points[0] = support(a, b, dir);
+  simplex.size = 1;
+  dir = -simplex.points[0];
+  for (int i = 0; i < MAX_ITERATIONS; ++i)
+  {
+    // the origin is on the current simplex, which may be inside the difference or on its boundary
+    if (dir.squaredNorm() < 1e-18)
+      return originInInterior(a, b, simplex);
+    const Eigen::Vector3d w = support(a, b, dir);
+    // the difference does not reach past the origin along dir, or only by round-off: at most contact
+    if (w.dot(dir) <= GJK_TOLERANCE * std::max(1.0, w.norm()) * dir.norm())
+      return false;
+    simplex.points[simplex.size++] = w;
+    if (updateSimplex(simplex, dir))
+      return originEnclosed(a, b, simplex);
+  }
+  // GJK only cycles when the origin is within round-off of the boundary; report an intersection, which is the
+  // conservative answer for collision checking
+  return true;
+}
+
+static bool intersectsImpl(const Body& a, const Body& b, double* depth, Eigen::Vector3d* normal)
+{
+  BoundingSphere sa, sb;
+  a.computeBoundingSphere(sa);
+  b.computeBoundingSphere(sb);
+  if ((sa.center - sb.center).squaredNorm() >= (sa.radius + sb.radius) * (sa.radius + sb.radius))
+    return false;
+
+  const shapes::ShapeType ta = a.getType();
+  const shapes::ShapeType tb = b.getType();
+  if (ta == shapes::SPHERE && tb == shapes::SPHERE)
+    return sphereSphere(sa, sb, depth, normal);
+  if (ta == shapes::SPHERE && tb == shapes::BOX)
+  {
+    // the normal of sphereBox() points from the box towards the sphere
+    if (!sphereBox(sa, static_cast<const Box&>(b), depth, normal))
+      return false;
+    if (normal)
+      *normal = -*normal;
+    return true;
+  }
+  if (ta == shapes::BOX && tb == shapes::SPHERE)
+    return sphereBox(sb, static_cast<const Box&>(a), depth, normal);
+  if (ta == shapes::BOX && tb == shapes::BOX)
+    return boxBox(static_cast<const Box&>(a), static_cast<const Box&>(b), depth, normal);
+
+  Simplex simplex;
+  if (!gjk(a, b, simplex))
+    return false;
+  if (depth)
+  {
+    // a flat Minkowski difference has no interior, so the bodies only touch
+    if (!completeTetrahedron(a, b, simplex))
+      return false;
+    epa(a, b, simplex, *depth, *normal);
+    *depth = std::max(*depth, 0.0);
+  }
+  return true;
+}
+}
+}
+
+bool bodies::intersects(const Body& a, const Body& b)
+{
+  return detail::intersectsImpl(a, b, NULL, NULL);
+}
+
+bool bodies::computePenetration(const Body& a, const Body& b, double& depth, Eigen::Vector3d& normal)
+{
+  return detail::intersectsImpl(a, b, &depth, &normal);
 }
@@ -36,11 +36,14 @@
 
 #include "geometric_shapes/mesh_operations.h"
 #include "geometric_shapes/shape_operations.h"
+#include "geometric_shapes/thread_pool.h"
 
 #include <cstdio>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <algorithm>
-#include <set>
+#include <random>
 #include <float.h>
 
 #include <console_bridge/console.h>
@@ -60,55 +63,204 @@ namespace detail
 {
 namespace
 {
-/// Local representation of a vertex that knows its position in an array (used for sorting)
-struct LocalVertexType
+/// Key that identifies the vertices welded together: the bits of the coordinates, or the grid cell they fall in
+struct WeldKey
 {
-  LocalVertexType() : x(0.0), y(0.0), z(0.0)
+  bool operator==(const WeldKey& other) const
   {
+    return c[0] == other.c[0] && c[1] == other.c[1] && c[2] == other.c[2];
   }
 
-  LocalVertexType(const Eigen::Vector3d& v) : x(v.x()), y(v.y()), z(v.z())
+  std::uint64_t c[3];
+};
+
+/// The key of \e v; a positive \e inv_tolerance is the inverse of the size of the grid cells
+WeldKey weldKey(const Eigen::Vector3d& v, double inv_tolerance)
+{
+  WeldKey key;
+  for (int k = 0; k < 3; ++k)
+    if (inv_tolerance > 0.0)
+      key.c[k] = static_cast<std::uint64_t>(static_cast<std::int64_t>(std::floor(v[k] * inv_tolerance)));
+    else
+    {
+      // adding 0 turns -0 into +0, which compares equal to it
+      const double x = v[k] + 0.0;
+      std::memcpy(&key.c[k], &x, sizeof(x));
+    }
+  return key;
+}
+
+/// Hash of a welding key; the top bits are as well mixed as the bottom ones
+std::uint32_t weldHash(const WeldKey& key)
+{
+  std::uint64_t h = 0;
+  for (int k = 0; k < 3; ++k)
+  {
+    h = (h ^ key.c[k]) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+  }
+  h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL;
+  return static_cast<std::uint32_t>(h >> 32);
+}
+
+/// Open addressing hash table with linear probing, from welding keys to the first vertex that had them
+class WeldTable
+{
+public:
+  struct Slot
+  {
+    std::uint32_t hash;
+
+    /// The index in the source of the first vertex with this key, or EMPTY
+    unsigned int source;
+
+    /// The index of that vertex in the welded mesh
+    unsigned int index;
+  };
+
+  static const unsigned int EMPTY = ~0u;
+
+  /// A table for up to \e n keys, kept at most half full
+  WeldTable(std::size_t n, const EigenSTL::vector_Vector3d& source, double inv_tolerance)
+    : source_(source), inv_tolerance_(inv_tolerance)
   {
+    std::size_t capacity = 16;
+    while (capacity < 2 * n)
+      capacity *= 2;
+    mask_ = capacity - 1;
+    const Slot empty = { 0, EMPTY, 0 };
+    slots_.resize(capacity, empty);
   }
 
-  double x, y, z;
-  unsigned int index;
+  /// The slot of the key of source[\e i]; a new slot, with slot.source == \e i, if no vertex had this key yet
+  Slot& find(unsigned int i, std::uint32_t hash)
+  {
+    const WeldKey key = weldKey(source_[i], inv_tolerance_);
+    for (std::size_t s = hash & mask_;; s = (s + 1) & mask_)
+    {
+      Slot& slot = slots_[s];
+      if (slot.source == EMPTY)
+      {
+        slot.hash = hash;
+        slot.source = i;
+        return slot;
+      }
+      if (slot.hash == hash && weldKey(source_[slot.source], inv_tolerance_) == key)
+        return slot;
+    }
+  }
+
+private:
+  const EigenSTL::vector_Vector3d& source_;
+  double inv_tolerance_;
+  std::size_t mask_;
+  std::vector<Slot> slots_;
 };
 
-/// Sorting operator by point value
-struct ltLocalVertexValue
+/// Check the input of createMeshFromVertices() and return the number of triangles it makes, or 0
+unsigned int weldTriangleCount(const EigenSTL::vector_Vector3d& source, double tolerance)
+{
+  if (source.size() < 3)
+    return 0;
+  if (source.size() % 3 != 0)
+    CONSOLE_BRIDGE_logError("The number of vertices to construct a mesh from is not divisible by 3. Probably "
+                            "constructed triangles will not make sense.");
+  if (tolerance < 0.0)
+    CONSOLE_BRIDGE_logWarn("Negative tolerance %lf for welding vertices; only identical vertices are welded",
+                           tolerance);
+  return source.size() / 3;
+}
+
+/// Sphere used while computing the smallest enclosing sphere of a set of points
+struct EnclosingSphere
 {
-  bool operator()(const LocalVertexType& p1, const LocalVertexType& p2) const
+  EnclosingSphere() : center(0.0, 0.0, 0.0), radius(-1.0)
+  {
+  }
+
+  EnclosingSphere(const Eigen::Vector3d& c, double r) : center(c), radius(r)
   {
-    if (p1.x < p2.x)
-      return true;
-    if (p1.x > p2.x)
-      return false;
-    if (p1.y < p2.y)
-      return true;
-    if (p1.y > p2.y)
-      return false;
-    if (p1.z < p2.z)
-      return true;
-    return false;
   }
+
+  bool contains(const Eigen::Vector3d& p) const
+  {
+    return (p - center).norm() <= radius * (1.0 + 1e-12) + 1e-12;
+  }
+
+  Eigen::Vector3d center;
+  double radius;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
 
-/// Sorting operator by point index
-struct ltLocalVertexIndex
+/// The smallest sphere with \e a and \e b on its surface
+EnclosingSphere sphereThrough(const Eigen::Vector3d& a, const Eigen::Vector3d& b)
 {
-  bool operator()(const LocalVertexType& p1, const LocalVertexType& p2) const
+  return EnclosingSphere((a + b) / 2.0, (a - b).norm() / 2.0);
+}
+
+/// The smallest sphere with \e a, \e b and \e c on its surface; for collinear points, the smallest sphere
+/// that contains them
+EnclosingSphere sphereThrough(const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c)
+{
+  const Eigen::Vector3d ab = b - a;
+  const Eigen::Vector3d ac = c - a;
+  const Eigen::Vector3d n = ab.cross(ac);
+  const double n2 = n.squaredNorm();
+  if (n2 <= 1e-24 * ab.squaredNorm() * ac.squaredNorm())
   {
-    return p1.index < p2.index;
+    EnclosingSphere s = sphereThrough(a, b);
+    const EnclosingSphere s2 = sphereThrough(a, c);
+    const EnclosingSphere s3 = sphereThrough(b, c);
+    if (s2.radius > s.radius)
+      s = s2;
+    if (s3.radius > s.radius)
+      s = s3;
+    return s;
   }
-};
+  const Eigen::Vector3d offset = (n.cross(ab) * ac.squaredNorm() + ac.cross(n) * ab.squaredNorm()) / (2.0 * n2);
+  return EnclosingSphere(a + offset, offset.norm());
+}
+
+/// The sphere with \e a, \e b, \e c and \e d on its surface; for coplanar points, the smallest sphere
+/// through three of them that contains the fourth
+EnclosingSphere sphereThrough(const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c,
+                              const Eigen::Vector3d& d)
+{
+  Eigen::Matrix3d m;
+  m.row(0) = b - a;
+  m.row(1) = c - a;
+  m.row(2) = d - a;
+  const double scale = m.row(0).norm() * m.row(1).norm() * m.row(2).norm();
+  const double det = m.determinant();
+  if (std::fabs(det) > 1e-12 * scale)
+  {
+    const Eigen::Vector3d rhs(m.row(0).squaredNorm() / 2.0, m.row(1).squaredNorm() / 2.0,
+                              m.row(2).squaredNorm() / 2.0);
+    const Eigen::Vector3d offset = m.inverse() * rhs;
+    return EnclosingSphere(a + offset, offset.norm());
+  }
+
+  const EnclosingSphere candidates[4] = { sphereThrough(a, b, c), sphereThrough(a, b, d), sphereThrough(a, c, d),
+                                          sphereThrough(b, c, d) };
+  const Eigen::Vector3d* other[4] = { &d, &c, &b, &a };
+  EnclosingSphere best;
+  for (int i = 0; i < 4; ++i)
+    if (candidates[i].contains(*other[i]) && (best.radius < 0.0 || candidates[i].radius < best.radius))
+      best = candidates[i];
+  if (best.radius < 0.0)
+    for (int i = 0; i < 4; ++i)
+      if (candidates[i].radius > best.radius)
+        best = candidates[i];
+  return best;
+}
 }
 }
 
 Mesh* createMeshFromVertices(const EigenSTL::vector_Vector3d& vertices, const std::vector<unsigned int>& triangles)
 {
   unsigned int nt = triangles.size() / 3;
-  Mesh* mesh = new Mesh(vertices.size(), nt);
+  Mesh* mesh = new Mesh(vertices.size(), nt, false);
   for (unsigned int i = 0; i < vertices.size(); ++i)
   {
     mesh->vertices[3 * i] = vertices[i].x();
@@ -117,86 +269,173 @@ Mesh* createMeshFromVertices(const EigenSTL::vector_Vector3d& vertices, const st
   }
 
   std::copy(triangles.begin(), triangles.end(), mesh->triangles);
-  mesh->computeTriangleNormals();
-  mesh->computeVertexNormals();
 
   return mesh;
 }
 
 Mesh* createMeshFromVertices(const EigenSTL::vector_Vector3d& source)
 {
-  if (source.size() < 3)
-    return NULL;
-
-  if (source.size() % 3 != 0)
-    CONSOLE_BRIDGE_logError("The number of vertices to construct a mesh from is not divisible by 3. Probably "
-                            "constructed triangles will not make sense.");
-
-  std::set<detail::LocalVertexType, detail::ltLocalVertexValue> vertices;
-  std::vector<unsigned int> triangles;
+  return createMeshFromVertices(source, 0.0);
+}
 
-  unsigned int n = source.size() / 3;
+Mesh* createMeshFromVertices(const EigenSTL::vector_Vector3d& source, double tolerance)
+{
+  const unsigned int nt = detail::weldTriangleCount(source, tolerance);
+  if (nt == 0)
+    return NULL;
+  const unsigned int n = nt * 3;
+  const double inv_tolerance = tolerance > 0.0 ? 1.0 / tolerance : 0.0;
+
+  // the triangles are written into the mesh as the vertices are welded; the vertex count is known only at the end
+  Mesh* mesh = new Mesh();
+  mesh->triangle_count = nt;
+  mesh->triangles = new unsigned int[n];
+  std::vector<double> vertices;
+  detail::WeldTable table(n, source, inv_tolerance);
   for (unsigned int i = 0; i < n; ++i)
   {
-    // check if we have new vertices
-    unsigned int i3 = i * 3;
-    detail::LocalVertexType vt1(source[i3]);
-    std::set<detail::LocalVertexType, detail::ltLocalVertexValue>::iterator p1 = vertices.find(vt1);
-    if (p1 == vertices.end())
+    detail::WeldTable::Slot& slot = table.find(i, detail::weldHash(detail::weldKey(source[i], inv_tolerance)));
+    if (slot.source == i)
     {
-      vt1.index = vertices.size();
-      vertices.insert(vt1);
+      slot.index = vertices.size() / 3;
+      vertices.insert(vertices.end(), source[i].data(), source[i].data() + 3);
     }
-    else
-      vt1.index = p1->index;
-    triangles.push_back(vt1.index);
+    mesh->triangles[i] = slot.index;
+  }
 
-    detail::LocalVertexType vt2(source[++i3]);
-    std::set<detail::LocalVertexType, detail::ltLocalVertexValue>::iterator p2 = vertices.find(vt2);
-    if (p2 == vertices.end())
+  mesh->vertex_count = vertices.size() / 3;
+  mesh->vertices = new double[vertices.size()];
+  std::copy(vertices.begin(), vertices.end(), mesh->vertices);
+
+  return mesh;
+}
+
+Mesh* createMeshFromVerticesParallel(const EigenSTL::vector_Vector3d& source, double tolerance, unsigned int threads)
+{
+  const unsigned int nt = detail::weldTriangleCount(source, tolerance);
+  if (nt == 0)
+    return NULL;
+  const unsigned int n = nt * 3;
+  const double inv_tolerance = tolerance > 0.0 ? 1.0 / tolerance : 0.0;
+
+  bodies::ThreadPool pool(threads);
+  const std::size_t CHUNK = 1 << 16;
+  const std::size_t chunks = (n + CHUNK - 1) / CHUNK;
+
+  // vertices are split by the top bits of their hash into parts that are welded independently
+  const unsigned int PART_BITS = 6;
+  const unsigned int parts = 1u << PART_BITS;
+  std::vector<std::uint32_t> hashes(n);
+  std::vector<std::size_t> part_offsets(chunks * parts, 0);
+  pool.run(chunks, [&](std::size_t c, unsigned int) {
+    std::size_t* counts = &part_offsets[c * parts];
+    for (std::size_t i = c * CHUNK, end = std::min<std::size_t>(n, i + CHUNK); i < end; ++i)
     {
-      vt2.index = vertices.size();
-      vertices.insert(vt2);
+      hashes[i] = detail::weldHash(detail::weldKey(source[i], inv_tolerance));
+      ++counts[hashes[i] >> (32 - PART_BITS)];
     }
-    else
-      vt2.index = p2->index;
-    triangles.push_back(vt2.index);
+  });
 
-    detail::LocalVertexType vt3(source[++i3]);
-    std::set<detail::LocalVertexType, detail::ltLocalVertexValue>::iterator p3 = vertices.find(vt3);
-    if (p3 == vertices.end())
+  // sort the vertices by part, keeping the source order within each part
+  std::vector<std::size_t> part_begin(parts + 1);
+  std::size_t offset = 0;
+  for (unsigned int p = 0; p < parts; ++p)
+  {
+    part_begin[p] = offset;
+    for (std::size_t c = 0; c < chunks; ++c)
     {
-      vt3.index = vertices.size();
-      vertices.insert(vt3);
+      const std::size_t count = part_offsets[c * parts + p];
+      part_offsets[c * parts + p] = offset;
+      offset += count;
     }
-    else
-      vt3.index = p3->index;
-
-    triangles.push_back(vt3.index);
   }
+  part_begin[parts] = offset;
+  std::vector<unsigned int> order(n);
+  pool.run(chunks, [&](std::size_t c, unsigned int) {
+    std::size_t* offsets = &part_offsets[c * parts];
+    for (std::size_t i = c * CHUNK, end = std::min<std::size_t>(n, i + CHUNK); i < end; ++i)
+      order[offsets[hashes[i] >> (32 - PART_BITS)]++] = i;
+  });
+
+  // weld each part; every vertex learns the first vertex in the source with its key
+  std::vector<unsigned int> first(n);
+  pool.run(parts, [&](std::size_t p, unsigned int) {
+    detail::WeldTable table(part_begin[p + 1] - part_begin[p], source, inv_tolerance);
+    for (std::size_t j = part_begin[p]; j < part_begin[p + 1]; ++j)
+      first[order[j]] = table.find(order[j], hashes[order[j]]).source;
+  });
+
+  // number the first vertices in source order, as the serial version does
+  std::vector<unsigned int> chunk_begin(chunks + 1, 0);
+  pool.run(chunks, [&](std::size_t c, unsigned int) {
+    unsigned int count = 0;
+    for (std::size_t i = c * CHUNK, end = std::min<std::size_t>(n, i + CHUNK); i < end; ++i)
+      count += first[i] == i;
+    chunk_begin[c + 1] = count;
+  });
+  for (std::size_t c = 0; c < chunks; ++c)
+    chunk_begin[c + 1] += chunk_begin[c];
+
+  Mesh* mesh = new Mesh(chunk_begin[chunks], nt, false);
+  std::vector<unsigned int>& index = order;  // no longer needed, so it holds the index of each first vertex
+  pool.run(chunks, [&](std::size_t c, unsigned int) {
+    unsigned int next = chunk_begin[c];
+    for (std::size_t i = c * CHUNK, end = std::min<std::size_t>(n, i + CHUNK); i < end; ++i)
+      if (first[i] == i)
+      {
+        index[i] = next;
+        std::copy(source[i].data(), source[i].data() + 3, mesh->vertices + 3 * next);
+        ++next;
+      }
+  });
+  pool.run(chunks, [&](std::size_t c, unsigned int) {
+    for (std::size_t i = c * CHUNK, end = std::min<std::size_t>(n, i + CHUNK); i < end; ++i)
+      mesh->triangles[i] = index[first[i]];
+  });
 
-  // sort our vertices
-  std::vector<detail::LocalVertexType> vt;
-  vt.insert(vt.end(), vertices.begin(), vertices.end());
-  std::sort(vt.begin(), vt.end(), detail::ltLocalVertexIndex());
+  return mesh;
+}
 
-  // copy the data to a mesh structure
-  unsigned int nt = triangles.size() / 3;
+void computeMinimumBoundingSphere(const EigenSTL::vector_Vector3d& vertices, Eigen::Vector3d& center, double& radius)
+{
+  center = Eigen::Vector3d(0.0, 0.0, 0.0);
+  radius = 0.0;
+  if (vertices.empty())
+    return;
+
+  // the expected running time is linear for points in random order; use a fixed seed so results are repeatable
+  EigenSTL::vector_Vector3d p(vertices);
+  std::mt19937 generator(0);
+  std::shuffle(p.begin(), p.end(), generator);
 
-  Mesh* mesh = new Mesh(vt.size(), nt);
-  for (unsigned int i = 0; i < vt.size(); ++i)
+  // the iterative form of Welzl's algorithm: every loop fixes one more point on the surface of the sphere
+  detail::EnclosingSphere s(p[0], 0.0);
+  for (std::size_t i = 1; i < p.size(); ++i)
   {
-    unsigned int i3 = i * 3;
-    mesh->vertices[i3] = vt[i].x;
-    mesh->vertices[i3 + 1] = vt[i].y;
-    mesh->vertices[i3 + 2] = vt[i].z;
+    if (s.contains(p[i]))
+      continue;
+    s = detail::EnclosingSphere(p[i], 0.0);
+    for (std::size_t j = 0; j < i; ++j)
+    {
+      if (s.contains(p[j]))
+        continue;
+      s = detail::sphereThrough(p[i], p[j]);
+      for (std::size_t k = 0; k < j; ++k)
+      {
+        if (s.contains(p[k]))
+          continue;
+        s = detail::sphereThrough(p[i], p[j], p[k]);
+        for (std::size_t l = 0; l < k; ++l)
+          if (!s.contains(p[l]))
+            s = detail::sphereThrough(p[i], p[j], p[k], p[l]);
+      }
+    }
   }
 
-  std::copy(triangles.begin(), triangles.end(), mesh->triangles);
-  mesh->computeTriangleNormals();
-  mesh->computeVertexNormals();
-
-  return mesh;
+  // make sure rounding did not leave any point outside
+  center = s.center;
+  for (std::size_t i = 0; i < p.size(); ++i)
+    radius = std::max(radius, (p[i] - center).norm());
 }
 
 Mesh* createMeshFromResource(const std::string& resource)
@@ -377,7 +616,7 @@ Mesh* createMeshFromShape(const Box& box)
   double z = box.size[2] / 2.0;
 
   // define vertices of box mesh
-  Mesh* result = new Mesh(8, 12);
+  Mesh* result = new Mesh(8, 12, false);
   result->vertices[0] = -x;
   result->vertices[1] = -y;
   result->vertices[2] = -z;
@@ -413,8 +652,6 @@ Mesh* createMeshFromShape(const Box& box)
   static const unsigned int tri[] = { 0, 1, 2, 2, 3, 0, 4, 3, 2, 2, 6, 4, 7, 6, 2, 2, 1, 7,
                                       3, 4, 5, 5, 0, 3, 0, 5, 7, 7, 1, 0, 7, 5, 4, 4, 6, 7 };
   memcpy(result->triangles, tri, sizeof(unsigned int) * 36);
-  result->computeTriangleNormals();
-  result->computeVertexNormals();
   return result;
 }
 
@@ -651,34 +888,23 @@ void writeSTLBinary(const Mesh* mesh, std::vector<char>& buffer)
   uint32_t nt = mesh->triangle_count;
   memcpy(ptr, &nt, sizeof(uint32_t));
   ptr += sizeof(uint32_t);
+  // stored normals are computed first if missing; compact meshes compute the normal of each triangle
+  mesh->getTriangleNormals();
   for (unsigned int i = 0; i < mesh->triangle_count; ++i)
   {
-    unsigned int i3 = i * 3;
+    double normal[3];
+    mesh->getTriangleNormal(i, normal);
+    writeFloatToSTL(ptr, normal[0]);
+    writeFloatToSTL(ptr, normal[1]);
+    writeFloatToSTL(ptr, normal[2]);
 
-    if (mesh->triangle_normals)
+    for (unsigned int k = 0; k < 3; ++k)
     {
-      writeFloatToSTL(ptr, mesh->triangle_normals[i3]);
-      writeFloatToSTL(ptr, mesh->triangle_normals[i3 + 1]);
-      writeFloatToSTL(ptr, mesh->triangle_normals[i3 + 2]);
+      const unsigned int index = mesh->getTriangleIndex(3 * i + k) * 3;
+      writeFloatToSTL(ptr, mesh->getVertexCoordinate(index));
+      writeFloatToSTL(ptr, mesh->getVertexCoordinate(index + 1));
+      writeFloatToSTL(ptr, mesh->getVertexCoordinate(index + 2));
     }
-    else
-    {
-      memset(ptr, 0, sizeof(float) * 3);
-      ptr += sizeof(float) * 3;
-    }
-
-    unsigned int index = mesh->triangles[i3] * 3;
-    writeFloatToSTL(ptr, mesh->vertices[index]);
-    writeFloatToSTL(ptr, mesh->vertices[index + 1]);
-    writeFloatToSTL(ptr, mesh->vertices[index + 2]);
-    index = mesh->triangles[i3 + 1] * 3;
-    writeFloatToSTL(ptr, mesh->vertices[index]);
-    writeFloatToSTL(ptr, mesh->vertices[index + 1]);
-    writeFloatToSTL(ptr, mesh->vertices[index + 2]);
-    index = mesh->triangles[i3 + 2] * 3;
-    writeFloatToSTL(ptr, mesh->vertices[index]);
-    writeFloatToSTL(ptr, mesh->vertices[index + 1]);
-    writeFloatToSTL(ptr, mesh->vertices[index + 2]);
     memset(ptr, 0, 2);
     ptr += 2;
   }
@@ -0,0 +1,238 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <geometric_shapes/point_cloud_filter.h>
+#include <console_bridge/console.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+const std::size_t bodies::PointCloudFilter::NO_BODY;
+
+namespace bodies
+{
+namespace detail
+{
+/** \brief Number of points that are converted to structure-of-arrays form at once */
+static const std::size_t FILTER_BLOCK_SIZE = 256;
+
+static const std::size_t FILTER_CACHE_LINE_SIZE = 64;
+
+/** \brief The number of inside points counted by one worker, padded so that the counters of different
+    workers are on different cache lines */
+struct WorkerCount
+{
+  WorkerCount() : inside(0)
+  {
+  }
+
+  char pad_begin[FILTER_CACHE_LINE_SIZE];
+  std::size_t inside;
+  char pad_end[FILTER_CACHE_LINE_SIZE];
+};
+
+/** \brief Label the points [begin, end) of a cloud and return how many of them are inside */
+template <typename T>
+static std::size_t filterRange(const BodyVector& bodies, const T* points, std::size_t stride, std::size_t begin,
+                               std::size_t end, uint8_t* labels, std::size_t* indices)
+{
+  double xs[FILTER_BLOCK_SIZE], ys[FILTER_BLOCK_SIZE], zs[FILTER_BLOCK_SIZE];
+  uint8_t mask[FILTER_BLOCK_SIZE];
+  std::size_t inside = 0;
+
+  for (std::size_t start = begin; start < end; start += FILTER_BLOCK_SIZE)
+  {
+    const std::size_t count = std::min(FILTER_BLOCK_SIZE, end - start);
+    uint8_t* block_labels = labels + start;
+
+    if (bodies.getUseBoundingVolumeHierarchy())
+    {
+      // the hierarchy answers single points; it already avoids testing most bodies
+      for (std::size_t j = 0; j < count; ++j)
+      {
+        const T* p = points + (start + j) * stride;
+        std::size_t index = PointCloudFilter::NO_BODY;
+        bool in = bodies.containsPoint(Eigen::Vector3d(p[0], p[1], p[2]), index);
+        block_labels[j] = in ? PointCloudFilter::INSIDE : PointCloudFilter::OUTSIDE;
+        if (indices)
+          indices[start + j] = in ? index : PointCloudFilter::NO_BODY;
+        inside += in;
+      }
+      continue;
+    }
+
+    for (std::size_t j = 0; j < count; ++j)
+    {
+      const T* p = points + (start + j) * stride;
+      xs[j] = p[0];
+      ys[j] = p[1];
+      zs[j] = p[2];
+    }
+    memset(block_labels, PointCloudFilter::OUTSIDE, count);
+    if (indices)
+      std::fill(indices + start, indices + start + count, PointCloudFilter::NO_BODY);
+
+    // test the whole block against one body at a time, in order, so that the first
+    // containing body is reported, as for BodyVector::containsPoint()
+    std::size_t remaining = count;
+    for (std::size_t i = 0; i < bodies.getCount() && remaining > 0; ++i)
+    {
+      bodies.getBody(i)->containsPoints(xs, ys, zs, count, mask);
+      for (std::size_t j = 0; j < count; ++j)
+        if (mask[j] && block_labels[j] == PointCloudFilter::OUTSIDE)
+        {
+          block_labels[j] = PointCloudFilter::INSIDE;
+          if (indices)
+            indices[start + j] = i;
+          --remaining;
+        }
+    }
+    inside += count - remaining;
+  }
+  return inside;
+}
+}
+}
+
+struct bodies::PointCloudFilter::Job
+{
+  const BodyVector* bodies;
+  const float* points_float;
+  const double* points_double;
+  std::size_t stride;
+  std::size_t n;
+  uint8_t* labels;
+  std::size_t* indices;
+  std::size_t chunk_size;
+
+  /** \brief Label the points of chunk \e chunk and return how many of them are inside */
+  std::size_t process(std::size_t chunk) const
+  {
+    const std::size_t begin = chunk * chunk_size;
+    const std::size_t end = std::min(n, begin + chunk_size);
+    if (points_float)
+      return detail::filterRange(*bodies, points_float, stride, begin, end, labels, indices);
+    return detail::filterRange(*bodies, points_double, stride, begin, end, labels, indices);
+  }
+};
+
+bodies::PointCloudFilter::PointCloudFilter(unsigned int threads) : pool_(threads), chunk_size_(1024)
+{
+}
+
+unsigned int bodies::PointCloudFilter::getThreadCount() const
+{
+  return pool_.getThreadCount();
+}
+
+void bodies::PointCloudFilter::setChunkSize(std::size_t chunk_size)
+{
+  if (chunk_size == 0)
+  {
+    CONSOLE_BRIDGE_logWarn("Chunk size must be positive; using 1");
+    chunk_size = 1;
+  }
+  chunk_size_ = chunk_size;
+}
+
+std::size_t bodies::PointCloudFilter::getChunkSize() const
+{
+  return chunk_size_;
+}
+
+const bodies::PointCloudFilter::Statistics& bodies::PointCloudFilter::getLastStatistics() const
+{
+  return statistics_;
+}
+
+void bodies::PointCloudFilter::filter(const BodyVector& bodies, const float* points, std::size_t stride, std::size_t n,
+                                      uint8_t* labels, std::size_t* indices)
+{
+  Job job;
+  job.bodies = &bodies;
+  job.points_float = points;
+  job.points_double = NULL;
+  job.stride = stride;
+  job.n = n;
+  job.labels = labels;
+  job.indices = indices;
+  job.chunk_size = chunk_size_;
+  run(job);
+}
+
+void bodies::PointCloudFilter::filter(const BodyVector& bodies, const double* points, std::size_t stride,
+                                      std::size_t n, uint8_t* labels, std::size_t* indices)
+{
+  Job job;
+  job.bodies = &bodies;
+  job.points_float = NULL;
+  job.points_double = points;
+  job.stride = stride;
+  job.n = n;
+  job.labels = labels;
+  job.indices = indices;
+  job.chunk_size = chunk_size_;
+  run(job);
+}
+
+void bodies::PointCloudFilter::filter(const BodyVector& bodies, const EigenSTL::vector_Vector3d& points,
+                                      std::vector<uint8_t>& labels, std::vector<std::size_t>& indices)
+{
+  labels.resize(points.size());
+  indices.resize(points.size());
+  if (points.empty())
+  {
+    statistics_ = Statistics();
+    return;
+  }
+  filter(bodies, points[0].data(), sizeof(Eigen::Vector3d) / sizeof(double), points.size(), &labels[0], &indices[0]);
+}
+
+void bodies::PointCloudFilter::run(const Job& job)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // one counter per worker, so the workers never update a shared total
+  const std::size_t chunks = (job.n + job.chunk_size - 1) / job.chunk_size;
+  std::vector<detail::WorkerCount> counts(pool_.getThreadCount());
+  pool_.run(chunks,
+            [&job, &counts](std::size_t chunk, unsigned int worker) { counts[worker].inside += job.process(chunk); });
+
+  statistics_.points = job.n;
+  statistics_.inside = 0;
+  for (std::size_t w = 0; w < counts.size(); ++w)
+    statistics_.inside += counts[w].inside;
+  statistics_.threads = chunks > 1 ? pool_.getThreadCount() : 1;
+  statistics_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
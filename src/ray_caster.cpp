@@ -0,0 +1,117 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <geometric_shapes/ray_caster.h>
+#include <console_bridge/console.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+bodies::RayCaster::RayCaster(unsigned int threads) : pool_(threads), chunk_size_(1024)
+{
+}
+
+unsigned int bodies::RayCaster::getThreadCount() const
+{
+  return pool_.getThreadCount();
+}
+
+void bodies::RayCaster::setChunkSize(std::size_t chunk_size)
+{
+  if (chunk_size == 0)
+  {
+    CONSOLE_BRIDGE_logWarn("Chunk size must be positive; using 1");
+    chunk_size = 1;
+  }
+  chunk_size_ = chunk_size;
+}
+
+std::size_t bodies::RayCaster::getChunkSize() const
+{
+  return chunk_size_;
+}
+
+const bodies::RayCaster::Statistics& bodies::RayCaster::getLastStatistics() const
+{
+  return statistics_;
+}
+
+void bodies::RayCaster::castRays(const BodyVector& bodies, const Eigen::Vector3d* origins, const Eigen::Vector3d* dirs,
+                                 std::size_t n, double* out_t, std::size_t* out_body_index)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // one counter per chunk, so the workers never update a shared total
+  const std::size_t chunk_size = chunk_size_;
+  const std::size_t chunks = (n + chunk_size - 1) / chunk_size;
+  std::vector<std::size_t> hits(chunks, 0);
+  pool_.run(chunks, [&](std::size_t chunk, unsigned int) {
+    const std::size_t begin = chunk * chunk_size;
+    const std::size_t count = std::min(n, begin + chunk_size) - begin;
+    bodies.intersectsRays(origins + begin, dirs + begin, count, out_t + begin,
+                          out_body_index ? out_body_index + begin : NULL);
+    for (std::size_t i = begin; i < begin + count; ++i)
+      if (!std::isinf(out_t[i]))
+        ++hits[chunk];
+  });
+
+  statistics_.rays = n;
+  statistics_.hits = 0;
+  for (std::size_t c = 0; c < chunks; ++c)
+    statistics_.hits += hits[c];
+  statistics_.threads = chunks > 1 ? pool_.getThreadCount() : 1;
+  statistics_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void bodies::RayCaster::castRays(const BodyVector& bodies, const EigenSTL::vector_Vector3d& origins,
+                                 const EigenSTL::vector_Vector3d& dirs, std::vector<double>& out_t,
+                                 std::vector<std::size_t>& out_body_index)
+{
+  if (origins.size() != dirs.size())
+  {
+    CONSOLE_BRIDGE_logError("Number of ray origins (%zu) and directions (%zu) differ", origins.size(), dirs.size());
+    out_t.clear();
+    out_body_index.clear();
+    return;
+  }
+
+  out_t.resize(origins.size());
+  out_body_index.resize(origins.size());
+  if (origins.empty())
+  {
+    statistics_ = Statistics();
+    return;
+  }
+  castRays(bodies, &origins[0], &dirs[0], origins.size(), &out_t[0], &out_body_index[0]);
+}
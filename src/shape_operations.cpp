@@ -265,11 +265,11 @@ Eigen::Vector3d computeShapeExtents(const Shape* shape)
         unsigned int i3 = i * 3;
         for (unsigned int k = 0; k < 3; ++k)
         {
-          unsigned int i3k = i3 + k;
-          if (mesh->vertices[i3k] > vmax[k])
-            vmax[k] = mesh->vertices[i3k];
-          if (mesh->vertices[i3k] < vmin[k])
-            vmin[k] = mesh->vertices[i3k];
+          const double v = mesh->getVertexCoordinate(i3 + k);
+          if (v > vmax[k])
+            vmax[k] = v;
+          if (v < vmin[k])
+            vmin[k] = v;
         }
       }
       return Eigen::Vector3d(vmax[0] - vmin[0], vmax[1] - vmin[1], vmax[2] - vmin[2]);
@@ -333,16 +333,28 @@ void computeShapeBoundingSphere(const Shape* shape, Eigen::Vector3d& center, dou
       double mx = std::numeric_limits<double>::max();
       Eigen::Vector3d min(mx, mx, mx);
       Eigen::Vector3d max(-mx, -mx, -mx);
-      unsigned int cnt = mesh->vertex_count * 3;
-      for (unsigned int i = 0; i < cnt; i += 3)
+      EigenSTL::vector_Vector3d vertices(mesh->vertex_count);
+      for (unsigned int i = 0; i < mesh->vertex_count; ++i)
       {
-        Eigen::Vector3d v(mesh->vertices[i + 0], mesh->vertices[i + 1], mesh->vertices[i + 2]);
-        min = min.cwiseMin(v);
-        max = max.cwiseMax(v);
+        vertices[i] = Eigen::Vector3d(mesh->getVertexCoordinate(3 * i), mesh->getVertexCoordinate(3 * i + 1),
+                                      mesh->getVertexCoordinate(3 * i + 2));
+        min = min.cwiseMin(vertices[i]);
+        max = max.cwiseMax(vertices[i]);
       }
 
       center = (min + max) * 0.5;
       radius = (max - min).norm() * 0.5;
+
+      // the sphere around the bounding box is optimal for box-like meshes; keep it unless the smallest
+      // enclosing sphere is tighter
+      Eigen::Vector3d min_center;
+      double min_radius;
+      computeMinimumBoundingSphere(vertices, min_center, min_radius);
+      if (min_radius < radius * (1.0 - 1e-9))
+      {
+        center = min_center;
+        radius = min_radius;
+      }
     }
   }
 }
@@ -406,17 +418,17 @@ bool constructMsgFromShape(const Shape* shape, ShapeMsg& shape_msg)
     for (unsigned int i = 0; i < mesh->vertex_count; ++i)
     {
       unsigned int i3 = i * 3;
-      s.vertices[i].x = mesh->vertices[i3];
-      s.vertices[i].y = mesh->vertices[i3 + 1];
-      s.vertices[i].z = mesh->vertices[i3 + 2];
+      s.vertices[i].x = mesh->getVertexCoordinate(i3);
+      s.vertices[i].y = mesh->getVertexCoordinate(i3 + 1);
+      s.vertices[i].z = mesh->getVertexCoordinate(i3 + 2);
     }
 
     for (unsigned int i = 0; i < s.triangles.size(); ++i)
     {
       unsigned int i3 = i * 3;
-      s.triangles[i].vertex_indices[0] = mesh->triangles[i3];
-      s.triangles[i].vertex_indices[1] = mesh->triangles[i3 + 1];
-      s.triangles[i].vertex_indices[2] = mesh->triangles[i3 + 2];
+      s.triangles[i].vertex_indices[0] = mesh->getTriangleIndex(i3);
+      s.triangles[i].vertex_indices[1] = mesh->getTriangleIndex(i3 + 1);
+      s.triangles[i].vertex_indices[2] = mesh->getTriangleIndex(i3 + 2);
     }
     shape_msg = s;
   }
@@ -468,13 +480,15 @@ void saveAsText(const Shape* shape, std::ostream& out)
     for (unsigned int i = 0; i < mesh->vertex_count; ++i)
     {
       unsigned int i3 = i * 3;
-      out << mesh->vertices[i3] << " " << mesh->vertices[i3 + 1] << " " << mesh->vertices[i3 + 2] << std::endl;
+      out << mesh->getVertexCoordinate(i3) << " " << mesh->getVertexCoordinate(i3 + 1) << " "
+          << mesh->getVertexCoordinate(i3 + 2) << std::endl;
     }
 
     for (unsigned int i = 0; i < mesh->triangle_count; ++i)
     {
       unsigned int i3 = i * 3;
-      out << mesh->triangles[i3] << " " << mesh->triangles[i3 + 1] << " " << mesh->triangles[i3 + 2] << std::endl;
+      out << mesh->getTriangleIndex(i3) << " " << mesh->getTriangleIndex(i3 + 1) << " "
+          << mesh->getTriangleIndex(i3 + 2) << std::endl;
     }
   }
   else
@@ -526,7 +540,7 @@ Shape* constructShapeFromText(std::istream& in)
       {
         unsigned int v, t;
         in >> v >> t;
-        Mesh* m = new Mesh(v, t);
+        Mesh* m = new Mesh(v, t, false);
         result = m;
         for (unsigned int i = 0; i < m->vertex_count; ++i)
         {
@@ -538,8 +552,6 @@ Shape* constructShapeFromText(std::istream& in)
           unsigned int i3 = i * 3;
           in >> m->triangles[i3] >> m->triangles[i3 + 1] >> m->triangles[i3 + 2];
         }
-        m->computeTriangleNormals();
-        m->computeVertexNormals();
       }
       else
         CONSOLE_BRIDGE_logError("Unknown shape type: '%s'", type.c_str());
@@ -35,12 +35,215 @@
 /* Author: Ioan Sucan */
 
 #include "geometric_shapes/shapes.h"
+#include "geometric_shapes/thread_pool.h"
 #include <eigen_stl_containers/eigen_stl_containers.h>
 #include <octomap/octomap.h>
 #include <console_bridge/console.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
 
 namespace shapes
 {
+namespace
+{
+/// A cell of a uniform grid
+struct GridCell
+{
+  bool operator==(const GridCell& other) const
+  {
+    return x == other.x && y == other.y && z == other.z;
+  }
+
+  std::int64_t x, y, z;
+};
+
+struct GridCellHash
+{
+  std::size_t operator()(const GridCell& cell) const
+  {
+    std::uint64_t h = static_cast<std::uint64_t>(cell.x) * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 32) ^ static_cast<std::uint64_t>(cell.y)) * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 32) ^ static_cast<std::uint64_t>(cell.z)) * 0x9e3779b97f4a7c15ULL;
+    return static_cast<std::size_t>(h ^ (h >> 32));
+  }
+};
+
+/// Vertices of a mesh binned in a grid of cells as large as a distance threshold, so the vertices within the
+/// threshold of a vertex are found in the 27 cells around it. With a threshold of 0, a cell holds identical
+/// vertices only.
+class VertexGrid
+{
+public:
+  static const unsigned int EMPTY = ~0u;
+
+  VertexGrid(const double* vertices, unsigned int count, double threshold)
+    : vertices_(vertices)
+    , threshold_sqr_(threshold * threshold)
+    , inv_size_(threshold > 0.0 ? 1.0 / threshold : 0.0)
+    , next_(count, EMPTY)
+  {
+    cells_.reserve(count);
+  }
+
+  /// Add vertex \e v to its cell
+  void insert(unsigned int v)
+  {
+    unsigned int& head = cells_.emplace(cellOf(v), EMPTY).first->second;
+    next_[v] = head;
+    head = v;
+  }
+
+  /// Call \e visit(u) for every vertex u added to the grid that is within the threshold of vertex \e v
+  template <typename Visit>
+  void forEachNear(unsigned int v, const Visit& visit) const
+  {
+    const GridCell center = cellOf(v);
+    const int reach = inv_size_ > 0.0 ? 1 : 0;
+    for (int dx = -reach; dx <= reach; ++dx)
+      for (int dy = -reach; dy <= reach; ++dy)
+        for (int dz = -reach; dz <= reach; ++dz)
+        {
+          const GridCell cell = { center.x + dx, center.y + dy, center.z + dz };
+          const std::unordered_map<GridCell, unsigned int, GridCellHash>::const_iterator it = cells_.find(cell);
+          if (it == cells_.end())
+            continue;
+          for (unsigned int u = it->second; u != EMPTY; u = next_[u])
+            if (distanceSQR(u, v) <= threshold_sqr_)
+              visit(u);
+        }
+  }
+
+  /// Call \e visit(u) for every vertex u < \e v within the threshold of vertex \e v, unless more than \e limit
+  /// earlier vertices are looked at, in which case false is returned. The vertices must have been added in
+  /// decreasing order, so that each cell lists them in increasing order.
+  template <typename Visit>
+  bool forEachNearBefore(unsigned int v, std::size_t limit, const Visit& visit) const
+  {
+    const GridCell center = cellOf(v);
+    const int reach = inv_size_ > 0.0 ? 1 : 0;
+    std::size_t looked_at = 0;
+    for (int dx = -reach; dx <= reach; ++dx)
+      for (int dy = -reach; dy <= reach; ++dy)
+        for (int dz = -reach; dz <= reach; ++dz)
+        {
+          const GridCell cell = { center.x + dx, center.y + dy, center.z + dz };
+          const std::unordered_map<GridCell, unsigned int, GridCellHash>::const_iterator it = cells_.find(cell);
+          if (it == cells_.end())
+            continue;
+          for (unsigned int u = it->second; u != EMPTY && u < v; u = next_[u])
+          {
+            if (++looked_at > limit)
+              return false;
+            if (distanceSQR(u, v) <= threshold_sqr_)
+              visit(u);
+          }
+        }
+    return true;
+  }
+
+private:
+  GridCell cellOf(unsigned int v) const
+  {
+    std::int64_t c[3];
+    for (int k = 0; k < 3; ++k)
+      if (inv_size_ > 0.0)
+      {
+        // clamped, so that huge coordinates or tiny thresholds do not overflow; such cells only get fuller
+        const double cell = std::floor(vertices_[3 * v + k] * inv_size_);
+        c[k] = static_cast<std::int64_t>(std::max(-4e18, std::min(4e18, cell)));
+      }
+      else
+      {
+        // adding 0 turns -0 into +0, which is the same coordinate
+        const double x = vertices_[3 * v + k] + 0.0;
+        std::memcpy(&c[k], &x, sizeof(x));
+      }
+    const GridCell cell = { c[0], c[1], c[2] };
+    return cell;
+  }
+
+  double distanceSQR(unsigned int u, unsigned int v) const
+  {
+    const double dx = vertices_[3 * u] - vertices_[3 * v];
+    const double dy = vertices_[3 * u + 1] - vertices_[3 * v + 1];
+    const double dz = vertices_[3 * u + 2] - vertices_[3 * v + 2];
+    return dx * dx + dy * dy + dz * dz;
+  }
+
+  const double* vertices_;
+  double threshold_sqr_;
+  double inv_size_;
+  std::unordered_map<GridCell, unsigned int, GridCellHash> cells_;
+  std::vector<unsigned int> next_;
+};
+
+const unsigned int VertexGrid::EMPTY;
+
+/// Meshes with fewer triangles have their normals computed on the calling thread only when first asked for
+const unsigned int PARALLEL_NORMALS_MIN_TRIANGLES = 1 << 18;
+
+/// Point \e array, freed first, to a new array of \e n elements
+template <typename T>
+void allocateArray(T*& array, std::size_t n)
+{
+  delete[] array;
+  array = new T[n];
+}
+
+/// Free \e array and set it to NULL
+template <typename T>
+void releaseArray(T*& array)
+{
+  delete[] array;
+  array = NULL;
+}
+
+/// A copy of the \e n elements of \e array, or NULL if it is NULL
+template <typename T>
+T* copyArray(const T* array, std::size_t n)
+{
+  if (!array)
+    return NULL;
+  T* copy = new T[n];
+  std::copy(array, array + n, copy);
+  return copy;
+}
+
+/// Set \e normal to the unit normal of the triangle (\e v1, \e v2, \e v3); also the cross product it is the
+/// direction of to \e cross, unless it is NULL
+inline void triangleNormal(const double* v1, const double* v2, const double* v3, double* normal, double* cross)
+{
+  const double s1[3] = { v1[0] - v2[0], v1[1] - v2[1], v1[2] - v2[2] };
+  const double s2[3] = { v2[0] - v3[0], v2[1] - v3[1], v2[2] - v3[2] };
+  normal[0] = s1[1] * s2[2] - s1[2] * s2[1];
+  normal[1] = s1[2] * s2[0] - s1[0] * s2[2];
+  normal[2] = s1[0] * s2[1] - s1[1] * s2[0];
+  if (cross)
+    std::copy(normal, normal + 3, cross);
+  const double norm2 = normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2];
+  if (norm2 > 0.0)
+  {
+    const double norm = std::sqrt(norm2);
+    normal[0] /= norm;
+    normal[1] /= norm;
+    normal[2] /= norm;
+  }
+}
+
+/// Set the normals of triangles [\e begin, \e end) of \e mesh; also the cross products they are the
+/// directions of into \e cross, unless it is NULL
+void computeTriangleNormalRange(const Mesh& mesh, std::size_t begin, std::size_t end, double* cross)
+{
+  for (std::size_t i = begin; i < end; ++i)
+    triangleNormal(mesh.vertices + 3 * mesh.triangles[3 * i], mesh.vertices + 3 * mesh.triangles[3 * i + 1],
+                   mesh.vertices + 3 * mesh.triangles[3 * i + 2], mesh.triangle_normals + 3 * i,
+                   cross ? cross + 3 * i : NULL);
+}
+}
+
 const std::string Sphere::STRING_NAME = "sphere";
 const std::string Box::STRING_NAME = "box";
 const std::string Cylinder::STRING_NAME = "cylinder";
@@ -145,7 +348,7 @@ Box::Box(double x, double y, double z) : Shape()
   size[2] = z;
 }
 
-Mesh::Mesh() : Shape()
+Mesh::Mesh() : Shape(), triangle_normals_ready_(false), vertex_normals_ready_(false)
 {
   type = MESH;
   vertex_count = 0;
@@ -154,29 +357,67 @@ Mesh::Mesh() : Shape()
   triangles = NULL;
   triangle_normals = NULL;
   vertex_normals = NULL;
+  compact_vertices = NULL;
+  compact_triangles = NULL;
 }
 
-Mesh::Mesh(unsigned int v_count, unsigned int t_count) : Shape()
+Mesh::Mesh(unsigned int v_count, unsigned int t_count, bool allocate_normals)
+  : Shape(), triangle_normals_ready_(false), vertex_normals_ready_(false)
 {
   type = MESH;
   vertex_count = v_count;
   vertices = new double[v_count * 3];
   triangle_count = t_count;
   triangles = new unsigned int[t_count * 3];
-  triangle_normals = new double[t_count * 3];
-  vertex_normals = new double[v_count * 3];
+  triangle_normals = allocate_normals ? new double[t_count * 3] : NULL;
+  vertex_normals = allocate_normals ? new double[v_count * 3] : NULL;
+  compact_vertices = NULL;
+  compact_triangles = NULL;
+}
+
+Mesh::Mesh(Mesh&& other) : Mesh()
+{
+  swapArrays(other);
+}
+
+Mesh& Mesh::operator=(Mesh&& other)
+{
+  if (this != &other)
+  {
+    // the arrays of this mesh go to a temporary that frees them, and other is left with the empty ones
+    Mesh taken;
+    taken.swapArrays(other);
+    swapArrays(taken);
+  }
+  return *this;
 }
 
 Mesh::~Mesh()
 {
-  if (vertices)
-    delete[] vertices;
-  if (triangles)
-    delete[] triangles;
-  if (triangle_normals)
-    delete[] triangle_normals;
-  if (vertex_normals)
-    delete[] vertex_normals;
+  delete[] vertices;
+  delete[] triangles;
+  delete[] triangle_normals;
+  delete[] vertex_normals;
+  delete[] compact_vertices;
+  delete[] compact_triangles;
+}
+
+void Mesh::swapArrays(Mesh& other)
+{
+  std::swap(vertex_count, other.vertex_count);
+  std::swap(triangle_count, other.triangle_count);
+  std::swap(vertices, other.vertices);
+  std::swap(triangles, other.triangles);
+  std::swap(triangle_normals, other.triangle_normals);
+  std::swap(vertex_normals, other.vertex_normals);
+  std::swap(compact_vertices, other.compact_vertices);
+  std::swap(compact_triangles, other.compact_triangles);
+  const bool triangle_normals_ready = triangle_normals_ready_.load(std::memory_order_relaxed);
+  const bool vertex_normals_ready = vertex_normals_ready_.load(std::memory_order_relaxed);
+  triangle_normals_ready_.store(other.triangle_normals_ready_.load(std::memory_order_relaxed));
+  vertex_normals_ready_.store(other.vertex_normals_ready_.load(std::memory_order_relaxed));
+  other.triangle_normals_ready_.store(triangle_normals_ready);
+  other.vertex_normals_ready_.store(vertex_normals_ready);
 }
 
 Plane::Plane() : Shape()
@@ -226,28 +467,24 @@ Shape* Box::clone() const
 
 Shape* Mesh::clone() const
 {
-  Mesh* dest = new Mesh(vertex_count, triangle_count);
-  unsigned int n = 3 * vertex_count;
-  for (unsigned int i = 0; i < n; ++i)
-    dest->vertices[i] = vertices[i];
-  if (vertex_normals)
-    for (unsigned int i = 0; i < n; ++i)
-      dest->vertex_normals[i] = vertex_normals[i];
-  else
+  Mesh* dest = new Mesh();
+  dest->vertex_count = vertex_count;
+  dest->triangle_count = triangle_count;
+  dest->vertices = copyArray(vertices, 3 * vertex_count);
+  dest->triangles = copyArray(triangles, 3 * triangle_count);
+  dest->compact_vertices = copyArray(compact_vertices, 3 * vertex_count);
+  dest->compact_triangles = copyArray(compact_triangles, 3 * triangle_count);
+  // normals that were allocated but not computed hold nothing worth copying
+  std::lock_guard<std::mutex> lock(normals_mutex_);
+  if (triangle_normals_ready_.load(std::memory_order_relaxed))
   {
-    delete[] dest->vertex_normals;
-    dest->vertex_normals = NULL;
+    dest->triangle_normals = copyArray(triangle_normals, 3 * triangle_count);
+    dest->triangle_normals_ready_.store(true, std::memory_order_relaxed);
   }
-  n = 3 * triangle_count;
-  for (unsigned int i = 0; i < n; ++i)
-    dest->triangles[i] = triangles[i];
-  if (triangle_normals)
-    for (unsigned int i = 0; i < n; ++i)
-      dest->triangle_normals[i] = triangle_normals[i];
-  else
+  if (vertex_normals_ready_.load(std::memory_order_relaxed))
   {
-    delete[] dest->triangle_normals;
-    dest->triangle_normals = NULL;
+    dest->vertex_normals = copyArray(vertex_normals, 3 * vertex_count);
+    dest->vertex_normals_ready_.store(true, std::memory_order_relaxed);
   }
   return dest;
 }
@@ -309,6 +546,14 @@ void Box::scaleAndPadd(double scale, double padding)
 
 void Mesh::scaleAndPadd(double scale, double padding)
 {
+  if (getStorage() == COMPACT_STORAGE)
+  {
+    setStorage(DOUBLE_STORAGE);
+    scaleAndPadd(scale, padding);
+    setStorage(COMPACT_STORAGE);
+    return;
+  }
+
   // find the center of the mesh
   double sx = 0.0, sy = 0.0, sz = 0.0;
   for (unsigned int i = 0; i < vertex_count; ++i)
@@ -351,6 +596,7 @@ void Mesh::scaleAndPadd(double scale, double padding)
       vertices[i3 + 2] = sz + ndz;
     }
   }
+  clearNormals();
 }
 
 void Shape::print(std::ostream& out) const
@@ -420,30 +666,19 @@ bool Plane::isFixed() const
 
 void Mesh::computeTriangleNormals()
 {
+  if (getStorage() == COMPACT_STORAGE)
+    return;
   if (triangle_count && !triangle_normals)
     triangle_normals = new double[triangle_count * 3];
-
-  // compute normals
-  for (unsigned int i = 0; i < triangle_count; ++i)
-  {
-    unsigned int i3 = i * 3;
-    Eigen::Vector3d s1(vertices[triangles[i3] * 3] - vertices[triangles[i3 + 1] * 3],
-                       vertices[triangles[i3] * 3 + 1] - vertices[triangles[i3 + 1] * 3 + 1],
-                       vertices[triangles[i3] * 3 + 2] - vertices[triangles[i3 + 1] * 3 + 2]);
-    Eigen::Vector3d s2(vertices[triangles[i3 + 1] * 3] - vertices[triangles[i3 + 2] * 3],
-                       vertices[triangles[i3 + 1] * 3 + 1] - vertices[triangles[i3 + 2] * 3 + 1],
-                       vertices[triangles[i3 + 1] * 3 + 2] - vertices[triangles[i3 + 2] * 3 + 2]);
-    Eigen::Vector3d normal = s1.cross(s2);
-    normal.normalize();
-    triangle_normals[i3] = normal.x();
-    triangle_normals[i3 + 1] = normal.y();
-    triangle_normals[i3 + 2] = normal.z();
-  }
+  computeTriangleNormalRange(*this, 0, triangle_count, NULL);
+  triangle_normals_ready_.store(true, std::memory_order_release);
 }
 
 void Mesh::computeVertexNormals()
 {
-  if (!triangle_normals)
+  if (getStorage() == COMPACT_STORAGE)
+    return;
+  if (!triangle_normals_ready_.load(std::memory_order_relaxed))
     computeTriangleNormals();
   if (vertex_count && !vertex_normals)
     vertex_normals = new double[vertex_count * 3];
@@ -480,68 +715,257 @@ void Mesh::computeVertexNormals()
     vertex_normals[i3 + 1] = avg_normals[i][1];
     vertex_normals[i3 + 2] = avg_normals[i][2];
   }
+  vertex_normals_ready_.store(true, std::memory_order_release);
 }
 
-void Mesh::mergeVertices(double threshold)
+void Mesh::computeNormals(bool area_weighted, unsigned int threads)
 {
-  const double thresholdSQR = threshold * threshold;
-
-  std::vector<unsigned int> vertex_map(vertex_count);
-  EigenSTL::vector_Vector3d orig_vertices(vertex_count);
-  EigenSTL::vector_Vector3d compressed_vertices;
+  if (getStorage() == COMPACT_STORAGE)
+    return;
+  if (triangle_count && !triangle_normals)
+    triangle_normals = new double[triangle_count * 3];
+  if (vertex_count && !vertex_normals)
+    vertex_normals = new double[vertex_count * 3];
 
-  for (unsigned int vIdx = 0; vIdx < vertex_count; ++vIdx)
+  // the triangle normals are independent of each other; with area weights, the cross products they are
+  // normalized from, which are as long as twice the areas, are what the vertex normals add up
+  bodies::ThreadPool pool(threads);
+  const std::size_t CHUNK = 1 << 14;
+  std::vector<double> cross(area_weighted ? 3 * triangle_count : 0);
+  pool.run((triangle_count + CHUNK - 1) / CHUNK, [this, &cross](std::size_t c, unsigned int) {
+    computeTriangleNormalRange(*this, c * CHUNK, std::min<std::size_t>(triangle_count, (c + 1) * CHUNK),
+                               cross.empty() ? NULL : &cross[0]);
+  });
+
+  // the sums around the vertices go through the triangles in order, as in computeVertexNormals()
+  const double* weights = area_weighted ? cross.data() : triangle_normals;
+  std::fill(vertex_normals, vertex_normals + 3 * vertex_count, 0.0);
+  for (unsigned int i = 0; i < 3 * triangle_count; ++i)
   {
-    orig_vertices[vIdx][0] = vertices[3 * vIdx];
-    orig_vertices[vIdx][1] = vertices[3 * vIdx + 1];
-    orig_vertices[vIdx][2] = vertices[3 * vIdx + 2];
-    vertex_map[vIdx] = vIdx;
+    double* normal = vertex_normals + 3 * triangles[i];
+    const double* weight = weights + 3 * (i / 3);
+    normal[0] += weight[0];
+    normal[1] += weight[1];
+    normal[2] += weight[2];
   }
+  pool.run((vertex_count + CHUNK - 1) / CHUNK, [this](std::size_t c, unsigned int) {
+    for (std::size_t v = c * CHUNK, end = std::min<std::size_t>(vertex_count, v + CHUNK); v < end; ++v)
+    {
+      double* normal = vertex_normals + 3 * v;
+      const double norm2 = normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2];
+      if (norm2 > 0.0)
+      {
+        const double norm = std::sqrt(norm2);
+        normal[0] /= norm;
+        normal[1] /= norm;
+        normal[2] /= norm;
+      }
+    }
+  });
+  triangle_normals_ready_.store(true, std::memory_order_release);
+  vertex_normals_ready_.store(true, std::memory_order_release);
+}
 
-  for (unsigned int vIdx1 = 0; vIdx1 < vertex_count; ++vIdx1)
+const double* Mesh::getTriangleNormals() const
+{
+  if (triangle_normals_ready_.load(std::memory_order_acquire))
+    return triangle_normals;
+  std::lock_guard<std::mutex> lock(normals_mutex_);
+  if (!triangle_normals_ready_.load(std::memory_order_relaxed) && getStorage() == DOUBLE_STORAGE)
+    const_cast<Mesh*>(this)->computeTriangleNormals();
+  return triangle_normals;
+}
+
+const double* Mesh::getVertexNormals() const
+{
+  if (vertex_normals_ready_.load(std::memory_order_acquire))
+    return vertex_normals;
+  std::lock_guard<std::mutex> lock(normals_mutex_);
+  if (!vertex_normals_ready_.load(std::memory_order_relaxed) && getStorage() == DOUBLE_STORAGE)
   {
-    if (vertex_map[vIdx1] != vIdx1)
-      continue;
+    // triangle normals that other threads may be reading are not written again
+    if (triangle_normals_ready_.load(std::memory_order_relaxed))
+      const_cast<Mesh*>(this)->computeVertexNormals();
+    else
+      const_cast<Mesh*>(this)->computeNormals(false, triangle_count >= PARALLEL_NORMALS_MIN_TRIANGLES ? 0 : 1);
+  }
+  return vertex_normals;
+}
 
-    vertex_map[vIdx1] = compressed_vertices.size();
-    compressed_vertices.push_back(orig_vertices[vIdx1]);
+void Mesh::clearNormals()
+{
+  releaseArray(triangle_normals);
+  releaseArray(vertex_normals);
+  triangle_normals_ready_.store(false, std::memory_order_relaxed);
+  vertex_normals_ready_.store(false, std::memory_order_relaxed);
+}
 
-    for (unsigned int vIdx2 = vIdx1 + 1; vIdx2 < vertex_count; ++vIdx2)
+void Mesh::setStorage(Storage storage)
+{
+  if (storage == getStorage())
+    return;
+  clearNormals();
+  if (storage == COMPACT_STORAGE)
+  {
+    allocateArray(compact_vertices, 3 * vertex_count);
+    std::copy(vertices, vertices + 3 * vertex_count, compact_vertices);
+    releaseArray(vertices);
+    if (vertex_count <= 65536)
+    {
+      allocateArray(compact_triangles, 3 * triangle_count);
+      std::copy(triangles, triangles + 3 * triangle_count, compact_triangles);
+      releaseArray(triangles);
+    }
+  }
+  else
+  {
+    allocateArray(vertices, 3 * vertex_count);
+    std::copy(compact_vertices, compact_vertices + 3 * vertex_count, vertices);
+    releaseArray(compact_vertices);
+    if (compact_triangles)
     {
-      double distanceSQR = (orig_vertices[vIdx1] - orig_vertices[vIdx2]).squaredNorm();
-      if (distanceSQR <= thresholdSQR)
-        vertex_map[vIdx2] = vertex_map[vIdx1];
+      allocateArray(triangles, 3 * triangle_count);
+      std::copy(compact_triangles, compact_triangles + 3 * triangle_count, triangles);
+      releaseArray(compact_triangles);
     }
   }
+}
 
-  if (compressed_vertices.size() == orig_vertices.size())
+void Mesh::getTriangleNormal(unsigned int t, double* normal) const
+{
+  if (triangle_normals_ready_.load(std::memory_order_acquire))
+  {
+    std::copy(triangle_normals + 3 * t, triangle_normals + 3 * t + 3, normal);
     return;
+  }
+  double p[3][3];
+  for (int k = 0; k < 3; ++k)
+    for (int j = 0; j < 3; ++j)
+      p[k][j] = getVertexCoordinate(3 * getTriangleIndex(3 * t + k) + j);
+  triangleNormal(p[0], p[1], p[2], normal, NULL);
+}
 
-  // redirect triangles to new vertices!
-  for (unsigned int tIdx = 0; tIdx < triangle_count; ++tIdx)
+void Mesh::mergeVertices(double threshold, unsigned int threads)
+{
+  if (getStorage() == COMPACT_STORAGE)
   {
-    unsigned int i3 = 3 * tIdx;
-    triangles[i3] = vertex_map[triangles[i3]];
-    triangles[i3 + 1] = vertex_map[triangles[i3 + 1]];
-    triangles[i3 + 2] = vertex_map[triangles[i3 + 2]];
+    setStorage(DOUBLE_STORAGE);
+    mergeVertices(threshold, threads);
+    setStorage(COMPACT_STORAGE);
+    return;
   }
 
-  vertex_count = compressed_vertices.size();
-  delete[] vertices;
-  vertices = new double[vertex_count * 3];
+  // Vertices are visited in order. A vertex with no earlier kept vertex within the threshold is kept;
+  // otherwise it is merged into the last earlier kept vertex within the threshold.
+  std::vector<unsigned int> vertex_map(vertex_count);
+  std::vector<unsigned int> kept;
+  // only the kept vertices go into the grid
+  VertexGrid grid(vertices, vertex_count, threshold);
 
-  for (unsigned int vIdx = 0; vIdx < vertex_count; ++vIdx)
+  if (threads == 1)
+  {
+    for (unsigned int v = 0; v < vertex_count; ++v)
+    {
+      unsigned int into = VertexGrid::EMPTY;
+      grid.forEachNear(v, [&into](unsigned int u) {
+        if (into == VertexGrid::EMPTY || u > into)
+          into = u;
+      });
+      if (into == VertexGrid::EMPTY)
+      {
+        vertex_map[v] = kept.size();
+        kept.push_back(v);
+        grid.insert(v);
+      }
+      else
+        vertex_map[v] = vertex_map[into];
+    }
+  }
+  else
   {
-    unsigned int i3 = 3 * vIdx;
-    vertices[i3] = compressed_vertices[vIdx][0];
-    vertices[i3 + 1] = compressed_vertices[vIdx][1];
-    vertices[i3 + 2] = compressed_vertices[vIdx][2];
+    // The earlier neighbors of every vertex are found in parallel, then the choice above is made in order.
+    // A vertex in a dense cluster would have a long list of neighbors that were mostly merged already: past
+    // NEIGHBORS_LIMIT earlier vertices, its list is dropped and the vertex is looked up among the kept vertices
+    // only, as on one thread. Those are more than the threshold apart, so few of them are near any vertex.
+    VertexGrid all(vertices, vertex_count, threshold);
+    for (unsigned int v = vertex_count; v-- > 0;)
+      all.insert(v);
+    bodies::ThreadPool pool(threads);
+    const std::size_t CHUNK = 4096;
+    const std::size_t NEIGHBORS_LIMIT = 64;
+    const std::size_t chunks = (vertex_count + CHUNK - 1) / CHUNK;
+    std::vector<std::vector<unsigned int> > neighbors(chunks);
+    std::vector<std::size_t> neighbors_end(vertex_count);
+    std::vector<char> listed(vertex_count);
+    pool.run(chunks, [&](std::size_t c, unsigned int) {
+      std::vector<unsigned int>& list = neighbors[c];
+      for (std::size_t v = c * CHUNK, end = std::min<std::size_t>(vertex_count, v + CHUNK); v < end; ++v)
+      {
+        const std::size_t begin = list.size();
+        listed[v] = all.forEachNearBefore(v, NEIGHBORS_LIMIT, [&list](unsigned int u) { list.push_back(u); });
+        if (!listed[v])
+          list.resize(begin);
+        neighbors_end[v] = list.size();
+      }
+    });
+
+    std::vector<bool> is_kept(vertex_count, false);
+    for (unsigned int v = 0; v < vertex_count; ++v)
+    {
+      unsigned int into = VertexGrid::EMPTY;
+      const auto consider = [&into](unsigned int u) {
+        if (into == VertexGrid::EMPTY || u > into)
+          into = u;
+      };
+      if (listed[v])
+      {
+        const std::vector<unsigned int>& list = neighbors[v / CHUNK];
+        for (std::size_t j = v % CHUNK == 0 ? 0 : neighbors_end[v - 1]; j < neighbors_end[v]; ++j)
+          if (is_kept[list[j]])
+            consider(list[j]);
+      }
+      else
+        grid.forEachNear(v, consider);
+      if (into == VertexGrid::EMPTY)
+      {
+        vertex_map[v] = kept.size();
+        kept.push_back(v);
+        is_kept[v] = true;
+        grid.insert(v);
+      }
+      else
+        vertex_map[v] = vertex_map[into];
+    }
   }
 
-  if (triangle_normals)
-    computeTriangleNormals();
-  if (vertex_normals)
-    computeVertexNormals();
+  if (kept.size() == vertex_count)
+    return;
+
+  // redirect triangles to the kept vertices, and drop the ones the merge collapsed
+  unsigned int kept_triangles = 0;
+  for (unsigned int tIdx = 0; tIdx < triangle_count; ++tIdx)
+  {
+    const unsigned int* t = triangles + 3 * tIdx;
+    const unsigned int v1 = vertex_map[t[0]];
+    const unsigned int v2 = vertex_map[t[1]];
+    const unsigned int v3 = vertex_map[t[2]];
+    const bool was_degenerate = t[0] == t[1] || t[1] == t[2] || t[0] == t[2];
+    if (!was_degenerate && (v1 == v2 || v2 == v3 || v1 == v3))
+      continue;
+    unsigned int* out = triangles + 3 * kept_triangles++;
+    out[0] = v1;
+    out[1] = v2;
+    out[2] = v3;
+  }
+  triangle_count = kept_triangles;
+
+  double* old_vertices = vertices;
+  vertices = new double[kept.size() * 3];
+  for (std::size_t vIdx = 0; vIdx < kept.size(); ++vIdx)
+    std::copy(old_vertices + 3 * kept[vIdx], old_vertices + 3 * kept[vIdx] + 3, vertices + 3 * vIdx);
+  delete[] old_vertices;
+  vertex_count = kept.size();
+  clearNormals();
 }
 
 } /* namespace shapes */
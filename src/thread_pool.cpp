@@ -0,0 +1,167 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <geometric_shapes/thread_pool.h>
+#include <algorithm>
+#include <atomic>
+
+namespace bodies
+{
+namespace detail
+{
+/** \brief Size of a cache line; per-worker state is padded to this size */
+static const std::size_t CACHE_LINE_SIZE = 64;
+}
+}
+
+/** \brief The chunks owned by one worker. Other workers steal from the same counter once their own
+    chunks are done. Padded so that the counters of different workers are on different cache lines. */
+struct bodies::ThreadPool::Worker
+{
+  Worker() : next(0), end(0)
+  {
+  }
+
+  char pad_begin[detail::CACHE_LINE_SIZE];
+  std::atomic<std::size_t> next;
+  std::size_t end;
+  char pad_end[detail::CACHE_LINE_SIZE];
+};
+
+bodies::ThreadPool::ThreadPool(unsigned int threads) : task_(NULL), generation_(0), running_(0), shutdown_(false)
+{
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (unsigned int i = 0; i < threads; ++i)
+    workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+
+  // the calling thread acts as worker 0
+  for (unsigned int i = 1; i < threads; ++i)
+    threads_.push_back(std::thread(&ThreadPool::threadMain, this, i));
+}
+
+bodies::ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  start_condition_.notify_all();
+  for (std::size_t i = 0; i < threads_.size(); ++i)
+    threads_[i].join();
+}
+
+unsigned int bodies::ThreadPool::getThreadCount() const
+{
+  return workers_.size();
+}
+
+void bodies::ThreadPool::run(std::size_t chunks, const std::function<void(std::size_t, unsigned int)>& task)
+{
+  if (chunks <= 1 || threads_.empty())
+  {
+    // not worth waking up the pool
+    for (std::size_t c = 0; c < chunks; ++c)
+      task(c, 0);
+    return;
+  }
+
+  const std::size_t per_worker = chunks / workers_.size();
+  const std::size_t extra = chunks % workers_.size();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t begin = 0;
+    for (std::size_t i = 0; i < workers_.size(); ++i)
+    {
+      const std::size_t end = begin + per_worker + (i < extra ? 1 : 0);
+      workers_[i]->next.store(begin, std::memory_order_relaxed);
+      workers_[i]->end = end;
+      begin = end;
+    }
+    task_ = &task;
+    ++generation_;
+    running_ = threads_.size();
+  }
+  start_condition_.notify_all();
+
+  work(0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_ > 0)
+    done_condition_.wait(lock);
+  task_ = NULL;
+}
+
+void bodies::ThreadPool::work(unsigned int self)
+{
+  const std::function<void(std::size_t, unsigned int)>& task = *task_;
+
+  // drain the own chunks first, then steal from the others
+  for (std::size_t k = 0; k < workers_.size(); ++k)
+  {
+    Worker& victim = *workers_[(self + k) % workers_.size()];
+    while (true)
+    {
+      const std::size_t chunk = victim.next.fetch_add(1, std::memory_order_relaxed);
+      if (chunk >= victim.end)
+        break;
+      task(chunk, self);
+    }
+  }
+}
+
+void bodies::ThreadPool::threadMain(unsigned int self)
+{
+  std::size_t generation = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!shutdown_ && generation == generation_)
+        start_condition_.wait(lock);
+      if (shutdown_)
+        return;
+      generation = generation_;
+    }
+
+    work(self);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--running_ == 0)
+        done_condition_.notify_one();
+    }
+  }
+}
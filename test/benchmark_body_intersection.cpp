@@ -0,0 +1,118 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+/* Compares bodies::intersects() with the sampling approach it replaces: sample
+   points inside one body and test whether the other body contains them.
+   Not run as a test. */
+
+#include <geometric_shapes/body_operations.h>
+#include <geometric_shapes/mesh_operations.h>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+/** \brief The sampling approach: look for a point of \e a that is inside \e b */
+bool sampledIntersection(bodies::Body& a, const bodies::Body& b, unsigned int samples,
+                         random_numbers::RandomNumberGenerator& rng)
+{
+  Eigen::Vector3d p;
+  for (unsigned int i = 0; i < samples; ++i)
+    if (a.samplePointInside(rng, 100, p) && b.containsPoint(p))
+      return true;
+  return false;
+}
+
+Eigen::Affine3d randomPose(double extent, random_numbers::RandomNumberGenerator& rng)
+{
+  double q[4];
+  rng.quaternion(q);
+  Eigen::Affine3d pose(Eigen::Quaterniond(q[3], q[0], q[1], q[2]));
+  pose.translation() = Eigen::Vector3d(rng.uniformReal(-extent, extent), rng.uniformReal(-extent, extent),
+                                       rng.uniformReal(-extent, extent));
+  return pose;
+}
+}
+
+int main()
+{
+  random_numbers::RandomNumberGenerator rng(1);
+  shapes::Sphere sphere(0.3);
+  shapes::Box box(0.4, 0.6, 0.8);
+  shapes::Cylinder cylinder(0.25, 0.7);
+  shapes::Mesh* mesh = shapes::createMeshFromShape(shapes::Sphere(0.35));
+
+  const char* names[4] = { "sphere", "box", "cylinder", "mesh" };
+  bodies::Body* bodies[4] = { new bodies::Sphere(&sphere), new bodies::Box(&box), new bodies::Cylinder(&cylinder),
+                              new bodies::ConvexMesh(mesh) };
+
+  const unsigned int pairs = 2000;
+  const unsigned int samples = 1000;
+  for (int i = 0; i < 4; ++i)
+    for (int j = i; j < 4; ++j)
+    {
+      std::vector<Eigen::Affine3d> poses(pairs);
+      std::vector<bodies::BodyPtr> others(pairs);
+      for (unsigned int k = 0; k < pairs; ++k)
+      {
+        poses[k] = randomPose(0.0, rng);
+        others[k] = bodies[j]->cloneAt(randomPose(0.6, rng), 0.0, 1.0);
+      }
+
+      std::size_t exact_hits = 0;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (unsigned int k = 0; k < pairs; ++k)
+      {
+        bodies[i]->setPose(poses[k]);
+        exact_hits += bodies::intersects(*bodies[i], *others[k]);
+      }
+      const double exact = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      std::size_t sampled_hits = 0;
+      start = std::chrono::steady_clock::now();
+      for (unsigned int k = 0; k < pairs; ++k)
+      {
+        bodies[i]->setPose(poses[k]);
+        sampled_hits += sampledIntersection(*bodies[i], *others[k], samples, rng);
+      }
+      const double sampled = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      printf("%-8s / %-8s: intersects() %8.3f us/pair (%4zu hits)   sampling %4u points %8.3f us/pair (%4zu hits)\n",
+             names[i], names[j], exact / pairs * 1e6, exact_hits, samples, sampled / pairs * 1e6, sampled_hits);
+    }
+
+  for (int i = 0; i < 4; ++i)
+    delete bodies[i];
+  delete mesh;
+  return 0;
+}
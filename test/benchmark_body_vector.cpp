@@ -0,0 +1,223 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+/* Compares the linear scan of bodies::BodyVector with its bounding volume
+   hierarchy for point containment and ray queries, and reports the throughput
+   of bodies::PointCloudFilter and bodies::RayCaster for several thread counts. Nearest hits of a lidar
+   scan are also found one ray at a time, with intersectsRay() and with bodies::Ray queries.
+   Not run as a test. */
+
+#include <geometric_shapes/bodies.h>
+#include <geometric_shapes/point_cloud_filter.h>
+#include <geometric_shapes/ray_caster.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+namespace
+{
+void addRandomBodies(bodies::BodyVector& bodies, unsigned int n, double extent,
+                     random_numbers::RandomNumberGenerator& rng)
+{
+  for (unsigned int i = 0; i < n; ++i)
+  {
+    Eigen::Affine3d pose(Eigen::Affine3d::Identity());
+    pose.translation() = Eigen::Vector3d(rng.uniformReal(0.0, extent), rng.uniformReal(0.0, extent),
+                                         rng.uniformReal(0.0, extent));
+    if (i % 3 == 0)
+    {
+      shapes::Sphere s(rng.uniformReal(0.1, 0.5));
+      bodies.addBody(&s, pose);
+    }
+    else if (i % 3 == 1)
+    {
+      shapes::Box b(rng.uniformReal(0.1, 1.0), rng.uniformReal(0.1, 1.0), rng.uniformReal(0.1, 1.0));
+      bodies.addBody(&b, pose);
+    }
+    else
+    {
+      shapes::Cylinder c(rng.uniformReal(0.1, 0.5), rng.uniformReal(0.1, 1.0));
+      bodies.addBody(&c, pose);
+    }
+  }
+}
+
+double timeQueries(const bodies::BodyVector& bodies, const EigenSTL::vector_Vector3d& points,
+                   const EigenSTL::vector_Vector3d& dirs, bool rays, std::size_t& hits)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::size_t index;
+  hits = 0;
+  for (std::size_t i = 0; i < points.size(); ++i)
+    if (rays ? bodies.intersectsRay(points[i], dirs[i], index) : bodies.containsPoint(points[i], index))
+      ++hits;
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+}
+
+int main()
+{
+  const std::size_t queries = 100000;
+  random_numbers::RandomNumberGenerator rng(42);
+
+  for (unsigned int n = 10; n <= 1000; n *= 10)
+  {
+    // keep the body density constant as the count grows
+    const double extent = 2.0 * std::cbrt((double)n);
+    bodies::BodyVector bodies;
+    addRandomBodies(bodies, n, extent, rng);
+
+    EigenSTL::vector_Vector3d points(queries), dirs(queries);
+    for (std::size_t i = 0; i < queries; ++i)
+    {
+      points[i] = Eigen::Vector3d(rng.uniformReal(0.0, extent), rng.uniformReal(0.0, extent),
+                                  rng.uniformReal(0.0, extent));
+      dirs[i] = Eigen::Vector3d(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0))
+                    .normalized();
+    }
+
+    for (int rays = 0; rays < 2; ++rays)
+    {
+      std::size_t linear_hits, bvh_hits;
+      bodies.setUseBoundingVolumeHierarchy(false);
+      double linear = timeQueries(bodies, points, dirs, rays, linear_hits);
+      bodies.setUseBoundingVolumeHierarchy(true);
+      double bvh = timeQueries(bodies, points, dirs, rays, bvh_hits);
+      printf("%4u bodies, %-14s linear %8.2f ms  bvh %8.2f ms  speedup %6.2fx  (hits %zu / %zu)\n", n,
+             rays ? "intersectsRay" : "containsPoint", linear * 1e3, bvh * 1e3, linear / bvh, linear_hits, bvh_hits);
+    }
+  }
+
+  // self filtering of a cloud around 30 bodies
+  bodies::BodyVector bodies;
+  addRandomBodies(bodies, 30, 2.0, rng);
+  EigenSTL::vector_Vector3d cloud(1000000);
+  for (std::size_t i = 0; i < cloud.size(); ++i)
+    cloud[i] = Eigen::Vector3d(rng.uniformReal(-1.0, 3.0), rng.uniformReal(-1.0, 3.0), rng.uniformReal(-1.0, 3.0));
+  std::vector<uint8_t> labels;
+  std::vector<std::size_t> indices;
+
+  const unsigned int hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned int threads = 1; threads <= hardware_threads; threads *= 2)
+  {
+    bodies::PointCloudFilter filter(threads);
+    filter.filter(bodies, cloud, labels, indices);  // warm up
+    filter.filter(bodies, cloud, labels, indices);
+    const bodies::PointCloudFilter::Statistics& stats = filter.getLastStatistics();
+    printf("filter %zu points, %2u threads: %8.2f ms  %6.2f Mpoints/s  %6.2f Mpoints/s per thread  (inside %zu)\n",
+           stats.points, stats.threads, stats.seconds * 1e3, stats.pointsPerSecond() * 1e-6,
+           stats.pointsPerSecondPerThread() * 1e-6, stats.inside);
+  }
+
+  // a 64 beam lidar with 2048 columns in the middle of the same bodies
+  const Eigen::Vector3d lidar(1.0, 1.0, 1.0);
+  EigenSTL::vector_Vector3d origins, dirs;
+  for (int beam = 0; beam < 64; ++beam)
+    for (int column = 0; column < 2048; ++column)
+    {
+      const double elevation = -0.4 + 0.8 * beam / 63.0;
+      const double azimuth = 2.0 * M_PI * column / 2048.0;
+      origins.push_back(lidar);
+      dirs.push_back(Eigen::Vector3d(cos(elevation) * cos(azimuth), cos(elevation) * sin(azimuth), sin(elevation)));
+    }
+
+  // nearest hit with the single ray interface
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::size_t single_hits = 0;
+  EigenSTL::vector_Vector3d intersections;
+  for (std::size_t i = 0; i < origins.size(); ++i)
+  {
+    double best = std::numeric_limits<double>::infinity();
+    for (std::size_t b = 0; b < bodies.getCount(); ++b)
+    {
+      intersections.clear();
+      if (bodies.getBody(b)->intersectsRay(origins[i], dirs[i], &intersections, 1))
+        best = std::min(best, (intersections[0] - origins[i]).norm());
+    }
+    single_hits += !std::isinf(best);
+  }
+  const double single = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%zu rays, single ray loop: %8.2f ms  %6.2f Mrays/s  (hits %zu)\n", origins.size(), single * 1e3,
+         origins.size() / single * 1e-6, single_hits);
+
+  // the same loop with ray query objects, which do not allocate
+  start = std::chrono::steady_clock::now();
+  std::size_t query_hits = 0;
+  for (std::size_t i = 0; i < origins.size(); ++i)
+  {
+    const bodies::Ray ray(origins[i], dirs[i]);
+    double best = std::numeric_limits<double>::infinity();
+    bodies::Hit hit;
+    for (std::size_t b = 0; b < bodies.getCount(); ++b)
+      if (bodies.getBody(b)->intersect(ray, hit) && hit.count > 0)
+        best = std::min(best, hit.t[0]);
+    query_hits += !std::isinf(best);
+  }
+  const double query = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%zu rays, ray query loop:  %8.2f ms  %6.2f Mrays/s  (hits %zu)\n", origins.size(), query * 1e3,
+         origins.size() / query * 1e-6, query_hits);
+
+  // the closest hit with its normal, where the bounding spheres and the best distance so far prune bodies
+  for (int use_bvh = 0; use_bvh < 2; ++use_bvh)
+  {
+    bodies.setUseBoundingVolumeHierarchy(use_bvh);
+    start = std::chrono::steady_clock::now();
+    std::size_t closest_hits = 0;
+    bodies::BodyVector::RayHit closest;
+    for (std::size_t i = 0; i < origins.size(); ++i)
+      closest_hits += bodies.closestHit(bodies::Ray(origins[i], dirs[i]), closest);
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%zu rays, closest hit%s: %8.2f ms  %6.2f Mrays/s  (hits %zu)\n", origins.size(),
+           use_bvh ? " + bvh" : "", elapsed * 1e3, origins.size() / elapsed * 1e-6, closest_hits);
+  }
+
+  std::vector<double> t;
+  std::vector<std::size_t> hit_bodies;
+  for (int use_bvh = 0; use_bvh < 2; ++use_bvh)
+  {
+    bodies.setUseBoundingVolumeHierarchy(use_bvh);
+    for (unsigned int threads = 1; threads <= hardware_threads; threads *= 2)
+    {
+      bodies::RayCaster caster(threads);
+      caster.castRays(bodies, origins, dirs, t, hit_bodies);  // warm up
+      caster.castRays(bodies, origins, dirs, t, hit_bodies);
+      const bodies::RayCaster::Statistics& stats = caster.getLastStatistics();
+      printf("%zu rays, packets%s, %2u threads: %8.2f ms  %6.2f Mrays/s  %6.2f Mrays/s per thread  (hits %zu)\n",
+             stats.rays, use_bvh ? " + bvh" : "", stats.threads, stats.seconds * 1e3, stats.raysPerSecond() * 1e-6,
+             stats.raysPerSecondPerThread() * 1e-6, stats.hits);
+    }
+  }
+  return 0;
+}
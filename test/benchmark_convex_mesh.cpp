@@ -0,0 +1,242 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+/* Reports the cost of building a bodies::ConvexMesh from test/resources/forearm_roll.stl, the volumes of
+   its bounding box and cylinder relative to the hull, and the throughput of point containment for the
+   mesh as modelled and rotated so that it lies diagonally in its own frame, and for hulls approximated
+   with a budget of planes. For rays, intersectsRay(), which clips the ray to the planes of the hull, is
+   compared with the loop over the triangles of the hull that it replaced. Not run as a test. */
+
+#include <geometric_shapes/bodies.h>
+#include <geometric_shapes/mesh_operations.h>
+#include <boost/filesystem.hpp>
+#include <boost/math/constants/constants.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include "resources/config.h"
+
+namespace
+{
+/** \brief Gives access to the bounding volumes that ConvexMesh keeps in its mesh data */
+class InspectedConvexMesh : public bodies::ConvexMesh
+{
+public:
+  InspectedConvexMesh(const shapes::Shape* shape, unsigned int max_planes) : bodies::ConvexMesh(shape, max_planes)
+  {
+  }
+
+  double boxVolume() const
+  {
+    return mesh_data_->box_size_.prod();
+  }
+
+  double cylinderVolume() const
+  {
+    return boost::math::constants::pi<double>() * mesh_data_->bounding_cylinder_.radius *
+           mesh_data_->bounding_cylinder_.radius * mesh_data_->bounding_cylinder_.length;
+  }
+
+  /** \brief The intersection test intersectsRay() used to do: intersect the ray with the plane of each
+      triangle, keep the points inside the triangle and sort them */
+  bool intersectsRayTriangles(const Eigen::Vector3d& origin, const Eigen::Vector3d& dir,
+                              EigenSTL::vector_Vector3d* intersections, unsigned int count) const
+  {
+    bodies::BoundingSphere sphere;
+    computeBoundingSphere(sphere);
+    const Eigen::Vector3d to_center = sphere.center - origin;
+    const double along = dir.normalized().dot(to_center);
+    if (to_center.squaredNorm() - along * along > sphere.radius * sphere.radius)
+      return false;
+
+    const Eigen::Vector3d orig(i_pose_ * origin);
+    const Eigen::Vector3d dr(i_pose_.linear() * dir);
+    const EigenSTL::vector_Vector3d& vertices = getScaledVertices();
+    std::vector<std::pair<double, Eigen::Vector3d> > hits;
+    bool result = false;
+    for (std::size_t i = 0; i < mesh_data_->triangles_.size() / 3; ++i)
+    {
+      const Eigen::Vector4d& plane = mesh_data_->planes_[mesh_data_->plane_for_triangle_[i]];
+      const Eigen::Vector3d normal(plane.x(), plane.y(), plane.z());
+      const double tmp = normal.dot(dr);
+      if (fabs(tmp) <= 1e-9)
+        continue;
+      const double t = -(normal.dot(orig) + plane.w()) / tmp;
+      if (t <= 0.0)
+        continue;
+      const Eigen::Vector3d& a = vertices[mesh_data_->triangles_[3 * i]];
+      const Eigen::Vector3d& b = vertices[mesh_data_->triangles_[3 * i + 1]];
+      const Eigen::Vector3d& c = vertices[mesh_data_->triangles_[3 * i + 2]];
+      const Eigen::Vector3d p(orig + dr * t);
+      if ((c - b).cross(p - b).dot((c - b).cross(a - b)) < 0.0 ||
+          (c - a).cross(p - a).dot((c - a).cross(b - a)) < 0.0 ||
+          (b - a).cross(p - a).dot((b - a).cross(c - a)) < 0.0)
+        continue;
+      result = true;
+      if (!intersections)
+        break;
+      hits.push_back(std::make_pair(t, Eigen::Vector3d(origin + dir * t)));
+    }
+    if (intersections)
+    {
+      std::sort(hits.begin(), hits.end(),
+                [](const std::pair<double, Eigen::Vector3d>& x, const std::pair<double, Eigen::Vector3d>& y) {
+                  return x.first < y.first;
+                });
+      const std::size_t n = count > 0 ? std::min<std::size_t>(count, hits.size()) : hits.size();
+      for (std::size_t i = 0; i < n; ++i)
+        intersections->push_back(hits[i].second);
+    }
+    return result;
+  }
+};
+
+void benchmarkRays(const char* name, const shapes::Mesh* mesh)
+{
+  InspectedConvexMesh body(mesh, 0);
+  body.setPose(Eigen::Affine3d(Eigen::Translation3d(0.3, -0.2, 0.1) * Eigen::AngleAxisd(0.4, Eigen::Vector3d::UnitX())));
+  bodies::BoundingSphere sphere;
+  body.computeBoundingSphere(sphere);
+
+  // rays from outside the bounding sphere towards points inside it
+  random_numbers::RandomNumberGenerator rng(3);
+  const std::size_t n = 200000;
+  EigenSTL::vector_Vector3d origins(n), dirs(n);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    const Eigen::Vector3d offset(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+    const Eigen::Vector3d target(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+    origins[i] = sphere.center + 2.0 * sphere.radius * offset.normalized();
+    dirs[i] = (sphere.center + target * sphere.radius - origins[i]).normalized();
+  }
+
+  EigenSTL::vector_Vector3d clipped, triangles;
+  std::size_t hits = 0, differ = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    clipped.clear();
+    hits += body.intersectsRay(origins[i], dirs[i], &clipped, 1);
+  }
+  const double clipping = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    triangles.clear();
+    body.intersectsRayTriangles(origins[i], dirs[i], &triangles, 1);
+  }
+  const double looping = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    clipped.clear();
+    triangles.clear();
+    body.intersectsRay(origins[i], dirs[i], &clipped, 1);
+    body.intersectsRayTriangles(origins[i], dirs[i], &triangles, 1);
+    if (clipped.size() != triangles.size() || (!clipped.empty() && (clipped[0] - triangles[0]).norm() > 1e-6))
+      ++differ;
+  }
+
+  printf("%-9s: intersectsRay %7.2f ns/ray clipping to planes, %7.2f ns/ray looping over triangles   "
+         "(%zu of %zu rays hit, %zu first hits differ)\n",
+         name, clipping / n * 1e9, looping / n * 1e9, hits, n, differ);
+}
+
+void benchmark(const char* name, const shapes::Mesh* mesh, unsigned int max_planes = 0)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  InspectedConvexMesh body(mesh, max_planes);
+  const double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  bodies::BoundingSphere sphere;
+  body.computeBoundingSphere(sphere);
+  random_numbers::RandomNumberGenerator rng(1);
+  const std::size_t n = 1000000;
+  std::vector<double> xs(n), ys(n), zs(n);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    xs[i] = sphere.center.x() + rng.uniformReal(-sphere.radius, sphere.radius);
+    ys[i] = sphere.center.y() + rng.uniformReal(-sphere.radius, sphere.radius);
+    zs[i] = sphere.center.z() + rng.uniformReal(-sphere.radius, sphere.radius);
+  }
+
+  std::size_t inside = 0;
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < n; ++i)
+    inside += body.containsPoint(Eigen::Vector3d(xs[i], ys[i], zs[i]));
+  const double single = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::vector<uint8_t> mask(n);
+  start = std::chrono::steady_clock::now();
+  body.containsPoints(&xs[0], &ys[0], &zs[0], n, &mask[0]);
+  const double batched = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  const double volume = body.computeVolume();
+  printf("%-9s: build %7.3f ms   %3zu planes (error %.5f)   box %5.2fx hull   cylinder %5.2fx hull   "
+         "containsPoint %6.2f ns/point   containsPoints %6.2f ns/point   (%zu of %zu inside)\n",
+         name, build * 1e3, body.getPlanes().size(), body.getApproximationError(), body.boxVolume() / volume,
+         body.cylinderVolume() / volume, single / n * 1e9, batched / n * 1e9, inside, n);
+}
+}
+
+int main()
+{
+  shapes::Mesh* mesh = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  if (!mesh)
+    return 1;
+  benchmark("modelled", mesh);
+  benchmark("64 planes", mesh, 64);
+  benchmark("32 planes", mesh, 32);
+  benchmark("16 planes", mesh, 16);
+
+  // the same link, modelled diagonally in its own frame
+  const Eigen::Matrix3d rotation =
+      (Eigen::AngleAxisd(0.6, Eigen::Vector3d::UnitZ()) * Eigen::AngleAxisd(0.8, Eigen::Vector3d::UnitY()))
+          .toRotationMatrix();
+  for (unsigned int i = 0; i < mesh->vertex_count; ++i)
+  {
+    const Eigen::Vector3d v =
+        rotation * Eigen::Vector3d(mesh->vertices[3 * i], mesh->vertices[3 * i + 1], mesh->vertices[3 * i + 2]);
+    mesh->vertices[3 * i] = v.x();
+    mesh->vertices[3 * i + 1] = v.y();
+    mesh->vertices[3 * i + 2] = v.z();
+  }
+  benchmark("diagonal", mesh);
+  benchmarkRays("rays", mesh);
+
+  delete mesh;
+  return 0;
+}
@@ -0,0 +1,190 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+/* Reports the resident memory of a scene of copies of a loaded mesh, and of a tessellated grid, kept with
+   double storage and with compact storage, and times writeSTLBinary() and the construction of convex meshes
+   for both. Then reports the time and memory taken by clones of a mesh of a million triangles, and by
+   moving them. Each measurement runs in its own process, so that memory freed by one does not hide the
+   growth of the next. Linux only, as the resident memory is read from /proc. Not run as a test. */
+
+#include <geometric_shapes/bodies.h>
+#include <geometric_shapes/mesh_operations.h>
+#include <boost/filesystem.hpp>
+#include "resources/config.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace
+{
+/** \brief The resident memory of the process, in bytes */
+std::size_t residentMemory()
+{
+  std::size_t size = 0, resident = 0;
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (statm)
+  {
+    if (fscanf(statm, "%zu %zu", &size, &resident) != 2)
+      resident = 0;
+    fclose(statm);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+/** \brief A square grid of \e side by \e side quads, two triangles each */
+shapes::Mesh* createGrid(unsigned int side)
+{
+  shapes::Mesh* mesh = new shapes::Mesh((side + 1) * (side + 1), 2 * side * side);
+  for (unsigned int y = 0; y <= side; ++y)
+    for (unsigned int x = 0; x <= side; ++x)
+    {
+      double* v = mesh->vertices + 3 * (y * (side + 1) + x);
+      v[0] = 0.01 * x;
+      v[1] = 0.01 * y;
+      v[2] = 0.001 * ((x * y) % 7);
+    }
+  unsigned int* t = mesh->triangles;
+  for (unsigned int y = 0; y < side; ++y)
+    for (unsigned int x = 0; x < side; ++x)
+    {
+      const unsigned int corner = y * (side + 1) + x;
+      const unsigned int quad[6] = { corner, corner + 1,        corner + side + 2,
+                                     corner, corner + side + 2, corner + side + 1 };
+      t = std::copy(quad, quad + 6, t);
+    }
+  return mesh;
+}
+
+/** \brief Build the scene with \e storage, and report its memory and timings */
+void measure(shapes::Mesh::Storage storage, unsigned int copies)
+{
+  const char* name = storage == shapes::Mesh::COMPACT_STORAGE ? "compact" : "double";
+  const std::unique_ptr<shapes::Mesh> loaded(shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string()));
+  if (!loaded)
+    return;
+
+  const std::size_t before = residentMemory();
+  std::vector<std::unique_ptr<shapes::Mesh> > scene;
+  for (unsigned int i = 0; i < copies; ++i)
+  {
+    scene.emplace_back(static_cast<shapes::Mesh*>(loaded->clone()));
+    scene.back()->setStorage(storage);
+  }
+  const std::size_t after_loaded = residentMemory();
+  scene.emplace_back(createGrid(250));
+  scene.back()->setStorage(storage);
+  const std::size_t after_grid = residentMemory();
+
+  char label[64];
+  snprintf(label, sizeof(label), "%u copies of %u vertices, %u triangles", copies, loaded->vertex_count,
+           loaded->triangle_count);
+  printf("%-7s  %-42s %9.2f MB\n", name, label, (after_loaded - before) / 1048576.0);
+  snprintf(label, sizeof(label), "grid of %u vertices, %u triangles", scene.back()->vertex_count,
+           scene.back()->triangle_count);
+  printf("%-7s  %-42s %9.2f MB\n", name, label, (after_grid - after_loaded) / 1048576.0);
+
+  std::vector<char> buffer;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < scene.size(); ++i)
+    shapes::writeSTLBinary(scene[i].get(), buffer);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  printf("%-7s  %-42s %9.2f ms\n", name, "writeSTLBinary of the scene", elapsed.count() * 1e3);
+
+  bodies::ConvexMesh::setCacheBudget(0);
+  start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < 20; ++i)
+    bodies::ConvexMesh convex(scene[i].get());
+  elapsed = std::chrono::steady_clock::now() - start;
+  printf("%-7s  %-42s %9.2f ms\n", name, "20 convex meshes of the loaded mesh", elapsed.count() * 1e3);
+}
+
+/** \brief Time \e count clones of a mesh of a million triangles, and their memory, then moving the clones */
+void measureClones(unsigned int count)
+{
+  const std::unique_ptr<shapes::Mesh> mesh(createGrid(708));
+  mesh->computeVertexNormals();
+  char label[64];
+  snprintf(label, sizeof(label), "%u clones of %u triangles", count, mesh->triangle_count);
+
+  std::vector<std::unique_ptr<shapes::Mesh> > clones;
+  const std::size_t before = residentMemory();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < count; ++i)
+    clones.emplace_back(static_cast<shapes::Mesh*>(mesh->clone()));
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  const std::size_t cloned = residentMemory();
+  printf("%-7s  %-42s %9.2f ms %9.2f MB\n", "cloned", label, elapsed.count() * 1e3, (cloned - before) / 1048576.0);
+
+  std::vector<shapes::Mesh> moved(clones.size());
+  start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < clones.size(); ++i)
+    moved[i] = std::move(*clones[i]);
+  elapsed = std::chrono::steady_clock::now() - start;
+  printf("%-7s  %-42s %9.2f ms %9.2f MB\n", "moved", label, elapsed.count() * 1e3,
+         (residentMemory() - cloned) / 1048576.0);
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  const unsigned int copies = argc > 1 ? atoi(argv[1]) : 2000;
+  const shapes::Mesh::Storage storages[2] = { shapes::Mesh::DOUBLE_STORAGE, shapes::Mesh::COMPACT_STORAGE };
+  for (shapes::Mesh::Storage storage : storages)
+  {
+    fflush(stdout);
+    const pid_t child = fork();
+    if (child == 0)
+    {
+      measure(storage, copies);
+      return 0;
+    }
+    waitpid(child, NULL, 0);
+  }
+  fflush(stdout);
+  const pid_t child = fork();
+  if (child == 0)
+  {
+    measureClones(20);
+    return 0;
+  }
+  waitpid(child, NULL, 0);
+  return 0;
+}
@@ -0,0 +1,245 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+/* Times shapes::createMeshFromVertices() on triangle soups of a tessellated grid, against the ordered set
+   it used to weld vertices with, and createMeshFromVerticesParallel() for growing numbers of threads.
+   Then times Mesh::mergeVertices() on the same soups with their corners moved a little, against the
+   comparison of every pair of vertices it used to do, and the computation of the normals of the welded
+   meshes. Not run as a test. */
+
+#include <geometric_shapes/mesh_operations.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <set>
+#include <thread>
+
+namespace
+{
+/** \brief A vertex with its index in the welded mesh */
+struct IndexedVertex
+{
+  double x, y, z;
+  unsigned int index;
+
+  bool operator<(const IndexedVertex& other) const
+  {
+    if (x != other.x)
+      return x < other.x;
+    if (y != other.y)
+      return y < other.y;
+    return z < other.z;
+  }
+};
+
+/** \brief The vertices and triangles of \e source welded with an ordered set, as createMeshFromVertices() did */
+shapes::Mesh* weldWithSet(const EigenSTL::vector_Vector3d& source)
+{
+  std::set<IndexedVertex> vertices;
+  std::vector<unsigned int> triangles(source.size());
+  for (std::size_t i = 0; i < source.size(); ++i)
+  {
+    IndexedVertex v = { source[i].x(), source[i].y(), source[i].z(), (unsigned int)vertices.size() };
+    triangles[i] = vertices.insert(v).first->index;
+  }
+  std::vector<IndexedVertex> sorted(vertices.begin(), vertices.end());
+  std::sort(sorted.begin(), sorted.end(),
+            [](const IndexedVertex& a, const IndexedVertex& b) { return a.index < b.index; });
+
+  shapes::Mesh* mesh = new shapes::Mesh(sorted.size(), triangles.size() / 3);
+  for (std::size_t i = 0; i < sorted.size(); ++i)
+  {
+    mesh->vertices[3 * i] = sorted[i].x;
+    mesh->vertices[3 * i + 1] = sorted[i].y;
+    mesh->vertices[3 * i + 2] = sorted[i].z;
+  }
+  std::copy(triangles.begin(), triangles.end(), mesh->triangles);
+  return mesh;
+}
+
+/** \brief The soup of the two triangles of each square of a \e side x \e side grid on a wavy surface */
+EigenSTL::vector_Vector3d gridSoup(unsigned int side)
+{
+  EigenSTL::vector_Vector3d soup;
+  soup.reserve(6 * side * side);
+  const auto point = [side](unsigned int i, unsigned int j) {
+    const double x = (double)i / side;
+    const double y = (double)j / side;
+    return Eigen::Vector3d(x, y, 0.1 * sin(10.0 * x) * cos(7.0 * y));
+  };
+  for (unsigned int i = 0; i < side; ++i)
+    for (unsigned int j = 0; j < side; ++j)
+    {
+      soup.push_back(point(i, j));
+      soup.push_back(point(i + 1, j));
+      soup.push_back(point(i + 1, j + 1));
+      soup.push_back(point(i, j));
+      soup.push_back(point(i + 1, j + 1));
+      soup.push_back(point(i, j + 1));
+    }
+  return soup;
+}
+
+/** \brief Mesh::mergeVertices() as it was, comparing every vertex with every later one */
+void mergeVerticesPairwise(shapes::Mesh& mesh, double threshold)
+{
+  std::vector<unsigned int> vertex_map(mesh.vertex_count);
+  for (unsigned int v = 0; v < mesh.vertex_count; ++v)
+    vertex_map[v] = v;
+  std::vector<double> kept;
+  for (unsigned int v1 = 0; v1 < mesh.vertex_count; ++v1)
+  {
+    if (vertex_map[v1] != v1)
+      continue;
+    vertex_map[v1] = kept.size() / 3;
+    kept.insert(kept.end(), &mesh.vertices[3 * v1], &mesh.vertices[3 * v1 + 3]);
+    const Eigen::Vector3d p1(&mesh.vertices[3 * v1]);
+    for (unsigned int v2 = v1 + 1; v2 < mesh.vertex_count; ++v2)
+      if ((p1 - Eigen::Vector3d(&mesh.vertices[3 * v2])).squaredNorm() <= threshold * threshold)
+        vertex_map[v2] = vertex_map[v1];
+  }
+  for (unsigned int i = 0; i < 3 * mesh.triangle_count; ++i)
+    mesh.triangles[i] = vertex_map[mesh.triangles[i]];
+  mesh.vertex_count = kept.size() / 3;
+  std::copy(kept.begin(), kept.end(), mesh.vertices);
+}
+
+/** \brief A mesh that keeps the corners of the triangles of \e soup apart, moved by less than \e jitter */
+shapes::Mesh* unweldedMesh(const EigenSTL::vector_Vector3d& soup, double jitter)
+{
+  EigenSTL::vector_Vector3d vertices(soup);
+  std::vector<unsigned int> triangles(soup.size());
+  for (std::size_t i = 0; i < soup.size(); ++i)
+  {
+    vertices[i] += Eigen::Vector3d(sin(i * 0.7), cos(i * 1.3), sin(i * 2.9)) * jitter / 2.0;
+    triangles[i] = i;
+  }
+  return shapes::createMeshFromVertices(vertices, triangles);
+}
+
+template <typename Weld>
+double time(const Weld& weld, unsigned int& vertex_count)
+{
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::unique_ptr<shapes::Mesh> mesh(weld());
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  vertex_count = mesh->vertex_count;
+  return seconds;
+}
+}
+
+int main()
+{
+  const unsigned int hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned int side = 100; side <= 1000; side *= 10)
+  {
+    const EigenSTL::vector_Vector3d soup = gridSoup(side);
+    unsigned int vertices = 0;
+    const double set = time([&soup]() { return weldWithSet(soup); }, vertices);
+    printf("%8zu triangles, ordered set:      %9.2f ms  (%u vertices)\n", soup.size() / 3, set * 1e3, vertices);
+    const double hash = time([&soup]() { return shapes::createMeshFromVertices(soup); }, vertices);
+    printf("%8zu triangles, hash weld:        %9.2f ms  (%u vertices)  speedup %6.2fx\n", soup.size() / 3,
+           hash * 1e3, vertices, set / hash);
+    const double tolerance = 0.5 / side;
+    const double snapped = time([&soup, tolerance]() { return shapes::createMeshFromVertices(soup, tolerance); },
+                                vertices);
+    printf("%8zu triangles, hash weld on grid: %8.2f ms  (%u vertices)\n", soup.size() / 3, snapped * 1e3,
+           vertices);
+    for (unsigned int threads = 1; threads <= hardware_threads; threads *= 2)
+    {
+      const double parallel = time(
+          [&soup, threads]() { return shapes::createMeshFromVerticesParallel(soup, 0.0, threads); }, vertices);
+      printf("%8zu triangles, %2u threads:       %9.2f ms  (%u vertices)  speedup %6.2fx\n", soup.size() / 3,
+             threads, parallel * 1e3, vertices, set / parallel);
+    }
+  }
+
+  for (unsigned int side = 30; side <= 1000; side *= 3)
+  {
+    const EigenSTL::vector_Vector3d soup = gridSoup(side);
+    const double threshold = 0.1 / side;
+    std::unique_ptr<shapes::Mesh> mesh(unweldedMesh(soup, threshold));
+    unsigned int vertices = 0;
+    double pairwise = 0.0;
+    if (side <= 100)
+    {
+      pairwise = time(
+          [&mesh, threshold]() {
+            shapes::Mesh* merged = static_cast<shapes::Mesh*>(mesh->clone());
+            mergeVerticesPairwise(*merged, threshold);
+            return merged;
+          },
+          vertices);
+      printf("%8u vertices, mergeVertices pairwise:  %9.2f ms  (%u vertices)\n", mesh->vertex_count, pairwise * 1e3,
+             vertices);
+    }
+    for (unsigned int threads = 1; threads <= hardware_threads; threads *= 2)
+    {
+      const double grid = time(
+          [&mesh, threshold, threads]() {
+            shapes::Mesh* merged = static_cast<shapes::Mesh*>(mesh->clone());
+            merged->mergeVertices(threshold, threads);
+            return merged;
+          },
+          vertices);
+      printf("%8u vertices, mergeVertices %2u threads: %8.2f ms  (%u vertices)", mesh->vertex_count, threads,
+             grid * 1e3, vertices);
+      if (pairwise > 0.0)
+        printf("  speedup %8.2fx", pairwise / grid);
+      printf("\n");
+    }
+  }
+
+  for (unsigned int side = 100; side <= 1000; side *= 10)
+  {
+    std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromVertices(gridSoup(side)));
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    mesh->computeTriangleNormals();
+    mesh->computeVertexNormals();
+    const double serial = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%8u triangles, normals one by one:   %8.2f ms\n", mesh->triangle_count, serial * 1e3);
+    for (unsigned int threads = 1; threads <= hardware_threads; threads *= 2)
+      for (int area_weighted = 0; area_weighted < 2; ++area_weighted)
+      {
+        mesh->clearNormals();
+        start = std::chrono::steady_clock::now();
+        mesh->computeNormals(area_weighted, threads);
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%8u triangles, normals%s %2u threads: %8.2f ms  speedup %6.2fx\n", mesh->triangle_count,
+               area_weighted ? " by area," : ",        ", threads, elapsed * 1e3, serial / elapsed);
+      }
+  }
+  return 0;
+}
@@ -0,0 +1,168 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+/* Reports how many planes a bodies::ConvexMesh built from test/resources/forearm_roll.stl tests, on
+   average, before it rejects a point that passed its bounding box, for frames of points that a sensor on
+   one side of the link would see: first in the order of the hull, then after the adaptive plane order has
+   seen a few frames. Not run as a test. */
+
+#include <geometric_shapes/bodies.h>
+#include <geometric_shapes/mesh_operations.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include "resources/config.h"
+
+namespace
+{
+/** \brief Gives access to the bounding box that ConvexMesh tests before its planes */
+class InspectedConvexMesh : public bodies::ConvexMesh
+{
+public:
+  InspectedConvexMesh(const shapes::Shape* shape) : bodies::ConvexMesh(shape)
+  {
+  }
+
+  bool boxContainsPoint(const Eigen::Vector3d& p) const
+  {
+    return bounding_box_.containsPoint(p);
+  }
+};
+
+/** \brief A frame of points in the half of the bounding sphere of \e body that faces \e sensor */
+void sampleFrame(const bodies::ConvexMesh& body, const Eigen::Vector3d& sensor,
+                 random_numbers::RandomNumberGenerator& rng, std::size_t n, std::vector<double>& xs,
+                 std::vector<double>& ys, std::vector<double>& zs)
+{
+  bodies::BoundingSphere sphere;
+  body.computeBoundingSphere(sphere);
+  const Eigen::Vector3d towards = (sensor - sphere.center).normalized();
+  xs.resize(n);
+  ys.resize(n);
+  zs.resize(n);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    Eigen::Vector3d p(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+    if (p.dot(towards) < 0.0)
+      p -= 2.0 * p.dot(towards) * towards;
+    p = sphere.center + p * sphere.radius;
+    xs[i] = p.x();
+    ys[i] = p.y();
+    zs[i] = p.z();
+  }
+}
+
+/** \brief The average number of planes tested, in the current order of \e body, for the points of a frame
+    that the bounding box accepts and the planes reject */
+double planesPerRejection(const InspectedConvexMesh& body, const std::vector<double>& xs,
+                          const std::vector<double>& ys, const std::vector<double>& zs, std::size_t& rejected)
+{
+  const EigenSTL::vector_Vector4d& planes = body.getPlanes();
+  const std::vector<unsigned int> order = body.getPlaneOrder();
+  std::size_t tested = 0;
+  rejected = 0;
+  for (std::size_t i = 0; i < xs.size(); ++i)
+  {
+    const Eigen::Vector3d p(xs[i], ys[i], zs[i]);
+    if (!body.boxContainsPoint(p))
+      continue;
+    for (std::size_t j = 0; j < order.size(); ++j)
+      if (planes[order[j]].head<3>().dot(p) + planes[order[j]].w() - 1e-6 > 0.0)
+      {
+        tested += j + 1;
+        ++rejected;
+        break;
+      }
+  }
+  return rejected ? static_cast<double>(tested) / rejected : 0.0;
+}
+
+/** \brief The shortest of a few runs of containsPoints() on a frame, in seconds */
+double timeContainsPoints(const bodies::ConvexMesh& body, const std::vector<double>& xs,
+                          const std::vector<double>& ys, const std::vector<double>& zs, std::vector<uint8_t>& mask)
+{
+  double best = std::numeric_limits<double>::infinity();
+  for (int run = 0; run < 5; ++run)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    body.containsPoints(&xs[0], &ys[0], &zs[0], xs.size(), &mask[0]);
+    best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+  return best;
+}
+
+void benchmark(const char* name, const shapes::Mesh* mesh, const Eigen::Vector3d& sensor)
+{
+  InspectedConvexMesh body(mesh);
+  random_numbers::RandomNumberGenerator rng(1);
+  const std::size_t n = 200000;
+  std::vector<double> xs, ys, zs;
+  std::vector<uint8_t> mask(n);
+
+  sampleFrame(body, sensor, rng, n, xs, ys, zs);
+  std::size_t rejected;
+  const double before = planesPerRejection(body, xs, ys, zs, rejected);
+  const double fixed = timeContainsPoints(body, xs, ys, zs, mask);
+
+  // let the order adapt to a few frames, then measure on a new one
+  body.setAdaptivePlaneOrder(true);
+  for (int frame = 0; frame < 5; ++frame)
+  {
+    sampleFrame(body, sensor, rng, n, xs, ys, zs);
+    body.containsPoints(&xs[0], &ys[0], &zs[0], n, &mask[0]);
+  }
+  sampleFrame(body, sensor, rng, n, xs, ys, zs);
+  const double after = planesPerRejection(body, xs, ys, zs, rejected);
+  const double adaptive = timeContainsPoints(body, xs, ys, zs, mask);
+
+  printf("%-8s: %3zu planes   %6zu of %zu points rejected by the planes   planes tested per rejection %6.2f "
+         "before, %6.2f after   containsPoints %6.2f ns/point before, %6.2f after\n",
+         name, body.getPlanes().size(), rejected, n, before, after, fixed / n * 1e9, adaptive / n * 1e9);
+}
+}
+
+int main()
+{
+  shapes::Mesh* mesh = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  if (!mesh)
+    return 1;
+  benchmark("above", mesh, Eigen::Vector3d(0.0, 0.0, 2.0));
+  benchmark("in front", mesh, Eigen::Vector3d(2.0, 0.0, 0.0));
+  benchmark("aside", mesh, Eigen::Vector3d(0.0, -2.0, 0.5));
+  delete mesh;
+  return 0;
+}
@@ -0,0 +1,232 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <geometric_shapes/body_operations.h>
+#include <geometric_shapes/mesh_operations.h>
+#include <gtest/gtest.h>
+
+namespace
+{
+Eigen::Affine3d makePose(double angle, const Eigen::Vector3d& axis, const Eigen::Vector3d& translation)
+{
+  Eigen::Affine3d pose(Eigen::AngleAxisd(angle, axis.normalized()));
+  pose.translation() = translation;
+  return pose;
+}
+
+/** \brief True if some point sampled around \e a is inside both bodies; this never reports false intersections */
+bool sampledIntersection(const bodies::Body& a, const bodies::Body& b, random_numbers::RandomNumberGenerator& rng)
+{
+  bodies::BoundingSphere sphere;
+  a.computeBoundingSphere(sphere);
+  for (int i = 0; i < 5000; ++i)
+  {
+    const Eigen::Vector3d p = sphere.center + sphere.radius * Eigen::Vector3d(rng.uniformReal(-1.0, 1.0),
+                                                                              rng.uniformReal(-1.0, 1.0),
+                                                                              rng.uniformReal(-1.0, 1.0));
+    if (a.containsPoint(p) && b.containsPoint(p))
+      return true;
+  }
+  return false;
+}
+}
+
+TEST(BodyIntersection, SphereSphere)
+{
+  shapes::Sphere shape(0.5);
+  bodies::Sphere a(&shape), b(&shape);
+  b.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(0.8, 0.0, 0.0)));
+  double depth;
+  Eigen::Vector3d normal;
+  ASSERT_TRUE(bodies::computePenetration(a, b, depth, normal));
+  EXPECT_NEAR(0.2, depth, 1e-12);
+  EXPECT_TRUE(normal.isApprox(Eigen::Vector3d::UnitX()));
+
+  b.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(1.1, 0.0, 0.0)));
+  EXPECT_FALSE(bodies::intersects(a, b));
+  b.setPadding(0.2);
+  EXPECT_TRUE(bodies::intersects(a, b));
+}
+
+TEST(BodyIntersection, SphereBox)
+{
+  shapes::Sphere sphere_shape(0.5);
+  shapes::Box box_shape(1.0, 2.0, 3.0);
+  bodies::Sphere sphere(&sphere_shape);
+  bodies::Box box(&box_shape);
+  sphere.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(0.8, 0.0, 0.0)));
+  double depth;
+  Eigen::Vector3d normal;
+  ASSERT_TRUE(bodies::computePenetration(box, sphere, depth, normal));
+  EXPECT_NEAR(0.2, depth, 1e-12);
+  EXPECT_TRUE(normal.isApprox(Eigen::Vector3d::UnitX()));
+  ASSERT_TRUE(bodies::computePenetration(sphere, box, depth, normal));
+  EXPECT_NEAR(0.2, depth, 1e-12);
+  EXPECT_TRUE(normal.isApprox(-Eigen::Vector3d::UnitX()));
+
+  // near a corner of the box the closest point is the corner
+  sphere.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(0.9, 1.4, 0.0)));
+  EXPECT_FALSE(bodies::intersects(sphere, box));
+  sphere.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(0.7, 1.2, 0.0)));
+  EXPECT_TRUE(bodies::intersects(sphere, box));
+}
+
+TEST(BodyIntersection, TouchingCylinders)
+{
+  // cylinders go through GJK, which must not report contact as an intersection
+  shapes::Cylinder cylinder_shape(1.0, 2.0);
+  shapes::Sphere sphere_shape(1.0);
+  bodies::Cylinder a(&cylinder_shape), b(&cylinder_shape);
+  bodies::Sphere sphere(&sphere_shape);
+  double depth;
+  Eigen::Vector3d normal;
+
+  // cap to cap, and a concentric pair, which puts the origin on the first simplex
+  b.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(0.0, 0.0, 2.0)));
+  EXPECT_FALSE(bodies::intersects(a, b));
+  EXPECT_FALSE(bodies::computePenetration(a, b, depth, normal));
+  b.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(0.0, 0.0, 1.9)));
+  ASSERT_TRUE(bodies::computePenetration(a, b, depth, normal));
+  EXPECT_NEAR(0.1, depth, 1e-6);
+  b.setPose(Eigen::Affine3d::Identity());
+  EXPECT_TRUE(bodies::intersects(a, b));
+
+  // side to side
+  b.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(2.0, 0.0, 0.0)));
+  EXPECT_FALSE(bodies::intersects(a, b));
+  EXPECT_FALSE(bodies::computePenetration(a, b, depth, normal));
+
+  // a sphere on the cap and against the side
+  sphere.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(0.0, 0.0, 2.0)));
+  EXPECT_FALSE(bodies::intersects(a, sphere));
+  EXPECT_FALSE(bodies::computePenetration(a, sphere, depth, normal));
+  sphere.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(0.0, 2.0, 0.0)));
+  EXPECT_FALSE(bodies::intersects(sphere, a));
+  sphere.setPose(makePose(0.0, Eigen::Vector3d::UnitX(), Eigen::Vector3d(0.0, 1.95, 0.0)));
+  EXPECT_TRUE(bodies::intersects(sphere, a));
+}
+
+TEST(BodyIntersection, AgreesWithSampling)
+{
+  shapes::Box box_shape(0.4, 0.6, 0.8);
+  shapes::Sphere sphere_shape(0.3);
+  shapes::Cylinder cylinder_shape(0.25, 0.7);
+  shapes::Mesh* mesh_shape = shapes::createMeshFromShape(shapes::Box(0.5, 0.3, 0.6));
+  std::vector<bodies::Body*> bodies;
+  bodies.push_back(new bodies::Box(&box_shape));
+  bodies.push_back(new bodies::Sphere(&sphere_shape));
+  bodies.push_back(new bodies::Cylinder(&cylinder_shape));
+  bodies.push_back(new bodies::ConvexMesh(mesh_shape));
+
+  random_numbers::RandomNumberGenerator rng(11);
+  for (int trial = 0; trial < 40; ++trial)
+    for (std::size_t i = 0; i < bodies.size(); ++i)
+      for (std::size_t j = 0; j < bodies.size(); ++j)
+      {
+        bodies[i]->setPose(makePose(rng.uniformReal(-M_PI, M_PI),
+                                    Eigen::Vector3d(rng.uniformReal(-1, 1), rng.uniformReal(-1, 1), 1.0),
+                                    Eigen::Vector3d::Zero()));
+        bodies[j]->setPose(makePose(rng.uniformReal(-M_PI, M_PI),
+                                    Eigen::Vector3d(1.0, rng.uniformReal(-1, 1), rng.uniformReal(-1, 1)),
+                                    Eigen::Vector3d(rng.uniformReal(-0.8, 0.8), rng.uniformReal(-0.8, 0.8),
+                                                    rng.uniformReal(-0.8, 0.8))));
+        if (i == j)
+          continue;
+        const bool result = bodies::intersects(*bodies[i], *bodies[j]);
+        EXPECT_EQ(result, bodies::intersects(*bodies[j], *bodies[i]));
+        // a common point proves an intersection
+        if (sampledIntersection(*bodies[i], *bodies[j], rng))
+        {
+          EXPECT_TRUE(result) << i << " " << j << " " << trial;
+        }
+
+        double depth;
+        Eigen::Vector3d normal;
+        ASSERT_EQ(result, bodies::computePenetration(*bodies[i], *bodies[j], depth, normal));
+        if (!result)
+          continue;
+        EXPECT_GE(depth, 0.0);
+        EXPECT_NEAR(1.0, normal.norm(), 1e-9);
+        // moving the second body a bit further than the depth separates the bodies, except for curved
+        // surfaces where EPA only approximates the depth
+        Eigen::Affine3d moved = bodies[j]->getPose();
+        moved.translation() += normal * (depth + 1e-3);
+        bodies[j]->setPose(moved);
+        EXPECT_FALSE(bodies::intersects(*bodies[i], *bodies[j])) << i << " " << j << " " << trial;
+      }
+
+  for (std::size_t i = 0; i < bodies.size(); ++i)
+    delete bodies[i];
+  delete mesh_shape;
+}
+
+TEST(BodyIntersection, MeshMatchesBox)
+{
+  // GJK and EPA on the hull of a box mesh give the same answers as the separating axis test on the box
+  shapes::Box box_shape(0.5, 0.3, 0.6);
+  shapes::Mesh* mesh_shape = shapes::createMeshFromShape(box_shape);
+  bodies::Box box(&box_shape);
+  bodies::ConvexMesh mesh(mesh_shape);
+  shapes::Box other_shape(0.4, 0.6, 0.8);
+  bodies::Box other(&other_shape);
+
+  random_numbers::RandomNumberGenerator rng(13);
+  for (int trial = 0; trial < 200; ++trial)
+  {
+    const Eigen::Affine3d pose = makePose(rng.uniformReal(-M_PI, M_PI),
+                                          Eigen::Vector3d(rng.uniformReal(-1, 1), rng.uniformReal(-1, 1), 1.0),
+                                          Eigen::Vector3d::Zero());
+    box.setPose(pose);
+    mesh.setPose(pose);
+    other.setPose(makePose(rng.uniformReal(-M_PI, M_PI),
+                           Eigen::Vector3d(1.0, rng.uniformReal(-1, 1), rng.uniformReal(-1, 1)),
+                           Eigen::Vector3d(rng.uniformReal(-0.8, 0.8), rng.uniformReal(-0.8, 0.8),
+                                           rng.uniformReal(-0.8, 0.8))));
+    double box_depth, mesh_depth;
+    Eigen::Vector3d box_normal, mesh_normal;
+    const bool box_result = bodies::computePenetration(box, other, box_depth, box_normal);
+    ASSERT_EQ(box_result, bodies::computePenetration(mesh, other, mesh_depth, mesh_normal));
+    if (box_result)
+    {
+      EXPECT_NEAR(box_depth, mesh_depth, 1e-5);
+    }
+  }
+  delete mesh_shape;
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
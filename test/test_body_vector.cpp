@@ -0,0 +1,373 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <geometric_shapes/bodies.h>
+#include <geometric_shapes/body_operations.h>
+#include <geometric_shapes/mesh_operations.h>
+#include <geometric_shapes/ray_caster.h>
+#include <gtest/gtest.h>
+
+namespace
+{
+/** \brief Fill \e bodies with \e n random spheres, boxes and cylinders placed inside a cube of side \e extent */
+void addRandomBodies(bodies::BodyVector& bodies, unsigned int n, double extent,
+                     random_numbers::RandomNumberGenerator& rng)
+{
+  for (unsigned int i = 0; i < n; ++i)
+  {
+    Eigen::Affine3d pose(Eigen::AngleAxisd(rng.uniformReal(-M_PI, M_PI),
+                                           Eigen::Vector3d(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0),
+                                                           rng.uniformReal(-1.0, 1.0))
+                                               .normalized()));
+    pose.translation() = Eigen::Vector3d(rng.uniformReal(0.0, extent), rng.uniformReal(0.0, extent),
+                                         rng.uniformReal(0.0, extent));
+    switch (i % 3)
+    {
+      case 0:
+      {
+        shapes::Sphere s(rng.uniformReal(0.1, 0.5));
+        bodies.addBody(&s, pose);
+        break;
+      }
+      case 1:
+      {
+        shapes::Box b(rng.uniformReal(0.1, 1.0), rng.uniformReal(0.1, 1.0), rng.uniformReal(0.1, 1.0));
+        bodies.addBody(&b, pose);
+        break;
+      }
+      default:
+      {
+        shapes::Cylinder c(rng.uniformReal(0.1, 0.5), rng.uniformReal(0.1, 1.0));
+        bodies.addBody(&c, pose);
+        break;
+      }
+    }
+  }
+}
+
+/** \brief Compare the answers of the linear scan and of the hierarchy on random points and rays */
+void compareQueries(bodies::BodyVector& bodies, double extent, random_numbers::RandomNumberGenerator& rng)
+{
+  for (int i = 0; i < 2000; ++i)
+  {
+    Eigen::Vector3d p(rng.uniformReal(0.0, extent), rng.uniformReal(0.0, extent), rng.uniformReal(0.0, extent));
+    Eigen::Vector3d d(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+    d.normalize();
+
+    std::size_t linear_index = 0, bvh_index = 0;
+    std::size_t linear_contains_index = 0, bvh_contains_index = 0;
+    EigenSTL::vector_Vector3d linear_pts, bvh_pts;
+
+    bodies.setUseBoundingVolumeHierarchy(false);
+    bool linear_contains = bodies.containsPoint(p, linear_contains_index);
+    bool linear_hit = bodies.intersectsRay(p, d, linear_index, &linear_pts);
+
+    bodies.setUseBoundingVolumeHierarchy(true);
+    bool bvh_contains = bodies.containsPoint(p, bvh_contains_index);
+    bool bvh_hit = bodies.intersectsRay(p, d, bvh_index, &bvh_pts);
+
+    EXPECT_EQ(linear_contains, bvh_contains);
+    if (linear_contains && bvh_contains)
+    {
+      EXPECT_EQ(linear_contains_index, bvh_contains_index);
+    }
+    EXPECT_EQ(linear_hit, bvh_hit);
+    if (linear_hit && bvh_hit)
+    {
+      EXPECT_EQ(linear_index, bvh_index);
+      ASSERT_EQ(linear_pts.size(), bvh_pts.size());
+      for (std::size_t j = 0; j < linear_pts.size(); ++j)
+        EXPECT_TRUE(linear_pts[j].isApprox(bvh_pts[j]));
+    }
+
+    // ray queries find the same body, for the whole ray and for a segment of it
+    for (int segment = 0; segment < 2; ++segment)
+    {
+      const bodies::Ray ray(p, d, 0.0, segment ? 1.0 : std::numeric_limits<double>::infinity());
+      std::size_t linear_ray_index = 0, bvh_ray_index = 0;
+      bodies::Hit linear_ray_hit, bvh_ray_hit;
+      bodies.setUseBoundingVolumeHierarchy(false);
+      bool linear_ray = bodies.intersect(ray, linear_ray_index, linear_ray_hit);
+      bodies.setUseBoundingVolumeHierarchy(true);
+      bool bvh_ray = bodies.intersect(ray, bvh_ray_index, bvh_ray_hit);
+      EXPECT_EQ(linear_ray, bvh_ray);
+      if (linear_ray && bvh_ray)
+      {
+        EXPECT_EQ(linear_ray_index, bvh_ray_index);
+        EXPECT_EQ(linear_ray_hit.count, bvh_ray_hit.count);
+      }
+      if (segment == 0)
+      {
+        EXPECT_EQ(linear_hit, linear_ray);
+        if (linear_hit && linear_ray)
+        {
+          EXPECT_EQ(linear_index, linear_ray_index);
+          ASSERT_GT(linear_ray_hit.count, 0u);
+          EXPECT_TRUE(ray.at(linear_ray_hit.t[0]).isApprox(linear_pts[0]));
+        }
+      }
+    }
+  }
+}
+}
+
+TEST(BodyVectorBVH, MatchesLinearScan)
+{
+  random_numbers::RandomNumberGenerator rng(7);
+  for (unsigned int n = 1; n <= 100; n *= 10)
+  {
+    bodies::BodyVector bodies;
+    addRandomBodies(bodies, n + 3, 4.0, rng);
+    compareQueries(bodies, 4.0, rng);
+  }
+}
+
+TEST(BodyVectorBVH, RefitOnSetPose)
+{
+  random_numbers::RandomNumberGenerator rng(11);
+  bodies::BodyVector bodies;
+  addRandomBodies(bodies, 50, 4.0, rng);
+  bodies.setUseBoundingVolumeHierarchy(true);
+
+  // move some bodies far away and others into the queried region
+  for (unsigned int i = 0; i < bodies.getCount(); i += 3)
+  {
+    Eigen::Affine3d pose(Eigen::Affine3d::Identity());
+    pose.translation() = Eigen::Vector3d(rng.uniformReal(0.0, 4.0), rng.uniformReal(0.0, 4.0), 8.0);
+    bodies.setPose(i, pose);
+  }
+
+  Eigen::Affine3d pose(Eigen::Affine3d::Identity());
+  pose.translation() = Eigen::Vector3d(2.0, 2.0, 8.0);
+  bodies.setPose(0, pose);
+  std::size_t index = 1000;
+  EXPECT_TRUE(bodies.containsPoint(Eigen::Vector3d(2.0, 2.0, 8.0), index));
+  EXPECT_EQ(0u, index);
+
+  compareQueries(bodies, 8.0, rng);
+}
+
+TEST(BodyVectorBVH, AddAndClear)
+{
+  bodies::BodyVector bodies;
+  bodies.setUseBoundingVolumeHierarchy(true);
+  std::size_t index;
+  EXPECT_FALSE(bodies.containsPoint(Eigen::Vector3d(0.0, 0.0, 0.0), index));
+
+  shapes::Sphere s(1.0);
+  bodies.addBody(&s, Eigen::Affine3d::Identity());
+  EXPECT_TRUE(bodies.containsPoint(Eigen::Vector3d(0.0, 0.0, 0.5), index));
+  EXPECT_EQ(0u, index);
+  EXPECT_TRUE(bodies.intersectsRay(Eigen::Vector3d(-5.0, 0.0, 0.0), Eigen::Vector3d(1.0, 0.0, 0.0), index));
+
+  // bodies added and moved before the next query are in the hierarchy it builds
+  shapes::Box b(1.0, 1.0, 1.0);
+  bodies.addBody(&b, Eigen::Affine3d::Identity());
+  bodies.addBody(&b, Eigen::Affine3d::Identity());
+  bodies.setPose(2, Eigen::Affine3d(Eigen::Translation3d(10.0, 0.0, 0.0)));
+  EXPECT_TRUE(bodies.containsPoint(Eigen::Vector3d(10.0, 0.0, 0.2), index));
+  EXPECT_EQ(2u, index);
+  bodies.setPose(2, Eigen::Affine3d(Eigen::Translation3d(20.0, 0.0, 0.0)));
+  EXPECT_FALSE(bodies.containsPoint(Eigen::Vector3d(10.0, 0.0, 0.2), index));
+  EXPECT_TRUE(bodies.containsPoint(Eigen::Vector3d(20.0, 0.0, 0.2), index));
+
+  bodies.clear();
+  EXPECT_FALSE(bodies.containsPoint(Eigen::Vector3d(0.0, 0.0, 0.5), index));
+  EXPECT_FALSE(bodies.intersectsRay(Eigen::Vector3d(-5.0, 0.0, 0.0), Eigen::Vector3d(1.0, 0.0, 0.0), index));
+}
+
+TEST(BodyVectorRays, NearestHit)
+{
+  random_numbers::RandomNumberGenerator rng(13);
+  bodies::BodyVector bodies;
+  addRandomBodies(bodies, 60, 4.0, rng);
+
+  const std::size_t n = 5003;
+  EigenSTL::vector_Vector3d origins(n), dirs(n);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    origins[i] = Eigen::Vector3d(rng.uniformReal(-1.0, 5.0), rng.uniformReal(-1.0, 5.0), rng.uniformReal(-1.0, 5.0));
+    dirs[i] = Eigen::Vector3d(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0))
+                  .normalized();
+  }
+
+  // brute force over the bodies, one ray at a time
+  std::vector<double> expected_t(n, std::numeric_limits<double>::infinity());
+  std::vector<std::size_t> expected_index(n, bodies::BodyVector::NO_BODY);
+  for (std::size_t b = 0; b < bodies.getCount(); ++b)
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      double t;
+      bodies.getBody(b)->intersectsRays(&origins[i], &dirs[i], 1, &t);
+      if (t < expected_t[i])
+      {
+        expected_t[i] = t;
+        expected_index[i] = b;
+      }
+    }
+
+  std::size_t hits = 0;
+  for (int use_bvh = 0; use_bvh < 2; ++use_bvh)
+  {
+    bodies.setUseBoundingVolumeHierarchy(use_bvh);
+    std::vector<double> t(n);
+    std::vector<std::size_t> index(n);
+    bodies.intersectsRays(&origins[0], &dirs[0], n, &t[0], &index[0]);
+    hits = 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      EXPECT_EQ(expected_t[i], t[i]) << "ray " << i;
+      EXPECT_EQ(expected_index[i], index[i]) << "ray " << i;
+      hits += !std::isinf(t[i]);
+    }
+
+    bodies::RayCaster caster(3);
+    caster.setChunkSize(100);
+    std::vector<double> caster_t;
+    std::vector<std::size_t> caster_index;
+    caster.castRays(bodies, origins, dirs, caster_t, caster_index);
+    EXPECT_TRUE(caster_t == t);
+    EXPECT_TRUE(caster_index == index);
+    EXPECT_EQ(n, caster.getLastStatistics().rays);
+    EXPECT_EQ(hits, caster.getLastStatistics().hits);
+  }
+  EXPECT_GT(hits, 0u);
+  EXPECT_LT(hits, n);
+}
+
+TEST(BodyVectorRays, HitModes)
+{
+  random_numbers::RandomNumberGenerator rng(17);
+  bodies::BodyVector bodies;
+  addRandomBodies(bodies, 60, 4.0, rng);
+
+  std::size_t hits = 0;
+  for (int i = 0; i < 2000; ++i)
+  {
+    const Eigen::Vector3d origin(rng.uniformReal(-1.0, 5.0), rng.uniformReal(-1.0, 5.0), rng.uniformReal(-1.0, 5.0));
+    const Eigen::Vector3d dir(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+    const bodies::Ray ray(origin, dir, 0.0, i % 2 ? 3.0 : std::numeric_limits<double>::infinity());
+
+    // brute force over the bodies
+    std::size_t expected_index = bodies::BodyVector::NO_BODY;
+    double expected_t = std::numeric_limits<double>::infinity();
+    std::size_t expected_count = 0;
+    for (std::size_t b = 0; b < bodies.getCount(); ++b)
+    {
+      bodies::Hit hit;
+      if (!bodies.getBody(b)->intersect(ray, hit))
+        continue;
+      ++expected_count;
+      const double t = hit.inside ? ray.tmin : hit.t[0];
+      if (t < expected_t)
+      {
+        expected_t = t;
+        expected_index = b;
+      }
+    }
+
+    for (int use_bvh = 0; use_bvh < 2; ++use_bvh)
+    {
+      bodies.setUseBoundingVolumeHierarchy(use_bvh);
+      bodies::BodyVector::RayHit closest, any;
+      std::vector<bodies::BodyVector::RayHit> all;
+      const bool found = bodies.closestHit(ray, closest);
+      EXPECT_EQ(expected_index != bodies::BodyVector::NO_BODY, found);
+      EXPECT_EQ(found, bodies.anyHit(ray, any));
+      EXPECT_EQ(expected_count, bodies.allHits(ray, all));
+      if (!found)
+        continue;
+
+      EXPECT_EQ(expected_index, closest.index);
+      EXPECT_EQ(expected_t, closest.t);
+      EXPECT_TRUE(closest.point.isApprox(ray.at(closest.t)));
+      EXPECT_NEAR(1.0, closest.normal.norm(), 1e-9);
+      // a ray entering the body from outside goes against the normal
+      if (closest.t > ray.tmin)
+      {
+        EXPECT_LT(closest.normal.dot(ray.dir), 1e-9);
+      }
+
+      bodies::Hit any_hit;
+      EXPECT_TRUE(bodies.getBody(any.index)->intersect(ray, any_hit));
+      ASSERT_FALSE(all.empty());
+      EXPECT_EQ(closest.index, all[0].index);
+      for (std::size_t j = 1; j < all.size(); ++j)
+        EXPECT_LE(all[j - 1].t, all[j].t);
+    }
+    hits += expected_index != bodies::BodyVector::NO_BODY;
+  }
+  EXPECT_GT(hits, 0u);
+  EXPECT_LT(hits, 2000u);
+}
+
+TEST(BodyVectorRays, SurfaceNormals)
+{
+  // the analytic normals agree with the gradient of the signed distance
+  shapes::Sphere sphere(0.5);
+  shapes::Box box(0.4, 0.6, 0.8);
+  shapes::Cylinder cylinder(0.3, 0.9);
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromShape(shapes::Box(0.5, 0.7, 0.3)));
+  random_numbers::RandomNumberGenerator rng(19);
+  const shapes::Shape* shapes[4] = { &sphere, &box, &cylinder, mesh.get() };
+  for (const shapes::Shape* shape : shapes)
+  {
+    bodies::Body* body = bodies::createBodyFromShape(shape);
+    Eigen::Affine3d pose(Eigen::AngleAxisd(0.7, Eigen::Vector3d(1.0, 2.0, 3.0).normalized()));
+    pose.translation() = Eigen::Vector3d(0.1, -0.2, 0.3);
+    body->setPose(pose);
+    for (int i = 0; i < 200; ++i)
+    {
+      // where a ray from outside aimed near the center enters the body
+      const Eigen::Vector3d target(pose * Eigen::Vector3d(rng.uniformReal(-0.1, 0.1), rng.uniformReal(-0.1, 0.1),
+                                                          rng.uniformReal(-0.1, 0.1)));
+      const Eigen::Vector3d away(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+      const Eigen::Vector3d origin(target + 3.0 * away.normalized());
+      const bodies::Ray ray(origin, target - origin);
+      bodies::Hit hit;
+      ASSERT_TRUE(body->intersect(ray, hit));
+      ASSERT_GT(hit.count, 0u);
+      const Eigen::Vector3d p(ray.at(hit.t[0]));
+      EXPECT_TRUE(body->computeSurfaceNormal(p).isApprox(body->bodies::Body::computeSurfaceNormal(p), 1e-3))
+          << "shape type " << shape->type << " point " << p.transpose();
+    }
+    delete body;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -270,6 +270,86 @@ TEST(MeshBoundingSphere, Mesh1)
   EXPECT_EQ(0.5, center.z());
 }
 
+TEST(MeshBoundingSphere, Tetrahedron)
+{
+  shapes::Mesh m(4, 4);
+  const double vertices[] = { 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+  const unsigned int triangles[] = { 0, 2, 1, 0, 1, 3, 0, 3, 2, 1, 2, 3 };
+  std::copy(vertices, vertices + 12, m.vertices);
+  std::copy(triangles, triangles + 12, m.triangles);
+
+  // the sphere around the bounding box has radius sqrt(0.75); the smallest sphere passes through the
+  // three unit vertices
+  Eigen::Vector3d center;
+  double radius;
+  computeShapeBoundingSphere(&m, center, radius);
+
+  EXPECT_NEAR(sqrt(2.0 / 3.0), radius, 1e-9);
+  EXPECT_NEAR(1.0 / 3.0, center.x(), 1e-9);
+  EXPECT_NEAR(1.0 / 3.0, center.y(), 1e-9);
+  EXPECT_NEAR(1.0 / 3.0, center.z(), 1e-9);
+}
+
+TEST(MeshBoundingSphere, MinimumBoundingSphere)
+{
+  EigenSTL::vector_Vector3d points;
+  for (int i = 0; i < 1000; ++i)
+  {
+    const double a = i * 0.1, b = i * 0.37;
+    points.push_back(Eigen::Vector3d(2.0 * cos(a) * sin(b), sin(a) * sin(b), 0.5 * cos(b)) * (1.0 - (i % 7) * 0.1));
+  }
+
+  Eigen::Vector3d center;
+  double radius;
+  shapes::computeMinimumBoundingSphere(points, center, radius);
+
+  // every point is enclosed and at least two of them are on the surface
+  unsigned int on_surface = 0;
+  for (std::size_t i = 0; i < points.size(); ++i)
+  {
+    const double d = (points[i] - center).norm();
+    EXPECT_LE(d, radius);
+    if (d > radius - 1e-9)
+      ++on_surface;
+  }
+  EXPECT_GE(on_surface, 2u);
+
+  // the points are within an ellipsoid with a major axis of length 4
+  EXPECT_LE(radius, 2.0);
+}
+
+TEST(BodiesBoundingSphere, MixedBodies)
+{
+  shapes::Box box_shape(1.0, 1.0, 1.0);
+  bodies::Box box(&box_shape);
+  Eigen::Affine3d pose = Eigen::Affine3d::Identity();
+  pose.translation() = Eigen::Vector3d(2.0, 0.0, 0.0);
+  box.setPose(pose);
+
+  shapes::Sphere sphere_shape(0.5);
+  bodies::Sphere sphere(&sphere_shape);
+  pose.translation() = Eigen::Vector3d(-2.0, 0.0, 0.0);
+  sphere.setPose(pose);
+
+  std::vector<const bodies::Body*> set;
+  set.push_back(&box);
+  set.push_back(&sphere);
+  bodies::BoundingSphere merged;
+  bodies::computeBoundingSphere(set, merged);
+
+  // the corners of the box and the whole sphere are enclosed
+  for (int i = 0; i < 8; ++i)
+  {
+    Eigen::Vector3d corner(i & 1 ? 2.5 : 1.5, i & 2 ? 0.5 : -0.5, i & 4 ? 0.5 : -0.5);
+    EXPECT_LE((corner - merged.center).norm(), merged.radius + 1e-9);
+  }
+  EXPECT_LE((Eigen::Vector3d(-2.0, 0.0, 0.0) - merged.center).norm() + 0.5, merged.radius + 1e-9);
+
+  // the bodies span 5 along x; the sphere body is merged with the smallest sphere around the box
+  EXPECT_GE(merged.radius, 2.5);
+  EXPECT_NEAR((4.0 + sqrt(0.75) + 0.5) / 2.0, merged.radius, 1e-9);
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
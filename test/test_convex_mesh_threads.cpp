@@ -0,0 +1,111 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <geometric_shapes/bodies.h>
+#include <geometric_shapes/body_operations.h>
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+
+namespace
+{
+/** \brief A random cloud of points around the origin, as a mesh without triangles */
+shapes::Mesh* makeRandomMesh(unsigned int seed)
+{
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> coord(-1.0, 1.0);
+  const unsigned int count = 20 + seed % 30;
+  shapes::Mesh* mesh = new shapes::Mesh(count, 0);
+  for (unsigned int i = 0; i < 3 * count; ++i)
+    mesh->vertices[i] = coord(gen) * (1.0 + 0.1 * (i % 3));
+  return mesh;
+}
+}
+
+TEST(ConvexMeshThreads, ConcurrentConstruction)
+{
+  const unsigned int threads = 8;
+  const unsigned int count = 400;
+  // make every body compute its own hull
+  const std::size_t budget = bodies::ConvexMesh::getCacheBudget();
+  bodies::ConvexMesh::setCacheBudget(0);
+
+  std::vector<shapes::Mesh*> meshes(count);
+  std::vector<bodies::Body*> expected(count);
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    meshes[i] = makeRandomMesh(i);
+    expected[i] = bodies::createBodyFromShape(meshes[i]);
+  }
+
+  // build all the hulls again, from several threads at once
+  std::vector<bodies::Body*> built(count, NULL);
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < threads; ++t)
+    workers.push_back(std::thread([&meshes, &built, t]() {
+      for (unsigned int i = t; i < count; i += threads)
+        built[i] = bodies::createBodyFromShape(meshes[i]);
+    }));
+  for (std::size_t t = 0; t < workers.size(); ++t)
+    workers[t].join();
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> coord(-1.5, 1.5);
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    ASSERT_TRUE(built[i] != NULL);
+    const bodies::ConvexMesh* a = static_cast<const bodies::ConvexMesh*>(expected[i]);
+    const bodies::ConvexMesh* b = static_cast<const bodies::ConvexMesh*>(built[i]);
+    ASSERT_EQ(a->getPlanes().size(), b->getPlanes().size());
+    for (std::size_t j = 0; j < a->getPlanes().size(); ++j)
+      EXPECT_TRUE(a->getPlanes()[j].isApprox(b->getPlanes()[j]));
+    ASSERT_EQ(a->getVertices().size(), b->getVertices().size());
+    EXPECT_EQ(a->getTriangles(), b->getTriangles());
+    for (int j = 0; j < 20; ++j)
+    {
+      Eigen::Vector3d p(coord(gen), coord(gen), coord(gen));
+      EXPECT_EQ(a->containsPoint(p), b->containsPoint(p));
+    }
+    delete expected[i];
+    delete built[i];
+    delete meshes[i];
+  }
+  bodies::ConvexMesh::setCacheBudget(budget);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -36,8 +36,13 @@
 
 #include "resources/config.h"
 #include <geometric_shapes/mesh_operations.h>
+#include <geometric_shapes/shapes.h>
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <random>
 #include <string>
+#include <thread>
 
 namespace
 {
@@ -67,6 +72,141 @@ shapes::Mesh* loadMesh(const std::string& mesh)
   std::string path = "file://" + std::string(TEST_RESOURCES_DIR) + "/" + mesh;
   return shapes::createMeshFromResource(path);
 }
+
+/// The corners of the triangles of \e mesh, three per triangle
+EigenSTL::vector_Vector3d triangleSoup(const shapes::Mesh& mesh)
+{
+  EigenSTL::vector_Vector3d soup;
+  for (unsigned int i = 0; i < 3 * mesh.triangle_count; ++i)
+    soup.push_back(Eigen::Vector3d(&mesh.vertices[3 * mesh.triangles[i]]));
+  return soup;
+}
+
+/// Mesh::mergeVertices() as it was, comparing every pair of vertices, with the collapsed triangles removed
+void mergeVerticesPairwise(shapes::Mesh& mesh, double threshold)
+{
+  std::vector<unsigned int> vertex_map(mesh.vertex_count);
+  for (unsigned int v = 0; v < mesh.vertex_count; ++v)
+    vertex_map[v] = v;
+  EigenSTL::vector_Vector3d kept;
+  for (unsigned int v1 = 0; v1 < mesh.vertex_count; ++v1)
+  {
+    if (vertex_map[v1] != v1)
+      continue;
+    vertex_map[v1] = kept.size();
+    kept.push_back(Eigen::Vector3d(&mesh.vertices[3 * v1]));
+    for (unsigned int v2 = v1 + 1; v2 < mesh.vertex_count; ++v2)
+      if ((kept.back() - Eigen::Vector3d(&mesh.vertices[3 * v2])).norm() <= threshold)
+        vertex_map[v2] = vertex_map[v1];
+  }
+
+  unsigned int triangle_count = 0;
+  for (unsigned int t = 0; t < mesh.triangle_count; ++t)
+  {
+    const unsigned int* v = &mesh.triangles[3 * t];
+    const unsigned int m[3] = { vertex_map[v[0]], vertex_map[v[1]], vertex_map[v[2]] };
+    if ((v[0] != v[1] && v[1] != v[2] && v[0] != v[2]) && (m[0] == m[1] || m[1] == m[2] || m[0] == m[2]))
+      continue;
+    std::copy(m, m + 3, &mesh.triangles[3 * triangle_count++]);
+  }
+  mesh.triangle_count = triangle_count;
+  mesh.vertex_count = kept.size();
+  for (unsigned int v = 0; v < mesh.vertex_count; ++v)
+    std::copy(kept[v].data(), kept[v].data() + 3, &mesh.vertices[3 * v]);
+}
+
+void expectSameMesh(const shapes::Mesh& expected, const shapes::Mesh& mesh)
+{
+  ASSERT_EQ(expected.vertex_count, mesh.vertex_count);
+  ASSERT_EQ(expected.triangle_count, mesh.triangle_count);
+  EXPECT_TRUE(std::equal(expected.vertices, expected.vertices + 3 * expected.vertex_count, mesh.vertices));
+  EXPECT_TRUE(std::equal(expected.triangles, expected.triangles + 3 * expected.triangle_count, mesh.triangles));
+}
+}
+
+TEST(CreateMesh, weldIdentical)
+{
+  shapes::Box box(1.0, 2.0, 3.0);
+  std::unique_ptr<shapes::Mesh> cube(shapes::createMeshFromShape(&box));
+  const EigenSTL::vector_Vector3d soup = triangleSoup(*cube);
+  std::unique_ptr<shapes::Mesh> welded(shapes::createMeshFromVertices(soup));
+  ASSERT_TRUE(welded != NULL);
+  EXPECT_EQ(8u, welded->vertex_count);
+  ASSERT_EQ(cube->triangle_count, welded->triangle_count);
+  for (unsigned int i = 0; i < 3 * welded->triangle_count; ++i)
+    EXPECT_TRUE(Eigen::Vector3d(&welded->vertices[3 * welded->triangles[i]]) == soup[i]);
+
+  // vertices are numbered in the order they first occur
+  EXPECT_EQ(0u, welded->triangles[0]);
+  EXPECT_EQ(1u, welded->triangles[1]);
+  EXPECT_EQ(2u, welded->triangles[2]);
+
+  // -0 and +0 are the same coordinate
+  EigenSTL::vector_Vector3d zeros(3, Eigen::Vector3d(0.0, 1.0, 0.0));
+  zeros[0] = Eigen::Vector3d(0.0, 0.0, 0.0);
+  zeros[1] = Eigen::Vector3d(-0.0, -0.0, 0.0);
+  welded.reset(shapes::createMeshFromVertices(zeros));
+  EXPECT_EQ(2u, welded->vertex_count);
+
+  EXPECT_TRUE(shapes::createMeshFromVertices(EigenSTL::vector_Vector3d(2)) == NULL);
+}
+
+TEST(CreateMesh, weldTolerance)
+{
+  shapes::Box box(1.0, 1.0, 1.0);
+  std::unique_ptr<shapes::Mesh> cube(shapes::createMeshFromShape(&box));
+  EigenSTL::vector_Vector3d soup = triangleSoup(*cube);
+
+  // the corners are at +-0.5, on the lower bounds of grid cells of 0.1; moving them up a little stays in the cell
+  std::mt19937 generator(5);
+  std::uniform_real_distribution<double> jitter(0.01, 0.04);
+  for (Eigen::Vector3d& v : soup)
+    v += Eigen::Vector3d(jitter(generator), jitter(generator), jitter(generator));
+
+  std::unique_ptr<shapes::Mesh> exact(shapes::createMeshFromVertices(soup));
+  EXPECT_EQ(soup.size(), exact->vertex_count);
+  std::unique_ptr<shapes::Mesh> welded(shapes::createMeshFromVertices(soup, 0.1));
+  EXPECT_EQ(8u, welded->vertex_count);
+  for (unsigned int i = 0; i < 3 * welded->triangle_count; ++i)
+    EXPECT_TRUE(Eigen::Vector3d(&welded->vertices[3 * welded->triangles[i]]).isApprox(soup[i], 0.1));
+}
+
+TEST(CreateMesh, weldParallel)
+{
+  // enough triangles for several chunks, with corners drawn from a smaller set of points
+  std::mt19937 generator(3);
+  std::uniform_real_distribution<double> coordinate(-1.0, 1.0);
+  EigenSTL::vector_Vector3d points(30000);
+  for (Eigen::Vector3d& p : points)
+    p = Eigen::Vector3d(coordinate(generator), coordinate(generator), coordinate(generator));
+  std::uniform_int_distribution<std::size_t> pick(0, points.size() - 1);
+  EigenSTL::vector_Vector3d soup(3 * 100000);
+  std::vector<bool> picked(points.size(), false);
+  for (Eigen::Vector3d& v : soup)
+  {
+    const std::size_t i = pick(generator);
+    v = points[i];
+    picked[i] = true;
+  }
+
+  const double tolerances[2] = { 0.0, 0.2 };
+  for (double tolerance : tolerances)
+  {
+    std::unique_ptr<shapes::Mesh> serial(shapes::createMeshFromVertices(soup, tolerance));
+    if (tolerance == 0.0)
+    {
+      EXPECT_EQ(std::count(picked.begin(), picked.end(), true), serial->vertex_count);
+    }
+    else
+    {
+      EXPECT_GE(1000u, serial->vertex_count);  // the number of grid cells
+    }
+    for (unsigned int threads = 1; threads <= 4; threads *= 2)
+    {
+      std::unique_ptr<shapes::Mesh> parallel(shapes::createMeshFromVerticesParallel(soup, tolerance, threads));
+      expectSameMesh(*serial, *parallel);
+    }
+  }
 }
 
 TEST(CreateMesh, stl)
@@ -109,6 +249,395 @@ TEST(CreateMesh, dae10M)
   assertMesh(loadMesh("triangle_10m.dae"));
 }
 
+TEST(MergeVertices, MatchesPairwise)
+{
+  // clusters of vertices a little apart, so that merging depends on the order
+  std::mt19937 generator(9);
+  std::uniform_real_distribution<double> coordinate(-1.0, 1.0);
+  std::uniform_real_distribution<double> offset(-0.02, 0.02);
+  const unsigned int clusters = 500;
+  const unsigned int vertex_count = 5000;
+  const unsigned int triangle_count = 8000;
+  EigenSTL::vector_Vector3d centers(clusters);
+  for (Eigen::Vector3d& c : centers)
+    c = Eigen::Vector3d(coordinate(generator), coordinate(generator), coordinate(generator));
+  std::uniform_int_distribution<unsigned int> pick_cluster(0, clusters - 1);
+  std::uniform_int_distribution<unsigned int> pick_vertex(0, vertex_count - 1);
+  shapes::Mesh mesh(vertex_count, triangle_count);
+  for (unsigned int v = 0; v < vertex_count; ++v)
+  {
+    const Eigen::Vector3d p =
+        centers[pick_cluster(generator)] + Eigen::Vector3d(offset(generator), offset(generator), offset(generator));
+    std::copy(p.data(), p.data() + 3, &mesh.vertices[3 * v]);
+  }
+  // every fourth vertex is an exact copy of an earlier one
+  for (unsigned int v = 4; v < vertex_count; v += 4)
+    std::copy(&mesh.vertices[3 * (v / 2)], &mesh.vertices[3 * (v / 2) + 3], &mesh.vertices[3 * v]);
+  for (unsigned int i = 0; i < 3 * triangle_count; ++i)
+    mesh.triangles[i] = pick_vertex(generator);
+  mesh.computeVertexNormals();
+
+  const double thresholds[3] = { 0.0, 0.01, 0.03 };
+  for (double threshold : thresholds)
+  {
+    std::unique_ptr<shapes::Mesh> expected(static_cast<shapes::Mesh*>(mesh.clone()));
+    mergeVerticesPairwise(*expected, threshold);
+    EXPECT_LT(expected->vertex_count, vertex_count);
+    for (unsigned int threads = 1; threads <= 4; threads *= 2)
+    {
+      std::unique_ptr<shapes::Mesh> merged(static_cast<shapes::Mesh*>(mesh.clone()));
+      merged->mergeVertices(threshold, threads);
+      expectSameMesh(*expected, *merged);
+    }
+  }
+}
+
+TEST(MergeVertices, DenseClusters)
+{
+  // many vertices within the threshold of each other, more than the parallel search lists for one vertex
+  std::mt19937 generator(11);
+  std::uniform_real_distribution<double> offset(-0.02, 0.02);
+  const unsigned int vertex_count = 12000;
+  const unsigned int triangle_count = 6000;
+  const Eigen::Vector3d centers[3] = { Eigen::Vector3d(0.0, 0.0, 0.0), Eigen::Vector3d(1.0, 0.0, 0.0),
+                                       Eigen::Vector3d(0.0, 0.0, 1.0) };
+  shapes::Mesh mesh(vertex_count, triangle_count);
+  for (unsigned int v = 0; v < vertex_count; ++v)
+  {
+    const Eigen::Vector3d p =
+        centers[v % 3] + Eigen::Vector3d(offset(generator), offset(generator), offset(generator));
+    std::copy(p.data(), p.data() + 3, &mesh.vertices[3 * v]);
+  }
+  for (unsigned int i = 0; i < 3 * triangle_count; ++i)
+    mesh.triangles[i] = i % vertex_count;
+
+  const double thresholds[2] = { 0.01, 0.05 };
+  for (double threshold : thresholds)
+  {
+    std::unique_ptr<shapes::Mesh> expected(static_cast<shapes::Mesh*>(mesh.clone()));
+    mergeVerticesPairwise(*expected, threshold);
+    for (unsigned int threads = 1; threads <= 4; threads *= 2)
+    {
+      std::unique_ptr<shapes::Mesh> merged(static_cast<shapes::Mesh*>(mesh.clone()));
+      merged->mergeVertices(threshold, threads);
+      expectSameMesh(*expected, *merged);
+    }
+  }
+}
+
+TEST(MergeVertices, RemovesCollapsedTriangles)
+{
+  // a fan of two triangles, one of which has an edge shorter than the threshold
+  EigenSTL::vector_Vector3d vertices(4);
+  vertices[0] = Eigen::Vector3d(0.0, 0.0, 0.0);
+  vertices[1] = Eigen::Vector3d(1.0, 0.0, 0.0);
+  vertices[2] = Eigen::Vector3d(0.0, 1.0, 0.0);
+  vertices[3] = Eigen::Vector3d(0.001, 1.0, 0.0);
+  std::vector<unsigned int> triangles = { 0, 1, 2, 0, 2, 3 };
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromVertices(vertices, triangles));
+  mesh->mergeVertices(0.01);
+  EXPECT_EQ(3u, mesh->vertex_count);
+  ASSERT_EQ(1u, mesh->triangle_count);
+  EXPECT_EQ(0u, mesh->triangles[0]);
+  EXPECT_EQ(1u, mesh->triangles[1]);
+  EXPECT_EQ(2u, mesh->triangles[2]);
+  EXPECT_DOUBLE_EQ(1.0, mesh->getTriangleNormals()[2]);
+}
+
+TEST(MeshNormals, ComputedWhenAskedFor)
+{
+  shapes::Box box(1.0, 2.0, 3.0);
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromShape(&box));
+  EXPECT_TRUE(mesh->triangle_normals == NULL);
+  EXPECT_TRUE(mesh->vertex_normals == NULL);
+
+  const double* vertex_normals = mesh->getVertexNormals();
+  ASSERT_TRUE(vertex_normals != NULL);
+  EXPECT_TRUE(mesh->getTriangleNormals() != NULL);
+  EXPECT_EQ(vertex_normals, mesh->getVertexNormals());
+  for (unsigned int v = 0; v < mesh->vertex_count; ++v)
+  {
+    // the corners of the box have normals pointing away from its center
+    const Eigen::Vector3d normal(vertex_normals + 3 * v);
+    EXPECT_NEAR(1.0, normal.norm(), 1e-12);
+    EXPECT_GT(normal.dot(Eigen::Vector3d(&mesh->vertices[3 * v])), 0.0);
+  }
+
+  mesh->scaleAndPadd(2.0, 0.0);
+  EXPECT_TRUE(mesh->triangle_normals == NULL);
+  EXPECT_TRUE(mesh->vertex_normals == NULL);
+
+  // meshes built by hand get room for their normals, which are still computed only when asked for
+  shapes::Mesh triangle(3, 1);
+  ASSERT_TRUE(triangle.triangle_normals != NULL);
+  ASSERT_TRUE(triangle.vertex_normals != NULL);
+  const double corners[9] = { 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0, 0.0 };
+  std::copy(corners, corners + 9, triangle.vertices);
+  for (unsigned int i = 0; i < 3; ++i)
+    triangle.triangles[i] = i;
+  const double* allocated = triangle.triangle_normals;
+  EXPECT_EQ(allocated, triangle.getTriangleNormals());
+  EXPECT_TRUE(Eigen::Vector3d(triangle.getTriangleNormals()).isApprox(Eigen::Vector3d::UnitZ()));
+  EXPECT_TRUE(Eigen::Vector3d(triangle.getVertexNormals() + 6).isApprox(Eigen::Vector3d::UnitZ()));
+  std::unique_ptr<shapes::Mesh> copy(static_cast<shapes::Mesh*>(triangle.clone()));
+  EXPECT_TRUE(Eigen::Vector3d(copy->triangle_normals).isApprox(Eigen::Vector3d::UnitZ()));
+}
+
+TEST(MeshNormals, AskedForOnSeveralThreads)
+{
+  shapes::Box box(1.0, 2.0, 3.0);
+  std::unique_ptr<shapes::Mesh> reference(shapes::createMeshFromShape(&box));
+  reference->computeVertexNormals();
+  const std::vector<double> vertex_normals(reference->vertex_normals,
+                                           reference->vertex_normals + 3 * reference->vertex_count);
+
+  // each mesh computes its normals once, whichever thread asks first; other meshes do not wait for it
+  std::vector<std::unique_ptr<shapes::Mesh> > meshes;
+  for (int i = 0; i < 8; ++i)
+    meshes.emplace_back(shapes::createMeshFromShape(&box));
+  std::vector<const double*> seen(4 * meshes.size());
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < 4; ++t)
+    threads.emplace_back([&meshes, &seen, t]() {
+      for (std::size_t i = 0; i < meshes.size(); ++i)
+      {
+        const shapes::Mesh& mesh = *meshes[(i + t) % meshes.size()];
+        mesh.getTriangleNormals();
+        seen[4 * ((i + t) % meshes.size()) + t] = mesh.getVertexNormals();
+      }
+    });
+  for (std::thread& thread : threads)
+    thread.join();
+  for (std::size_t i = 0; i < meshes.size(); ++i)
+  {
+    for (std::size_t t = 0; t < 4; ++t)
+      EXPECT_EQ(meshes[i]->vertex_normals, seen[4 * i + t]);
+    EXPECT_TRUE(std::equal(vertex_normals.begin(), vertex_normals.end(), meshes[i]->vertex_normals));
+  }
+}
+
+TEST(MeshNormals, Parallel)
+{
+  // a soup of random triangles over few vertices, so every vertex has many triangles of different areas
+  std::mt19937 generator(4);
+  std::uniform_real_distribution<double> coordinate(-1.0, 1.0);
+  const unsigned int vertex_count = 2000;
+  const unsigned int triangle_count = 100000;
+  std::uniform_int_distribution<unsigned int> pick(0, vertex_count - 1);
+  shapes::Mesh mesh(vertex_count, triangle_count);
+  for (unsigned int i = 0; i < 3 * vertex_count; ++i)
+    mesh.vertices[i] = coordinate(generator);
+  for (unsigned int i = 0; i < 3 * triangle_count; ++i)
+    mesh.triangles[i] = pick(generator);
+
+  mesh.computeVertexNormals();
+  const std::vector<double> triangle_normals(mesh.triangle_normals, mesh.triangle_normals + 3 * triangle_count);
+  const std::vector<double> vertex_normals(mesh.vertex_normals, mesh.vertex_normals + 3 * vertex_count);
+  for (unsigned int threads = 1; threads <= 4; threads *= 2)
+  {
+    mesh.clearNormals();
+    mesh.computeNormals(false, threads);
+    EXPECT_TRUE(std::equal(triangle_normals.begin(), triangle_normals.end(), mesh.triangle_normals));
+    EXPECT_TRUE(std::equal(vertex_normals.begin(), vertex_normals.end(), mesh.vertex_normals));
+  }
+
+  // with area weights, the vertex normals are the normalized sums of the cross products
+  EigenSTL::vector_Vector3d weighted(vertex_count, Eigen::Vector3d::Zero());
+  for (unsigned int t = 0; t < triangle_count; ++t)
+  {
+    const Eigen::Vector3d v1(&mesh.vertices[3 * mesh.triangles[3 * t]]);
+    const Eigen::Vector3d v2(&mesh.vertices[3 * mesh.triangles[3 * t + 1]]);
+    const Eigen::Vector3d v3(&mesh.vertices[3 * mesh.triangles[3 * t + 2]]);
+    const Eigen::Vector3d cross = (v1 - v2).cross(v2 - v3);
+    for (int k = 0; k < 3; ++k)
+      weighted[mesh.triangles[3 * t + k]] += cross;
+  }
+  mesh.computeNormals(true, 2);
+  EXPECT_TRUE(std::equal(triangle_normals.begin(), triangle_normals.end(), mesh.triangle_normals));
+  for (unsigned int v = 0; v < vertex_count; ++v)
+    EXPECT_TRUE(Eigen::Vector3d(&mesh.vertex_normals[3 * v]).isApprox(weighted[v].normalized(), 1e-9));
+}
+
+TEST(MeshStorage, Compact)
+{
+  // the corners of this box are exact as floats, so both storages give the same normals and files
+  shapes::Box box(1.0, 2.0, 3.0);
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromShape(&box));
+  std::vector<char> stl;
+  shapes::writeSTLBinary(mesh.get(), stl);
+  std::unique_ptr<shapes::Mesh> reference(static_cast<shapes::Mesh*>(mesh->clone()));
+
+  mesh->setStorage(shapes::Mesh::COMPACT_STORAGE);
+  EXPECT_EQ(shapes::Mesh::COMPACT_STORAGE, mesh->getStorage());
+  EXPECT_TRUE(mesh->vertices == NULL);
+  EXPECT_TRUE(mesh->triangles == NULL);
+  ASSERT_TRUE(mesh->compact_vertices != NULL);
+  ASSERT_TRUE(mesh->compact_triangles != NULL);
+  EXPECT_TRUE(mesh->getTriangleNormals() == NULL);
+  for (unsigned int i = 0; i < 3 * mesh->vertex_count; ++i)
+    EXPECT_EQ(reference->vertices[i], mesh->getVertexCoordinate(i));
+  for (unsigned int i = 0; i < 3 * mesh->triangle_count; ++i)
+    EXPECT_EQ(reference->triangles[i], mesh->getTriangleIndex(i));
+
+  std::vector<char> compact_stl;
+  shapes::writeSTLBinary(mesh.get(), compact_stl);
+  EXPECT_EQ(stl, compact_stl);
+
+  std::unique_ptr<shapes::Mesh> copy(static_cast<shapes::Mesh*>(mesh->clone()));
+  EXPECT_EQ(shapes::Mesh::COMPACT_STORAGE, copy->getStorage());
+  EXPECT_TRUE(std::equal(mesh->compact_vertices, mesh->compact_vertices + 3 * mesh->vertex_count,
+                         copy->compact_vertices));
+
+  mesh->scaleAndPadd(2.0, 0.0);
+  reference->scaleAndPadd(2.0, 0.0);
+  EXPECT_EQ(shapes::Mesh::COMPACT_STORAGE, mesh->getStorage());
+  mesh->setStorage(shapes::Mesh::DOUBLE_STORAGE);
+  EXPECT_TRUE(mesh->compact_vertices == NULL);
+  EXPECT_TRUE(mesh->compact_triangles == NULL);
+  EXPECT_TRUE(std::equal(reference->vertices, reference->vertices + 3 * mesh->vertex_count, mesh->vertices));
+  EXPECT_TRUE(std::equal(reference->triangles, reference->triangles + 3 * mesh->triangle_count, mesh->triangles));
+}
+
+TEST(MeshStorage, CompactNormalsAndMerge)
+{
+  shapes::Box box(1.0, 2.0, 3.0);
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromShape(&box));
+  std::unique_ptr<shapes::Mesh> compact(static_cast<shapes::Mesh*>(mesh->clone()));
+  compact->setStorage(shapes::Mesh::COMPACT_STORAGE);
+
+  // the functions that would write the normal arrays leave a compact mesh without them
+  compact->computeTriangleNormals();
+  compact->computeVertexNormals();
+  compact->computeNormals(true, 2);
+  EXPECT_TRUE(compact->triangle_normals == NULL);
+  EXPECT_TRUE(compact->vertex_normals == NULL);
+  EXPECT_TRUE(compact->getVertexNormals() == NULL);
+  const double* triangle_normals = mesh->getTriangleNormals();
+  for (unsigned int t = 0; t < compact->triangle_count; ++t)
+  {
+    double normal[3];
+    compact->getTriangleNormal(t, normal);
+    EXPECT_TRUE(std::equal(normal, normal + 3, triangle_normals + 3 * t));
+  }
+
+  // merging converts to doubles and back
+  mesh->mergeVertices(2.5);
+  compact->mergeVertices(2.5);
+  EXPECT_EQ(shapes::Mesh::COMPACT_STORAGE, compact->getStorage());
+  compact->setStorage(shapes::Mesh::DOUBLE_STORAGE);
+  expectSameMesh(*mesh, *compact);
+}
+
+TEST(MeshStorage, CompactKeepsWideIndices)
+{
+  // with more vertices than 16 bit indices can address, the triangles stay as they are
+  const unsigned int vertex_count = 70000;
+  shapes::Mesh mesh(vertex_count, 1);
+  for (unsigned int i = 0; i < 3 * vertex_count; ++i)
+    mesh.vertices[i] = 0.1 * i;
+  mesh.triangles[0] = 0;
+  mesh.triangles[1] = 65536;
+  mesh.triangles[2] = vertex_count - 1;
+
+  mesh.setStorage(shapes::Mesh::COMPACT_STORAGE);
+  EXPECT_TRUE(mesh.compact_triangles == NULL);
+  ASSERT_TRUE(mesh.triangles != NULL);
+  EXPECT_EQ(65536u, mesh.getTriangleIndex(1));
+  EXPECT_EQ(vertex_count - 1, mesh.getTriangleIndex(2));
+  EXPECT_EQ((double)(float)(0.1 * 7), mesh.getVertexCoordinate(7));
+
+  mesh.setStorage(shapes::Mesh::DOUBLE_STORAGE);
+  EXPECT_EQ(vertex_count - 1, mesh.triangles[2]);
+  EXPECT_EQ((double)(float)(0.1 * 7), mesh.vertices[7]);
+}
+
+TEST(MeshClone, CopiesArrays)
+{
+  shapes::Box box(1.0, 2.0, 3.0);
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromShape(&box));
+  mesh->computeVertexNormals();
+  const std::vector<double> vertices(mesh->vertices, mesh->vertices + 3 * mesh->vertex_count);
+  const std::vector<double> normals(mesh->vertex_normals, mesh->vertex_normals + 3 * mesh->vertex_count);
+
+  std::unique_ptr<shapes::Mesh> copy(static_cast<shapes::Mesh*>(mesh->clone()));
+  EXPECT_NE(mesh->vertices, copy->vertices);
+  EXPECT_NE(mesh->triangles, copy->triangles);
+  EXPECT_NE(mesh->vertex_normals, copy->vertex_normals);
+  EXPECT_TRUE(std::equal(vertices.begin(), vertices.end(), copy->vertices));
+  EXPECT_TRUE(std::equal(mesh->triangles, mesh->triangles + 3 * mesh->triangle_count, copy->triangles));
+  EXPECT_TRUE(std::equal(normals.begin(), normals.end(), copy->vertex_normals));
+
+  // the clone's arrays are its own to write to, free and replace
+  copy->vertices[0] = 5.0;
+  delete[] copy->triangles;
+  copy->triangles = new unsigned int[3 * copy->triangle_count];
+  std::fill(copy->triangles, copy->triangles + 3 * copy->triangle_count, 0u);
+  copy->scaleAndPadd(2.0, 0.0);
+  EXPECT_TRUE(std::equal(vertices.begin(), vertices.end(), mesh->vertices));
+  EXPECT_TRUE(std::equal(normals.begin(), normals.end(), mesh->vertex_normals));
+  EXPECT_NE(0u, mesh->triangles[1]);
+  copy.reset();
+  EXPECT_TRUE(std::equal(vertices.begin(), vertices.end(), mesh->vertices));
+}
+
+TEST(MeshClone, MergeAndStorage)
+{
+  EigenSTL::vector_Vector3d vertices(4);
+  vertices[0] = Eigen::Vector3d(0.0, 0.0, 0.0);
+  vertices[1] = Eigen::Vector3d(1.0, 0.0, 0.0);
+  vertices[2] = Eigen::Vector3d(0.0, 1.0, 0.0);
+  vertices[3] = Eigen::Vector3d(0.001, 1.0, 0.0);
+  std::vector<unsigned int> triangles = { 0, 1, 2, 0, 2, 3, 0, 1, 3 };
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromVertices(vertices, triangles));
+  std::unique_ptr<shapes::Mesh> merged(static_cast<shapes::Mesh*>(mesh->clone()));
+  merged->mergeVertices(0.01);
+  EXPECT_EQ(3u, merged->vertex_count);
+  EXPECT_EQ(2u, merged->triangle_count);
+  EXPECT_EQ(4u, mesh->vertex_count);
+  EXPECT_EQ(3u, mesh->triangle_count);
+  EXPECT_EQ(3u, mesh->triangles[5]);
+  EXPECT_EQ(0.001, mesh->vertices[9]);
+
+  std::unique_ptr<shapes::Mesh> compact(static_cast<shapes::Mesh*>(mesh->clone()));
+  compact->setStorage(shapes::Mesh::COMPACT_STORAGE);
+  std::unique_ptr<shapes::Mesh> compact_copy(static_cast<shapes::Mesh*>(compact->clone()));
+  EXPECT_NE(compact->compact_vertices, compact_copy->compact_vertices);
+  EXPECT_EQ(shapes::Mesh::COMPACT_STORAGE, compact_copy->getStorage());
+  EXPECT_EQ(shapes::Mesh::DOUBLE_STORAGE, mesh->getStorage());
+  EXPECT_EQ(3u, mesh->triangles[5]);
+  compact.reset();
+  EXPECT_EQ((float)0.001, compact_copy->compact_vertices[9]);
+  EXPECT_EQ(3u, compact_copy->compact_triangles[5]);
+}
+
+TEST(MeshClone, Move)
+{
+  shapes::Mesh mesh(4, 2);
+  for (unsigned int i = 0; i < 12; ++i)
+    mesh.vertices[i] = i;
+  const double* vertices = mesh.vertices;
+
+  shapes::Mesh moved(std::move(mesh));
+  EXPECT_EQ(shapes::MESH, moved.type);
+  EXPECT_EQ(4u, moved.vertex_count);
+  EXPECT_EQ(2u, moved.triangle_count);
+  EXPECT_EQ(vertices, moved.vertices);
+  EXPECT_EQ(0u, mesh.vertex_count);
+  EXPECT_EQ(0u, mesh.triangle_count);
+  EXPECT_TRUE(mesh.vertices == NULL);
+  EXPECT_TRUE(mesh.triangles == NULL);
+
+  // arrays assigned directly are owned by the mesh, and move with it
+  shapes::Mesh assigned;
+  assigned.vertex_count = 1;
+  assigned.vertices = new double[3]{ 1.0, 2.0, 3.0 };
+  moved = std::move(assigned);
+  EXPECT_EQ(1u, moved.vertex_count);
+  EXPECT_EQ(0u, moved.triangle_count);
+  EXPECT_EQ(3.0, moved.vertices[2]);
+  EXPECT_TRUE(assigned.vertices == NULL);
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
@@ -40,6 +40,8 @@
 #include <boost/filesystem.hpp>
 #include <gtest/gtest.h>
 #include "resources/config.h"
+#include <memory>
+#include <sstream>
 
 /**
  * Test fixture that generates meshes from the primitive shapes SPHERE, CYLINDER, CONE and BOX,
@@ -198,6 +200,102 @@ TEST_F(CompareMeshVsPrimitive, BoxTriangleCount)
   EXPECT_EQ(shape_meshes.back()->triangle_count, loaded_meshes.back()->triangle_count);
 }
 
+TEST(CompactMesh, SameBodies)
+{
+  // bodies built from the float copy of a loaded mesh match those built from the doubles it was read as
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string()));
+  ASSERT_TRUE(mesh != nullptr);
+  std::unique_ptr<shapes::Mesh> compact(static_cast<shapes::Mesh*>(mesh->clone()));
+  compact->setStorage(shapes::Mesh::COMPACT_STORAGE);
+
+  bodies::ConvexMesh convex(mesh.get());
+  bodies::ConvexMesh compact_convex(compact.get());
+  EXPECT_DOUBLE_EQ(convex.computeVolume(), compact_convex.computeVolume());
+  EXPECT_EQ(convex.getVertices().size(), compact_convex.getVertices().size());
+
+  shapes::ShapeMsg shape_msg, compact_shape_msg;
+  ASSERT_TRUE(shapes::constructMsgFromShape(mesh.get(), shape_msg));
+  ASSERT_TRUE(shapes::constructMsgFromShape(compact.get(), compact_shape_msg));
+  const shape_msgs::Mesh& msg = boost::get<shape_msgs::Mesh>(shape_msg);
+  const shape_msgs::Mesh& compact_msg = boost::get<shape_msgs::Mesh>(compact_shape_msg);
+  ASSERT_EQ(msg.vertices.size(), compact_msg.vertices.size());
+  for (std::size_t i = 0; i < msg.vertices.size(); ++i)
+  {
+    EXPECT_EQ(msg.vertices[i].x, compact_msg.vertices[i].x);
+    EXPECT_EQ(msg.vertices[i].y, compact_msg.vertices[i].y);
+    EXPECT_EQ(msg.vertices[i].z, compact_msg.vertices[i].z);
+  }
+  ASSERT_EQ(msg.triangles.size(), compact_msg.triangles.size());
+  for (std::size_t i = 0; i < msg.triangles.size(); ++i)
+    for (int k = 0; k < 3; ++k)
+      EXPECT_EQ(msg.triangles[i].vertex_indices[k], compact_msg.triangles[i].vertex_indices[k]);
+}
+
+TEST(CompactMesh, SameShapeOperations)
+{
+  // the STL file holds floats, so the compact copy has exactly the same vertices
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string()));
+  ASSERT_TRUE(mesh != nullptr);
+  std::unique_ptr<shapes::Mesh> compact(static_cast<shapes::Mesh*>(mesh->clone()));
+  compact->setStorage(shapes::Mesh::COMPACT_STORAGE);
+
+  EXPECT_EQ(shapes::computeShapeExtents(mesh.get()), shapes::computeShapeExtents(compact.get()));
+  Eigen::Vector3d center, compact_center;
+  double radius, compact_radius;
+  shapes::computeShapeBoundingSphere(mesh.get(), center, radius);
+  shapes::computeShapeBoundingSphere(compact.get(), compact_center, compact_radius);
+  EXPECT_EQ(center, compact_center);
+  EXPECT_EQ(radius, compact_radius);
+
+  std::stringstream text, compact_text;
+  shapes::saveAsText(mesh.get(), text);
+  shapes::saveAsText(compact.get(), compact_text);
+  EXPECT_EQ(text.str(), compact_text.str());
+
+  visualization_msgs::Marker marker, compact_marker;
+  ASSERT_TRUE(shapes::constructMarkerFromShape(mesh.get(), marker, true));
+  ASSERT_TRUE(shapes::constructMarkerFromShape(compact.get(), compact_marker, true));
+  ASSERT_EQ(marker.points.size(), compact_marker.points.size());
+  for (std::size_t i = 0; i < marker.points.size(); ++i)
+  {
+    EXPECT_EQ(marker.points[i].x, compact_marker.points[i].x);
+    EXPECT_EQ(marker.points[i].y, compact_marker.points[i].y);
+    EXPECT_EQ(marker.points[i].z, compact_marker.points[i].z);
+  }
+}
+
+TEST(CompactMesh, SameTriangleMesh)
+{
+  std::unique_ptr<shapes::Mesh> mesh(shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string()));
+  ASSERT_TRUE(mesh != nullptr);
+  std::unique_ptr<shapes::Mesh> compact(static_cast<shapes::Mesh*>(mesh->clone()));
+  compact->setStorage(shapes::Mesh::COMPACT_STORAGE);
+
+  std::unique_ptr<bodies::Body> body(bodies::createBodyFromShape(mesh.get(), bodies::TRIANGLES));
+  std::unique_ptr<bodies::Body> compact_body(bodies::createBodyFromShape(compact.get(), bodies::TRIANGLES));
+  EXPECT_DOUBLE_EQ(body->computeVolume(), compact_body->computeVolume());
+
+  bodies::BoundingSphere sphere;
+  body->computeBoundingSphere(sphere);
+  random_numbers::RandomNumberGenerator rng(5);
+  for (int i = 0; i < 200; ++i)
+  {
+    const Eigen::Vector3d origin(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+    const Eigen::Vector3d target = sphere.center + Eigen::Vector3d(rng.uniformReal(-0.5, 0.5) * sphere.radius,
+                                                                   rng.uniformReal(-0.5, 0.5) * sphere.radius,
+                                                                   rng.uniformReal(-0.5, 0.5) * sphere.radius);
+    EigenSTL::vector_Vector3d hits, compact_hits;
+    EXPECT_EQ(body->intersectsRay(origin, target - origin, &hits),
+              compact_body->intersectsRay(origin, target - origin, &compact_hits));
+    ASSERT_EQ(hits.size(), compact_hits.size());
+    for (std::size_t k = 0; k < hits.size(); ++k)
+      EXPECT_EQ(hits[k], compact_hits[k]);
+  }
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,169 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+#include <geometric_shapes/bodies.h>
+#include <geometric_shapes/body_operations.h>
+#include <octomap/octomap.h>
+#include <gtest/gtest.h>
+
+namespace
+{
+/** \brief A tree with resolution 0.1 whose occupied voxels fill the box [0, 0.4] x [0, 0.2] x [0, 0.2] */
+shapes::OcTree* makeBlock()
+{
+  std::shared_ptr<octomap::OcTree> tree(new octomap::OcTree(0.1));
+  for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 2; ++j)
+      for (int k = 0; k < 2; ++k)
+        tree->updateNode(0.05 + 0.1 * i, 0.05 + 0.1 * j, 0.05 + 0.1 * k, true);
+  // a free voxel next to the block does not count
+  tree->updateNode(0.45, 0.05, 0.05, false);
+  return new shapes::OcTree(tree);
+}
+}
+
+TEST(OcTreeBody, ContainsPoint)
+{
+  shapes::OcTree* shape = makeBlock();
+  bodies::Body* body = bodies::createBodyFromShape(shape);
+  ASSERT_TRUE(body != NULL);
+  EXPECT_EQ(shapes::OCTREE, body->getType());
+  EXPECT_EQ(16u, static_cast<bodies::OcTree*>(body)->getVoxelCount());
+  EXPECT_NEAR(0.016, body->computeVolume(), 1e-12);
+
+  EXPECT_TRUE(body->containsPoint(Eigen::Vector3d(0.05, 0.05, 0.05)));
+  EXPECT_TRUE(body->containsPoint(Eigen::Vector3d(0.39, 0.19, 0.19)));
+  EXPECT_FALSE(body->containsPoint(Eigen::Vector3d(0.45, 0.05, 0.05)));
+  EXPECT_FALSE(body->containsPoint(Eigen::Vector3d(-0.05, 0.05, 0.05)));
+  EXPECT_FALSE(body->containsPoint(Eigen::Vector3d(0.05, 0.25, 0.05)));
+
+  Eigen::Affine3d pose(Eigen::AngleAxisd(M_PI / 2.0, Eigen::Vector3d::UnitZ()));
+  pose.translation() = Eigen::Vector3d(1.0, 0.0, 0.0);
+  body->setPose(pose);
+  EXPECT_TRUE(body->containsPoint(Eigen::Vector3d(0.95, 0.35, 0.05)));
+  EXPECT_FALSE(body->containsPoint(Eigen::Vector3d(0.05, 0.05, 0.05)));
+
+  bodies::BoundingSphere sphere;
+  body->computeBoundingSphere(sphere);
+  EXPECT_TRUE(sphere.center.isApprox(Eigen::Vector3d(0.9, 0.2, 0.1)));
+  EXPECT_NEAR(std::sqrt(0.06), sphere.radius, 1e-9);
+
+  delete body;
+  delete shape;
+}
+
+TEST(OcTreeBody, Padding)
+{
+  shapes::OcTree* shape = makeBlock();
+  bodies::OcTree body(shape);
+  body.setPadding(0.05);
+  EXPECT_TRUE(body.containsPoint(Eigen::Vector3d(0.45, 0.05, 0.05)));
+  EXPECT_TRUE(body.containsPoint(Eigen::Vector3d(-0.05, -0.05, 0.05)));
+  // padding is applied in whole voxels; corners stay within the padding distance
+  EXPECT_FALSE(body.containsPoint(Eigen::Vector3d(-0.15, 0.05, 0.05)));
+  EXPECT_FALSE(body.containsPoint(Eigen::Vector3d(0.05, 0.05, -0.15)));
+
+  bodies::BodyPtr clone = body.cloneAt(Eigen::Affine3d::Identity(), 0.0, 1.0);
+  EXPECT_FALSE(clone->containsPoint(Eigen::Vector3d(0.45, 0.05, 0.05)));
+  EXPECT_EQ(16u, static_cast<bodies::OcTree*>(clone.get())->getVoxelCount());
+  delete shape;
+}
+
+TEST(OcTreeBody, IntersectsRay)
+{
+  shapes::OcTree* shape = makeBlock();
+  bodies::OcTree body(shape);
+  EigenSTL::vector_Vector3d intersections;
+
+  ASSERT_TRUE(body.intersectsRay(Eigen::Vector3d(-1.0, 0.05, 0.05), Eigen::Vector3d::UnitX(), &intersections, 2));
+  ASSERT_EQ(2u, intersections.size());
+  EXPECT_TRUE(intersections[0].isApprox(Eigen::Vector3d(0.0, 0.05, 0.05)));
+  EXPECT_TRUE(intersections[1].isApprox(Eigen::Vector3d(0.4, 0.05, 0.05)));
+
+  intersections.clear();
+  ASSERT_TRUE(body.intersectsRay(Eigen::Vector3d(-1.0, 0.05, 0.05), Eigen::Vector3d::UnitX(), &intersections, 1));
+  ASSERT_EQ(1u, intersections.size());
+  EXPECT_TRUE(intersections[0].isApprox(Eigen::Vector3d(0.0, 0.05, 0.05)));
+
+  intersections.clear();
+  ASSERT_TRUE(body.intersectsRay(Eigen::Vector3d(0.05, 0.05, 0.05), Eigen::Vector3d::UnitX(), &intersections, 2));
+  ASSERT_EQ(1u, intersections.size());
+  EXPECT_TRUE(intersections[0].isApprox(Eigen::Vector3d(0.4, 0.05, 0.05)));
+
+  intersections.clear();
+  const Eigen::Vector3d dir = Eigen::Vector3d(1.0, 1.0, 1.0).normalized();
+  ASSERT_TRUE(body.intersectsRay(Eigen::Vector3d(0.25, 0.05, 0.05) - dir, dir, &intersections, 1));
+  EXPECT_TRUE(body.containsPoint(intersections[0] + 1e-6 * dir));
+  EXPECT_FALSE(body.containsPoint(intersections[0] - 1e-6 * dir));
+
+  EXPECT_FALSE(body.intersectsRay(Eigen::Vector3d(-1.0, 0.05, 0.05), -Eigen::Vector3d::UnitX()));
+  EXPECT_FALSE(body.intersectsRay(Eigen::Vector3d(-1.0, 0.25, 0.05), Eigen::Vector3d::UnitX()));
+
+  // scaling keeps the ray parameter in world units
+  body.setScale(2.0);
+  intersections.clear();
+  ASSERT_TRUE(body.intersectsRay(Eigen::Vector3d(-1.0, 0.1, 0.1), Eigen::Vector3d::UnitX(), &intersections, 1));
+  EXPECT_TRUE(intersections[0].isApprox(Eigen::Vector3d(-0.2, 0.1, 0.1)));
+  delete shape;
+}
+
+TEST(OcTreeBody, SignedDistance)
+{
+  shapes::OcTree* shape = makeBlock();
+  bodies::OcTree body(shape);
+  EXPECT_NEAR(0.5, body.computeSignedDistance(Eigen::Vector3d(0.9, 0.1, 0.1)), 1e-9);
+  EXPECT_NEAR(-0.05, body.computeSignedDistance(Eigen::Vector3d(0.15, 0.05, 0.05)), 1e-9);
+  const Eigen::Vector3d support = body.computeSupportPoint(Eigen::Vector3d(1.0, 1.0, 1.0));
+  EXPECT_TRUE(support.isApprox(Eigen::Vector3d(0.4, 0.2, 0.2)));
+  delete shape;
+}
+
+TEST(OcTreeBody, BodyVector)
+{
+  shapes::OcTree* shape = makeBlock();
+  bodies::BodyVector bodies;
+  Eigen::Affine3d pose = Eigen::Affine3d::Identity();
+  pose.translation() = Eigen::Vector3d(0.0, 0.0, 1.0);
+  bodies.addBody(shape, pose, 0.0);
+  std::size_t index;
+  EXPECT_TRUE(bodies.containsPoint(Eigen::Vector3d(0.05, 0.05, 1.05), index));
+  EXPECT_EQ(0u, index);
+  EXPECT_FALSE(bodies.containsPoint(Eigen::Vector3d(0.05, 0.05, 0.05), index));
+  delete shape;
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,178 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+
+#include <geometric_shapes/point_cloud_filter.h>
+#include <geometric_shapes/mesh_operations.h>
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include "resources/config.h"
+
+namespace
+{
+void makeBodies(bodies::BodyVector& bodies)
+{
+  Eigen::Affine3d pose(Eigen::AngleAxisd(0.3, Eigen::Vector3d(1.0, 1.0, 0.0).normalized()));
+  pose.translation() = Eigen::Vector3d(0.5, 0.0, 0.0);
+  shapes::Box box(1.0, 0.8, 0.6);
+  bodies.addBody(&box, pose);
+
+  pose.translation() = Eigen::Vector3d(0.0, 0.4, 0.2);
+  shapes::Sphere sphere(0.5);
+  bodies.addBody(&sphere, pose);
+
+  pose.translation() = Eigen::Vector3d(-0.5, -0.3, 0.0);
+  shapes::Cylinder cylinder(0.3, 1.2);
+  bodies.addBody(&cylinder, pose);
+
+  shapes::Mesh* mesh = shapes::createMeshFromResource("file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) /
+                                                                   "/forearm_roll.stl").string());
+  ASSERT_TRUE(mesh != NULL);
+  pose.translation() = Eigen::Vector3d(0.0, -0.5, -0.2);
+  bodies.addBody(mesh, pose, 0.05);
+  delete mesh;
+}
+
+void checkAgainstBodyVector(const bodies::BodyVector& bodies, const EigenSTL::vector_Vector3d& points,
+                            const std::vector<uint8_t>& labels, const std::vector<std::size_t>& indices)
+{
+  ASSERT_EQ(points.size(), labels.size());
+  ASSERT_EQ(points.size(), indices.size());
+  for (std::size_t i = 0; i < points.size(); ++i)
+  {
+    std::size_t index;
+    if (bodies.containsPoint(points[i], index))
+    {
+      EXPECT_EQ(bodies::PointCloudFilter::INSIDE, labels[i]);
+      EXPECT_EQ(index, indices[i]);
+    }
+    else
+    {
+      EXPECT_EQ(bodies::PointCloudFilter::OUTSIDE, labels[i]);
+      EXPECT_EQ(bodies::PointCloudFilter::NO_BODY, indices[i]);
+    }
+  }
+}
+}
+
+TEST(PointCloudFilter, MatchesBodyVector)
+{
+  bodies::BodyVector bodies;
+  makeBodies(bodies);
+
+  random_numbers::RandomNumberGenerator rng(3);
+  EigenSTL::vector_Vector3d points(50000);
+  for (std::size_t i = 0; i < points.size(); ++i)
+    points[i] = Eigen::Vector3d(rng.uniformReal(-1.5, 1.5), rng.uniformReal(-1.5, 1.5), rng.uniformReal(-1.5, 1.5));
+
+  const unsigned int thread_counts[] = { 1, 2, 5 };
+  const std::size_t chunk_sizes[] = { 1, 100, 1024, 100000 };
+  for (int use_bvh = 0; use_bvh < 2; ++use_bvh)
+  {
+    bodies.setUseBoundingVolumeHierarchy(use_bvh);
+    for (unsigned int t = 0; t < 3; ++t)
+    {
+      bodies::PointCloudFilter filter(thread_counts[t]);
+      EXPECT_EQ(thread_counts[t], filter.getThreadCount());
+      for (unsigned int c = 0; c < 4; ++c)
+      {
+        filter.setChunkSize(chunk_sizes[c]);
+        std::vector<uint8_t> labels;
+        std::vector<std::size_t> indices;
+        filter.filter(bodies, points, labels, indices);
+        checkAgainstBodyVector(bodies, points, labels, indices);
+
+        const bodies::PointCloudFilter::Statistics& stats = filter.getLastStatistics();
+        EXPECT_EQ(points.size(), stats.points);
+        EXPECT_EQ((std::size_t)std::count(labels.begin(), labels.end(), bodies::PointCloudFilter::INSIDE),
+                  stats.inside);
+        EXPECT_GT(stats.inside, 0u);
+        EXPECT_LT(stats.inside, points.size());
+      }
+    }
+  }
+}
+
+TEST(PointCloudFilter, FloatPointsWithStride)
+{
+  bodies::BodyVector bodies;
+  makeBodies(bodies);
+
+  // x, y, z followed by an unused field, as in many point cloud layouts
+  random_numbers::RandomNumberGenerator rng(5);
+  const std::size_t n = 10007;
+  std::vector<float> data(4 * n);
+  EigenSTL::vector_Vector3d points(n);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    for (int k = 0; k < 3; ++k)
+      data[4 * i + k] = rng.uniformReal(-1.5, 1.5);
+    data[4 * i + 3] = 1.0f;
+    points[i] = Eigen::Vector3d(data[4 * i], data[4 * i + 1], data[4 * i + 2]);
+  }
+
+  bodies::PointCloudFilter filter(3);
+  std::vector<uint8_t> labels(n);
+  std::vector<std::size_t> indices(n);
+  filter.filter(bodies, &data[0], 4, n, &labels[0], &indices[0]);
+  checkAgainstBodyVector(bodies, points, labels, indices);
+
+  // the indices are optional
+  std::vector<uint8_t> labels_only(n);
+  filter.filter(bodies, &data[0], 4, n, &labels_only[0]);
+  EXPECT_TRUE(labels == labels_only);
+}
+
+TEST(PointCloudFilter, EmptyInput)
+{
+  bodies::PointCloudFilter filter(2);
+  EigenSTL::vector_Vector3d points;
+  std::vector<uint8_t> labels(3);
+  std::vector<std::size_t> indices(3);
+
+  bodies::BodyVector empty;
+  filter.filter(empty, points, labels, indices);
+  EXPECT_TRUE(labels.empty());
+  EXPECT_TRUE(indices.empty());
+
+  points.push_back(Eigen::Vector3d(0.0, 0.0, 0.0));
+  filter.filter(empty, points, labels, indices);
+  EXPECT_EQ(bodies::PointCloudFilter::OUTSIDE, labels[0]);
+  EXPECT_EQ(bodies::PointCloudFilter::NO_BODY, indices[0]);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
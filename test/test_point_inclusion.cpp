@@ -37,10 +37,101 @@
 #include <geometric_shapes/bodies.h>
 #include <geometric_shapes/shape_operations.h>
 #include <geometric_shapes/body_operations.h>
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <gtest/gtest.h>
 #include "resources/config.h"
 
+namespace
+{
+/** \brief Check that the batched containment test of \e body agrees with containsPoint() on random points
+    around the body */
+void checkBatchedContainment(const bodies::Body* body, unsigned int n)
+{
+  random_numbers::RandomNumberGenerator r;
+  bodies::BoundingSphere bs;
+  body->computeBoundingSphere(bs);
+
+  std::vector<double> xs(n), ys(n), zs(n);
+  for (unsigned int i = 0; i < n; ++i)
+  {
+    xs[i] = r.uniformReal(bs.center.x() - bs.radius, bs.center.x() + bs.radius);
+    ys[i] = r.uniformReal(bs.center.y() - bs.radius, bs.center.y() + bs.radius);
+    zs[i] = r.uniformReal(bs.center.z() - bs.radius, bs.center.z() + bs.radius);
+  }
+
+  std::vector<uint8_t> mask(n, 2);
+  body->containsPoints(&xs[0], &ys[0], &zs[0], n, &mask[0]);
+
+  Eigen::Matrix3Xd points(3, n);
+  for (unsigned int i = 0; i < n; ++i)
+    points.col(i) = Eigen::Vector3d(xs[i], ys[i], zs[i]);
+  std::vector<uint8_t> matrix_mask(n, 2);
+  body->containsPoints(points, &matrix_mask[0]);
+
+  unsigned int inside = 0;
+  for (unsigned int i = 0; i < n; ++i)
+  {
+    const bool expected = body->containsPoint(xs[i], ys[i], zs[i]);
+    EXPECT_EQ(expected ? 1 : 0, mask[i]) << "point " << i;
+    EXPECT_EQ(mask[i], matrix_mask[i]) << "point " << i;
+    inside += expected;
+  }
+  EXPECT_GT(inside, 0u);
+  EXPECT_LT(inside, n);
+}
+
+/** \brief Compare Body::intersectsRays() on \e body with the single ray intersectsRay() of \e reference,
+    which is the same body placed at \e to_reference * pose. Rays start outside of the bounding sphere
+    and, if \e inside_origins is set, also near the center of the body. */
+void checkBatchedRays(const bodies::Body* body, const bodies::Body* reference, const Eigen::Affine3d& to_reference,
+                      unsigned int n, bool inside_origins)
+{
+  bodies::BoundingSphere sphere;
+  body->computeBoundingSphere(sphere);
+
+  random_numbers::RandomNumberGenerator rng(17);
+  EigenSTL::vector_Vector3d origins(n), dirs(n);
+  for (unsigned int i = 0; i < n; ++i)
+  {
+    Eigen::Vector3d target(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+    target = sphere.center + target * sphere.radius;
+    if (inside_origins && i % 4 == 0)
+    {
+      origins[i] = sphere.center + 0.01 * (target - sphere.center);
+      dirs[i] = (target - origins[i]).normalized();
+    }
+    else
+    {
+      Eigen::Vector3d offset(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+      origins[i] = sphere.center + 2.0 * sphere.radius * offset.normalized();
+      dirs[i] = (target - origins[i]).normalized();
+    }
+  }
+
+  std::vector<double> t(n, -1.0);
+  body->intersectsRays(&origins[0], &dirs[0], n, &t[0]);
+
+  unsigned int hits = 0;
+  for (unsigned int i = 0; i < n; ++i)
+  {
+    const Eigen::Vector3d o = to_reference * origins[i];
+    const Eigen::Vector3d d = to_reference.linear() * dirs[i];
+    EigenSTL::vector_Vector3d pts;
+    if (reference->intersectsRay(o, d, &pts, 1))
+    {
+      ASSERT_EQ(1u, pts.size());
+      EXPECT_NEAR((pts[0] - o).dot(d), t[i], 1e-5) << "ray " << i;
+      ++hits;
+    }
+    else
+      EXPECT_TRUE(std::isinf(t[i])) << "ray " << i << " t " << t[i];
+  }
+  EXPECT_GT(hits, 0u);
+  EXPECT_LT(hits, n);
+}
+}
+
 TEST(SpherePointContainment, SimpleInside)
 {
   shapes::Sphere shape(1.0);
@@ -93,6 +184,20 @@ TEST(SpherePointContainment, ComplexOutside)
   EXPECT_FALSE(contains);
 }
 
+TEST(SpherePointContainment, Batched)
+{
+  shapes::Sphere shape(1.0);
+  bodies::Body* sphere = new bodies::Sphere(&shape);
+  sphere->setScale(0.95);
+  sphere->setPadding(0.1);
+  Eigen::Affine3d pose;
+  pose.setIdentity();
+  pose.translation() = Eigen::Vector3d(1.0, -1.0, 2.0);
+  sphere->setPose(pose);
+  checkBatchedContainment(sphere, 1003);
+  delete sphere;
+}
+
 TEST(SphereRayIntersection, SimpleRay1)
 {
   shapes::Sphere shape(1.0);
@@ -127,6 +232,19 @@ TEST(SphereRayIntersection, SimpleRay2)
   EXPECT_EQ(0, (int)p.size());
 }
 
+TEST(SphereRayIntersection, Batched)
+{
+  shapes::Sphere shape(1.0);
+  bodies::Body* sphere = new bodies::Sphere(&shape);
+  sphere->setScale(0.95);
+  sphere->setPadding(0.1);
+  Eigen::Affine3d pose(Eigen::Affine3d::Identity());
+  pose.translation() = Eigen::Vector3d(1.0, -1.0, 2.0);
+  sphere->setPose(pose);
+  checkBatchedRays(sphere, sphere, Eigen::Affine3d::Identity(), 1003, true);
+  delete sphere;
+}
+
 TEST(BoxPointContainment, SimpleInside)
 {
   shapes::Box shape(1.0, 2.0, 3.0);
@@ -190,6 +308,19 @@ TEST(BoxPointContainment, ComplexOutside)
   EXPECT_FALSE(contains);
 }
 
+TEST(BoxPointContainment, Batched)
+{
+  shapes::Box shape(1.0, 2.0, 3.0);
+  bodies::Body* box = new bodies::Box(&shape);
+  box->setScale(1.01);
+  box->setPadding(0.05);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(M_PI / 3.0, Eigen::Vector3d(1.0, 1.0, 0.0).normalized()));
+  pose.translation() = Eigen::Vector3d(1.0, 1.0, 1.0);
+  box->setPose(pose);
+  checkBatchedContainment(box, 1003);
+  delete box;
+}
+
 TEST(BoxRayIntersection, SimpleRay1)
 {
   shapes::Box shape(1.0, 1.0, 3.0);
@@ -253,6 +384,23 @@ TEST(BoxRayIntersection, SimpleRay3)
   delete box;
 }
 
+TEST(BoxRayIntersection, Batched)
+{
+  // compare a rotated box with itself and with an axis aligned one hit by the transformed rays
+  shapes::Box shape(1.0, 2.0, 3.0);
+  bodies::Body* box = new bodies::Box(&shape);
+  box->setPadding(0.1);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(0.7, Eigen::Vector3d(1.0, 2.0, 3.0).normalized()));
+  pose.translation() = Eigen::Vector3d(1.0, -1.0, 2.0);
+  box->setPose(pose);
+  bodies::Body* reference = new bodies::Box(&shape);
+  reference->setPadding(0.1);
+  checkBatchedRays(box, reference, pose.inverse(), 1003, false);
+  checkBatchedRays(box, box, Eigen::Affine3d::Identity(), 1003, true);
+  delete box;
+  delete reference;
+}
+
 TEST(CylinderPointContainment, SimpleInside)
 {
   shapes::Cylinder shape(1.0, 4.0);
@@ -297,6 +445,53 @@ TEST(CylinderPointContainment, CylinderPadding)
   delete cylinder;
 }
 
+TEST(CylinderPointContainment, Sampling)
+{
+  shapes::Cylinder shape(1.0, 4.0);
+  bodies::Cylinder cylinder(&shape);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(0.7, Eigen::Vector3d(1.0, 2.0, 3.0).normalized()));
+  pose.translation() = Eigen::Vector3d(3.0, -1.0, 2.0);
+  cylinder.setPose(pose);
+
+  random_numbers::RandomNumberGenerator r(3);
+  EigenSTL::vector_Vector3d points(10000);
+  ASSERT_EQ(points.size(), cylinder.samplePointsInside(r, points.size(), &points[0]));
+  unsigned int inner = 0;
+  for (std::size_t i = 0; i < points.size(); ++i)
+  {
+    EXPECT_TRUE(cylinder.containsPoint(points[i]));
+    if ((pose.inverse() * points[i]).head<2>().norm() < 0.5)
+      ++inner;
+  }
+  // a quarter of the area of the disc is within half the radius
+  EXPECT_NEAR(0.25, inner / (double)points.size(), 0.02);
+}
+
+TEST(CylinderPointContainment, Batched)
+{
+  shapes::Cylinder shape(1.0, 4.0);
+  bodies::Body* cylinder = new bodies::Cylinder(&shape);
+  cylinder->setPadding(0.02);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(M_PI / 5.0, Eigen::Vector3d::UnitY()));
+  pose.translation() = Eigen::Vector3d(-1.0, 0.5, 0.0);
+  cylinder->setPose(pose);
+  checkBatchedContainment(cylinder, 1003);
+  delete cylinder;
+}
+
+TEST(CylinderRayIntersection, Batched)
+{
+  shapes::Cylinder shape(0.5, 2.0);
+  bodies::Body* cylinder = new bodies::Cylinder(&shape);
+  cylinder->setScale(1.1);
+  cylinder->setPadding(0.05);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(0.7, Eigen::Vector3d(1.0, 2.0, 3.0).normalized()));
+  pose.translation() = Eigen::Vector3d(1.0, -1.0, 2.0);
+  cylinder->setPose(pose);
+  checkBatchedRays(cylinder, cylinder, Eigen::Affine3d::Identity(), 1003, true);
+  delete cylinder;
+}
+
 TEST(MeshPointContainment, Pr2Forearm)
 {
   shapes::Mesh* ms = shapes::createMeshFromResource(
@@ -325,6 +520,544 @@ TEST(MeshPointContainment, Pr2Forearm)
   delete ms;
 }
 
+TEST(MeshPointContainment, Sampling)
+{
+  shapes::Mesh* ms = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  ASSERT_TRUE(ms != NULL);
+  bodies::ConvexMesh m(ms);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(M_PI / 4.0, Eigen::Vector3d::UnitZ()));
+  pose.translation() = Eigen::Vector3d(0.3, 0.0, -0.2);
+  m.setPose(pose);
+
+  random_numbers::RandomNumberGenerator r(5);
+  EigenSTL::vector_Vector3d points(1000);
+  ASSERT_EQ(points.size(), m.samplePointsInside(r, points.size(), &points[0]));
+  for (std::size_t i = 0; i < points.size(); ++i)
+    EXPECT_TRUE(m.containsPoint(points[i]));
+
+  m.setScale(1.1);
+  m.setPadding(0.01);
+  ASSERT_EQ(points.size(), m.samplePointsInside(r, points.size(), &points[0]));
+  for (std::size_t i = 0; i < points.size(); ++i)
+    EXPECT_TRUE(m.containsPoint(points[i]));
+  delete ms;
+}
+
+TEST(MeshPointContainment, CoplanarFacets)
+{
+  // the triangles of each face of the box share one plane
+  shapes::Mesh* box_mesh = shapes::createMeshFromShape(shapes::Box(0.2, 0.3, 0.4));
+  bodies::ConvexMesh box(box_mesh);
+  EXPECT_EQ(6u, box.getPlanes().size());
+  EXPECT_EQ(12u, box.getTriangles().size() / 3);
+
+  // the caps of the cylinder mesh are fans of triangles; each side is a rectangle
+  shapes::Mesh* cylinder_mesh = shapes::createMeshFromShape(shapes::Cylinder(0.1, 0.5));
+  bodies::ConvexMesh cylinder(cylinder_mesh);
+  EXPECT_GT(cylinder.getPlanes().size(), 2u);
+  EXPECT_LT(cylinder.getPlanes().size(), cylinder.getTriangles().size() / 3);
+
+  random_numbers::RandomNumberGenerator r(7);
+  for (int i = 0; i < 1000; ++i)
+  {
+    const Eigen::Vector3d p(r.uniformReal(-0.12, 0.12), r.uniformReal(-0.17, 0.17), r.uniformReal(-0.22, 0.22));
+    if (std::fabs(std::fabs(p.x()) - 0.1) > 1e-5 && std::fabs(std::fabs(p.y()) - 0.15) > 1e-5 &&
+        std::fabs(std::fabs(p.z()) - 0.2) > 1e-5)
+    {
+      EXPECT_EQ(std::fabs(p.x()) < 0.1 && std::fabs(p.y()) < 0.15 && std::fabs(p.z()) < 0.2, box.containsPoint(p));
+    }
+  }
+
+  // the merged planes still support the hull: every vertex is behind them and some vertex is on them
+  for (std::size_t i = 0; i < cylinder.getPlanes().size(); ++i)
+  {
+    const Eigen::Vector4d& plane = cylinder.getPlanes()[i];
+    double support = -std::numeric_limits<double>::infinity();
+    for (std::size_t j = 0; j < cylinder.getVertices().size(); ++j)
+      support = std::max(support, plane.head<3>().dot(cylinder.getVertices()[j]) + plane.w());
+    EXPECT_NEAR(0.0, support, 1e-12);
+  }
+
+  // qhull lists the two triangles of some faces of this cube apart from each other
+  shapes::Mesh* cube_mesh = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/cube.stl").string());
+  ASSERT_TRUE(cube_mesh != NULL);
+  bodies::ConvexMesh cube(cube_mesh);
+  EXPECT_EQ(6u, cube.getPlanes().size());
+  delete box_mesh;
+  delete cylinder_mesh;
+  delete cube_mesh;
+}
+
+TEST(MeshPointContainment, PlaneBudget)
+{
+  shapes::Mesh* ms = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  ASSERT_TRUE(ms != NULL);
+  bodies::ConvexMesh exact(ms);
+  bodies::ConvexMesh approximate(ms, 24);
+  EXPECT_EQ(0.0, exact.getApproximationError());
+  ASSERT_GT(exact.getPlanes().size(), 24u);
+  EXPECT_LE(approximate.getPlanes().size(), 24u);
+  EXPECT_GT(approximate.getApproximationError(), 0.0);
+  EXPECT_LT(approximate.getApproximationError(), 0.01);
+
+  // the approximation contains the hull
+  for (std::size_t i = 0; i < exact.getVertices().size(); ++i)
+  {
+    const Eigen::Vector3d& v = exact.getVertices()[i];
+    for (std::size_t j = 0; j < approximate.getPlanes().size(); ++j)
+      EXPECT_LE(approximate.getPlanes()[j].head<3>().dot(v) + approximate.getPlanes()[j].w(), 1e-9);
+  }
+
+  // and is nowhere farther from it than the reported error
+  random_numbers::RandomNumberGenerator r(11);
+  EigenSTL::vector_Vector3d points(1000);
+  ASSERT_EQ(points.size(), approximate.samplePointsInside(r, points.size(), &points[0]));
+  for (std::size_t i = 0; i < points.size(); ++i)
+    EXPECT_LE(exact.computeSignedDistance(points[i]), approximate.getApproximationError() + 1e-9);
+
+  // clones keep the approximation
+  bodies::BodyPtr clone = approximate.cloneAt(Eigen::Affine3d::Identity(), 0.0, 1.0);
+  EXPECT_EQ(approximate.getPlanes().size(), static_cast<bodies::ConvexMesh*>(clone.get())->getPlanes().size());
+  delete ms;
+}
+
+TEST(MeshPointContainment, AdaptivePlaneOrder)
+{
+  shapes::Mesh* ms = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  ASSERT_TRUE(ms != NULL);
+  bodies::ConvexMesh fixed(ms);
+  bodies::ConvexMesh adaptive(ms);
+  adaptive.setAdaptivePlaneOrder(true, 256);
+  EXPECT_TRUE(adaptive.getAdaptivePlaneOrder());
+  EXPECT_EQ(fixed.getPlaneOrder(), adaptive.getPlaneOrder());
+
+  // points that all come from the +x side of the hull
+  bodies::BoundingSphere sphere;
+  fixed.computeBoundingSphere(sphere);
+  random_numbers::RandomNumberGenerator r(5);
+  const std::size_t n = 20000;
+  std::vector<double> xs(n), ys(n), zs(n);
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    xs[i] = sphere.center.x() + r.uniformReal(0.0, sphere.radius);
+    ys[i] = sphere.center.y() + r.uniformReal(-sphere.radius, sphere.radius);
+    zs[i] = sphere.center.z() + r.uniformReal(-sphere.radius, sphere.radius);
+  }
+
+  // the order changes what is tested first, never the result
+  std::vector<uint8_t> expected(n), mask(n);
+  fixed.containsPoints(&xs[0], &ys[0], &zs[0], n, &expected[0]);
+  for (std::size_t i = 0; i < n; ++i)
+    EXPECT_EQ(expected[i] != 0, adaptive.containsPoint(Eigen::Vector3d(xs[i], ys[i], zs[i])));
+  adaptive.containsPoints(&xs[0], &ys[0], &zs[0], n, &mask[0]);
+  EXPECT_EQ(expected, mask);
+
+  // the planes that reject these points come first
+  std::vector<unsigned int> order = adaptive.getPlaneOrder();
+  ASSERT_EQ(adaptive.getPlanes().size(), order.size());
+  const EigenSTL::vector_Vector4d& planes = adaptive.getPlanes();
+  std::size_t tested_before = 0, tested_after = 0;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    const Eigen::Vector3d p(xs[i], ys[i], zs[i]);
+    for (std::size_t j = 0; j < planes.size(); ++j)
+      if (planes[j].head<3>().dot(p) + planes[j].w() > 1e-6)
+      {
+        tested_before += j + 1;
+        break;
+      }
+    for (std::size_t j = 0; j < planes.size(); ++j)
+      if (planes[order[j]].head<3>().dot(p) + planes[order[j]].w() > 1e-6)
+      {
+        tested_after += j + 1;
+        break;
+      }
+  }
+  EXPECT_LT(tested_after * 2, tested_before);
+  std::vector<unsigned int> sorted(order);
+  std::sort(sorted.begin(), sorted.end());
+  EXPECT_EQ(fixed.getPlaneOrder(), sorted);
+
+  // clones start from the learned order
+  bodies::BodyPtr clone = adaptive.cloneAt(Eigen::Affine3d::Identity(), 0.0, 1.0);
+  EXPECT_EQ(order, static_cast<bodies::ConvexMesh*>(clone.get())->getPlaneOrder());
+
+  adaptive.setAdaptivePlaneOrder(false);
+  EXPECT_EQ(fixed.getPlaneOrder(), adaptive.getPlaneOrder());
+  delete ms;
+}
+
+TEST(MeshPointContainment, DiagonalBoundingVolumes)
+{
+  // a long box modelled diagonally in the frame of its mesh
+  shapes::Mesh* ms = shapes::createMeshFromShape(shapes::Box(0.2, 0.2, 2.0));
+  const Eigen::Matrix3d rotation =
+      (Eigen::AngleAxisd(0.6, Eigen::Vector3d::UnitZ()) * Eigen::AngleAxisd(0.8, Eigen::Vector3d::UnitY()))
+          .toRotationMatrix();
+  for (unsigned int i = 0; i < ms->vertex_count; ++i)
+  {
+    const Eigen::Vector3d v =
+        rotation * Eigen::Vector3d(ms->vertices[3 * i], ms->vertices[3 * i + 1], ms->vertices[3 * i + 2]);
+    ms->vertices[3 * i] = v.x();
+    ms->vertices[3 * i + 1] = v.y();
+    ms->vertices[3 * i + 2] = v.z();
+  }
+  bodies::ConvexMesh m(ms);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(M_PI / 4.0, Eigen::Vector3d::UnitX()));
+  pose.translation() = Eigen::Vector3d(0.3, 0.0, -0.2);
+  m.setPose(pose);
+
+  // the cylinder follows the long side of the box instead of an axis of the frame
+  bodies::BoundingCylinder cylinder;
+  m.computeBoundingCylinder(cylinder);
+  EXPECT_NEAR(2.0, cylinder.length, 1e-6);
+  EXPECT_NEAR(sqrt(0.02), cylinder.radius, 1e-6);
+  EXPECT_NEAR(1.0, std::fabs(cylinder.pose.linear().col(2).dot(pose.linear() * rotation.col(2))), 1e-6);
+  EXPECT_NEAR(0.0, (cylinder.pose.translation() - pose.translation()).norm(), 1e-6);
+
+  // containment, which rejects points with the oriented bounding box first, matches the box
+  random_numbers::RandomNumberGenerator r(3);
+  unsigned int inside = 0;
+  for (int i = 0; i < 10000; ++i)
+  {
+    const Eigen::Vector3d local(r.uniformReal(-0.15, 0.15), r.uniformReal(-0.15, 0.15), r.uniformReal(-1.1, 1.1));
+    const bool expected = std::fabs(local.x()) < 0.1 && std::fabs(local.y()) < 0.1 && std::fabs(local.z()) < 1.0;
+    const Eigen::Vector3d p = pose * (rotation * local);
+    if (std::fabs(std::fabs(local.x()) - 0.1) > 1e-5 && std::fabs(std::fabs(local.y()) - 0.1) > 1e-5 &&
+        std::fabs(std::fabs(local.z()) - 1.0) > 1e-5)
+    {
+      EXPECT_EQ(expected, m.containsPoint(p)) << local.transpose();
+    }
+    inside += expected;
+  }
+  EXPECT_GT(inside, 0u);
+
+  // scaling and padding grow the cylinder around the scaled and padded vertices
+  m.setScale(1.5);
+  m.setPadding(0.1);
+  m.computeBoundingCylinder(cylinder);
+  EXPECT_NEAR(3.2, cylinder.length, 1e-6);
+  EXPECT_NEAR(1.5 * sqrt(0.02) + 0.1, cylinder.radius, 1e-6);
+  checkBatchedContainment(&m, 1003);
+  delete ms;
+}
+
+TEST(MeshPointContainment, Batched)
+{
+  shapes::Mesh* ms = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  ASSERT_TRUE(ms != NULL);
+  bodies::Body* m = new bodies::ConvexMesh(ms);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(M_PI / 4.0, Eigen::Vector3d::UnitZ()));
+  pose.translation() = Eigen::Vector3d(0.3, 0.0, -0.2);
+  m->setPose(pose);
+  m->setScale(1.1);
+  m->setPadding(0.01);
+  checkBatchedContainment(m, 1003);
+  delete m;
+  delete ms;
+}
+
+TEST(MeshRayIntersection, Batched)
+{
+  shapes::Mesh* ms = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  ASSERT_TRUE(ms != NULL);
+  bodies::Body* m = new bodies::ConvexMesh(ms);
+  checkBatchedRays(m, m, Eigen::Affine3d::Identity(), 1003, true);
+
+  // with a pose, scaling and padding, hits are on the surface that containsPoint() uses
+  Eigen::Affine3d pose(Eigen::AngleAxisd(M_PI / 4.0, Eigen::Vector3d::UnitZ()));
+  pose.translation() = Eigen::Vector3d(0.3, 0.0, -0.2);
+  m->setPose(pose);
+  m->setScale(1.1);
+  m->setPadding(0.01);
+  random_numbers::RandomNumberGenerator rng(5);
+  bodies::BoundingSphere sphere;
+  m->computeBoundingSphere(sphere);
+  unsigned int hits = 0;
+  for (int i = 0; i < 200; ++i)
+  {
+    Eigen::Vector3d o(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0));
+    o = sphere.center + 2.0 * sphere.radius * o.normalized();
+    Eigen::Vector3d d = (sphere.center - o).normalized();
+    double t;
+    m->intersectsRays(&o, &d, 1, &t);
+    ASSERT_FALSE(std::isinf(t));
+    EXPECT_FALSE(m->containsPoint(o + (t - 1e-4) * d));
+    EXPECT_TRUE(m->containsPoint(o + (t + 1e-4) * d));
+
+    // the single ray version reports where the ray enters and leaves that surface
+    EigenSTL::vector_Vector3d pts;
+    ASSERT_TRUE(m->intersectsRay(o, d, &pts));
+    ASSERT_EQ(2u, pts.size());
+    EXPECT_NEAR(t, (pts[0] - o).dot(d), 1e-9);
+    EXPECT_TRUE(m->containsPoint(pts[1] - 1e-4 * d));
+    EXPECT_FALSE(m->containsPoint(pts[1] + 1e-4 * d));
+    ++hits;
+  }
+  EXPECT_EQ(200u, hits);
+  checkBatchedRays(m, m, Eigen::Affine3d::Identity(), 1003, true);
+  delete m;
+  delete ms;
+}
+
+TEST(MeshPointContainment, PoseUpdate)
+{
+  shapes::Mesh* ms = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  ASSERT_TRUE(ms != NULL);
+  bodies::ConvexMesh* m = new bodies::ConvexMesh(ms);
+  m->setScale(1.1);
+  m->setPadding(0.01);
+  const Eigen::Vector3d* scaled = &m->getScaledVertices()[0];
+
+  random_numbers::RandomNumberGenerator rng(3);
+  for (int i = 0; i < 10; ++i)
+  {
+    Eigen::Affine3d pose(Eigen::AngleAxisd(rng.uniformReal(-M_PI, M_PI), Eigen::Vector3d(1.0, 2.0, 3.0).normalized()));
+    pose.translation() = Eigen::Vector3d(rng.uniformReal(-1.0, 1.0), rng.uniformReal(-1.0, 1.0), 0.0);
+    m->setPose(pose);
+    // moving the body does not recompute the scaled vertices
+    EXPECT_EQ(scaled, &m->getScaledVertices()[0]);
+
+    bodies::BodyPtr fresh = m->cloneAt(pose, m->getPadding(), m->getScale());
+    bodies::BoundingSphere s1, s2;
+    m->computeBoundingSphere(s1);
+    fresh->computeBoundingSphere(s2);
+    EXPECT_TRUE(s1.center.isApprox(s2.center));
+    EXPECT_EQ(s1.radius, s2.radius);
+    for (int j = 0; j < 100; ++j)
+    {
+      Eigen::Vector3d p = s1.center + s1.radius * Eigen::Vector3d(rng.uniformReal(-1.0, 1.0),
+                                                                   rng.uniformReal(-1.0, 1.0),
+                                                                   rng.uniformReal(-1.0, 1.0));
+      EXPECT_EQ(fresh->containsPoint(p), m->containsPoint(p));
+    }
+  }
+  delete m;
+  delete ms;
+}
+
+TEST(SignedDistance, Primitives)
+{
+  shapes::Box box_shape(1.0, 2.0, 3.0);
+  bodies::Box box(&box_shape);
+  EXPECT_NEAR(1.5, box.computeSignedDistance(Eigen::Vector3d(2.0, 0.0, 0.0)), 1e-12);
+  EXPECT_NEAR(-0.5, box.computeSignedDistance(Eigen::Vector3d(0.0, 0.0, 0.0)), 1e-12);
+  EXPECT_NEAR(sqrt(1.25), box.computeSignedDistance(Eigen::Vector3d(1.5, 1.5, 0.0)), 1e-12);
+
+  shapes::Cylinder cylinder_shape(1.0, 2.0);
+  bodies::Cylinder cylinder(&cylinder_shape);
+  EXPECT_NEAR(-1.0, cylinder.computeSignedDistance(Eigen::Vector3d(0.0, 0.0, 0.0)), 1e-12);
+  EXPECT_NEAR(-0.5, cylinder.computeSignedDistance(Eigen::Vector3d(0.0, 0.0, 0.5)), 1e-12);
+  EXPECT_NEAR(2.0, cylinder.computeSignedDistance(Eigen::Vector3d(3.0, 0.0, 0.0)), 1e-12);
+  EXPECT_NEAR(sqrt(2.0), cylinder.computeSignedDistance(Eigen::Vector3d(0.0, 2.0, 2.0)), 1e-12);
+
+  shapes::Sphere sphere_shape(1.0);
+  bodies::Sphere sphere(&sphere_shape);
+  sphere.setPadding(0.1);
+  EXPECT_NEAR(0.9, sphere.computeSignedDistance(Eigen::Vector3d(2.0, 0.0, 0.0)), 1e-12);
+  EXPECT_NEAR(-1.1, sphere.computeSignedDistance(Eigen::Vector3d(0.0, 0.0, 0.0)), 1e-12);
+}
+
+TEST(SignedDistance, Batched)
+{
+  Eigen::Affine3d pose(Eigen::AngleAxisd(0.7, Eigen::Vector3d(1.0, 2.0, 3.0).normalized()));
+  pose.translation() = Eigen::Vector3d(0.1, -0.2, 0.3);
+
+  shapes::Box box_shape(0.6, 0.8, 1.0);
+  shapes::Sphere sphere_shape(0.5);
+  shapes::Cylinder cylinder_shape(0.4, 1.0);
+  shapes::Mesh* ms = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  ASSERT_TRUE(ms != NULL);
+  std::vector<bodies::Body*> bodies;
+  bodies.push_back(new bodies::Box(&box_shape));
+  bodies.push_back(new bodies::Sphere(&sphere_shape));
+  bodies.push_back(new bodies::Cylinder(&cylinder_shape));
+  bodies.push_back(new bodies::ConvexMesh(ms));
+
+  random_numbers::RandomNumberGenerator rng(7);
+  const std::size_t n = 1003;
+  std::vector<double> xs(n), ys(n), zs(n), distances(n);
+  for (std::size_t i = 0; i < bodies.size(); ++i)
+  {
+    bodies[i]->setPose(pose);
+    bodies[i]->setScale(1.1);
+    bodies[i]->setPadding(0.01);
+    bodies::BoundingSphere sphere;
+    bodies[i]->computeBoundingSphere(sphere);
+    for (std::size_t j = 0; j < n; ++j)
+    {
+      xs[j] = sphere.center.x() + rng.uniformReal(-1.5, 1.5) * sphere.radius;
+      ys[j] = sphere.center.y() + rng.uniformReal(-1.5, 1.5) * sphere.radius;
+      zs[j] = sphere.center.z() + rng.uniformReal(-1.5, 1.5) * sphere.radius;
+    }
+    bodies[i]->computeSignedDistances(&xs[0], &ys[0], &zs[0], n, &distances[0]);
+    for (std::size_t j = 0; j < n; ++j)
+    {
+      const Eigen::Vector3d p(xs[j], ys[j], zs[j]);
+      EXPECT_NEAR(bodies[i]->computeSignedDistance(p), distances[j], 1e-12);
+      // the sign agrees with containsPoint(), away from the surface
+      if (std::abs(distances[j]) > 1e-3)
+      {
+        EXPECT_EQ(distances[j] < 0.0, bodies[i]->containsPoint(p)) << "body " << i << " point " << j;
+      }
+    }
+  }
+  for (std::size_t i = 0; i < bodies.size(); ++i)
+    delete bodies[i];
+  delete ms;
+}
+
+TEST(SignedDistance, MeshMatchesBox)
+{
+  // the hull of a box mesh has the same surface as the box
+  shapes::Box box_shape(0.6, 0.8, 1.0);
+  shapes::Mesh* ms = shapes::createMeshFromShape(box_shape);
+  bodies::ConvexMesh mesh(ms);
+  bodies::Box box(&box_shape);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(0.7, Eigen::Vector3d(1.0, 2.0, 3.0).normalized()));
+  pose.translation() = Eigen::Vector3d(0.1, -0.2, 0.3);
+  mesh.setPose(pose);
+  mesh.setScale(1.2);
+  box.setPose(pose);
+  box.setScale(1.2);
+
+  random_numbers::RandomNumberGenerator rng(9);
+  for (int i = 0; i < 1000; ++i)
+  {
+    Eigen::Vector3d p(rng.uniformReal(-1.5, 1.5), rng.uniformReal(-1.5, 1.5), rng.uniformReal(-1.5, 1.5));
+    EXPECT_NEAR(box.computeSignedDistance(p), mesh.computeSignedDistance(p), 1e-9);
+  }
+  delete ms;
+}
+
+TEST(MeshCache, SharesHulls)
+{
+  shapes::Mesh* ms = shapes::createMeshFromResource(
+      "file://" + (boost::filesystem::path(TEST_RESOURCES_DIR) / "/forearm_roll.stl").string());
+  ASSERT_TRUE(ms != NULL);
+  shapes::Mesh* copy = static_cast<shapes::Mesh*>(ms->clone());
+  bodies::ConvexMesh::clearCache();
+
+  bodies::ConvexMesh* m1 = new bodies::ConvexMesh(ms);
+  bodies::ConvexMesh* m2 = new bodies::ConvexMesh(copy);
+  bodies::ConvexMesh::CacheStatistics stats = bodies::ConvexMesh::getCacheStatistics();
+  EXPECT_EQ(1u, stats.misses);
+  EXPECT_EQ(1u, stats.hits);
+  EXPECT_EQ(1u, stats.entries);
+  EXPECT_GT(stats.bytes, 0u);
+  // the second body uses the hull computed for the first one
+  EXPECT_EQ(&m1->getPlanes(), &m2->getPlanes());
+
+  // a different mesh is not a hit
+  copy->vertices[0] += 0.01;
+  bodies::ConvexMesh* m3 = new bodies::ConvexMesh(copy);
+  EXPECT_NE(&m1->getPlanes(), &m3->getPlanes());
+  stats = bodies::ConvexMesh::getCacheStatistics();
+  EXPECT_EQ(2u, stats.misses);
+  EXPECT_EQ(2u, stats.entries);
+
+  // with a budget for a single hull, the least recently used one is dropped
+  const std::size_t budget = bodies::ConvexMesh::getCacheBudget();
+  bodies::ConvexMesh::setCacheBudget(stats.bytes - 1);
+  stats = bodies::ConvexMesh::getCacheStatistics();
+  EXPECT_EQ(1u, stats.evictions);
+  EXPECT_EQ(1u, stats.entries);
+  bodies::ConvexMesh* m4 = new bodies::ConvexMesh(copy);
+  EXPECT_EQ(&m3->getPlanes(), &m4->getPlanes());
+
+  // without a budget, nothing is cached
+  bodies::ConvexMesh::setCacheBudget(0);
+  bodies::ConvexMesh* m5 = new bodies::ConvexMesh(copy);
+  EXPECT_NE(&m3->getPlanes(), &m5->getPlanes());
+  EXPECT_EQ(0u, bodies::ConvexMesh::getCacheStatistics().entries);
+  EXPECT_EQ(m3->getPlanes().size(), m5->getPlanes().size());
+
+  bodies::ConvexMesh::setCacheBudget(budget);
+  bodies::ConvexMesh::clearCache();
+  delete m1;
+  delete m2;
+  delete m3;
+  delete m4;
+  delete m5;
+  delete ms;
+  delete copy;
+}
+
+TEST(RayQuery, Segments)
+{
+  shapes::Sphere shape(1.0);
+  bodies::Sphere sphere(&shape);
+  // the direction need not be normalized; distances are measured along the normalized one
+  const Eigen::Vector3d origin(-3.0, 0.0, 0.0), dir(2.0, 0.0, 0.0);
+  bodies::Hit hit;
+  ASSERT_TRUE(sphere.intersect(bodies::Ray(origin, dir), hit));
+  ASSERT_EQ(2u, hit.count);
+  EXPECT_NEAR(2.0, hit.t[0], 1e-9);
+  EXPECT_NEAR(4.0, hit.t[1], 1e-9);
+
+  ASSERT_TRUE(sphere.intersect(bodies::Ray(origin, dir, 0.0, 3.0), hit));
+  ASSERT_EQ(1u, hit.count);
+  EXPECT_NEAR(2.0, hit.t[0], 1e-9);
+
+  // a segment inside the body overlaps it without crossing its surface
+  EXPECT_TRUE(sphere.intersect(bodies::Ray(origin, dir, 2.5, 3.5), hit));
+  EXPECT_EQ(0u, hit.count);
+  EXPECT_FALSE(sphere.intersect(bodies::Ray(origin, dir, 0.0, 1.5), hit));
+  EXPECT_FALSE(sphere.intersect(bodies::Ray(origin, -dir), hit));
+}
+
+TEST(RayQuery, MatchesIntersectsRay)
+{
+  shapes::Sphere sphere(0.5);
+  shapes::Cylinder cylinder(0.4, 1.2);
+  shapes::Box box(0.6, 0.8, 1.4);
+  shapes::Mesh* box_mesh = shapes::createMeshFromShape(box);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(0.7, Eigen::Vector3d(1.0, 2.0, 3.0).normalized()));
+  pose.translation() = Eigen::Vector3d(0.2, -0.1, 0.3);
+  std::vector<bodies::Body*> bodies = { new bodies::Sphere(&sphere), new bodies::Cylinder(&cylinder),
+                                        new bodies::Box(&box), new bodies::ConvexMesh(box_mesh),
+                                        new bodies::TriangleMesh(box_mesh) };
+
+  random_numbers::RandomNumberGenerator rng(23);
+  for (std::size_t b = 0; b < bodies.size(); ++b)
+  {
+    bodies[b]->setPose(pose);
+    bodies[b]->setPadding(0.05);
+    unsigned int hits = 0;
+    for (int i = 0; i < 500; ++i)
+    {
+      const Eigen::Vector3d o = pose.translation() + Eigen::Vector3d(rng.uniformReal(-2.0, 2.0),
+                                                                     rng.uniformReal(-2.0, 2.0),
+                                                                     rng.uniformReal(-2.0, 2.0));
+      const Eigen::Vector3d target = pose.translation() + Eigen::Vector3d(rng.uniformReal(-0.5, 0.5),
+                                                                          rng.uniformReal(-0.5, 0.5),
+                                                                          rng.uniformReal(-0.5, 0.5));
+      const bodies::Ray ray(o, target - o);
+      EigenSTL::vector_Vector3d pts;
+      bodies::Hit hit;
+      const bool expected = bodies[b]->intersectsRay(o, ray.dir, &pts, 2);
+      ASSERT_EQ(expected, bodies[b]->intersect(ray, hit)) << "body " << b << " ray " << i;
+      if (!expected)
+        continue;
+      ++hits;
+      ASSERT_EQ(pts.size(), hit.count) << "body " << b << " ray " << i;
+      for (unsigned int k = 0; k < hit.count; ++k)
+        EXPECT_NEAR(0.0, (ray.at(hit.t[k]) - pts[k]).norm(), 1e-9);
+    }
+    EXPECT_GT(hits, 0u);
+    delete bodies[b];
+  }
+  delete box_mesh;
+}
+
 TEST(MergeBoundingSpheres, MergeTwoSpheres)
 {
   std::vector<bodies::BoundingSphere> spheres;
@@ -0,0 +1,231 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (c) 2018, Willow Garage, Inc.
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the Willow Garage nor the names of its
+*     contributors may be used to endorse or promote products derived
+*     from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+#include <geometric_shapes/bodies.h>
+#include <geometric_shapes/body_operations.h>
+#include <geometric_shapes/mesh_operations.h>
+#include <random_numbers/random_numbers.h>
+#include <gtest/gtest.h>
+
+namespace
+{
+/** \brief An L-shaped prism of height 1: the square [0, 2] x [0, 2] without the corner [1, 2] x [1, 2] */
+shapes::Mesh* makeLShape()
+{
+  const double outline[6][2] = { { 0, 0 }, { 2, 0 }, { 2, 1 }, { 1, 1 }, { 1, 2 }, { 0, 2 } };
+  shapes::Mesh* mesh = new shapes::Mesh(12, 20);
+  for (int i = 0; i < 6; ++i)
+    for (int k = 0; k < 2; ++k)
+    {
+      mesh->vertices[3 * (i + 6 * k)] = outline[i][0];
+      mesh->vertices[3 * (i + 6 * k) + 1] = outline[i][1];
+      mesh->vertices[3 * (i + 6 * k) + 2] = k;
+    }
+  unsigned int t = 0;
+  const auto add = [&](unsigned int a, unsigned int b, unsigned int c) {
+    mesh->triangles[3 * t] = a;
+    mesh->triangles[3 * t + 1] = b;
+    mesh->triangles[3 * t + 2] = c;
+    ++t;
+  };
+  // the caps are fans around the reflex corner, which sees all of the outline
+  for (unsigned int i = 4; i < 8; ++i)
+  {
+    add(3, (i + 1) % 6, i % 6);
+    add(9, 6 + i % 6, 6 + (i + 1) % 6);
+  }
+  for (unsigned int i = 0; i < 6; ++i)
+  {
+    const unsigned int j = (i + 1) % 6;
+    add(i, j, 6 + j);
+    add(i, 6 + j, 6 + i);
+  }
+  return mesh;
+}
+}
+
+TEST(TriangleMesh, Concave)
+{
+  shapes::Mesh* shape = makeLShape();
+  bodies::Body* body = bodies::createBodyFromShape(shape, bodies::TRIANGLES);
+  ASSERT_TRUE(dynamic_cast<bodies::TriangleMesh*>(body) != NULL);
+  bodies::ConvexMesh hull(shape);
+
+  EXPECT_NEAR(3.0, body->computeVolume(), 1e-9);
+  EXPECT_TRUE(body->containsPoint(Eigen::Vector3d(0.5, 0.5, 0.5)));
+  EXPECT_TRUE(body->containsPoint(Eigen::Vector3d(1.5, 0.5, 0.5)));
+  EXPECT_TRUE(body->containsPoint(Eigen::Vector3d(0.5, 1.5, 0.5)));
+  EXPECT_FALSE(body->containsPoint(Eigen::Vector3d(1.5, 1.5, 0.5)));
+  EXPECT_TRUE(hull.containsPoint(Eigen::Vector3d(1.5, 1.5, 0.5)));
+  EXPECT_FALSE(body->containsPoint(Eigen::Vector3d(0.5, 0.5, 1.5)));
+  EXPECT_NEAR(0.5, body->computeSignedDistance(Eigen::Vector3d(1.5, 1.5, 0.5)), 1e-9);
+  EXPECT_NEAR(-0.25, body->computeSignedDistance(Eigen::Vector3d(0.5, 0.5, 0.25)), 1e-9);
+
+  // the ray through the notch enters and leaves the mesh once
+  EigenSTL::vector_Vector3d intersections;
+  ASSERT_TRUE(body->intersectsRay(Eigen::Vector3d(-1.0, 1.5, 0.5), Eigen::Vector3d::UnitX(), &intersections));
+  ASSERT_EQ(2u, intersections.size());
+  EXPECT_TRUE(intersections[0].isApprox(Eigen::Vector3d(0.0, 1.5, 0.5)));
+  EXPECT_TRUE(intersections[1].isApprox(Eigen::Vector3d(1.0, 1.5, 0.5)));
+  EXPECT_FALSE(body->intersectsRay(Eigen::Vector3d(1.5, 1.5, -1.0), Eigen::Vector3d::UnitZ()));
+
+  body->setPadding(0.1);
+  EXPECT_TRUE(body->containsPoint(Eigen::Vector3d(1.05, 1.5, 0.5)));
+  EXPECT_TRUE(body->containsPoint(Eigen::Vector3d(1.06, 1.06, 0.5)));
+  EXPECT_FALSE(body->containsPoint(Eigen::Vector3d(1.08, 1.08, 1.08)));
+  EXPECT_FALSE(body->containsPoint(Eigen::Vector3d(1.5, 1.5, 0.5)));
+  intersections.clear();
+  ASSERT_TRUE(body->intersectsRay(Eigen::Vector3d(1.5, 1.5, 0.5), -Eigen::Vector3d::UnitX(), &intersections, 1));
+  EXPECT_NEAR(1.1, intersections[0].x(), 1e-6);
+
+  delete body;
+  delete shape;
+}
+
+TEST(TriangleMesh, PaddedRays)
+{
+  // a padded ray reports the same crossings as the padded hull of a convex mesh, from inside as well
+  shapes::Box box(1.0, 1.0, 1.0);
+  shapes::Mesh* shape = shapes::createMeshFromShape(&box);
+  ASSERT_TRUE(shape != NULL);
+  bodies::TriangleMesh body(shape);
+  bodies::ConvexMesh hull(shape);
+  body.setPadding(0.1);
+  hull.setPadding(0.1);
+
+  EigenSTL::vector_Vector3d points, hull_points;
+  ASSERT_TRUE(body.intersectsRay(Eigen::Vector3d::Zero(), Eigen::Vector3d::UnitX(), &points));
+  ASSERT_TRUE(hull.intersectsRay(Eigen::Vector3d::Zero(), Eigen::Vector3d::UnitX(), &hull_points));
+  ASSERT_EQ(1u, points.size());
+  ASSERT_EQ(hull_points.size(), points.size());
+  EXPECT_NEAR(0.6, points[0].x(), 1e-6);
+
+  points.clear();
+  hull_points.clear();
+  ASSERT_TRUE(body.intersectsRay(Eigen::Vector3d(-2.0, 0.1, 0.2), Eigen::Vector3d::UnitX(), &points));
+  ASSERT_TRUE(hull.intersectsRay(Eigen::Vector3d(-2.0, 0.1, 0.2), Eigen::Vector3d::UnitX(), &hull_points));
+  ASSERT_EQ(2u, points.size());
+  ASSERT_EQ(hull_points.size(), points.size());
+  EXPECT_NEAR(-0.6, points[0].x(), 1e-6);
+  EXPECT_NEAR(0.6, points[1].x(), 1e-6);
+
+  points.clear();
+  ASSERT_TRUE(body.intersectsRay(Eigen::Vector3d(-2.0, 0.1, 0.2), Eigen::Vector3d::UnitX(), &points, 1));
+  ASSERT_EQ(1u, points.size());
+  EXPECT_NEAR(-0.6, points[0].x(), 1e-6);
+
+  bodies::Hit hit;
+  ASSERT_TRUE(body.intersect(bodies::Ray(Eigen::Vector3d(0.1, 0.0, 0.0), Eigen::Vector3d::UnitY()), hit));
+  EXPECT_TRUE(hit.inside);
+  ASSERT_EQ(1u, hit.count);
+  EXPECT_NEAR(0.6, hit.t[0], 1e-6);
+  EXPECT_FALSE(body.intersectsRay(Eigen::Vector3d(-2.0, 0.7, 0.0), Eigen::Vector3d::UnitX()));
+  delete shape;
+}
+
+TEST(TriangleMesh, PoseAndScale)
+{
+  shapes::Mesh* shape = makeLShape();
+  bodies::TriangleMesh body(shape);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(M_PI / 2.0, Eigen::Vector3d::UnitZ()));
+  pose.translation() = Eigen::Vector3d(0.0, 0.0, 1.0);
+  body.setPose(pose);
+  body.setScale(2.0);
+
+  // scaled about (1, 1, 0.5), then rotated so that +x goes to +y
+  EXPECT_NEAR(24.0, body.computeVolume(), 1e-9);
+  EXPECT_TRUE(body.containsPoint(pose * Eigen::Vector3d(-0.5, -0.5, 1.25)));
+  EXPECT_TRUE(body.containsPoint(pose * Eigen::Vector3d(2.5, -0.5, -0.25)));
+  EXPECT_FALSE(body.containsPoint(pose * Eigen::Vector3d(2.5, 2.5, 0.5)));
+  // inside if the rotation was ignored
+  EXPECT_FALSE(body.containsPoint(Eigen::Vector3d(2.5, 0.5, 1.25)));
+
+  bodies::BodyPtr clone = body.cloneAt(Eigen::Affine3d::Identity(), 0.0, 1.0);
+  EXPECT_TRUE(clone->containsPoint(Eigen::Vector3d(0.5, 0.5, 0.5)));
+  EXPECT_FALSE(clone->containsPoint(Eigen::Vector3d(1.5, 1.5, 0.5)));
+  delete shape;
+}
+
+TEST(TriangleMesh, MatchesConvexMesh)
+{
+  // for a convex mesh, both bodies contain the same points
+  shapes::Cylinder cylinder(1.0, 2.0);
+  shapes::Mesh* shape = shapes::createMeshFromShape(&cylinder);
+  ASSERT_TRUE(shape != NULL);
+  // the hull TriangleMesh scales about is not left in the cache of ConvexMesh
+  bodies::ConvexMesh::clearCache();
+  const bodies::ConvexMesh::CacheStatistics before = bodies::ConvexMesh::getCacheStatistics();
+  bodies::TriangleMesh triangles(shape);
+  EXPECT_EQ(before.misses, bodies::ConvexMesh::getCacheStatistics().misses);
+  EXPECT_EQ(0u, bodies::ConvexMesh::getCacheStatistics().entries);
+  bodies::ConvexMesh hull(shape);
+  Eigen::Affine3d pose(Eigen::AngleAxisd(0.3, Eigen::Vector3d(1.0, 2.0, 3.0).normalized()));
+  pose.translation() = Eigen::Vector3d(0.5, -0.2, 0.1);
+  triangles.setPose(pose);
+  hull.setPose(pose);
+  EXPECT_NEAR(hull.computeVolume(), triangles.computeVolume(), 1e-6 * hull.computeVolume());
+  triangles.setScale(1.3);
+  hull.setScale(1.3);
+
+  random_numbers::RandomNumberGenerator rng(7);
+  unsigned int mismatches = 0;
+  for (int i = 0; i < 2000; ++i)
+  {
+    const Eigen::Vector3d p = pose.translation() + Eigen::Vector3d(rng.uniformReal(-1.5, 1.5),
+                                                                   rng.uniformReal(-1.5, 1.5),
+                                                                   rng.uniformReal(-1.5, 1.5));
+    // points right on the surface may go either way
+    if (std::fabs(hull.computeSignedDistance(p)) < 1e-6)
+      continue;
+    if (hull.containsPoint(p) != triangles.containsPoint(p))
+      ++mismatches;
+
+    const Eigen::Vector3d dir = Eigen::Vector3d(rng.gaussian01(), rng.gaussian01(), rng.gaussian01()).normalized();
+    double t;
+    EigenSTL::vector_Vector3d b;
+    hull.intersectsRays(&p, &dir, 1, &t);
+    EXPECT_EQ(std::isinf(t), !triangles.intersectsRay(p, dir, &b, 1));
+    if (!b.empty() && !std::isinf(t))
+    {
+      EXPECT_NEAR(0.0, (p + dir * t - b[0]).norm(), 1e-6);
+    }
+  }
+  EXPECT_EQ(0u, mismatches);
+  delete shape;
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}